@@ -37,6 +37,10 @@
 
 #include <stdarg.h>
 #include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <event2/event.h>
 
 /*
  * 		Here the reference to the accessible DBs is set
@@ -44,18 +48,20 @@
 static altoDbPtr ALTO_DB_req = NULL;		// Pointer to the ALTO DB for the Request
 static altoDbPtr ALTO_DB_res = NULL;		// Pointer to the ALTO DB for the Resposne
 
-static xmlDocPtr ALTO_XML_req = NULL;		// Pointer to the XML for the Request
-static xmlDocPtr ALTO_XML_res = NULL;		// Pointer to the XML for the Request
+static altoDbPtr ALTO_DB_cache = NULL;	// Ratings the server gave in the last rounds
 
-// This is the varaiable where the ALTO server can be found
-static char alto_server_url[256];
+// The cache is only valid for the rating criteria and host it was filled for
+static int alto_cache_ttl = ALTO_CACHE_TTL;
+static struct in_addr alto_cache_rc_host;
+static int alto_cache_pri_rat = 0;
+static int alto_cache_sec_rat = 0;
 
-// And this is the struct where the XML buffer for CURL is cached
-#ifdef USE_CURL
-static struct curl_reply_buffer_t alto_rep_buf = {ALTO_REP_BUF_SIZE,0,""};
-#endif
+// The cache is shared by all queries in flight
+static pthread_mutex_t alto_cache_lock = PTHREAD_MUTEX_INITIALIZER;
 
-static char alto_reply_buf_nano[ALTO_REP_BUF_SIZE];
+
+// This is the varaiable where the ALTO server can be found
+static char alto_server_url[256];
 
 static void alto_debugf(const char* str, ...) {
 	char msg[1024];
@@ -93,6 +99,18 @@ int set_ALTO_server(char * string){
 	return 1;
 }
 
+/*
+ * 	Set how long ratings are reused before the server is asked again,
+ * 	0 asks for every host in every round
+ */
+int set_ALTO_cache_ttl(int seconds){
+	// Sanity check
+	returnIf(seconds < 0, "Negative cache TTL\n", -1);
+
+	alto_cache_ttl = seconds;
+	return 1;
+}
+
 /*
  * 	get the address from the actual set ALTO server;
  */
@@ -283,21 +301,16 @@ xmlDocPtr alto_create_request_XML(struct alto_db_t * db, struct in_addr rc_host,
 #ifdef USE_CURL
 
 // this function will be registered with curl as a handler, which
-// copies the http reply to a the buffer
-size_t curl_copy_reply_to_buf(void *ptr,size_t size,size_t nmemb,void *stream){
+// hands every chunk of the http reply to the parser
+size_t curl_copy_reply_to_parser(void *ptr,size_t size,size_t nmemb,void *stream){
     size_t realsize = size * nmemb;
-    struct curl_reply_buffer_t *crb = (struct curl_reply_buffer_t *)stream;
-    // error: new chunk plus trailing zero would not fit into remaining buffer
-    if( (realsize+1) > (crb->size - crb->fill) ) return 0;
-    memcpy( &crb->buffer[crb->fill], ptr, realsize );
-    crb->fill += realsize;
-    crb->buffer[crb->fill] = 0;
+    struct alto_reply_parser_t *parser = (struct alto_reply_parser_t *)stream;
+    if( alto_reply_parser_feed(parser, ptr, realsize) < 0 ) return 0;
     return realsize;
 }
-uint16_t prefixes = 0;
 
-xmlDocPtr query_ALTO_server_curl(xmlDocPtr doc, char* ALTO_server_URL){
-	xmlDocPtr ALTO_XML_response;
+int query_ALTO_server_curl(xmlDocPtr doc, char* ALTO_server_URL, struct alto_db_t * db){
+	struct alto_reply_parser_t *parser;
 
 	// starting here the ALTO list will be send out.....
 	CURL *curl;
@@ -306,7 +319,13 @@ xmlDocPtr query_ALTO_server_curl(xmlDocPtr doc, char* ALTO_server_URL){
 	struct curl_httppost *lastptr=NULL;
 
 	curl = curl_easy_init();
-	returnIf(curl == NULL, "Couldn't get a handle from curl_easy_init(). abort.", NULL);
+	returnIf(curl == NULL, "Couldn't get a handle from curl_easy_init(). abort.", -1);
+
+	parser = alto_reply_parser_init(db);
+	if(parser == NULL){
+		curl_easy_cleanup(curl);
+		return -1;
+	}
 
 //	printf("Will send HTTP POST to %s\nwith form data:\n\n%s\n", alto_server_url, ALTO_XML_query);
 
@@ -334,10 +353,9 @@ xmlDocPtr query_ALTO_server_curl(xmlDocPtr doc, char* ALTO_server_URL){
 
 	curl_easy_setopt(curl, CURLOPT_HTTPPOST, formpost);
 
-	// we do not want the reply written to stdout but to our buffer
-	alto_rep_buf.fill = 0;	// reset buffer (armin 12-jul-2010, reported by Andrzej)
-	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_copy_reply_to_buf);
-	curl_easy_setopt(curl, CURLOPT_WRITEDATA, &alto_rep_buf);
+	// we do not want the reply written to stdout but to the parser
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_copy_reply_to_parser);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, parser);
 
 	// do it!
 	res = curl_easy_perform(curl);
@@ -347,15 +365,16 @@ xmlDocPtr query_ALTO_server_curl(xmlDocPtr doc, char* ALTO_server_URL){
 
 	// then cleanup the form post chain
 	curl_formfree(formpost);
+	xmlFree(doctxt);
 
 //  printf("result of curl_easy_perform() is: %i\n", res);
-//  printf("received %i octetts. the buffer is:\n\n%s\nthat's all. bye.\n",alto_rep_buf.fill,alto_rep_buf.buffer);
-
 
-	// and last but nor least, transform it into an XML doc
-	ALTO_XML_response = xmlRecoverMemory(alto_rep_buf.buffer,sizeof(alto_rep_buf.buffer));		// <- for getting XML from memory
-
-	return ALTO_XML_response;
+	// and last but nor least, finish the parsing
+	if(res != CURLE_OK){
+		alto_reply_parser_finish(parser);
+		return -1;
+	}
+	return alto_reply_parser_finish(parser);
 }
 
 #endif // USE_CURL
@@ -402,29 +421,27 @@ void* POST_send(const char* url, const char* data) {
 }
 
 // nano
-xmlDocPtr ALTO_request_to_server(xmlDocPtr doc, char* endPoint){
-	xmlDocPtr result = NULL;
+int ALTO_request_to_server(xmlDocPtr doc, char* endPoint, struct alto_db_t * db){
 	xmlChar*  doctxt = NULL;
-	int		size = 0;
 	int		doclen = 0;
 	int		bytesRead = 0;
 	int		bytesSum = 0;
+	int		result;
 	char*	data = NULL;
 	size_t  dataLen = 0;
 	void*	ctx = NULL;
-	char*   alto_reply_buffer_ptr = alto_reply_buf_nano;
-//	int		errorcode = 0;
-//	FILE*	f = NULL;
+	char	block[ALTO_REPLY_BLOCK_SIZE];
+	struct alto_reply_parser_t *parser;
 
-	returnIf(doc == NULL, "xml doc ptr is NULL!", NULL);
-	returnIf(endPoint == NULL, "ALTO server URL is NULL!", NULL);
+	returnIf(doc == NULL, "xml doc ptr is NULL!", -1);
+	returnIf(endPoint == NULL, "ALTO server URL is NULL!", -1);
+	returnIf(db == NULL, "No DB for the reply!", -1);
 
-	xmlNanoHTTPInit();
 	xmlDocDumpFormatMemoryEnc(doc,&doctxt,&doclen,"utf-8",1);
 
 	dataLen = doclen + 2048;
 	data = malloc(dataLen);
-	returnIf(data == NULL, "Couldn't allocate data buffer! Out of memory?", NULL);
+	returnIf(data == NULL, "Couldn't allocate data buffer! Out of memory?", -1);
 	memset(data, 0, dataLen);
 
 	// build the mime multipart contents
@@ -443,78 +460,30 @@ xmlDocPtr ALTO_request_to_server(xmlDocPtr doc, char* endPoint){
 	free(data);
 	data = NULL;
 
-	if (!ctx) return NULL;
+	if (!ctx) return -1;
 
 	alto_debugf("%s: POST ok.\n", __FUNCTION__);
 
-	memset(alto_reply_buf_nano, 0, ALTO_REP_BUF_SIZE);
-
-//	bytesSum = xmlNanoHTTPRead(ctx, &alto_reply_buf_nano, ALTO_REP_BUF_SIZE);
-	#define BLOCK_SIZE 4096
-	bytesRead = xmlNanoHTTPRead(ctx, alto_reply_buffer_ptr, BLOCK_SIZE);
-	bytesSum += bytesRead;
-	while (bytesRead) {
-		alto_reply_buffer_ptr += bytesRead;
-		bytesRead = xmlNanoHTTPRead(ctx, alto_reply_buffer_ptr, BLOCK_SIZE);
-		bytesSum += bytesRead;
-	}
-
-	#ifdef USE_DEBUG_OUTPUT
-//	printf("xmlNanoHTTPRead: %d bytes read.\n", bytesRead);
-	printf("ALTO reply (%d bytes):\n\n%s", bytesSum, alto_reply_buf_nano);
-	#endif
-
-	// dump to file
-/*	f = fopen("http_reply.txt", "wt");
-	fwrite(output, 1, strlen(output), f);
-	fclose(f);*/
-
-	result = xmlRecoverMemory(alto_reply_buf_nano, bytesSum);
-//
-// TODO: PushParser doesn't work yet somehow..
-//
-/*
-	xmlParserCtxtPtr pushCtx = NULL;
-	pushCtx = xmlCreatePushParserCtxt(NULL, NULL, output, bytesRead, NULL);
-//	xmlInitParserCtxt(pushCtx);
-
-	if (!pushCtx) {
-		printf("ERROR: xmlCreatePushParserCtxt failed!\n");
-	} else {
-		printf("xmlCreatePushParserCtxt ok.\n");
-	}
-
-	while (bytesRead) {
-		if(xmlParseChunk(pushCtx, output, bytesRead, 0) != 0) {
-			printf("ERROR: xmlParseChunk failed!\n");
-		} else {
-			printf("xmlParseChunk ok.\n");
-		}
-		bytesRead = xmlNanoHTTPRead(ctx,&output,10024);
-		printf("xmlNanoHTTPRead: %d bytes read.\n", bytesRead);
+	parser = alto_reply_parser_init(db);
+	if (!parser) {
+		xmlNanoHTTPClose(ctx);
+		return -1;
 	}
 
-	printf("Finalizing...\n");
-	errorcode = xmlParseChunk(pushCtx, output, 0, 1);
-	if(errorcode) {
-		printf("ERROR: Final xmlParseChunk failed! errorcode=%d\n", errorcode);
-	} else {
-		printf("Final xmlParseChunk ok.\n");
+	// parse the reply block by block while it comes in
+	while ((bytesRead = xmlNanoHTTPRead(ctx, block, sizeof(block))) > 0) {
+		bytesSum += bytesRead;
+		if (alto_reply_parser_feed(parser, block, bytesRead) < 0) break;
 	}
 
-	result = pushCtx->myDoc;
-	xmlFreeParserCtxt(pushCtx);
-*/
+	xmlNanoHTTPClose(ctx);
 
-	if (!result) {
-		printf("*** ERROR: ALTO XML reply (%d bytes):\n\n%s", bytesSum, alto_reply_buf_nano);
-		alto_errorf("%s - XML parsing failed (result == NULL)!\n", __FUNCTION__);
+	result = alto_reply_parser_finish(parser);
+	if (result < 0) {
+		alto_errorf("%s - XML parsing failed after %d bytes!\n", __FUNCTION__, bytesSum);
 	} else {
-		alto_debugf("%s: XML parsing ok.\n", __FUNCTION__);
+		alto_debugf("%s: XML parsing ok, %d bytes, %d ratings.\n", __FUNCTION__, bytesSum, result);
 	}
-
-	xmlNanoHTTPClose(ctx);
-	xmlNanoHTTPCleanup();
 	return result;
 }
 
@@ -537,6 +506,9 @@ struct alto_db_t * alto_db_init(void){
 	db->first = NULL;
 	db->last = NULL;
 	db->num_of_elements = 0;
+	db->prefix_index = NULL;
+	db->host_index = NULL;
+	db->key_index = NULL;
 	return db;
 }
 
@@ -549,6 +521,7 @@ int alto_free_db(struct alto_db_t * db){
 	returnIf(db == NULL, "No DB to be free'd.", -1);
 
 	res = alto_purge_db(db);
+	alto_db_drop_index(db);
 
 	// Free the DB struct & Goodby!
 	free(db);
@@ -632,6 +605,9 @@ int alto_add_element(struct alto_db_t * db, struct alto_db_element_t * element){
 	// Error handling
 	returnIf((db == NULL || element == NULL), "Error in appending element on the DB! ABORT", -1);
 
+	// the indexes don't know the new element
+	alto_db_drop_index(db);
+
 	// Special case, first element in DB
 	if(db->first == NULL && db->last == NULL){
 
@@ -676,6 +652,7 @@ int alto_rem_element(struct alto_db_element_t * element){
 	// Now get the DB where the element is in
 	struct alto_db_t *db;
 	db = element->alto_db;
+	alto_db_drop_index(db);
 
 	// Special case, last and only element in DB
 	if(db->first == element && db->last == element){
@@ -734,11 +711,45 @@ int alto_rem_element(struct alto_db_element_t * element){
 	return -1;
 }
 
+/*
+ *  Moves all elements of src to the end of dst, they are stamped as new
+ *
+ *  return:	num		number of moved elements
+ */
+int alto_move_elements(struct alto_db_t *dst, struct alto_db_t *src){
+	returnIf((dst == NULL || src == NULL), "Error in moving elements between DBs! ABORT", -1);
+
+	int num = src->num_of_elements;
+	if(num == 0) return 0;
+
+	alto_db_drop_index(dst);
+	alto_db_drop_index(src);
+
+	time_t now = time(NULL);
+	struct alto_db_element_t * cur;
+	for(cur = src->first; cur != NULL; cur = cur->next){
+		cur->alto_db = dst;
+		cur->stamp = now;
+	}
+
+	// chain the list of src behind the one of dst
+	src->first->prev = dst->last;
+	if(dst->last != NULL) dst->last->next = src->first;
+	else dst->first = src->first;
+	dst->last = src->last;
+	dst->num_of_elements += num;
+
+	src->first = NULL;
+	src->last = NULL;
+	src->num_of_elements = 0;
+	return num;
+}
+
 struct in_addr compute_subnet(struct in_addr host, int prefix){
 	struct in_addr subn;
 	uint32_t match_host = host.s_addr;
 	uint32_t match_mask = 0xFFFFFFFF;
-	match_mask <<= 32 - prefix;
+	match_mask = prefix > 0 ? match_mask << (32 - prefix) : 0;
 	match_mask = ntohl(match_mask);
 	uint32_t match_merg = match_host & match_mask;
 //	printf("host  : %s/%d \t", inet_ntoa(host), prefix);
@@ -749,6 +760,220 @@ struct in_addr compute_subnet(struct in_addr host, int prefix){
 	return subn;
 }
 
+/*
+ *
+ * 		Longest prefix match index
+ *
+ */
+
+/*
+ * 	Number of leading bits two keys have in common, at most max
+ */
+static int alto_key_common_bits(const uint8_t *a, const uint8_t *b, int max){
+	int bits = 0;
+	while(bits < max){
+		uint8_t diff = a[bits >> 3] ^ b[bits >> 3];
+		if(diff == 0){
+			bits += 8;
+			continue;
+		}
+		while(!(diff & 0x80)){
+			diff <<= 1;
+			bits++;
+		}
+		break;
+	}
+	return bits < max ? bits : max;
+}
+
+/*
+ * 	Value of bit number pos of a key (0 = most significant bit of the first byte)
+ */
+static int alto_key_bit(const uint8_t *key, int pos){
+	return (key[pos >> 3] >> (7 - (pos & 7))) & 1;
+}
+
+static struct alto_trie_node_t * alto_trie_new_node(struct alto_trie_t *trie, const uint8_t *key, int len){
+	struct alto_trie_node_t *node;
+	node = calloc(1, sizeof(ALTO_TRIE_NODE_T));
+	returnIf(node == NULL, "Couldn't allocate trie node! Out of memory?", NULL);
+
+	// copy the prefix, clear the bits after it
+	memcpy(node->key, key, (len + 7) / 8);
+	if(len & 7) node->key[len >> 3] &= (uint8_t)(0xFF << (8 - (len & 7)));
+	node->len = len;
+	trie->num_of_nodes++;
+	return node;
+}
+
+static void alto_trie_free_node(struct alto_trie_node_t *node){
+	if(node == NULL) return;
+	alto_trie_free_node(node->child[0]);
+	alto_trie_free_node(node->child[1]);
+	free(node);
+}
+
+struct alto_trie_t * alto_trie_init(void){
+	struct alto_trie_t *trie;
+	trie = malloc(sizeof(ALTO_TRIE_T));
+	returnIf(trie == NULL, "Couldn't allocate trie! Out of memory?", NULL);
+	trie->root = NULL;
+	trie->num_of_nodes = 0;
+	return trie;
+}
+
+void alto_trie_free(struct alto_trie_t *trie){
+	if(trie == NULL) return;
+	alto_trie_free_node(trie->root);
+	free(trie);
+}
+
+/*
+ * 	Store a value for a prefix
+ *
+ * 	in:		key		the address in network byte order, bits after len are ignored
+ * 			len		the prefix length in bits
+ * 			replace	overwrite the value if the prefix is already stored
+ * 	return:	1/-1	success / failure
+ */
+int alto_trie_insert(struct alto_trie_t *trie, const uint8_t *key, int len, int value, int replace){
+	returnIf(trie == NULL || key == NULL, "No trie to insert in! ABORT", -1);
+	returnIf(len < 0 || len > ALTO_TRIE_MAX_BITS, "Invalid prefix length! ABORT", -1);
+
+	struct alto_trie_node_t **link = &trie->root;
+	struct alto_trie_node_t *node;
+	while((node = *link) != NULL){
+		int common = alto_key_common_bits(node->key, key, node->len < len ? node->len : len);
+
+		if(common < node->len){
+			// the prefix ends or branches off within this node: insert a node above it
+			struct alto_trie_node_t *split = alto_trie_new_node(trie, key, common);
+			returnIf(split == NULL, "Couldn't split trie node! ABORT", -1);
+			split->child[alto_key_bit(node->key, common)] = node;
+			*link = split;
+			if(common == len){
+				split->has_value = 1;
+				split->value = value;
+				return 1;
+			}
+			link = &split->child[alto_key_bit(key, common)];
+			break;
+		}
+
+		if(node->len == len){
+			if(!node->has_value || replace){
+				node->has_value = 1;
+				node->value = value;
+			}
+			return 1;
+		}
+		link = &node->child[alto_key_bit(key, node->len)];
+	}
+
+	node = alto_trie_new_node(trie, key, len);
+	returnIf(node == NULL, "Couldn't add trie node! ABORT", -1);
+	node->has_value = 1;
+	node->value = value;
+	*link = node;
+	return 1;
+}
+
+/*
+ * 	Find the longest stored prefix of an address
+ *
+ * 	in:		key		the address in network byte order
+ * 			max_len	only prefixes up to this length are considered
+ * 	out:	value	the value of the longest matching prefix
+ * 	return:	len/-1	length of the matching prefix / no match
+ */
+int alto_trie_lookup(struct alto_trie_t *trie, const uint8_t *key, int max_len, int *value){
+	int best = -1;
+	if(trie == NULL) return -1;
+
+	struct alto_trie_node_t *node = trie->root;
+	while(node != NULL && node->len <= max_len){
+		if(alto_key_common_bits(node->key, key, node->len) < node->len)
+			break;
+		if(node->has_value){
+			best = node->len;
+			*value = node->value;
+		}
+		if(node->len == max_len)
+			break;
+		node = node->child[alto_key_bit(key, node->len)];
+	}
+	return best;
+}
+
+/*
+ * 	Throw away the indexes of a DB, they are rebuilt on the next lookup
+ */
+void alto_db_drop_index(struct alto_db_t *db){
+	if(db == NULL) return;
+	alto_trie_free(db->prefix_index);
+	alto_trie_free(db->host_index);
+	alto_trie_free(db->key_index);
+	db->prefix_index = NULL;
+	db->host_index = NULL;
+	db->key_index = NULL;
+}
+
+/*
+ * 	Index of the rated prefixes of a DB. If a prefix is listed more than
+ * 	once the first entry wins, unrated (0) entries are left out so that a
+ * 	shorter rated prefix is found instead.
+ */
+static struct alto_trie_t * alto_db_prefix_index(struct alto_db_t *db){
+	if(db->prefix_index == NULL){
+		db->prefix_index = alto_trie_init();
+		returnIf(db->prefix_index == NULL, "Couldn't build prefix index!", NULL);
+
+		ALTO_DB_ELEMENT_T * cur = db->first;
+		while(cur != NULL){
+			if(cur->rating != 0 && cur->host_mask >= 0 && cur->host_mask <= 32)
+				alto_trie_insert(db->prefix_index, (uint8_t *) &cur->host.s_addr, cur->host_mask, cur->rating, 0);
+			cur = cur->next;
+		}
+	}
+	return db->prefix_index;
+}
+
+/*
+ * 	Index of the host addresses of a DB, the first entry of a host wins
+ */
+static struct alto_trie_t * alto_db_host_index(struct alto_db_t *db){
+	if(db->host_index == NULL){
+		db->host_index = alto_trie_init();
+		returnIf(db->host_index == NULL, "Couldn't build host index!", NULL);
+
+		ALTO_DB_ELEMENT_T * cur = db->first;
+		while(cur != NULL){
+			alto_trie_insert(db->host_index, (uint8_t *) &cur->host.s_addr, 32, cur->rating, 0);
+			cur = cur->next;
+		}
+	}
+	return db->host_index;
+}
+
+/*
+ * 	Index of the exact host/host_mask entries of a DB, whatever their
+ * 	rating is, the first entry of a prefix wins
+ */
+static struct alto_trie_t * alto_db_key_index(struct alto_db_t *db){
+	if(db->key_index == NULL){
+		db->key_index = alto_trie_init();
+		returnIf(db->key_index == NULL, "Couldn't build key index!", NULL);
+
+		ALTO_DB_ELEMENT_T * cur = db->first;
+		while(cur != NULL){
+			if(cur->host_mask >= 0 && cur->host_mask <= 32)
+				alto_trie_insert(db->key_index, (uint8_t *) &cur->host.s_addr, cur->host_mask, cur->rating, 0);
+			cur = cur->next;
+		}
+	}
+	return db->key_index;
+}
+
 /*
  * 	Search in an ALTO DB for the match of an host
  *
@@ -762,15 +987,9 @@ int get_ALTO_rating_for_host(struct in_addr add, ALTO_DB_T * db){
 	returnIf(add.s_addr == 0, "Couldn't read the ALTO host IP to query! ABORT", 0);
 	returnIf(db == NULL, "Couldn't access the DB! ABORT", 0);
 
-	// walk through the DB until you find the element
-    struct alto_db_element_t * cur;
-    cur = db->first;
-    while(cur != NULL){
-    	if(cur->host.s_addr == add.s_addr){
-    		return cur->rating;
-    	}
-    	cur = cur->next;
-    }
+	int rating;
+	if(alto_trie_lookup(alto_db_host_index(db), (uint8_t *) &add.s_addr, 32, &rating) == 32)
+		return rating;
 
     // Here you come in case of error/not found!
 	return 0;
@@ -789,23 +1008,15 @@ int ask_helper_func(struct in_addr subnet, ALTO_DB_T * db){
 	return 0;
 }
 
+/*
+ * 	Rating of the longest rated prefix in db that covers element->host
+ * 	and is not longer than element->host_mask, 0 if there is none
+ */
 int get_alto_rating(ALTO_DB_ELEMENT_T * element, ALTO_DB_T * db){
-
-	int mask = element->host_mask;
-	struct in_addr subnet = compute_subnet(element->host, mask);
-//	printf("Host: %s/%d \n", inet_ntoa(element->host), mask);
-
-	int i, check;
-	for(i=mask;i>0;i--){
-		check = ask_helper_func(subnet, db);
-		if(check == 0){
-			subnet = compute_subnet(element->host, mask--);
-		}else{
-//			printf("Found rating, with value: %d \n", check);
-			return check;
-		}
-	}
-	return 0;
+	int rating;
+	if(alto_trie_lookup(alto_db_prefix_index(db), (uint8_t *) &element->host.s_addr, element->host_mask, &rating) < 0)
+		return 0;
+	return rating;
 }
 
 int get_alto_subnet_mask(ALTO_DB_ELEMENT_T * element, ALTO_DB_T * db){
@@ -853,6 +1064,73 @@ int alto_do_the_magic(ALTO_DB_T * ALTO_db_req, ALTO_DB_T * ALTO_db_res){
 	return 1;
 }
 
+/*
+ * 	Removes the cached ratings that are older than ttl seconds
+ *
+ * 	in:		cache	the DB with the ratings of the former rounds
+ * 			ttl		max age of a rating in seconds
+ * 	return:	num		number of removed ratings
+ */
+int alto_expire_cache(ALTO_DB_T * cache, int ttl){
+	returnIf(cache == NULL, "No cache to expire! ABORT", -1);
+
+	int num = 0;
+	time_t now = time(NULL);
+	ALTO_DB_ELEMENT_T * cur = cache->first;
+	while(cur != NULL){
+		ALTO_DB_ELEMENT_T * next = cur->next;
+		if(now - cur->stamp >= ttl){
+			alto_rem_element(cur);
+			num++;
+		}
+		cur = next;
+	}
+	return num;
+}
+
+/*
+ * 	Rates the hosts of db with the cached ratings. A host is only answered
+ * 	from the cache if exactly its prefix was asked before, the prefixes of
+ * 	the server's reply can't be used as it only lists the ones it matched.
+ *
+ * 	in:		db		the DB with the hosts to rate, the others keep their rating
+ * 			cache	the DB with the ratings of the former rounds
+ * 	out:	missing	if not NULL, gets one copy of every prefix not in the cache
+ * 	return:	num		number of hosts rated from the cache
+ */
+int alto_lookup_cache(ALTO_DB_T * db, ALTO_DB_T * cache, ALTO_DB_T * missing){
+	returnIf((db == NULL || cache == NULL), "Errors in accessing the DBs! ABORT", -1);
+
+	int num = 0;
+	struct alto_trie_t *index = alto_db_key_index(cache);
+	struct alto_trie_t *asked = missing ? alto_trie_init() : NULL;
+	ALTO_DB_ELEMENT_T * cur;
+	for(cur = db->first; cur != NULL; cur = cur->next){
+		struct in_addr subnet = compute_subnet(cur->host, cur->host_mask);
+		int rating;
+
+		if(alto_trie_lookup(index, (uint8_t *) &subnet.s_addr, cur->host_mask, &rating) == cur->host_mask){
+			cur->rating = rating;
+			num++;
+			continue;
+		}
+
+		// ask the server only once per prefix
+		if(asked == NULL || alto_trie_lookup(asked, (uint8_t *) &subnet.s_addr, cur->host_mask, &rating) == cur->host_mask)
+			continue;
+		alto_trie_insert(asked, (uint8_t *) &subnet.s_addr, cur->host_mask, 1, 0);
+
+		ALTO_DB_ELEMENT_T * element = malloc(sizeof(ALTO_DB_ELEMENT_T));
+		if(element == NULL) break;
+		element->host = subnet;
+		element->host_mask = cur->host_mask;
+		element->rating = 0;
+		alto_add_element(missing, element);
+	}
+	alto_trie_free(asked);
+	return num;
+}
+
 int alto_parse_from_file(altoDbPtr db, char *file_name){
 	alto_debugf("%s: Read hosts from file (%s) and store it in the Request-DB\n", __FUNCTION__, file_name);
 
@@ -874,6 +1152,7 @@ int alto_parse_from_file(altoDbPtr db, char *file_name){
 		element = malloc(sizeof(ALTO_DB_ELEMENT_T));
 		element->host = get_ALTO_host_IP(ptr);
 		element->host_mask = get_ALTO_host_mask(ptr);
+		element->rating = 0;
 		// and add this element to the db
 		alto_add_element(db, element);
 	    }
@@ -961,6 +1240,189 @@ int alto_parse_from_XML(altoDbPtr db, xmlDocPtr doc){
 	return 1;
 }
 
+/*
+ *
+ * 		Streaming parser for the ALTO reply
+ *
+ */
+
+/*
+ * 	Copies the value of the attribute name out of a SAX2 attribute list
+ * 	(localname/prefix/URI/value/end per attribute)
+ */
+static int alto_sax_attr(const xmlChar **attributes, int nb_attributes, const char *name, char *buf, int size){
+	int i;
+	for(i = 0; i < nb_attributes; i++){
+		const xmlChar **attr = attributes + i * 5;
+		if(xmlStrcmp(attr[0], BAD_CAST name)) continue;
+		int len = attr[4] - attr[3];
+		if(len > size - 1) len = size - 1;
+		memcpy(buf, attr[3], len);
+		buf[len] = 0;
+		return len;
+	}
+	return -1;
+}
+
+static void alto_sax_start(void *ctx, const xmlChar *localname, const xmlChar *prefix, const xmlChar *URI,
+		int nb_namespaces, const xmlChar **namespaces, int nb_attributes, int nb_defaulted, const xmlChar **attributes){
+	struct alto_reply_parser_t *parser = ctx;
+	char value[64];
+
+	if (!xmlStrcmp(localname, BAD_CAST "group_rating_reply")) {
+		if (alto_sax_attr(attributes, nb_attributes, "statuscode", value, sizeof(value)) >= 0)
+			alto_debugf("*** ALTO reply statuscode = %s\n", value);
+	}
+	else if (!xmlStrcmp(localname, BAD_CAST "statustext")) {
+		parser->in_statustext = 1;
+		parser->statustext_len = 0;
+	}
+	else if (!xmlStrcmp(localname, BAD_CAST "cnd_hla")) {
+		parser->in_cnd_hla = 1;
+		parser->rating = 0;
+		if (alto_sax_attr(attributes, nb_attributes, "overall_rating", value, sizeof(value)) >= 0)
+			parser->rating = atoi(value);
+	}
+	else if (!xmlStrcmp(localname, BAD_CAST "ipprefix") && parser->in_cnd_hla) {
+		if (alto_sax_attr(attributes, nb_attributes, "prefix", value, sizeof(value)) < 0) {
+			alto_debugf("Couldn't find ipprefix!\n");
+			return;
+		}
+
+		// create the ALTO element
+		struct alto_db_element_t *element;
+		element = malloc(sizeof(ALTO_DB_ELEMENT_T));
+		if (element == NULL) return;
+		element->host = get_ALTO_host_IP(value);
+		element->host_mask = get_ALTO_host_mask(value);
+		element->rating = parser->rating;
+
+		// and add this element to the db
+		alto_add_element(parser->db, element);
+		parser->num_of_ratings++;
+	}
+}
+
+static void alto_sax_end(void *ctx, const xmlChar *localname, const xmlChar *prefix, const xmlChar *URI){
+	struct alto_reply_parser_t *parser = ctx;
+
+	if (!xmlStrcmp(localname, BAD_CAST "statustext")) {
+		parser->statustext[parser->statustext_len] = 0;
+		parser->in_statustext = 0;
+		alto_debugf("***********************************************************************\n");
+		alto_debugf("*** ALTO reply statustext = '%s'\n", parser->statustext);
+		alto_debugf("***********************************************************************\n");
+	}
+	else if (!xmlStrcmp(localname, BAD_CAST "cnd_hla")) {
+		parser->in_cnd_hla = 0;
+		parser->rating = 0;
+	}
+}
+
+static void alto_sax_characters(void *ctx, const xmlChar *ch, int len){
+	struct alto_reply_parser_t *parser = ctx;
+	int room = sizeof(parser->statustext) - 1 - parser->statustext_len;
+
+	if (!parser->in_statustext) return;
+	if (len > room) len = room;
+	memcpy(parser->statustext + parser->statustext_len, ch, len);
+	parser->statustext_len += len;
+}
+
+/*
+ * 	Prepares the parsing of one reply
+ *
+ * 	in:		db		the DB where the rated prefixes are added
+ * 	ret:	parser	to be fed with the reply and finished
+ */
+struct alto_reply_parser_t * alto_reply_parser_init(struct alto_db_t *db){
+	returnIf(db == NULL, "No DB to parse in! ABORT", NULL);
+
+	struct alto_reply_parser_t *parser;
+	parser = calloc(1, sizeof(ALTO_REPLY_PARSER_T));
+	returnIf(parser == NULL, "Couldn't allocate parser! Out of memory?", NULL);
+	parser->db = db;
+
+	// only our callbacks, none of the ones building a document
+	xmlSAXHandler sax;
+	memset(&sax, 0, sizeof(sax));
+	sax.initialized = XML_SAX2_MAGIC;
+	sax.startElementNs = alto_sax_start;
+	sax.endElementNs = alto_sax_end;
+	sax.characters = alto_sax_characters;
+
+	parser->ctxt = xmlCreatePushParserCtxt(&sax, parser, NULL, 0, NULL);
+	if (parser->ctxt == NULL) {
+		free(parser);
+		returnIf(1, "xmlCreatePushParserCtxt failed!", NULL);
+	}
+	xmlCtxtUseOptions(parser->ctxt, XML_PARSE_RECOVER | XML_PARSE_NONET);
+	return parser;
+}
+
+/*
+ * 	Parses the next part of the reply
+ *
+ * 	ret:	1/-1	continue / the reply can't be parsed any further
+ */
+int alto_reply_parser_feed(struct alto_reply_parser_t *parser, const char *buf, int len){
+	returnIf(parser == NULL, "No parser! ABORT", -1);
+	if (len <= 0) return 1;
+
+	xmlParseChunk(parser->ctxt, buf, len, 0);
+	if (parser->ctxt->disableSAX && parser->ctxt->errNo != XML_ERR_OK)
+		return -1;
+	return 1;
+}
+
+/*
+ * 	Ends the parsing of a reply and frees the parser
+ *
+ * 	ret:	num/-1	number of ipprefix elements added / no ratings due to errors
+ */
+int alto_reply_parser_finish(struct alto_reply_parser_t *parser){
+	returnIf(parser == NULL, "No parser! ABORT", -1);
+
+	xmlParseChunk(parser->ctxt, NULL, 0, 1);
+	int num = parser->num_of_ratings;
+	int well_formed = parser->ctxt->wellFormed;
+
+	xmlFreeParserCtxt(parser->ctxt);
+	free(parser);
+
+	if (num == 0) {
+		alto_debugf("WARNING: ALTO XML reply didn't contain rating info, no peers were rated!\n");
+		if (!well_formed) return -1;
+	}
+	return num;
+}
+
+/*
+ * 	Parses a stored ALTO reply into the DB
+ *
+ * 	ret:	num/-1	number of ipprefix elements added / errors
+ */
+int alto_parse_reply_file(altoDbPtr db, char *file_name){
+	char block[ALTO_REPLY_BLOCK_SIZE];
+	size_t len;
+	FILE *file;
+
+	returnIf(db == NULL, "No DB selected! ABORT", -1);
+	file = fopen(file_name, "r");
+	returnIf(file == NULL, "Can't open the file! ABORT", -1);
+
+	struct alto_reply_parser_t *parser = alto_reply_parser_init(db);
+	if (parser == NULL) {
+		fclose(file);
+		return -1;
+	}
+	while ((len = fread(block, 1, sizeof(block), file)) > 0)
+		if (alto_reply_parser_feed(parser, block, len) < 0) break;
+	fclose(file);
+
+	return alto_reply_parser_finish(parser);
+}
+
 /*
  * 	Converts a given alto_list_t structure into the internal DB structure
  *
@@ -1039,13 +1501,12 @@ void start_ALTO_client(){
 	// initialize the DBs
 	ALTO_DB_req = alto_db_init();
 	ALTO_DB_res = alto_db_init();
+	ALTO_DB_cache = alto_db_init();
 
-	// prepare the XML environment
+	// prepare the XML environment, before any query thread uses it
 	LIBXML_TEST_VERSION;
-
-	// and Initialize the XMLs
-    ALTO_XML_req = NULL;
-    ALTO_XML_res = NULL;
+	xmlInitParser();
+	xmlNanoHTTPInit();
 
 
 }
@@ -1057,14 +1518,19 @@ void start_ALTO_client(){
 void stop_ALTO_client(){
 	alto_debugf("STOP ALTO client! \n");
 
+	// Wait for the query workers, queries not started yet are called back as cancelled
+	alto_query_stop_workers();
+
 	// Kill the DBs
 	alto_free_db(ALTO_DB_req);
 	alto_free_db(ALTO_DB_res);
+	alto_free_db(ALTO_DB_cache);
+	ALTO_DB_req = NULL;
+	ALTO_DB_res = NULL;
+	ALTO_DB_cache = NULL;
 
 	// Kill the XML
-    if (ALTO_XML_req) { xmlFreeDoc(ALTO_XML_req); ALTO_XML_req = NULL; }
-    if (ALTO_XML_res) { xmlFreeDoc(ALTO_XML_res); ALTO_XML_res = NULL; }
-
+	xmlNanoHTTPCleanup();
 	xmlCleanupParser();
 }
 
@@ -1142,77 +1608,330 @@ int get_ALTO_guidance_for_list(ALTO_GUIDANCE_T * list, int num, struct in_addr r
     Multi-Threaded Query
   ==================================*/
 
+/*
+ * 	Queries are run by a small pool of worker threads, each query with its
+ * 	own request and response DB. The completion callback is called in the
+ * 	event loop of the caller: the worker queues the finished query and
+ * 	wakes the loop through a pipe.
+ */
+static pthread_mutex_t alto_query_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t alto_query_cond = PTHREAD_COND_INITIALIZER;
+
+static struct alto_query_queue_t alto_query_pending = {NULL, NULL};	// waiting for a worker
+static struct alto_query_queue_t alto_query_done = {NULL, NULL};	// waiting for the callback
+
+static pthread_t alto_query_workers[ALTO_QUERY_WORKERS];
+static int alto_query_num_workers = 0;
+static int alto_query_stopping = 0;
+
+static int alto_query_pipe[2] = {-1, -1};
+static struct event *alto_query_event = NULL;
+
+// read and written from the workers too, hence the __atomic builtins
 static int queryState = ALTO_QUERY_READY;
 
-static pthread_t threadId;
-static pthread_attr_t attr;
+static void alto_query_push(struct alto_query_queue_t *queue, struct alto_query_t *query){
+	query->next = NULL;
+	if(queue->last != NULL) queue->last->next = query;
+	else queue->first = query;
+	queue->last = query;
+}
 
-typedef struct {
-	ALTO_GUIDANCE_T* list;
-	int num;	// number of elements in list
-	struct in_addr rc_host;
-	int pri_rat;
-	int sec_rat;
-} ALTO_ThreadArgs_t;
+static struct alto_query_t * alto_query_pop(struct alto_query_queue_t *queue){
+	struct alto_query_t *query = queue->first;
+	if(query != NULL){
+		queue->first = query->next;
+		if(queue->first == NULL) queue->last = NULL;
+	}
+	return query;
+}
 
-ALTO_ThreadArgs_t threadArgs;
+/*
+ * 	Rates the hosts of a request DB, from the cache or by asking the server
+ *
+ * 	in:		req		the hosts to rate, the ratings are stored in here
+ * 			res		an empty DB for the reply of the server
+ * 	return:	1/0		all hosts rated / the server couldn't be asked
+ */
+static int alto_query_db(ALTO_DB_T * req, ALTO_DB_T * res, struct in_addr rc_host, int pri_rat, int sec_rat){
+	xmlDocPtr xml_req;
+	int cached, rated;
+
+	pthread_mutex_lock(&alto_cache_lock);
+
+	// The ratings depend on the asking host and the criteria
+	if(rc_host.s_addr != alto_cache_rc_host.s_addr || pri_rat != alto_cache_pri_rat || sec_rat != alto_cache_sec_rat){
+		alto_purge_db(ALTO_DB_cache);
+		alto_cache_rc_host = rc_host;
+		alto_cache_pri_rat = pri_rat;
+		alto_cache_sec_rat = sec_rat;
+	}
+	alto_expire_cache(ALTO_DB_cache, alto_cache_ttl);
+
+	// Step 1: rate from the cache what is known, collect the rest
+	altoDbPtr ALTO_DB_delta = alto_db_init();
+	if (!ALTO_DB_delta) {
+		pthread_mutex_unlock(&alto_cache_lock);
+		return 0;
+	}
+	cached = alto_lookup_cache(req, ALTO_DB_cache, ALTO_DB_delta);
+	pthread_mutex_unlock(&alto_cache_lock);
+
+	alto_debugf("%s: %d of %d hosts rated from the cache, asking for %d prefixes\n", __FUNCTION__,
+		cached, req->num_of_elements, ALTO_DB_delta->num_of_elements);
+
+	if (ALTO_DB_delta->num_of_elements == 0) {
+		alto_free_db(ALTO_DB_delta);
+		return 1;
+	}
+
+	// Step 2: create an XML from the DB entries
+	xml_req = alto_create_request_XML(ALTO_DB_delta, rc_host, pri_rat, sec_rat);
+
+	// Step 3: get the reply, it is parsed to the DB while it comes in
+#ifndef USE_LOCAL_REPLY_XML
+	// Step3a: send POST request to ALTO server
+	#ifdef USE_CURL
+	rated = query_ALTO_server_curl(xml_req, alto_server_url, res);
+	#else
+	rated = ALTO_request_to_server(xml_req, alto_server_url, res);
+	#endif
+#else
+	// Step3b: use for testing the local stored TXT-file
+	rated = alto_parse_reply_file(res, "reply.xml");
+#endif
+
+	// a reply without any rating (e.g. a server error) is not kept
+	if (rated > 0) {
+		// ###### Big Magic ######
+		// And now check for the corresponding rating
+		alto_do_the_magic(ALTO_DB_delta, res);
+
+		// keep the new ratings and hand them out, unless a query for other
+		// criteria has taken over the cache in the meantime
+		pthread_mutex_lock(&alto_cache_lock);
+		if(rc_host.s_addr == alto_cache_rc_host.s_addr && pri_rat == alto_cache_pri_rat && sec_rat == alto_cache_sec_rat){
+			alto_move_elements(ALTO_DB_cache, ALTO_DB_delta);
+			alto_lookup_cache(req, ALTO_DB_cache, NULL);
+		}else{
+			alto_lookup_cache(req, ALTO_DB_delta, NULL);
+		}
+		pthread_mutex_unlock(&alto_cache_lock);
+	}
+
+	// free xml data
+	xmlFreeDoc(xml_req);
+
+	// purge the intermediate DBs
+	alto_purge_db(res);
+	alto_free_db(ALTO_DB_delta);
+	return rated > 0;
+}
+
+/*
+ * 	Runs one query in a worker thread
+ */
+static int alto_query_run(struct alto_query_t *query){
+	int count, result = 0;
+	altoDbPtr req = alto_db_init();
+	altoDbPtr res = alto_db_init();
+
+	if (req != NULL && res != NULL) {
+		alto_parse_from_list(req, query->list, query->num);
+		result = alto_query_db(req, res, query->rc_host, query->pri_rat, query->sec_rat);
+
+		// write values back
+		for(count = 0; count < query->num; count++){
+			query->list[count].rating = get_ALTO_rating_for_host(query->list[count].alto_host, req);
+		}
+	}
+	if (req) alto_free_db(req);
+	if (res) alto_free_db(res);
+	return result;
+}
 
 void* alto_query_thread_func(void* thread_args)
 {
-	int count = 0;
-	ALTO_ThreadArgs_t* args = (ALTO_ThreadArgs_t*) thread_args;
+	struct alto_query_t *query;
+
+	for(;;){
+		pthread_mutex_lock(&alto_query_lock);
+		while (!alto_query_stopping && alto_query_pending.first == NULL)
+			pthread_cond_wait(&alto_query_cond, &alto_query_lock);
+		if (alto_query_stopping) {
+			pthread_mutex_unlock(&alto_query_lock);
+			break;
+		}
+		query = alto_query_pop(&alto_query_pending);
+		pthread_mutex_unlock(&alto_query_lock);
 
-	alto_debugf("alto_query_thread_func\n");
+		// this will block at some point
+		query->result = alto_query_run(query);
 
-	// this will block at some point
-	do_ALTO_update(args->rc_host, args->pri_rat, args->sec_rat);
+		if (query->in_worker || alto_query_event == NULL) {
+			query->cb(query->list, query->num, query->result, query->arg);
+			free(query);
+			continue;
+		}
 
-	// write values back
-	for(count = 0; count < args->num; count++){
-		args->list[count].rating = get_ALTO_rating_for_host(args->list[count].alto_host, ALTO_DB_req);
+		// hand it over to the event loop
+		pthread_mutex_lock(&alto_query_lock);
+		alto_query_push(&alto_query_done, query);
+		pthread_mutex_unlock(&alto_query_lock);
+		if (write(alto_query_pipe[1], "q", 1) < 0 && errno != EAGAIN)
+			alto_errorf("%s - Couldn't wake up the event loop!\n", __FUNCTION__);
 	}
+	return thread_args;
+}
 
-	// signal that query is ready
-	queryState = ALTO_QUERY_READY;
+/*
+ * 	Called in the event loop when queries are finished
+ */
+static void alto_query_notify(evutil_socket_t fd, short what, void *arg){
+	char buf[64];
+	struct alto_query_queue_t done;
+	struct alto_query_t *query;
 
-	return thread_args;
+	while (read(fd, buf, sizeof(buf)) > 0);
+
+	pthread_mutex_lock(&alto_query_lock);
+	done = alto_query_done;
+	alto_query_done.first = alto_query_done.last = NULL;
+	pthread_mutex_unlock(&alto_query_lock);
+
+	while ((query = alto_query_pop(&done)) != NULL) {
+		query->cb(query->list, query->num, query->result, query->arg);
+		free(query);
+	}
 }
 
-int ALTO_query_state() {
-	return queryState;
+static int alto_query_start_workers(){
+	pthread_mutex_lock(&alto_query_lock);
+	while (alto_query_num_workers < ALTO_QUERY_WORKERS) {
+		if (pthread_create(&alto_query_workers[alto_query_num_workers], NULL, alto_query_thread_func, NULL) != 0) {
+			fprintf(stderr,"[ALTOclient] pthread_create failed!\n");
+			break;
+		}
+		alto_query_num_workers++;
+	}
+	pthread_mutex_unlock(&alto_query_lock);
+	return alto_query_num_workers > 0;
 }
 
-int ALTO_query_exec(ALTO_GUIDANCE_T * list, int num, struct in_addr rc_host, int pri_rat, int sec_rat){
-	alto_debugf("ALTO_query_exec\n");
+/*
+ * 	Stops and joins the workers and calls back the queries that are not
+ * 	delivered yet, the ones that did not run with result -1
+ */
+void alto_query_stop_workers(){
+	struct alto_query_t *query;
+	int i;
+
+	pthread_mutex_lock(&alto_query_lock);
+	alto_query_stopping = 1;
+	pthread_cond_broadcast(&alto_query_cond);
+	pthread_mutex_unlock(&alto_query_lock);
+
+	for (i = 0; i < alto_query_num_workers; i++)
+		pthread_join(alto_query_workers[i], NULL);
+	alto_query_num_workers = 0;
+	alto_query_stopping = 0;
+
+	while ((query = alto_query_pop(&alto_query_done)) != NULL) {
+		query->cb(query->list, query->num, query->result, query->arg);
+		free(query);
+	}
+	while ((query = alto_query_pop(&alto_query_pending)) != NULL) {
+		query->cb(query->list, query->num, -1, query->arg);
+		free(query);
+	}
+	__atomic_store_n(&queryState, ALTO_QUERY_READY, __ATOMIC_RELEASE);
+
+	if (alto_query_event) {
+		event_free(alto_query_event);
+		alto_query_event = NULL;
+		close(alto_query_pipe[0]);
+		close(alto_query_pipe[1]);
+		alto_query_pipe[0] = alto_query_pipe[1] = -1;
+	}
+}
 
+int ALTO_query_attach(void *event_base){
+	returnIf(event_base == NULL, "No event base!", 0);
+	returnIf(alto_query_event != NULL, "Already attached to an event base!", 0);
+
+	returnIf(pipe(alto_query_pipe) != 0, "Couldn't create the notification pipe!", 0);
+	fcntl(alto_query_pipe[0], F_SETFL, O_NONBLOCK);
+	fcntl(alto_query_pipe[1], F_SETFL, O_NONBLOCK);
+
+	alto_query_event = event_new((struct event_base *) event_base, alto_query_pipe[0], EV_READ | EV_PERSIST, alto_query_notify, NULL);
+	if (alto_query_event == NULL || event_add(alto_query_event, NULL) != 0) {
+		if (alto_query_event) event_free(alto_query_event);
+		alto_query_event = NULL;
+		close(alto_query_pipe[0]);
+		close(alto_query_pipe[1]);
+		alto_query_pipe[0] = alto_query_pipe[1] = -1;
+		returnIf(1, "Couldn't add the notification event!", 0);
+	}
+	return 1;
+}
+
+static int alto_query_queue(ALTO_GUIDANCE_T * list, int num, struct in_addr rc_host, int pri_rat, int sec_rat,
+		ALTO_QUERY_CB cb, void *arg, int in_worker){
 	// Sanity checks (list)
 	returnIf(list == NULL, "Can't access the list!", 0);
 
 	// Sanity checks (num of elements)
 	returnIf(num < 0, "<0 elements?", 0);
+	returnIf(cb == NULL, "No completion callback!", 0);
+	returnIf(!alto_query_start_workers(), "No query worker running!", 0);
+
+	struct alto_query_t *query;
+	query = malloc(sizeof(ALTO_QUERY_T));
+	returnIf(query == NULL, "Couldn't allocate query! Out of memory?", 0);
+	query->list = list;
+	query->num = num;
+	query->rc_host = rc_host;
+	query->pri_rat = pri_rat;
+	query->sec_rat = sec_rat;
+	query->cb = cb;
+	query->arg = arg;
+	query->result = 0;
+	query->in_worker = in_worker;
+
+	pthread_mutex_lock(&alto_query_lock);
+	alto_query_push(&alto_query_pending, query);
+	pthread_cond_signal(&alto_query_cond);
+	pthread_mutex_unlock(&alto_query_lock);
+	return 1;
+}
 
-	// set new state
-	if (queryState == ALTO_QUERY_INPROGRESS) {
-		alto_debugf("*** WARNING: Calling ALTO_query_exec while query is still in progress! Race condition?!\n");
-		return 0;
-	}
-	queryState = ALTO_QUERY_INPROGRESS;
+int ALTO_query_submit(ALTO_GUIDANCE_T * list, int num, struct in_addr rc_host, int pri_rat, int sec_rat,
+		ALTO_QUERY_CB cb, void *arg){
+	alto_debugf("ALTO_query_submit\n");
+	return alto_query_queue(list, num, rc_host, pri_rat, sec_rat, cb, arg, 0);
+}
 
-	// first purge existing DB entries
-	alto_purge_db(ALTO_DB_req);
+int ALTO_query_state() {
+	return __atomic_load_n(&queryState, __ATOMIC_ACQUIRE);
+}
 
-	// Step 1 (read struct into DB)
-	alto_parse_from_list(ALTO_DB_req, list, num);
+static void alto_query_exec_done(ALTO_GUIDANCE_T * list, int num, int result, void *arg){
+	// signal that query is ready
+	__atomic_store_n(&queryState, ALTO_QUERY_READY, __ATOMIC_RELEASE);
+}
 
-	//ALTO_XML_req = alto_create_request_XML(ALTO_DB_req, rc_host, pri_rat, sec_rat);
+int ALTO_query_exec(ALTO_GUIDANCE_T * list, int num, struct in_addr rc_host, int pri_rat, int sec_rat){
+	alto_debugf("ALTO_query_exec\n");
 
-	threadArgs.list = list;
-	threadArgs.num = num;
-	pthread_attr_init(&attr);
-	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
-	if (pthread_create(&threadId, &attr, alto_query_thread_func, &threadArgs) != 0) {
-		fprintf(stderr,"[ALTOclient] pthread_create failed!\n");
-		queryState = ALTO_QUERY_READY;
+	// set new state, unless a query is still running
+	int state = ALTO_QUERY_READY;
+	if (!__atomic_compare_exchange_n(&queryState, &state, ALTO_QUERY_INPROGRESS, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		alto_debugf("*** WARNING: Calling ALTO_query_exec while query is still in progress! Race condition?!\n");
+		return 0;
+	}
+
+	if (!alto_query_queue(list, num, rc_host, pri_rat, sec_rat, alto_query_exec_done, NULL, 1)) {
+		__atomic_store_n(&queryState, ALTO_QUERY_READY, __ATOMIC_RELEASE);
 		return 0;
 	}
 
@@ -1231,39 +1950,5 @@ void do_ALTO_update(struct in_addr rc_host, int pri_rat, int sec_rat){
 		return;
 	}
 
-	// Step 2: create an XML from the DB entries
-	ALTO_XML_req = alto_create_request_XML(ALTO_DB_req, rc_host, pri_rat, sec_rat);
-
-#ifndef USE_LOCAL_REPLY_XML
-	// Step2a: send POST request to ALTO server
-	#ifdef USE_CURL
-	ALTO_XML_res = query_ALTO_server_curl(ALTO_XML_req, alto_server_url);
-	#else
-	ALTO_XML_res = ALTO_request_to_server(ALTO_XML_req, alto_server_url);
-	#endif
-#else
-	// Step2b: use for testing the local stored TXT-file
-	ALTO_XML_res = xmlReadFile("reply.xml",NULL,XML_PARSE_RECOVER);
-#endif
-
-	if (ALTO_XML_res) {
-		// Step 3: Parse the XML to the DB
-		alto_parse_from_XML(ALTO_DB_res, ALTO_XML_res);
-
-		// ###### Big Magic ######
-		// And now check for the corresponding rating
-		alto_do_the_magic(ALTO_DB_req, ALTO_DB_res);
-
-		xmlFreeDoc(ALTO_XML_res);
-		ALTO_XML_res = NULL;
-	}
-
-	// free xml data
-	xmlFreeDoc(ALTO_XML_req);
-	ALTO_XML_req = NULL;
-
-	// purge the intermediate DB
-	alto_purge_db(ALTO_DB_res);
+	alto_query_db(ALTO_DB_req, ALTO_DB_res, rc_host, pri_rat, sec_rat);
 }
-
-
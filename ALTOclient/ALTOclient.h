@@ -102,6 +102,19 @@ int set_ALTO_server(char * string);
  */
 char *get_ALTO_server(void);
 
+/**
+ * 	Set how long ratings from the ALTO server are reused.
+ * 	The client remembers the rating of every prefix it asked for. Later
+ * 	updates only ask the server for the prefixes that are new or whose
+ * 	rating is older than the given time, the others are rated locally.
+ * 	Changing the rc_host or the rating criteria drops all ratings.
+ *
+ * 	@param	seconds	Max age of a reused rating, 0 asks the server for
+ * 					every host in every update (default: 600)
+ * 	@return			1 = SUCCESS / -1 = ERROR
+ */
+int set_ALTO_cache_ttl(int seconds);
+
 /**
  *	With this function a given list of hosts in a txt file will be ALTOrated
  *	This function will read from a text file all given hosts, transform them into
@@ -147,6 +160,43 @@ int get_ALTO_guidance_for_list(ALTO_GUIDANCE_T * list, int num, struct in_addr r
  */
 int ALTO_query_exec(ALTO_GUIDANCE_T * list, int num, struct in_addr rc_host, int pri_rat, int sec_rat);
 
+/**
+ *	Called when an asynchronous query is finished.
+ *
+ * 	@param	list		the list given to ALTO_query_submit, with the ratings
+ * 	@param	num			the number of elements in the list
+ * 	@param	result		1 = SUCCESS / 0 = the ALTO server couldn't be asked,
+ * 						only cached ratings were filled in / -1 = cancelled by
+ * 						stop_ALTO_client before it ran, no rating was filled in
+ * 	@param	arg			the argument given to ALTO_query_submit
+ */
+typedef void (*ALTO_QUERY_CB)(ALTO_GUIDANCE_T *list, int num, int result, void *arg);
+
+/**
+ *	Deliver the completion of asynchronous queries to an event loop.
+ *	After this call the callbacks of ALTO_query_submit are called from the
+ *	given libevent base. Without it they are called from the query thread.
+ *
+ * 	@param	event_base	pointer to the event base of libevent
+ * 	@return				1 = SUCCESS / 0 = ERROR
+ */
+int ALTO_query_attach(void *event_base);
+
+/**
+ *	Asynchronous ALTO query with completion callback.
+ *	Several queries can be in flight at the same time, each is rated on
+ *	its own. The list must not be touched until the callback was called.
+ *	Queries not finished when stop_ALTO_client is called are called back
+ *	from stop_ALTO_client, the ones that did not run with result -1.
+ *
+ * 	@param	cb			called with the rated list when the query is done
+ * 	@param	arg			passed on to cb
+ * 	@return				1 = SUCCESS / 0 = ERROR
+ *	@see get_ALTO_guidance_for_list
+ */
+int ALTO_query_submit(ALTO_GUIDANCE_T * list, int num, struct in_addr rc_host, int pri_rat, int sec_rat,
+		ALTO_QUERY_CB cb, void *arg);
+
 /**
  *	Returns current state of query (asynchronous processing).
  *	@return				ALTO_QUERY_READY / ALTO_QUERY_INPROGRESS
@@ -39,6 +39,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <time.h>
+#include <stdint.h>
 
 // for having all the fancy host structs
 #include <arpa/inet.h>
@@ -50,6 +51,7 @@
 #include <libxml/xmlIO.h>
 #include <libxml/parser.h>
 #include <libxml/tree.h>
+#include <libxml/nanohttp.h>
 
 // use #define USE_CURL to enable curl codepath for POST requests to
 // the ALTO server
@@ -64,9 +66,38 @@
 
 
 
-// This is needed for the CURL reply
-#define ALTO_REP_BUF_SIZE 524288
+// The reply is handed to the parser in blocks of this size
+#define ALTO_REPLY_BLOCK_SIZE 4096
 
+// How long (in seconds) a rating from the ALTO server is reused by default
+#define ALTO_CACHE_TTL 600
+
+// Number of queries that are sent to the ALTO server at the same time
+#define ALTO_QUERY_WORKERS 4
+
+
+/*
+ *  Longest prefix match index
+ *
+ *  A path compressed binary trie over the address bits. Keys are addresses
+ *  in network byte order of up to ALTO_TRIE_MAX_BITS bits, so IPv6 prefixes
+ *  can be stored the same way as IPv4 ones. A lookup visits at most one node
+ *  per prefix length, independent of the number of stored prefixes.
+ */
+#define ALTO_TRIE_MAX_BITS 128
+
+typedef struct alto_trie_node_t{
+	struct alto_trie_node_t *child[2];	// next node for bit 0 / 1 after the prefix
+	uint8_t key[ALTO_TRIE_MAX_BITS / 8];	// the prefix, bits after len are 0
+	int len;							// prefix length in bits
+	int has_value;						// 0 for nodes only created to branch
+	int value;
+}ALTO_TRIE_NODE_T;
+
+typedef struct alto_trie_t{
+	struct alto_trie_node_t *root;
+	int num_of_nodes;
+}ALTO_TRIE_T;
 
 /*
  *  This is the internal ALTO DB
@@ -76,6 +107,11 @@ typedef struct alto_db_t{
 	int num_of_elements;
 	struct alto_db_element_t *first;
 	struct alto_db_element_t *last;
+
+	// lookup indexes, built on first use and dropped when the DB changes
+	struct alto_trie_t *prefix_index;	// host/host_mask -> rating
+	struct alto_trie_t *host_index;		// host -> rating
+	struct alto_trie_t *key_index;		// exactly host/host_mask -> rating
 }ALTO_DB_T;
 typedef ALTO_DB_T *altoDbPtr;
 
@@ -107,20 +143,49 @@ typedef struct alto_db_element_t{
 }ALTO_DB_ELEMENT_T;
 
 /*
- * 	This is needed for the CURL intearction with the ALTO server
+ * 	State of the streaming parser for the ALTO reply
+ *
+ * 	The reply is fed in as it arrives. Every ipprefix is added to the DB with
+ * 	the overall_rating of its cnd_hla as soon as the element is seen, so no
+ * 	document tree is built and the reply is never held in memory as a whole.
  */
-#ifdef USE_CURL
-struct curl_reply_buffer_t {
-    size_t          size;
-    size_t          fill;
-    char            buffer[ALTO_REP_BUF_SIZE];
-};
-#endif
+typedef struct alto_reply_parser_t{
+	xmlParserCtxtPtr ctxt;				// libxml2 SAX push parser
+	struct alto_db_t *db;				// where the ratings go
+	int in_cnd_hla;						// only candidates are rated, not the rc_hla
+	int rating;							// overall_rating of the current cnd_hla
+	int in_statustext;
+	int statustext_len;
+	char statustext[256];
+	int num_of_ratings;					// ipprefix elements added so far
+}ALTO_REPLY_PARSER_T;
 
 
 
 
 
+/*
+ * 	One asynchronous query, owned by the pool until its callback was called
+ */
+typedef struct alto_query_t{
+	ALTO_GUIDANCE_T *list;				// the hosts, the ratings are written in here
+	int num;
+	struct in_addr rc_host;
+	int pri_rat;
+	int sec_rat;
+	ALTO_QUERY_CB cb;
+	void *arg;
+	int result;							// 1/0 success / server couldn't be asked
+	int in_worker;						// call cb in the worker thread
+	struct alto_query_t *next;
+}ALTO_QUERY_T;
+
+typedef struct alto_query_queue_t{
+	struct alto_query_t *first;
+	struct alto_query_t *last;
+}ALTO_QUERY_QUEUE_T;
+
+
 /*
  *  And here the internal functions:
  */
@@ -128,11 +193,11 @@ struct in_addr get_ALTO_host_IP(char * host_string);
 int16_t get_ALTO_host_mask(char * host_string);
 
 xmlDocPtr alto_create_request_XML(struct alto_db_t * db, struct in_addr rc_host, int pri_rat, int sec_rat);
-xmlDocPtr ALTO_request_to_server(xmlDocPtr doc, char* endPoint);
+int ALTO_request_to_server(xmlDocPtr doc, char* endPoint, struct alto_db_t * db);
 
 #ifdef USE_CURL
-xmlDocPtr query_ALTO_server_curl(xmlDocPtr doc, char* ALTO_server_URL);
-size_t curl_copy_reply_to_buf(void *ptr,size_t size,size_t nmemb,void *stream);
+int query_ALTO_server_curl(xmlDocPtr doc, char* ALTO_server_URL, struct alto_db_t * db);
+size_t curl_copy_reply_to_parser(void *ptr,size_t size,size_t nmemb,void *stream);
 #endif
 
 void print_Alto_XML_info(xmlDocPtr doc);
@@ -147,6 +212,26 @@ int alto_free_db(struct alto_db_t * db);
 int alto_add_element(struct alto_db_t *db, struct alto_db_element_t * element);
 int alto_parse_from_list(struct alto_db_t *db, struct alto_guidance_t *list, int num_of_elements);
 int alto_rem_element(struct alto_db_element_t * element);
+int alto_purge_db(struct alto_db_t * db);
+int alto_move_elements(struct alto_db_t *dst, struct alto_db_t *src);
+
+
+// Rating cache
+int alto_expire_cache(struct alto_db_t *cache, int ttl);
+int alto_lookup_cache(struct alto_db_t *db, struct alto_db_t *cache, struct alto_db_t *missing);
+
+
+// Longest prefix match index
+struct alto_trie_t * alto_trie_init(void);
+void alto_trie_free(struct alto_trie_t *trie);
+int alto_trie_insert(struct alto_trie_t *trie, const uint8_t *key, int len, int value, int replace);
+int alto_trie_lookup(struct alto_trie_t *trie, const uint8_t *key, int max_len, int *value);
+void alto_db_drop_index(struct alto_db_t *db);
+
+
+// Query pool
+void* alto_query_thread_func(void* thread_args);
+void alto_query_stop_workers();
 
 
 // Helper Functions
@@ -161,6 +246,12 @@ int get_ALTO_rating_for_host(struct in_addr add, ALTO_DB_T * db);
 
 int alto_parse_from_file(altoDbPtr db, char *file_name);
 int alto_parse_from_XML(altoDbPtr db, xmlDocPtr doc);
+int alto_parse_reply_file(altoDbPtr db, char *file_name);
+
+// Streaming reply parser
+struct alto_reply_parser_t * alto_reply_parser_init(struct alto_db_t *db);
+int alto_reply_parser_feed(struct alto_reply_parser_t *parser, const char *buf, int len);
+int alto_reply_parser_finish(struct alto_reply_parser_t *parser);
 int alto_write_to_file(altoDbPtr db, char *file_name);
 
 
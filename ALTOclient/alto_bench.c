@@ -0,0 +1,137 @@
+/*
+ * alto_bench.c
+ *
+ *  Rates a list of random peers against a random ALTO reply the same way
+ *  do_ALTO_update() does and prints how long the matching takes. A small
+ *  run is checked against a linear longest-prefix search first.
+ *
+ *  Usage: alto_bench [peers] [prefixes] [seed]
+ */
+#include "ALTOclient.h"
+#include "ALTOclient_impl.h"
+
+#include <sys/time.h>
+
+static double now_ms(){
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+/*
+ * 	Reply with prefixes of length 8..28 whose network addresses are all
+ * 	different
+ */
+static void fill_reply(ALTO_DB_T *db, int num){
+	ALTO_TRIE_T *seen = alto_trie_init();
+	int dummy;
+
+	while(db->num_of_elements < num){
+		struct alto_db_element_t *element = malloc(sizeof(ALTO_DB_ELEMENT_T));
+		int len = 8 + rand() % 21;
+		uint32_t addr = ((uint32_t) rand() << 16) ^ (uint32_t) rand();
+		addr &= 0xFFFFFFFF << (32 - len);
+		element->host.s_addr = htonl(addr);
+		element->host_mask = len;
+		element->rating = 1 + rand() % 100;
+		if(alto_trie_lookup(seen, (uint8_t *) &element->host.s_addr, 32, &dummy) == 32){
+			free(element);
+			continue;
+		}
+		alto_trie_insert(seen, (uint8_t *) &element->host.s_addr, 32, 1, 0);
+		alto_add_element(db, element);
+	}
+	alto_trie_free(seen);
+}
+
+/*
+ * 	Peers, half of them inside one of the reply prefixes
+ */
+static void fill_peers(ALTO_DB_T *db, ALTO_DB_T *reply, int num){
+	int i;
+	ALTO_DB_ELEMENT_T **prefixes = malloc(reply->num_of_elements * sizeof(ALTO_DB_ELEMENT_T *));
+	ALTO_DB_ELEMENT_T *cur = reply->first;
+	for(i = 0; cur != NULL; cur = cur->next) prefixes[i++] = cur;
+
+	for(i = 0; i < num; i++){
+		struct alto_db_element_t *element = malloc(sizeof(ALTO_DB_ELEMENT_T));
+		uint32_t addr = ((uint32_t) rand() << 16) ^ (uint32_t) rand();
+		if(i & 1){
+			ALTO_DB_ELEMENT_T *p = prefixes[rand() % reply->num_of_elements];
+			uint32_t mask = 0xFFFFFFFF << (32 - p->host_mask);
+			addr = (ntohl(p->host.s_addr) & mask) | (addr & ~mask);
+		}
+		element->host.s_addr = htonl(addr);
+		element->host_mask = 32;
+		element->rating = 0;
+		alto_add_element(db, element);
+	}
+	free(prefixes);
+}
+
+/*
+ * 	Linear longest-prefix match over the reply, the reference for the index
+ */
+static int linear_rating(ALTO_DB_ELEMENT_T *element, ALTO_DB_T *db){
+	int mask;
+	for(mask = element->host_mask; mask > 0; mask--){
+		struct in_addr subnet = compute_subnet(element->host, mask);
+		ALTO_DB_ELEMENT_T *cur;
+		for(cur = db->first; cur != NULL; cur = cur->next)
+			if(cur->host.s_addr == subnet.s_addr && cur->host_mask == mask && cur->rating != 0)
+				return cur->rating;
+	}
+	return 0;
+}
+
+static int check(int peers, int prefixes){
+	int errors = 0;
+	ALTO_DB_T *req = alto_db_init();
+	ALTO_DB_T *res = alto_db_init();
+	ALTO_DB_ELEMENT_T *cur;
+
+	fill_reply(res, prefixes);
+	fill_peers(req, res, peers);
+	alto_do_the_magic(req, res);
+	for(cur = req->first; cur != NULL; cur = cur->next)
+		if(cur->rating != linear_rating(cur, res)) errors++;
+
+	alto_free_db(req);
+	alto_free_db(res);
+	return errors;
+}
+
+int main(int argc, char *argv[]){
+	int peers = argc > 1 ? atoi(argv[1]) : 10000;
+	int prefixes = argc > 2 ? atoi(argv[2]) : 50000;
+	unsigned int seed = argc > 3 ? atoi(argv[3]) : 1;
+	ALTO_DB_T *req, *res;
+	ALTO_DB_ELEMENT_T *cur;
+	double t0, t1, t2;
+	int errors, rated = 0;
+
+	srand(seed);
+	errors = check(1000, 2000);
+	printf("check against linear search: %d mismatches\n", errors);
+
+	req = alto_db_init();
+	res = alto_db_init();
+	fill_reply(res, prefixes);
+	fill_peers(req, res, peers);
+	alto_db_drop_index(req);
+	alto_db_drop_index(res);
+
+	t0 = now_ms();
+	alto_do_the_magic(req, res);
+	t1 = now_ms();
+	for(cur = req->first; cur != NULL; cur = cur->next)
+		if(get_ALTO_rating_for_host(cur->host, req) != 0) rated++;
+	t2 = now_ms();
+
+	printf("%d peers against %d prefixes (%d trie nodes): matching %.2f ms, %d rated, host lookups %.2f ms\n",
+		peers, prefixes, res->prefix_index ? res->prefix_index->num_of_nodes : 0, t1 - t0, rated, t2 - t1);
+
+	alto_free_db(req);
+	alto_free_db(res);
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,276 @@
+/*
+ * alto_cache_test.c
+ *
+ *  Runs the ALTO client against a stand-in ALTO server on the loopback
+ *  interface and checks that overlapping neighbour lists are only asked
+ *  for the prefixes that are new or whose rating has expired.
+ *
+ *  The stand-in rates every asked prefix with (first byte % 9) + 1 and
+ *  counts the prefixes it was asked for. Every connection is served by its
+ *  own thread, so concurrent queries overlap.
+ */
+#define _GNU_SOURCE
+#include "ALTOclient.h"
+#include "ALTOclient_impl.h"
+
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <sys/time.h>
+#include <event2/event.h>
+
+// big enough for the replies of the largest round
+#define STANDIN_BUF_SIZE (4 * 1024 * 1024)
+
+static int server_fd;
+static int server_delay_ms;		// the stand-in takes this long per request
+static pthread_mutex_t server_lock = PTHREAD_MUTEX_INITIALIZER;
+static int asked_prefixes;		// prefixes asked since the last reset
+static int requests;
+
+static int expected_rating(struct in_addr host){
+	return (ntohl(host.s_addr) >> 24) % 9 + 1;
+}
+
+/*
+ * 	Reads one HTTP request, returns the body or NULL
+ */
+static char *read_request(int fd, char *buf){
+	int fill = 0, len = -1;
+	char *body = NULL;
+
+	while(fill < STANDIN_BUF_SIZE - 1){
+		int n = read(fd, buf + fill, STANDIN_BUF_SIZE - 1 - fill);
+		if(n <= 0) return NULL;
+		fill += n;
+		buf[fill] = 0;
+		if(body == NULL && (body = strstr(buf, "\r\n\r\n")) != NULL){
+			char *cl = strcasestr(buf, "Content-Length:");
+			body += 4;
+			len = cl ? atoi(cl + 15) : 0;
+		}
+		if(body != NULL && buf + fill - body >= len) return body;
+	}
+	return NULL;
+}
+
+/*
+ * 	Answers every candidate prefix with its own cnd_hla, like the H12 reply
+ */
+static void answer(int fd, char *body, char *reply){
+	char header[128];
+	char *p = strstr(body, "cnd_hla");
+	int len, asked = 0;
+
+	len = sprintf(reply, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+		"<alto xmlns=\"urn:ietf:params:xml:ns:p2p:alto\">\n"
+		"  <group_rating_reply statuscode=\"200\">\n");
+	while(p != NULL && (p = strstr(p, "prefix=\"")) != NULL){
+		char prefix[64];
+		p += 8;
+		sscanf(p, "%63[^\"]", prefix);
+		len += sprintf(reply + len, "    <cnd_hla overall_rating=\"%d\">\n"
+			"      <ipprefix prefix=\"%s\" version=\"4\" />\n"
+			"    </cnd_hla>\n", expected_rating(get_ALTO_host_IP(prefix)), prefix);
+		asked++;
+	}
+	len += sprintf(reply + len, "  </group_rating_reply>\n</alto>\n");
+
+	usleep(server_delay_ms * 1000);
+	pthread_mutex_lock(&server_lock);
+	asked_prefixes += asked;
+	requests++;
+	pthread_mutex_unlock(&server_lock);
+
+	sprintf(header, "HTTP/1.0 200 OK\r\nContent-Type: text/xml\r\nContent-Length: %d\r\n\r\n", len);
+	write(fd, header, strlen(header));
+	write(fd, reply, len);
+}
+
+static void *connection_func(void *arg){
+	int fd = (intptr_t) arg;
+	char *buf = malloc(STANDIN_BUF_SIZE);
+	char *reply = malloc(STANDIN_BUF_SIZE);
+	char *body;
+
+	if((body = read_request(fd, buf)) != NULL)
+		answer(fd, body, reply);
+	close(fd);
+	free(buf);
+	free(reply);
+	return NULL;
+}
+
+static void *server_func(void *arg){
+	for(;;){
+		pthread_t thread;
+		int fd = accept(server_fd, NULL, NULL);
+		if(fd < 0) break;
+		pthread_create(&thread, NULL, connection_func, (void *) (intptr_t) fd);
+		pthread_detach(thread);
+	}
+	return arg;
+}
+
+static int start_server(){
+	struct sockaddr_in addr;
+	socklen_t addr_len = sizeof(addr);
+	pthread_t thread;
+
+	server_fd = socket(AF_INET, SOCK_STREAM, 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if(bind(server_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(server_fd, 4) < 0) return -1;
+	getsockname(server_fd, (struct sockaddr *) &addr, &addr_len);
+	pthread_create(&thread, NULL, server_func, NULL);
+	return ntohs(addr.sin_port);
+}
+
+/*
+ * 	Rates peers first..first+num-1 of a fixed peer population, returns the
+ * 	number of wrong ratings
+ */
+static void fill_peers(ALTO_GUIDANCE_T *list, int first, int num){
+	int i;
+	for(i = 0; i < num; i++){
+		uint32_t id = first + i;
+		list[i].alto_host.s_addr = htonl(((id * 37 % 200 + 20) << 24) | (id + 1));
+		list[i].prefix = 32;
+		list[i].rating = -1;
+	}
+}
+
+static int wrong_ratings(ALTO_GUIDANCE_T *list, int num){
+	int i, errors = 0;
+	for(i = 0; i < num; i++)
+		if(list[i].rating != expected_rating(list[i].alto_host)) errors++;
+	return errors;
+}
+
+static int rate_peers(int first, int num, struct in_addr rc_host){
+	ALTO_GUIDANCE_T list[num];
+
+	fill_peers(list, first, num);
+	asked_prefixes = 0;
+	get_ALTO_guidance_for_list(list, num, rc_host, REL_PREF, 7);
+	return wrong_ratings(list, num);
+}
+
+/*
+ * 	Rates the peers and checks how many prefixes the server was asked for
+ */
+static int check(const char *what, int first, int num, struct in_addr rc_host, int expected){
+	int errors = rate_peers(first, num, rc_host);
+	printf("%-40s asked for %3d prefixes (expected %3d), %d wrong ratings\n", what, asked_prefixes, expected, errors);
+	return errors != 0 || asked_prefixes != expected;
+}
+
+/*
+ * 	Asynchronous queries, completed through the event loop
+ */
+#define ASYNC_QUERIES 4
+#define ASYNC_PEERS 50
+
+static pthread_t main_thread;
+static struct event_base *base;
+static int async_done, async_errors;
+
+static void async_done_cb(ALTO_GUIDANCE_T *list, int num, int result, void *arg){
+	if(!pthread_equal(pthread_self(), main_thread) || !result) async_errors++;
+	async_errors += wrong_ratings(list, num);
+	if(++async_done == ASYNC_QUERIES) event_base_loopbreak(base);
+}
+
+static int check_async(struct in_addr rc_host){
+	static ALTO_GUIDANCE_T lists[ASYNC_QUERIES][ASYNC_PEERS];
+	struct timeval t0, t1;
+	int i, ms;
+
+	asked_prefixes = 0;
+	server_delay_ms = 200;
+	gettimeofday(&t0, NULL);
+	for(i = 0; i < ASYNC_QUERIES; i++){
+		fill_peers(lists[i], 20000 + i * ASYNC_PEERS, ASYNC_PEERS);
+		ALTO_query_submit(lists[i], ASYNC_PEERS, rc_host, REL_PREF, 7, async_done_cb, NULL);
+	}
+	event_base_dispatch(base);
+	gettimeofday(&t1, NULL);
+	server_delay_ms = 0;
+
+	ms = (t1.tv_sec - t0.tv_sec) * 1000 + (t1.tv_usec - t0.tv_usec) / 1000;
+	printf("%-40s asked for %3d prefixes (expected %3d), %d wrong ratings, %d ms\n", "4 concurrent queries, 200 ms each",
+		asked_prefixes, ASYNC_QUERIES * ASYNC_PEERS, async_errors, ms);
+	return async_done != ASYNC_QUERIES || async_errors != 0 || asked_prefixes != ASYNC_QUERIES * ASYNC_PEERS || ms >= 400;
+}
+
+/*
+ * 	Queries still queued when the client stops are called back too
+ */
+#define STOP_QUERIES 8
+
+static int stop_done, stop_cancelled;
+
+static void stop_done_cb(ALTO_GUIDANCE_T *list, int num, int result, void *arg){
+	stop_done++;
+	if(result < 0) stop_cancelled++;
+}
+
+static int check_stop(struct in_addr rc_host){
+	static ALTO_GUIDANCE_T lists[STOP_QUERIES][ASYNC_PEERS];
+	int i;
+
+	server_delay_ms = 200;
+	for(i = 0; i < STOP_QUERIES; i++){
+		fill_peers(lists[i], 30000 + i * ASYNC_PEERS, ASYNC_PEERS);
+		ALTO_query_submit(lists[i], ASYNC_PEERS, rc_host, REL_PREF, 7, stop_done_cb, NULL);
+	}
+	stop_ALTO_client();
+	server_delay_ms = 0;
+
+	printf("%-40s %d of %d called back, %d cancelled\n", "stopped with queries in flight", stop_done, STOP_QUERIES, stop_cancelled);
+	return stop_done != STOP_QUERIES || stop_cancelled == 0;
+}
+
+int main(){
+	char url[64];
+	struct in_addr rc_host, other_host;
+	int port, failed = 0;
+
+	port = start_server();
+	if(port < 0){
+		perror("stand-in server");
+		return 1;
+	}
+	sprintf(url, "http://127.0.0.1:%d/alto", port);
+	rc_host.s_addr = inet_addr("195.37.70.39");
+	other_host.s_addr = inet_addr("195.37.70.40");
+
+	start_ALTO_client();
+	set_ALTO_server(url);
+	main_thread = pthread_self();
+	base = event_base_new();
+	ALTO_query_attach(base);
+
+	failed |= check("first round, 100 peers", 0, 100, rc_host, 100);
+	failed |= check("same peers again", 0, 100, rc_host, 0);
+	failed |= check("90 known and 10 new peers", 10, 100, rc_host, 10);
+	failed |= check("other rc_host", 10, 100, other_host, 100);
+	failed |= check("5000 new peers, reply over 512 KB", 1000, 5000, other_host, 5000);
+
+	failed |= check_async(other_host);
+
+	set_ALTO_cache_ttl(0);
+	failed |= check("cache disabled", 10, 100, other_host, 100);
+
+	set_ALTO_cache_ttl(1);
+	rate_peers(10, 100, other_host);
+	sleep(1);
+	failed |= check("ratings expired", 10, 100, other_host, 100);
+
+	failed |= check_stop(other_host);
+	event_base_free(base);
+	printf("%d requests to the server, %s\n", requests, failed ? "FAILED" : "ok");
+	return failed;
+}
@@ -0,0 +1,246 @@
+/*
+ * Timers for NAPA: all periodic and one-shot timers share a timer wheel
+ * driven by a single libevent timer.
+ *
+ * The wheel has TIMER_SLOTS slots of TIMER_TICK_US each. A timer is filed in
+ * the slot of the tick its (absolute, monotonic) deadline falls in, further
+ * ticks than the wheel covers simply wait for the wheel to come around. The
+ * libevent timer is armed for the next tick that has a timer filed, so an idle
+ * wheel does not wake up at all, and any number of timers due in the same
+ * tick cost one wakeup.
+ * Periodic timers compute their next deadline from the previous deadline,
+ * not from the time they ran, so they do not drift.
+ */
+
+#include	<stdio.h>
+#include	<stdlib.h>
+#include	<stdint.h>
+#include	<string.h>
+#include	<math.h>
+#include	<time.h>
+
+#include	<event2/event.h>
+
+#include	"napa.h"
+#include	"napa_log.h"
+
+#define TIMER_TICK_US	1000
+#define TIMER_SLOTS	1024		/* power of 2 */
+#define TIMER_WORDS	(TIMER_SLOTS / 64)
+
+enum timer_state { TIMER_IDLE, TIMER_QUEUED, TIMER_FIRING };
+
+struct napa_timer {
+	void(*cb)(HANDLE handle, void *arg);
+	void *cbarg;
+	/** absolute deadline, microseconds of the monotonic clock */
+	uint64_t deadline;
+	/** microseconds, 0 for one-shot timers */
+	uint64_t period;
+	/** tick the timer is filed in */
+	uint64_t tick;
+	/** TIMER_FIRING while its callback runs, unless the callback re-arms or disarms it */
+	enum timer_state state;
+	/** its callback is running */
+	int firing;
+	/** freed when its callback returns */
+	int dead;
+	/** slot list (or the list of timers being fired) */
+	struct napa_timer *next;
+	struct napa_timer **pprev;
+};
+
+static struct {
+	struct napa_timer *slots[TIMER_SLOTS];
+	/** a bit for every non-empty slot */
+	uint64_t used[TIMER_WORDS];
+	/** ticks up to this one have been processed */
+	uint64_t current;
+	/** tick the libevent timer is armed for, 0 if not armed */
+	uint64_t armed;
+	struct event *ev;
+} wheel;
+
+static uint64_t now_us() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void link_timer(struct napa_timer **head, struct napa_timer *t) {
+	t->next = *head;
+	if (t->next) t->next->pprev = &t->next;
+	t->pprev = head;
+	*head = t;
+}
+
+static void unlink_timer(struct napa_timer *t) {
+	*t->pprev = t->next;
+	if (t->next) t->next->pprev = t->pprev;
+	t->next = NULL;
+	t->pprev = NULL;
+}
+
+static void wheel_process(evutil_socket_t fd, short what, void *arg);
+
+/** Arm the libevent timer for the first tick after the current one with timers filed */
+static void wheel_arm() {
+	int i, s = (wheel.current + 1) & (TIMER_SLOTS - 1);
+	int first = -1;
+
+	/* look for a used slot from s onwards, wrapping around */
+	for (i = 0; i <= TIMER_WORDS && first < 0; i++) {
+		int w = ((s >> 6) + i) % TIMER_WORDS;
+		uint64_t bits = wheel.used[w];
+		if (i == 0) bits &= ~0ULL << (s & 63);
+		else if (i == TIMER_WORDS) bits &= (s & 63) ? ~(~0ULL << (s & 63)) : 0;
+		if (bits) first = w * 64 + __builtin_ctzll(bits);
+	}
+	if (first < 0) {
+		if (wheel.armed) evtimer_del(wheel.ev);
+		wheel.armed = 0;
+		return;
+	}
+
+	uint64_t tick = wheel.current + 1 + ((first - s) & (TIMER_SLOTS - 1));
+	if (wheel.armed == tick) return;
+
+	uint64_t now = now_us(), at = tick * TIMER_TICK_US;
+	uint64_t delay = at > now ? at - now : 0;
+	struct timeval tv = { delay / 1000000, delay % 1000000 };
+	evtimer_add(wheel.ev, &tv);
+	wheel.armed = tick;
+}
+
+static void wheel_insert(struct napa_timer *t) {
+	if (!wheel.ev) {
+		wheel.ev = evtimer_new(eventbase, wheel_process, NULL);
+		if (!wheel.ev) fatal("Unable to create the timer wheel event");
+		wheel.current = now_us() / TIMER_TICK_US;
+	}
+
+	t->tick = (t->deadline + TIMER_TICK_US - 1) / TIMER_TICK_US;
+	if (t->tick <= wheel.current) t->tick = wheel.current + 1;
+
+	int s = t->tick & (TIMER_SLOTS - 1);
+	link_timer(&wheel.slots[s], t);
+	wheel.used[s >> 6] |= 1ULL << (s & 63);
+	t->state = TIMER_QUEUED;
+
+	if (!wheel.armed || t->tick < wheel.armed) wheel_arm();
+}
+
+static void wheel_remove(struct napa_timer *t) {
+	int s = t->tick & (TIMER_SLOTS - 1);
+	unlink_timer(t);
+	if (!wheel.slots[s]) wheel.used[s >> 6] &= ~(1ULL << (s & 63));
+	t->state = TIMER_IDLE;
+}
+
+/** Move the timers of slot s that are due by tick onto the due list */
+static void collect_slot(int s, uint64_t tick, struct napa_timer **due) {
+	struct napa_timer *t = wheel.slots[s];
+	while (t) {
+		struct napa_timer *next = t->next;
+		if (t->tick <= tick) {
+			unlink_timer(t);
+			link_timer(due, t);
+		}
+		t = next;
+	}
+	if (!wheel.slots[s]) wheel.used[s >> 6] &= ~(1ULL << (s & 63));
+}
+
+static void wheel_process(evutil_socket_t fd, short what, void *arg) {
+	uint64_t now = now_us(), tick = now / TIMER_TICK_US;
+	struct napa_timer *due = NULL;
+	uint64_t t;
+
+	/* libevent's clock may be coarser than ours, take its word that the armed tick has come */
+	if (tick < wheel.armed) tick = wheel.armed;
+	wheel.armed = 0;
+	if (tick <= wheel.current) {
+		wheel_arm();
+		return;
+	}
+
+	/* every slot needs to be looked at only once, however long ago we ran */
+	uint64_t from = wheel.current + 1;
+	if (tick - from >= TIMER_SLOTS) from = tick - TIMER_SLOTS + 1;
+	for (t = from; t <= tick; t++) {
+		int s = t & (TIMER_SLOTS - 1);
+		if (wheel.used[s >> 6] & (1ULL << (s & 63))) collect_slot(s, tick, &due);
+	}
+	wheel.current = tick;
+
+	/* the callbacks may add, re-arm or free any timer, including the due ones */
+	while (due) {
+		struct napa_timer *timer = due;
+		unlink_timer(timer);
+		timer->state = TIMER_FIRING;
+		timer->firing = 1;
+		if (timer->cb) timer->cb((HANDLE)timer, timer->cbarg);
+		timer->firing = 0;
+
+		if (timer->dead) free(timer);
+		else if (timer->state != TIMER_FIRING) continue;	/* re-armed or disarmed by its callback */
+		else if (timer->period) {
+			timer->deadline += timer->period;
+			/* skip the periods missed while the loop was busy, do not burst */
+			if (timer->deadline <= now) timer->deadline += ((now - timer->deadline) / timer->period + 1) * timer->period;
+			wheel_insert(timer);
+		}
+		else timer->state = TIMER_IDLE;
+	}
+	wheel_arm();
+}
+
+HANDLE napaTimerNew(void(*cb)(HANDLE handle, void *arg), void *cbarg) {
+	struct napa_timer *t = calloc(1, sizeof(struct napa_timer));
+	if (!t) return NULL;
+	t->cb = cb;
+	t->cbarg = cbarg;
+	t->state = TIMER_IDLE;
+	return t;
+}
+
+void napaTimerAdd(HANDLE h, const struct timeval *delay) {
+	struct napa_timer *t = h;
+	if (t->state == TIMER_QUEUED) wheel_remove(t);
+	t->period = 0;
+	t->deadline = now_us();
+	if (delay) t->deadline += (uint64_t)delay->tv_sec * 1000000 + delay->tv_usec;
+	wheel_insert(t);
+}
+
+void napaTimerDel(HANDLE h) {
+	struct napa_timer *t = h;
+	if (t->state == TIMER_QUEUED) wheel_remove(t);
+	t->state = TIMER_IDLE;
+}
+
+void napaTimerFree(HANDLE h) {
+	struct napa_timer *t = h;
+	if (!t) return;
+	if (t->state == TIMER_QUEUED) wheel_remove(t);
+	/* freeing itself from its own callback */
+	if (t->firing) t->dead = 1;
+	else free(t);
+}
+
+HANDLE napaSchedulePeriodic(const struct timeval *start, double frequency, void(*cb)(HANDLE handle, void *arg), void *cbarg) {
+	if (frequency <= 0.0) return NULL;
+	struct napa_timer *t = napaTimerNew(cb, cbarg);
+	if (!t) return NULL;
+
+	t->deadline = now_us();
+	if (start) t->deadline += (uint64_t)start->tv_sec * 1000000 + start->tv_usec;
+	t->period = llround(1000000.0 / frequency);
+	if (t->period == 0) t->period = 1;
+	wheel_insert(t);
+	return t;
+}
+
+void napaStopPeriodic(HANDLE h) {
+	napaTimerFree(h);
+}
@@ -52,6 +52,7 @@ void napaInitLog(int log_level, const char *filename, const char *mode) {
 }
 
 void napaCloseLog() {
+	napaTraceClose();
 	if (!initialized) return;
 
 	DCLogClose(dclog);
@@ -64,7 +65,8 @@ void napaWriteLog(const unsigned char lev, const char *fmt, ... ) {
 	va_list str_args;
 
 	if (!initialized) return;
-
+	/* do not format what DCLogWrite would throw away */
+	if (lev > dclog->lev) return;
 
   	va_start( str_args, fmt );
 #if !_WIN32 && !MAC_OS
@@ -0,0 +1,218 @@
+/*
+ * napa_tracedump: print a NAPA binary trace file (see napa_trace.h) as text,
+ * oldest message first, in the format of the text log.
+ *
+ * Usage: napa_tracedump <tracefile>
+ */
+
+#include	<stdio.h>
+#include	<stdarg.h>
+#include	<stdlib.h>
+#include	<stdint.h>
+#include	<stddef.h>
+#include	<string.h>
+#include	<time.h>
+#include	<fcntl.h>
+#include	<unistd.h>
+#include	<sys/mman.h>
+#include	<sys/stat.h>
+#include	"trace.h"
+
+static const char *levels[] = { "ALARM", "ERROR", "WARNING", "INFO", "DEBUG", "PROFILE" };
+
+struct site {
+	const char *file;
+	const char *format;
+	uint32_t line;
+	uint32_t level;
+};
+
+static struct site *sites;
+static uint32_t num_sites;
+
+static int compare_blocks(const void *a, const void *b) {
+	uint64_t x = (*(struct trace_block **)a)->seq, y = (*(struct trace_block **)b)->seq;
+	return x < y ? -1 : x > y;
+}
+
+/** Append to the message buffer, as much as fits */
+static void append(char *msg, size_t *len, size_t size, const char *fmt, ...) {
+	va_list ap;
+	if (*len >= size - 1) return;
+	va_start(ap, fmt);
+	int n = vsnprintf(msg + *len, size - *len, fmt, ap);
+	va_end(ap);
+	if (n > 0) *len += (size_t)n < size - *len ? (size_t)n : size - *len - 1;
+}
+
+/** Format a record the way printf would have; 0 if the record does not match its format */
+static int format_record(const struct site *s, const uint64_t *w, const uint64_t *end, char *msg, size_t size) {
+	const char *p = s->format;
+	size_t len = 0;
+
+	msg[0] = 0;
+	while (*p) {
+		const char *pct = strchr(p, '%');
+		if (!pct) {
+			append(msg, &len, size, "%s", p);
+			break;
+		}
+		append(msg, &len, size, "%.*s", (int)(pct - p), p);
+
+		unsigned char kinds[3];
+		int i, n, star[2], stars = 0;
+		const char *next = trace_scan_conversion(pct + 1, kinds, &n);
+		if (!next) return 0;
+
+		char spec[64];
+		if ((size_t)(next - pct) >= sizeof(spec)) return 0;
+		memcpy(spec, pct, next - pct);
+		spec[next - pct] = 0;
+		if (n == 0) {
+			append(msg, &len, size, "%s", strcmp(spec, "%%") ? spec : "%");
+			p = next;
+			continue;
+		}
+
+		for (i = 0; i != n; i++) {
+			if (w >= end) return 0;
+			if (i < n - 1) {
+				star[stars++] = (int)*w++;
+				continue;
+			}
+#define PRINT(v) \
+	if (stars == 2) append(msg, &len, size, spec, star[0], star[1], v); \
+	else if (stars == 1) append(msg, &len, size, spec, star[0], v); \
+	else append(msg, &len, size, spec, v)
+			switch (kinds[i]) {
+				case TRACE_INT: PRINT((int)*w); break;
+				case TRACE_LONG: PRINT((long)*w); break;
+				case TRACE_LLONG: PRINT((long long)*w); break;
+				case TRACE_SIZE: PRINT((size_t)*w); break;
+				case TRACE_INTMAX: PRINT((intmax_t)*w); break;
+				case TRACE_PTRDIFF: PRINT((ptrdiff_t)*w); break;
+				case TRACE_DOUBLE: {
+					double d;
+					memcpy(&d, w, sizeof(d));
+					PRINT(d);
+					break;
+				}
+				case TRACE_LDOUBLE: {
+					double d;
+					memcpy(&d, w, sizeof(d));
+					PRINT((long double)d);
+					break;
+				}
+				case TRACE_PTR: PRINT((void *)(uintptr_t)*w); break;
+				case TRACE_STRING: {
+					uint64_t l = *w;
+					char str[TRACE_MAX_STRING + 1];
+					if (l > TRACE_MAX_STRING || (const char *)(w + 1) + l > (const char *)end) return 0;
+					memcpy(str, w + 1, l);
+					str[l] = 0;
+					PRINT(str);
+					w += TRACE_PAD(l) / sizeof(uint64_t);
+					break;
+				}
+			}
+#undef PRINT
+			w++;
+		}
+		p = next;
+	}
+	return w == end;
+}
+
+static void dump_record(const struct trace_record *r) {
+	char msg[8192];
+
+	if (r->id == 0 || r->id > num_sites || !sites[r->id - 1].format) {
+		printf("(record of unknown message %u)\n", r->id);
+		return;
+	}
+	const struct site *s = &sites[r->id - 1];
+	if (!format_record(s, (const uint64_t *)(r + 1), (const uint64_t *)((const char *)r + r->size), msg, sizeof(msg))) {
+		printf("(corrupt record of message \"%s\" [%s,%u])\n", s->format, s->file, s->line);
+		return;
+	}
+	size_t len = strlen(msg);
+	while (len && msg[len - 1] == '\n') msg[--len] = 0;
+
+	time_t sec = r->time / 1000000000;
+	struct tm *tm = localtime(&sec);
+	printf("%02d:%02d:%02d.%06u: %s %s [%s,%u]\n", tm->tm_hour, tm->tm_min, tm->tm_sec,
+		(unsigned)(r->time % 1000000000 / 1000), s->level < 6 ? levels[s->level] : "?", msg, s->file, s->line);
+}
+
+int main(int argc, char *argv[]) {
+	struct stat st;
+	uint32_t i;
+
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s <tracefile>\n", argv[0]);
+		return 1;
+	}
+	int fd = open(argv[1], O_RDONLY);
+	if (fd < 0 || fstat(fd, &st)) {
+		perror(argv[1]);
+		return 1;
+	}
+	const char *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		perror(argv[1]);
+		return 1;
+	}
+
+	const struct trace_header *h = (const struct trace_header *)base;
+	if ((size_t)st.st_size < sizeof(*h) || memcmp(h->magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) || h->version != TRACE_VERSION ||
+		h->dict_offset + h->dict_size > (uint64_t)st.st_size || h->dict_used > h->dict_size ||
+		h->ring_offset + (uint64_t)h->blocks * h->block_size > (uint64_t)st.st_size) {
+		fprintf(stderr, "%s is not a NAPA trace file\n", argv[1]);
+		return 1;
+	}
+
+	/* the dictionary */
+	const char *d = base + h->dict_offset, *dend = d + h->dict_used;
+	while (d + sizeof(struct trace_site_entry) <= dend) {
+		const struct trace_site_entry *e = (const struct trace_site_entry *)d;
+		if (e->size < sizeof(*e) || d + e->size > dend) break;
+		if (e->id > num_sites) {
+			sites = realloc(sites, e->id * sizeof(struct site));
+			if (!sites) return 1;
+			memset(sites + num_sites, 0, (e->id - num_sites) * sizeof(struct site));
+			num_sites = e->id;
+		}
+		struct site *s = &sites[e->id - 1];
+		s->file = (const char *)(e + 1);
+		s->format = s->file + strnlen(s->file, e->size - sizeof(*e)) + 1;
+		s->line = e->line;
+		s->level = e->level;
+		if (s->format >= d + e->size || memchr(s->format, 0, d + e->size - s->format) == NULL) s->format = NULL;
+		d += e->size;
+	}
+
+	/* the blocks in the order they were written */
+	const struct trace_block **blocks = malloc(h->blocks * sizeof(*blocks));
+	uint32_t n = 0;
+	if (!blocks) return 1;
+	for (i = 0; i != h->blocks; i++) {
+		const struct trace_block *b = (const struct trace_block *)(base + h->ring_offset + (uint64_t)i * h->block_size);
+		if (b->seq) blocks[n++] = b;
+	}
+	qsort(blocks, n, sizeof(*blocks), compare_blocks);
+
+	for (i = 0; i != n; i++) {
+		const char *p = (const char *)blocks[i] + sizeof(struct trace_block);
+		const char *end = (const char *)blocks[i] + (blocks[i]->used <= h->block_size ? blocks[i]->used : h->block_size);
+		while (p + sizeof(struct trace_record) <= end) {
+			const struct trace_record *r = (const struct trace_record *)p;
+			if (r->size < sizeof(*r) || p + r->size > end) break;
+			dump_record(r);
+			p += r->size;
+		}
+	}
+	free(blocks);
+	free(sites);
+	return 0;
+}
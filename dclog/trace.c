@@ -0,0 +1,285 @@
+/*
+ * This file implements the binary trace mode of the NAPA logging facility.
+ *
+ * A traced call site is registered in the dictionary of the trace file the
+ * first time it traces, its format string parsed once to know the kinds of its
+ * arguments. From then on a trace is a timestamp, the site id and the raw
+ * arguments copied into the current block of the ring; formatting is left to
+ * napa_tracedump.
+ * Like the rest of the NAPA log, it is not thread-safe.
+ */
+
+#include	<stdio.h>
+#include	<stdlib.h>
+#include	<stdarg.h>
+#include	<stdint.h>
+#include	<stddef.h>
+#include	<string.h>
+#include	<time.h>
+#include	<napa_trace.h>
+#include	"trace.h"
+
+#ifndef _WIN32
+#include	<fcntl.h>
+#include	<unistd.h>
+#include	<sys/mman.h>
+#endif
+
+int napa_trace_level = -1;
+
+static struct {
+	char *base;
+	size_t length;
+	struct trace_header *header;
+	struct trace_block *block;
+	uint64_t seq;
+	uint32_t next_id;
+	/** changes with every trace file, so that sites register again */
+	unsigned generation;
+} trace;
+
+const char *trace_scan_conversion(const char *fmt, unsigned char *kinds, int *n) {
+	enum { NONE, HH, H, L, LL, BIGL, J, Z, T } len = NONE;
+
+	*n = 0;
+	if (*fmt == '%' || *fmt == 'm') return fmt + 1;
+
+	while (*fmt && strchr("-+ #0'", *fmt)) fmt++;
+	if (*fmt == '*') {
+		kinds[(*n)++] = TRACE_INT;
+		fmt++;
+	}
+	else while (*fmt >= '0' && *fmt <= '9') fmt++;
+	if (*fmt == '.') {
+		fmt++;
+		if (*fmt == '*') {
+			kinds[(*n)++] = TRACE_INT;
+			fmt++;
+		}
+		else while (*fmt >= '0' && *fmt <= '9') fmt++;
+	}
+
+	switch (*fmt) {
+		case 'h': len = H; if (*++fmt == 'h') { len = HH; fmt++; } break;
+		case 'l': len = L; if (*++fmt == 'l') { len = LL; fmt++; } break;
+		case 'q': len = LL; fmt++; break;
+		case 'L': len = BIGL; fmt++; break;
+		case 'j': len = J; fmt++; break;
+		case 'z': len = Z; fmt++; break;
+		case 't': len = T; fmt++; break;
+	}
+
+	switch (*fmt) {
+		case 'd': case 'i': case 'u': case 'o': case 'x': case 'X': case 'c':
+			kinds[(*n)++] = len == L ? TRACE_LONG : len == LL ? TRACE_LLONG : len == J ? TRACE_INTMAX :
+				len == Z ? TRACE_SIZE : len == T ? TRACE_PTRDIFF : TRACE_INT;
+			break;
+		case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+			kinds[(*n)++] = len == BIGL ? TRACE_LDOUBLE : TRACE_DOUBLE;
+			break;
+		case 's':
+			if (len != NONE) return NULL;
+			kinds[(*n)++] = TRACE_STRING;
+			break;
+		case 'p':
+			kinds[(*n)++] = TRACE_PTR;
+			break;
+		default:
+			return NULL;
+	}
+	return fmt + 1;
+}
+
+/** Find out the kinds of the arguments of a site */
+static int parse_site(struct napa_trace_site *site) {
+	const char *p = site->format;
+
+	site->nargs = 0;
+	site->has_strings = 0;
+	while ((p = strchr(p, '%')) != NULL) {
+		unsigned char kinds[3];
+		int i, n;
+
+		if ((p = trace_scan_conversion(p + 1, kinds, &n)) == NULL) return -1;
+		if (site->nargs + n > NAPA_TRACE_MAX_ARGS) return -1;
+		for (i = 0; i != n; i++) {
+			if (kinds[i] == TRACE_STRING) site->has_strings = 1;
+			site->kinds[site->nargs++] = kinds[i];
+		}
+	}
+	return 0;
+}
+
+/** Give a site an id in the current trace file and add it to the dictionary */
+static void register_site(struct napa_trace_site *site) {
+	struct trace_header *h = trace.header;
+	size_t file_len = strlen(site->file) + 1, format_len = strlen(site->format) + 1;
+	size_t size = TRACE_PAD(sizeof(struct trace_site_entry) + file_len + format_len);
+
+	site->generation = trace.generation;
+	site->id = -1;
+	if (parse_site(site)) {
+		fprintf(stderr, "Unable to trace the message at %s:%d (format \"%s\")\n", site->file, site->line, site->format);
+		return;
+	}
+	if (h->dict_used + size > h->dict_size) {
+		fprintf(stderr, "Trace dictionary full, unable to trace the message at %s:%d\n", site->file, site->line);
+		return;
+	}
+
+	struct trace_site_entry *e = (struct trace_site_entry *)(trace.base + h->dict_offset + h->dict_used);
+	e->size = size;
+	e->id = trace.next_id++;
+	e->line = site->line;
+	e->level = site->level;
+	memcpy((char *)(e + 1), site->file, file_len);
+	memcpy((char *)(e + 1) + file_len, site->format, format_len);
+	h->dict_used += size;
+	site->id = e->id;
+}
+
+/** Start the oldest block over as the current one */
+static void next_block() {
+	struct trace_header *h = trace.header;
+	uint64_t i = trace.seq++ % h->blocks;
+
+	trace.block = (struct trace_block *)(trace.base + h->ring_offset + i * h->block_size);
+	trace.block->used = sizeof(struct trace_block);
+	trace.block->seq = trace.seq;
+}
+
+int napaTraceOpen(const char *filename, size_t size, int level) {
+#ifndef _WIN32
+	size_t blocks = size / TRACE_BLOCK_SIZE;
+	if (blocks < 2) blocks = 2;
+	size_t length = TRACE_HEADER_SIZE + TRACE_DICT_SIZE + blocks * TRACE_BLOCK_SIZE;
+
+	napaTraceClose();
+	int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "Unable to open trace file %s\n", filename);
+		return -1;
+	}
+	if (ftruncate(fd, length)) {
+		fprintf(stderr, "Unable to size trace file %s\n", filename);
+		close(fd);
+		return -1;
+	}
+	char *base = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		fprintf(stderr, "Unable to map trace file %s\n", filename);
+		return -1;
+	}
+
+	trace.base = base;
+	trace.length = length;
+	trace.header = (struct trace_header *)base;
+	trace.header->version = TRACE_VERSION;
+	trace.header->block_size = TRACE_BLOCK_SIZE;
+	trace.header->blocks = blocks;
+	trace.header->dict_size = TRACE_DICT_SIZE;
+	trace.header->dict_used = 0;
+	trace.header->dict_offset = TRACE_HEADER_SIZE;
+	trace.header->ring_offset = TRACE_HEADER_SIZE + TRACE_DICT_SIZE;
+	/* last, a reader seeing the magic sees a valid header */
+	memcpy(trace.header->magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+	trace.seq = 0;
+	trace.next_id = 1;
+	trace.generation++;
+	next_block();
+
+	napa_trace_level = level;
+	return 0;
+#else
+	return -1;
+#endif
+}
+
+void napaTraceClose() {
+	napa_trace_level = -1;
+#ifndef _WIN32
+	if (trace.base) munmap(trace.base, trace.length);
+#endif
+	trace.base = NULL;
+}
+
+void napaTraceWrite(struct napa_trace_site *site, ...) {
+	va_list ap;
+	struct timespec now;
+	int i;
+
+	if (!trace.base) return;
+	if (site->generation != trace.generation) register_site(site);
+	if (site->id < 0) return;
+
+	size_t size = sizeof(struct trace_record) + site->nargs * sizeof(uint64_t);
+	if (site->has_strings) {
+		va_start(ap, site);
+		for (i = 0; i != site->nargs; i++) {
+			switch (site->kinds[i]) {
+				case TRACE_INT: va_arg(ap, int); break;
+				case TRACE_LONG: va_arg(ap, long); break;
+				case TRACE_LLONG: va_arg(ap, long long); break;
+				case TRACE_SIZE: va_arg(ap, size_t); break;
+				case TRACE_INTMAX: va_arg(ap, intmax_t); break;
+				case TRACE_PTRDIFF: va_arg(ap, ptrdiff_t); break;
+				case TRACE_DOUBLE: va_arg(ap, double); break;
+				case TRACE_LDOUBLE: va_arg(ap, long double); break;
+				case TRACE_PTR: va_arg(ap, void *); break;
+				case TRACE_STRING: {
+					const char *s = va_arg(ap, const char *);
+					size_t len = s ? strnlen(s, TRACE_MAX_STRING) : 6;
+					size += TRACE_PAD(len);
+					break;
+				}
+			}
+		}
+		va_end(ap);
+	}
+
+	if (trace.block->used + size > trace.header->block_size) next_block();
+	struct trace_record *r = (struct trace_record *)((char *)trace.block + trace.block->used);
+	uint64_t *w = (uint64_t *)(r + 1);
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	r->id = site->id;
+	r->size = size;
+	r->time = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+
+	va_start(ap, site);
+	for (i = 0; i != site->nargs; i++) {
+		switch (site->kinds[i]) {
+			case TRACE_INT: *w++ = va_arg(ap, int); break;
+			case TRACE_LONG: *w++ = va_arg(ap, long); break;
+			case TRACE_LLONG: *w++ = va_arg(ap, long long); break;
+			case TRACE_SIZE: *w++ = va_arg(ap, size_t); break;
+			case TRACE_INTMAX: *w++ = va_arg(ap, intmax_t); break;
+			case TRACE_PTRDIFF: *w++ = va_arg(ap, ptrdiff_t); break;
+			case TRACE_DOUBLE: {
+				double d = va_arg(ap, double);
+				memcpy(w++, &d, sizeof(d));
+				break;
+			}
+			case TRACE_LDOUBLE: {
+				double d = va_arg(ap, long double);
+				memcpy(w++, &d, sizeof(d));
+				break;
+			}
+			case TRACE_PTR: *w++ = (uintptr_t)va_arg(ap, void *); break;
+			case TRACE_STRING: {
+				const char *s = va_arg(ap, const char *);
+				if (!s) s = "(null)";
+				size_t len = strnlen(s, TRACE_MAX_STRING);
+				*w++ = len;
+				memcpy(w, s, len);
+				w += TRACE_PAD(len) / sizeof(uint64_t);
+				break;
+			}
+		}
+	}
+	va_end(ap);
+
+	/* last, so that the record is complete when a reader sees it */
+	trace.block->used += size;
+}
@@ -0,0 +1,79 @@
+/*
+ * Layout of the NAPA binary trace files, shared by the writer (trace.c) and
+ * napa_tracedump.
+ *
+ * A trace file is a header page, a dictionary of the traced call sites and a
+ * ring of blocks. Records never span blocks; a block is reused whole, so the
+ * records of the blocks in sequence order are the trace, oldest first.
+ * All numbers are in the byte order of the machine that wrote the trace.
+ */
+
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include	<stdint.h>
+
+#define TRACE_MAGIC		"NAPATRC"
+#define TRACE_VERSION		1
+#define TRACE_HEADER_SIZE	4096
+#define TRACE_DICT_SIZE		(256 * 1024)
+#define TRACE_BLOCK_SIZE	(64 * 1024)
+/** longer string arguments are truncated */
+#define TRACE_MAX_STRING	256
+
+struct trace_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t block_size;
+	uint32_t blocks;
+	uint32_t dict_size;
+	/** bytes of the dictionary in use, updated after each entry is complete */
+	uint32_t dict_used;
+	uint32_t reserved;
+	uint64_t dict_offset;
+	uint64_t ring_offset;
+};
+
+/** Dictionary entry, followed by the file name and the format, both 0 terminated, padded to 8 bytes */
+struct trace_site_entry {
+	uint32_t size;
+	uint32_t id;
+	uint32_t line;
+	uint32_t level;
+};
+
+struct trace_block {
+	/** 0 for a block never written */
+	uint64_t seq;
+	/** bytes of the block in use, updated after each record is complete */
+	uint32_t used;
+	uint32_t reserved;
+};
+
+/** Record header, followed by a 64 bit word per argument; a string is its length word and its bytes padded to 8 */
+struct trace_record {
+	uint32_t id;
+	uint32_t size;
+	/** CLOCK_REALTIME, nanoseconds */
+	uint64_t time;
+};
+
+/** How an argument is passed and stored */
+enum trace_kind {
+	TRACE_INT = 1, TRACE_LONG, TRACE_LLONG, TRACE_SIZE, TRACE_INTMAX, TRACE_PTRDIFF,
+	TRACE_DOUBLE, TRACE_LDOUBLE, TRACE_PTR, TRACE_STRING
+};
+
+#define TRACE_PAD(n)		(((n) + 7) & ~(size_t)7)
+
+/**
+  Scan a printf conversion.
+
+  @param[in] fmt the character after the '%'
+  @param[out] kinds the kind of each argument the conversion takes (at most 3)
+  @param[out] n number of arguments it takes
+  @return the character after the conversion, NULL if it is not understood
+*/
+const char *trace_scan_conversion(const char *fmt, unsigned char *kinds, int *n);
+
+#endif
@@ -434,6 +434,42 @@ result monRetrieveResult(MonHandler mh, enum stat_types st);
 
 result monRetrieveResultById(SocketId src, MsgType mt, MeasurementCapabilities flags, MeasurementId mid, enum stat_types st);
 
+/** A column of the table filled by monRetrieveResults(): a statistic of a measure */
+typedef struct {
+	/** measurement type id */
+	MeasurementId mid;
+	/** measurement flags used while creating the measure (as in monRetrieveResultById()) */
+	MeasurementCapabilities flags;
+	/** statistical type to be retrieved */
+	enum stat_types st;
+} MonResultColumn;
+
+/** A row of the table filled by monRetrieveResults() */
+typedef struct {
+	/** the other peer involved, valid while measures towards it are active */
+	SocketId peer;
+	/** the message type */
+	MsgType mt;
+} MonResultRow;
+
+/**
+  Retrieve results in bulk
+
+   Used to retrieve the same results from all the peers in one call: fills a table with a row
+   for each peer and message type having one of the measures of the columns active, in one
+   pass over them.
+
+   @param[in] columns the statistics of the measures to be retrieved
+   @param[in] n_columns the number of columns
+   @param[in] since only the rows with a sample newer than this epoch are filled, 0 for all of them
+   @param[out] rows the peer and message type of each row
+   @param[out] values the table: values[i * n_columns + j] is column j of row i, NAN if the measure is not active for the row
+   @param[in] max_rows the number of rows the table can hold
+   @param[out] epoch the current epoch, to be used as since in the next call (may be NULL)
+   @return the number of rows, negative value on failure (-EINVAL for a column with an unknown statistical type). If more than max_rows, the rows after max_rows were not filled and the call can be repeated with the same since and a larger table
+*/
+int monRetrieveResults(const MonResultColumn *columns, int n_columns, uint32_t since, MonResultRow *rows, result *values, int max_rows, uint32_t *epoch);
+
 /**
   Save arbitrary samples
 
@@ -455,6 +491,23 @@ int monNewSample(MonHandler mh, result r);
 */
 int monSetPeerName(const char *name);
 
+/**
+  Start recording samples
+
+   Every new sample of the measures with the P_RECORD parameter set is appended to memory mapped
+   segment files prefix.000000, prefix.000001, ... holding records samples each: the time, the
+   peer, the measure and the value. mon_recorddump reads them.
+
+   @param[in] prefix the path of the segment files, existing ones are not overwritten
+   @param[in] records the number of records of a segment
+   @param[in] keep the number of segments to keep, the oldest is removed when one more is created; 0 to keep them all
+   @return 0 on success, negative value on failure
+*/
+int monRecordOpen(const char *prefix, int records, int keep);
+
+/** Stop recording samples */
+void monRecordClose();
+
 /**
    Deactivate measure
 
@@ -101,6 +101,8 @@ void napaYield();
 
   Use this function for scheduling periodic activity. 
   The callback function supports one extra argument besides its own handle.
+  Invocations are scheduled at start + k/frequency, so they do not drift; invocations missed while
+  the event loop was busy are skipped.
 
   @param[in] start time of first exection, in timeval units from now. NULL (or timeval {0,0}) means "now" or "asap". 
   @param[in] frequency invocation frequency .
@@ -119,6 +121,41 @@ HANDLE napaSchedulePeriodic(const struct timeval *start, double frequency, void(
 */
 void napaStopPeriodic(HANDLE h);
 
+/**
+  Create a one-shot timer. It is not armed until napaTimerAdd is called.
+
+  Timers and periodic functions share one timer wheel with millisecond resolution, driven by
+  a single libevent timer.
+
+  @param[in] cb callback function to be called when the timer expires.
+  @param[in] cbarg argument for the callback function.
+  @return handle to the timer or NULL on error.
+  @see napaTimerAdd napaTimerFree
+*/
+HANDLE napaTimerNew(void(*cb)(HANDLE handle, void *arg), void *cbarg);
+
+/**
+  Arm (or re-arm) a timer to expire once after the given delay.
+
+  @param h handle of the timer.
+  @param[in] delay time from now, NULL means "asap".
+*/
+void napaTimerAdd(HANDLE h, const struct timeval *delay);
+
+/**
+  Disarm a timer, in constant time. The timer may be armed again.
+
+  @param h handle of the timer.
+*/
+void napaTimerDel(HANDLE h);
+
+/**
+  Disarm and free a timer. It may be called from the callback of the timer.
+
+  @param h handle of the timer.
+*/
+void napaTimerFree(HANDLE h);
+
 
 /** Convenience function to print a timeval */
 const char *timeval2str(const struct timeval *ts);
@@ -9,6 +9,7 @@
  */
 
 #include	<stdlib.h>
+#include	<napa_trace.h>
 
 /* These log levels should match dclog's internal definition */
 #define DCLOG_ALARM   0 //!< alarms
@@ -31,8 +32,11 @@
 /** log level for PROFILE messages */
 #define LOG_PROFILE     DCLOG_PROFILE
 
-/** general-purpose, module-aware log facility, to be used with a log priority */
-#define napa_log(priority, format, ... ) napaWriteLog(priority,  format " [%s,%d]\n",  ##__VA_ARGS__ , __FILE__, __LINE__ )
+/** general-purpose, module-aware log facility, to be used with a log priority; also traced when napaTraceOpen() was called */
+#define napa_log(priority, format, ... ) do { \
+	napa_trace(priority, format, ##__VA_ARGS__ ); \
+	napaWriteLog(priority,  format " [%s,%d]\n",  ##__VA_ARGS__ , __FILE__, __LINE__ ); \
+	} while (0)
 /** Convenience macro to log TODOs */
 #define todo(format, ...) napa_log(LOG_WARN, "[TODO] " format " file: %s, line %d",  ##__VA_ARGS__ )
 
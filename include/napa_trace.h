@@ -0,0 +1,76 @@
+#ifndef _NAPA_TRACE_H
+#define _NAPA_TRACE_H
+
+/** Binary trace log for NAPA
+
+ * @file napa_trace.h
+ * @brief Deferred-formatting trace of log messages into a memory-mapped ring file
+ *
+ * In trace mode a log call does not format its message: it writes the time, an id
+ * standing for its format string and call site, and its raw arguments into a ring
+ * file mapped in memory. The napa_tracedump tool turns the file back into text.
+ * This makes it affordable to keep packet-level tracing on.
+ *
+ * The napa_log() macros of napa_log.h and the DPRINT() macros of the messaging
+ * layer trace automatically once napaTraceOpen() is called, independently of the
+ * level of the text log.
+ */
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Maximum number of arguments of a traced message, messages with more are not traced */
+#define NAPA_TRACE_MAX_ARGS	24
+
+/** Static description of a traced call site, filled in by the first trace it makes */
+struct napa_trace_site {
+	const char *format;
+	const char *file;
+	int line;
+	int level;
+	/** id in the current trace file, -1 if the site cannot be traced */
+	int id;
+	/** trace file the id belongs to */
+	unsigned generation;
+	int nargs;
+	unsigned char kinds[NAPA_TRACE_MAX_ARGS];
+	int has_strings;
+};
+
+/** Messages on or above this level are traced, -1 if tracing is off */
+extern int napa_trace_level;
+
+/** Trace a message if its level is traced. Arguments are not evaluated otherwise. */
+#define napa_trace(prio, fmt, ... ) do { \
+	static struct napa_trace_site _napa_trace_site = { .format = fmt, .file = __FILE__, .line = __LINE__, .level = prio, \
+		.id = 0, .generation = 0, .nargs = 0, .kinds = { 0 }, .has_strings = 0 }; \
+	if ((prio) <= napa_trace_level) napaTraceWrite(&_napa_trace_site, ##__VA_ARGS__ ); \
+	} while (0)
+
+/**
+  Start tracing into a file.
+
+  The file is truncated and mapped in memory; once its ring is full, the oldest
+  messages are overwritten.
+
+  @param[in] filename trace file
+  @param[in] size size of the ring in bytes (at least 128 KB are used)
+  @param[in] level trace messages on or above this level
+  @return 0 on success, -1 on error
+*/
+int napaTraceOpen(const char *filename, size_t size, int level);
+
+/** Stop tracing and unmap the trace file. Called by napaCloseLog() too. */
+void napaTraceClose();
+
+/** Low-level interface to the trace, use napa_trace() or the napa_log.h macros instead */
+void napaTraceWrite(struct napa_trace_site *site, ...);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -122,7 +122,7 @@ typedef void (*cb_repGetPeers)(HANDLE rep, HANDLE id, void *cbarg, char **result
   @param rep handle of the repository client.
   @param id handle of the particular request (assigned by the repCountPeers call)
   @param cbarg arbitrary user-provided parameter for the callback
-  @param nPeers result
+  @param nPeers result, -1 on error
   @see repCountPeers 
 */
 typedef void (*cb_repCountPeers)(HANDLE rep, HANDLE id, void *cbarg, int nPeers);
@@ -132,12 +132,26 @@ typedef void (*cb_repCountPeers)(HANDLE rep, HANDLE id, void *cbarg, int nPeers)
   @param rep handle of the repository client.
   @param id handle of the particular request (assigned by the repGetMeasurements call)
   @param cbarg arbitrary user-provided parameter for the callback
-  @param result result array, to be freed by the callback.
+  @param result result array, to be freed by the callback. The strings of the records are in the same
+  allocation, so free(result) releases everything.
   @param nResults number of entries in result
   @see repGetMeasurements
 */
 typedef void (*cb_repGetMeasurements)(HANDLE rep, HANDLE id, void *cbarg, MeasurementRecord *result, int nResults);
 
+/** Callback for returning the results of a repGetMeasurementsBatched call, one batch at a time.
+
+  @param rep handle of the repository client.
+  @param id handle of the particular request (assigned by the repGetMeasurementsBatched call)
+  @param cbarg arbitrary user-provided parameter for the callback
+  @param batch records received since the previous call. The records and their strings belong to the
+  repository client and are only valid during the callback.
+  @param nResults number of entries in batch
+  @param done 0 if more batches follow, 1 for the last call of the request, -1 if the request failed
+  @see repGetMeasurementsBatched
+*/
+typedef void (*cb_repMeasurementBatch)(HANDLE rep, HANDLE id, void *cbarg, const MeasurementRecord *batch, int nResults, int done);
+
 /** Callback for informing about the completion of a publish call 
 
   @param rep handle of the repository client.
@@ -233,6 +247,17 @@ HANDLE repGetPeers(HANDLE rep,cb_repGetPeers cb, void *cbarg, int maxPeers, Cons
 */
 HANDLE repCountPeers(HANDLE rep, cb_repCountPeers cb, void *cbarg, Constraint *cons, int clen, const char *ch);
 
+/**
+  Set how long the answer of a repGetPeers or repCountPeers query is reused.
+
+  The same query asked again within this time is answered from the previous answer, and
+  callers asking the same query while it is in flight share one request to the Repository.
+
+  @param rep the repository instance
+  @param ttl_ms time in milliseconds, 0 disables reusing answers (1000 by default)
+*/
+void repSetPeersCacheTTL(HANDLE rep, int ttl_ms);
+
 /** 
   Publish a measurementrecord to the given repository.
 
@@ -260,6 +285,25 @@ HANDLE repPublish(HANDLE rep, cb_repPublish cb, void *cbarg, MeasurementRecord *
 */
 HANDLE repGetMeasurements(HANDLE rep, cb_repGetMeasurements cb, void *cbarg, int maxResults, const char *originator, const char *targetA, const char *targetB, const char *measurementName, const char *channel);
 
+/**
+  Get MeasurementRecord entries from the Repository while the response is arriving.
+
+  Same as repGetMeasurements, but the records are handed to the callback in batches as they are
+  parsed, so large results need not be held in memory.
+
+  @param rep the repository instance to be queried
+  @param cb callback for the batches
+  @param cbarg arbitrary user-provided parameter for the callback
+  @param maxResults maximum number of MeasurementRecords to return (unlimited if <= 0)
+  @param originator originator filter
+  @param targetA targetA filter
+  @param targetB targetB filter
+  @param measurementName MeasurementName filter
+  @param channel channel filter
+  @return request handle or NULL on error (the callback will not be called)
+*/
+HANDLE repGetMeasurementsBatched(HANDLE rep, cb_repMeasurementBatch cb, void *cbarg, int maxResults, const char *originator, const char *targetA, const char *targetB, const char *measurementName, const char *channel);
+
 /** 
   Helper function for debugging.
 
@@ -72,6 +72,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <sys/time.h>
+#include <time.h>
 #ifndef _WIN32
 	#include <netinet/in.h>
 #else
@@ -139,9 +140,11 @@ typedef struct
 {
   bool priority; ///<  A boolean variable that states if the data shall be send with priority.
   bool padding; ///<  A boolean that states if missing fragments shall be replaced with '0'
-  bool confirmation; ///<   A boolean that causes a receive confirmation
-  bool reliable; ///< A boolean that sends the data over a reliable protocol. Warning: If the messaging layer fails to establish a connection with a reliable protocol it falls back to UDP.
+  bool confirmation; ///<   A boolean that causes a receive confirmation: the message is sent reliably and its outcome reported to the send confirmation callback
+  bool reliable; ///< A boolean that sends the data reliably: lost fragments are retransmitted until the receiver acknowledged them all, at a rate yielding to other traffic (see mlRegisterSendConfirmationCb)
   int  keepalive; ///< Send KEEPALIVE messages over this connection at every n. seconds. Set to <= 0 to disable keepalive
+  int  deadline; ///< Milliseconds after which the message is of no use: if it is still in the TX queue of the rate limiter then, it is dropped whole. Set to <= 0 for no deadline
+  double sched_priority; ///< Rank among the messages waiting in the TX queue of the rate limiter, higher first, e.g. the priority of the ChunkAttrPrio of a chunk. Messages with a deadline go first, the earliest first, then by this rank; equal ones in order. Default 0
 } send_params;
 
 /**
@@ -169,7 +172,7 @@ typedef struct {
   char monitoringHeaderType; ///<  This value indicates if a monitoring header was added to the data. The header is added when the value is either 1 or 3.
   char *monitoringDataHeader; ///<  A pointer to the monitoring header.
   int monitoringDataHeaderLen;
-  struct timeval arrival_time; ///< The arrival time of the data
+  struct timespec arrival_time; ///< The arrival time of the data (the kernel receive time of its last packet)
   char firstPacketArrived; ///< A boolean that states if the first fragment arrived.
   int nrMissingBytes; ///<  The number of bytes that did not arrive.
   int recvFragments; ///< The overall number of fragments arrived
@@ -195,7 +198,7 @@ typedef struct {
   char *monitoringHeader; ///< A pointer to the monitoring header.
   int monitoringHeaderLen;
   int ttl; ///< The TTL Field from the IP Header of the packet.
-  struct timeval arrival_time; ///< The arrival time of the packet.
+  struct timespec arrival_time; ///< The arrival time of the packet, as stamped by the kernel. For sent packets, the send time as cached by the event loop, or their kernel TX timestamp in the get_send_pkt_ts_cb callback.
 
 } mon_pkt_inf;
 
@@ -212,13 +215,22 @@ typedef void (*get_recv_pkt_inf_cb)(void *arg);
  */
 typedef void (*get_send_pkt_inf_cb)(void *arg);
 
+/**
+ * Typedef for a callback when the kernel TX timestamp of a packet with a monitoring header is known
+ * The param is a pointer to a mon_pkt_inf struct with arrival_time set to the timestamp, buffer is NULL
+ * and monitoringHeader points to a copy of the monitoring header as it was sent
+ */
+typedef void (*get_send_pkt_ts_cb)(void *arg);
+
 /**
  * Typedef for a callback that asks if a monitoring module packet header shall be set
- * the first param is a pointer to the monitoring module packet header
- * the second param is a pointer to a send_pkt_type_and_dst_inf struct
- * return value returns 0 for no header and 1 for header
+ * the first param is the socketID of the destination
+ * the second param is the message type
+ * the third param is the zeroed header space of the packet: what the callback puts there
+ * reaches the get_send_pkt_inf_cb of the packet, which fills in the header for the wire
+ * return value is the length of the header, 0 for no header
  */
-typedef int (*set_monitoring_header_pkt_cb)(socketID_handle, uint8_t);
+typedef int (*set_monitoring_header_pkt_cb)(socketID_handle, uint8_t, void *);
 
 /**
  * Typedef for a callback that is envoked when data has been received
@@ -261,6 +273,15 @@ typedef void (*connection_failed_cb)(int connectionID,void *arg);
  */
 typedef void (*receive_data_cb)(char *buffer,int buflen,unsigned char msgtype,recv_params *rparams);
 
+/**
+ * Typedef for a callback reporting the outcome of a message sent with confirmation.
+ * The first param is the connection the message was sent on
+ * The second param is the message ID returned by mlSendData
+ * The third param is the message type
+ * The fourth param is true if the receiver acknowledged the whole message, false if it was given up
+ */
+typedef void (*send_confirmation_cb)(int connectionID,int msgID,unsigned char msgtype,bool delivered);
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -310,6 +331,16 @@ void mlRegisterGetRecvPktInf(get_recv_pkt_inf_cb  recv_pkt_inf_cb);
  */
 void mlRegisterGetSendPktInf(get_send_pkt_inf_cb  send_pkt_inf_cb);
 
+/**
+ * @brief Register a sent packet timestamp callback.
+ * This function is to register a callback that is invoked with the kernel TX timestamp of each packet
+ * sent with a monitoring header. The timestamps are read from the error queue of the socket, so they
+ * arrive some time after the packet was sent. The packets sent in one GSO batch share the timestamp
+ * of the batch. Without kernel support the callback is never invoked.
+ * @param send_pkt_ts_cb A function pointer to a callback function from the type get_send_pkt_ts_cb, NULL to stop the timestamps
+ */
+void mlRegisterGetSendPktTimestamp(get_send_pkt_ts_cb send_pkt_ts_cb);
+
 /**
  * @brief Register a monitoring packet callback.
  * This function is to register a callback that allows to add a monitoring module header to a packet.
@@ -363,6 +394,16 @@ void mlRegisterErrorConnectionCb(connection_failed_cb conn_failed);
 
 void mlRegisterRecvDataCb(receive_data_cb data_cb,unsigned char msgtype);
 
+/**
+ * @brief Register a send confirmation callback.
+ * This function is to register a callback that reports whether the messages sent with
+ * send_params.confirmation were delivered. Messages are given up 30 seconds after they
+ * were sent, when a fragment to retransmit no longer fits the lowered path MTU, or when
+ * their connection is closed.
+ * @param cb A function pointer to a callback function from the type send_confirmation_cb
+ */
+void mlRegisterSendConfirmationCb(send_confirmation_cb cb);
+
 /**
  * @brief Close a socket.
  * This function destroys a messaging layer socket.
@@ -410,8 +451,9 @@ int mlSendAllData(const int connectionID,send_all_data_container *container,int
  * @param bufsize The buffersize of the send buffer. 
  * @param msgtype The message type. 
  * @param sParams A pointer to a send_params struct. If NULL, the default is used given at mlOpenConnection
+ * @return the message ID (passed to the send confirmation callback), or -1 if the message could not be sent.
  */
-void mlSendData(const int connectionID,char *sendbuf,int bufsize,unsigned char msgtype,send_params *sParams);
+int mlSendData(const int connectionID,char *sendbuf,int bufsize,unsigned char msgtype,send_params *sParams);
 
 /**
  * @brief Receive newly arrived data.
@@ -555,6 +597,148 @@ int mlGetPathMTU(int ConnectionId);
 */
 void mlSetRateLimiterParams(int bucketsize, int drainrate, int maxQueueSize, int maxQueueSizeRTX, double maxTimeToHold);
 
+/**
+  * Let the output rate control follow the available uplink.
+  * The drain rate is then lowered while the paths report a growing one way
+  * delay or loss (see mlRateFeedback), and raised while packets wait in the
+  * TX queue without the paths being congested; without reports it is not
+  * raised while the time packets wait in the TX queue grows. It starts from the drain rate
+  * set with mlSetRateLimiterParams, or maxrate if none was set.
+  * @param minrate The lowest drain rate in bits/s.
+  * @param maxrate The highest drain rate in bits/s. If maxrate is <= 0 the drain rate stays where it is.
+*/
+void mlSetAdaptiveRate(int minrate, int maxrate);
+
+/**
+  * Report a measurement of the path towards a peer to the adaptive output rate control.
+  * The monitoring layer calls this with the corrected delay and loss its
+  * peers compute on the packets they receive.
+  * @param peer The remote socketID.
+  * @param delay One way delay of a packet in seconds, with the clock offset removed, or NAN.
+  * @param loss Loss ratio in [0, 1], or NAN.
+*/
+void mlRateFeedback(socketID_handle peer, double delay, double loss);
+
+/**
+  * Get the current drain rate of the output rate control.
+  * @return The drain rate in bits/s, 0 if rate control is disabled.
+*/
+int mlGetOutputRate();
+
+/**
+  * Keep the time packets wait in the TX queue of the output rate control low.
+  * Once packets waited more than target for a whole interval, queued
+  * messages are dropped whole, at shrinking intervals, until the waiting time
+  * is below target again (CoDel). Messages are never dropped once their first
+  * fragment was sent, nor reliable messages. Messages past their deadline
+  * (send_params.deadline) are dropped whatever these parameters.
+  * Statistics count the messages dropped in txAqmDrops and txDeadlineDrops.
+  * @param target Waiting time to keep below, in ms. If target is <= 0 (the default), only the size of the queue limits it.
+  * @param interval Time the waiting time may stay above target, in ms, about the round trip time to the peers. If <= 0 the default of 200 ms is used.
+*/
+void mlSetTXQueueAQM(int target, int interval);
+
+/**
+  * Request UDP segmentation and receive offload (Linux GSO/GRO).
+  * Fragments of a message are then passed to the kernel in a single call and
+  * coalesced datagrams are split again on reception. Without kernel support the
+  * messaging layer falls back to one datagram per call.
+  * Has to be called before mlInit.
+  * @param enable true to request offload.
+*/
+void mlSetUdpOffload(bool enable);
+
+
+/**
+  * Get the per connection slot reserved for the monitoring module.
+  * May only be called from within a monitoring callback (packet/data hooks and header
+  * callbacks), with the remote socketID that callback was given. The slot is NULL when
+  * the connection is opened; whatever it points to is released with free() when the
+  * connection is closed. This allows the monitoring module to keep per connection state
+  * without looking up the socketID.
+  * @param remote_socketID The socketID passed to the monitoring callback.
+  * @return A pointer to the slot, or NULL if the socketID does not belong to an open connection (e.g. for connection setup messages).
+*/
+void **mlGetMonitoringData(socketID_handle remote_socketID);
+
+/**
+ * @brief Number of buckets of an ml_histogram
+ */
+#define ML_HIST_BUCKETS 24
+
+/**
+ * @brief Histogram of durations in microseconds with logarithmic buckets.
+ * Bucket 0 counts samples of 0 us, bucket i counts samples from 2^(i-1) to 2^i - 1 us.
+ * The last bucket also counts all larger samples.
+ */
+typedef struct {
+  uint64_t count; ///< number of samples
+  uint64_t sum; ///< sum of all samples (us)
+  uint64_t max; ///< largest sample (us)
+  uint64_t bucket[ML_HIST_BUCKETS]; ///< number of samples per bucket
+} ml_histogram;
+
+/**
+ * @brief Messaging layer statistics, either of one connection or of the whole messaging layer.
+ * Counters cover the interval starting at since, the creation of the connection or the last reset.
+ */
+typedef struct {
+  struct timeval since; ///< start of the interval
+
+  uint64_t txMsgs; ///< messages passed to mlSendData
+  uint64_t txBytes; ///< bytes passed to mlSendData
+  uint64_t txPkts; ///< packets the socket accepted, including control messages and retransmissions
+  uint64_t txRtxPkts; ///< packets retransmitted on request of the receiver
+  uint64_t txNacks; ///< retransmission requests sent
+  uint64_t txQueued; ///< packets held back by the rate limiter
+  uint64_t txQueueDrops; ///< packets dropped because the TX queue was full
+  uint64_t txAqmDrops; ///< messages dropped from the TX queue because its packets waited too long (see mlSetTXQueueAQM)
+  uint64_t txDeadlineDrops; ///< messages dropped from the TX queue past their deadline
+  uint64_t txErrors; ///< packets the socket refused
+  uint64_t pmtuChanges; ///< reductions of the path MTU estimate
+  uint64_t txRelRtxPkts; ///< fragments of reliable messages retransmitted
+  uint64_t txRelFailures; ///< reliable messages given up
+
+  uint64_t rxMsgs; ///< messages delivered complete
+  uint64_t rxBytes; ///< bytes of the messages delivered complete
+  uint64_t rxPkts; ///< data packets received
+  uint64_t rxRtxPkts; ///< packets filling a gap
+  uint64_t rxLatePkts; ///< packets of messages that were already complete
+  uint64_t rxDupPkts; ///< fragments that had already arrived, ignored
+  uint64_t rxNacks; ///< retransmission requests received
+  uint64_t rxTimeoutDrops; ///< messages given up incomplete after the receive timeout
+  uint64_t rxNoBufDrops; ///< packets dropped for want of room to reassemble their message
+  uint64_t rxMalformedPkts; ///< packets dropped as neither a valid ML packet nor STUN (global statistics only)
+
+  uint64_t txQueuePkts; ///< packets in the TX queue now (global statistics only)
+  uint64_t txQueueBytes; ///< bytes in the TX queue now (global statistics only)
+  uint64_t txQueueMaxBytes; ///< highest TX queue occupation in the interval (global statistics only)
+
+  ml_histogram reassemblyTime; ///< first fragment to complete message
+  ml_histogram fragmentInterArrival; ///< time between fragments of the same message
+  ml_histogram txQueueTime; ///< time packets waited in the TX queue
+  ml_histogram nackRecoveryTime; ///< first retransmission request to complete message
+} ml_stats;
+
+/**
+  * Get a snapshot of the messaging layer statistics.
+  * May be called from any thread: every counter is read atomically, though the snapshot
+  * as a whole is not. Other threads must make sure the connection is not closed meanwhile.
+  * @param connectionID an open connection, or -1 for the statistics of the whole messaging layer.
+  * @param stats the snapshot is copied here.
+  * @param reset if true the statistics are cleared after the copy and a new interval starts.
+  * @return 0 on success, -1 if the connection does not exist.
+*/
+int mlGetStats(int connectionID, ml_stats *stats, bool reset);
+
+/**
+  * Estimate a percentile of a histogram of mlGetStats.
+  * @param h the histogram.
+  * @param p the percentile as fraction, e.g. 0.99.
+  * @return the upper bound of the bucket holding the percentile in microseconds (at most h->max), 0 for an empty histogram.
+*/
+double mlStatsPercentile(const ml_histogram *h, double p);
+
 
 #ifdef __cplusplus
 }
@@ -123,6 +123,16 @@ connect_data *connectbuf[CONNECTBUFSIZE];
  */
 recvdata *recvdatabuf[RECVDATABUFSIZE];
 
+/*
+ * timers of the recv_data slots, created the first time a slot is used and
+ * reused by every message it holds afterwards; the callbacks get the slot
+ */
+static struct event *recv_slot_timeout[RECVDATABUFSIZE];
+#ifdef RTX
+static struct event *recv_slot_last_pkt_timeout[RECVDATABUFSIZE];
+static struct event *recv_slot_nack_timeout[RECVDATABUFSIZE];
+#endif
+
 /*
  * define a pointer buffer for message multiplexing
  */
@@ -138,6 +148,52 @@ struct sockaddr_storage stun_server;
  */
 static struct timeval recv_timeout = RECV_TIMEOUT_DEFAULT;
 
+/*
+ * kernel receive time of the packet being processed
+ */
+static struct timespec pkt_arrival_time;
+
+/*
+ * the packet being processed is a fragment of a reliable message
+ */
+static bool pkt_reliable;
+
+/*
+ * Count a packet dropped as malformed. Floods of them are logged once a
+ * second, so that formatting warnings cannot stall the event loop.
+ */
+static void malformed_pkt(const char *why, int size, struct sockaddr_storage *from)
+{
+	static time_t last_report;
+	static unsigned int suppressed;
+	time_t now = time(NULL);
+	char from_str[INET6_ADDRSTRLEN] = "?";
+
+	STATS_INC(globalStats.rxMalformedPkts, 1);
+	if (now == last_report) {
+		suppressed++;
+		return;
+	}
+	last_report = now;
+	if (from) get_sockaddr_ip(from, from_str, ADDRESS_STR_LEN(from));
+	warn("ML: dropping malformed packet of %d bytes from %s: %s (%u more since the last report)\n", size, from_str, why, suppressed);
+	suppressed = 0;
+}
+
+/*
+ * packets with a monitoring header waiting for their kernel TX timestamp, in sending order;
+ * the packets of a GSO batch share the key of its timestamp
+ */
+#define TX_STAMP_RING 1024
+static struct {
+	uint32_t key;
+	int con_id;
+	mon_pkt_inf pkt_info;
+	char monitoringHeader[MON_PKT_HEADER_SPACE];	// as sent
+} tx_stamps[TX_STAMP_RING];
+static int tx_stamps_first, tx_stamps_len;
+static bool tx_stamps_on = false;
+
 /*
  * boolean NAT traversal successful if true
  */
@@ -163,10 +219,15 @@ socketID_handle loc_socketID = &local_socketID;
  */
 get_recv_pkt_inf_cb get_Recv_pkt_inf_cb = NULL;
 get_send_pkt_inf_cb get_Send_pkt_inf_cb = NULL;
+get_send_pkt_ts_cb get_Send_pkt_ts_cb = NULL;
 set_monitoring_header_pkt_cb set_Monitoring_header_pkt_cb = NULL;
 get_recv_data_inf_cb get_Recv_data_inf_cb = NULL;
 get_send_data_inf_cb get_Send_data_inf_cb = NULL;
 set_monitoring_header_data_cb set_Monitoring_header_data_cb = NULL;
+/*
+ * reliable messages callback
+ */
+send_confirmation_cb send_Confirmation_cb = NULL;
 /*
  * connection callbacks
  */
@@ -209,13 +270,6 @@ struct Counters {
 	unsigned int sentNACKMorePktCounter;
 } counters;
 
-struct pkt_recv_timeout_cb_arg{
-	int recv_id;
-	int seqnr;
-	int gap;
-	int retry;
-};
-
 
 extern unsigned int sentRTXDataPktCounter;
 
@@ -255,46 +309,56 @@ void recv_nack_msg(struct msg_header *msg_h, char *msgbuf, int msg_size)
 	unsigned int gapSize = nackmsg->offsetTo - nackmsg->offsetFrom;
 	//if (gapSize == 1349) counters.receivedNACK1PktCounter++;
 	//else counters.receivedNACKMorePktCounter++;
+	STATS_ADD(msg_h->remote_con_id, rxNacks, 1);
 
 	rtxPacketsFromTo(nackmsg->con_id, nackmsg->msg_seq_num, nackmsg->offsetFrom, nackmsg->offsetTo);	
 }
 
-void send_msg(int con_id, int msg_type, void* msg, int msg_len, bool truncable, send_params * sParams);
-
+// sends the NACKs due for the gaps of a message and arms the timer for the next one
 void pkt_recv_timeout_cb(int fd, short event, void *arg){
-	struct pkt_recv_timeout_cb_arg *args = arg;
-	int recv_id = args->recv_id;
-	int seqnr = args->seqnr;
-	int gap = args->gap;
+	int recv_id = (long) arg;
+	struct timeval now, next;
+	int gap;
 
 	debug("ML: pkt_recv_timeout_cb called. Timeout for id:%d\n",recv_id);
 
-	//check if message still exists	
-	if (recvdatabuf[recv_id] == NULL || recvdatabuf[recv_id]->seqnr != seqnr) {
-		free(args);
+	if (recvdatabuf[recv_id] == NULL) {
 		return;
 	}
+	gettimeofday(&now, NULL);
+	timerclear(&recvdatabuf[recv_id]->nackDue);
+	timerclear(&next);
 
-	//check if gap was filled in the meantime
-	if (recvdatabuf[recv_id]->gapArray[gap].offsetFrom == recvdatabuf[recv_id]->gapArray[gap].offsetTo) {
-		free(args);
-		return;	
-	}
+	for (gap = 0; gap < recvdatabuf[recv_id]->gapCounter; gap++) {
+		struct gap *g = &recvdatabuf[recv_id]->gapArray[gap];
 
-	struct nack_msg nackmsg;
-	nackmsg.con_id = recvdatabuf[recv_id]->txConnectionID;
-	nackmsg.msg_seq_num = recvdatabuf[recv_id]->seqnr;
-	nackmsg.offsetFrom = recvdatabuf[recv_id]->gapArray[gap].offsetFrom;
-	nackmsg.offsetTo = recvdatabuf[recv_id]->gapArray[gap].offsetTo;
+		//check if gap was filled in the meantime
+		if (g->retry == 0 || g->offsetFrom == g->offsetTo) {
+			g->retry = 0;
+			continue;
+		}
 
-	unsigned int gapSize = nackmsg.offsetTo - nackmsg.offsetFrom;
+		if (!timercmp(&g->nackDue, &now, >)) {
+			struct nack_msg nackmsg;
+			nackmsg.con_id = recvdatabuf[recv_id]->txConnectionID;
+			nackmsg.msg_seq_num = recvdatabuf[recv_id]->seqnr;
+			nackmsg.offsetFrom = g->offsetFrom;
+			nackmsg.offsetTo = g->offsetTo;
 
-	send_msg(recvdatabuf[recv_id]->connectionID, ML_NACK_MSG, (char *) &nackmsg, sizeof(struct nack_msg), true, &(connectbuf[recvdatabuf[recv_id]->connectionID]->defaultSendParams));	
+			if (!recvdatabuf[recv_id]->nackTime.tv_sec) recvdatabuf[recv_id]->nackTime = now;
+			STATS_ADD(recvdatabuf[recv_id]->connectionID, txNacks, 1);
+			send_msg(recvdatabuf[recv_id]->connectionID, ML_NACK_MSG, (char *) &nackmsg, sizeof(struct nack_msg), true, &(connectbuf[recvdatabuf[recv_id]->connectionID]->defaultSendParams));
 
-	if (--args->retry > 0) {
-		event_base_once(base, -1, EV_TIMEOUT, &pkt_recv_timeout_cb, arg, &pkt_recv_timeout_retry);	//prepare the next timeout
-	} else {
-		free(args);
+			if (--g->retry == 0) continue;
+			timeradd(&now, &pkt_recv_timeout_retry, &g->nackDue);	//prepare the next timeout
+		}
+		if (!timerisset(&next) || timercmp(&g->nackDue, &next, <)) next = g->nackDue;
+	}
+
+	if (timerisset(&next)) {
+		recvdatabuf[recv_id]->nackDue = next;
+		timersub(&next, &now, &next);
+		evtimer_add(recv_slot_nack_timeout[recv_id], &next);
 	}
 }
 
@@ -306,12 +370,7 @@ void last_pkt_recv_timeout_cb(int fd, short event, void *arg){
 		return;
 	}
 
-	if (recvdatabuf[recv_id]->last_pkt_timeout_event) {
-		debug("ML: freeing last packet timeout for %d",recv_id);
-		event_del(recvdatabuf[recv_id]->last_pkt_timeout_event);
-		event_free(recvdatabuf[recv_id]->last_pkt_timeout_event);
-		recvdatabuf[recv_id]->last_pkt_timeout_event = NULL;
-	}
+	recvdatabuf[recv_id]->last_pkt_timeout_event = NULL;
 
 	if (recvdatabuf[recv_id]->expectedOffset == recvdatabuf[recv_id]->bufsize - recvdatabuf[recv_id]->monitoringDataHeaderLen) return;
 
@@ -323,6 +382,8 @@ void last_pkt_recv_timeout_cb(int fd, short event, void *arg){
 
 	unsigned int gapSize = nackmsg.offsetTo - nackmsg.offsetFrom;
 
+	if (!recvdatabuf[recv_id]->nackTime.tv_sec) gettimeofday(&recvdatabuf[recv_id]->nackTime, NULL);
+	STATS_ADD(recvdatabuf[recv_id]->connectionID, txNacks, 1);
 	send_msg(recvdatabuf[recv_id]->connectionID, ML_NACK_MSG, &nackmsg, sizeof(struct nack_msg), true, &(connectbuf[recvdatabuf[recv_id]->connectionID]->defaultSendParams));	
 }
 
@@ -379,7 +440,12 @@ bool isStunDefined()
 	return strcmp(ip_a,INADDR_NONE_STR) && strcmp(ip_a,""); 
 }
 
-void send_msg(int con_id, int msg_type, void* msg, int msg_len, bool truncable, send_params * sParams) {
+/*
+ * connection the monitoring callback being called is about, see mlGetMonitoringData()
+ */
+static int monitoring_con_id = -1;
+
+int send_msg(int con_id, int msg_type, void* msg, int msg_len, bool truncable, send_params * sParams) {
 #ifdef FEC
 	int chk_msg_len=msg_len;
 	int n=4;
@@ -390,8 +456,10 @@ void send_msg(int con_id, int msg_type, void* msg, int msg_len, bool truncable,
 #endif
 	struct sockaddr_storage udpgen;
 	bool retry;
-	int pkt_len, offset;
+	bool reliable = (sParams->reliable || sParams->confirmation) && msg_type < 127 && !truncable;
+	int pkt_len, offset, seqnr;
 	struct iovec iov[4];
+	struct timeval deadline;
 
 	char h_pkt[MON_PKT_HEADER_SPACE];
 	char h_data[MON_DATA_HEADER_SPACE];
@@ -403,10 +471,13 @@ void send_msg(int con_id, int msg_type, void* msg, int msg_len, bool truncable,
 	iov[0].iov_base = &msg_h;
 	iov[0].iov_len = MSG_HEADER_SIZE;
 
+	msg_h.magic = ML_MAGIC;
+	msg_h.version = ML_VERSION;
 	msg_h.local_con_id = htonl(con_id);
 	msg_h.remote_con_id = htonl(connectbuf[con_id]->external_connectionID);
 	msg_h.msg_type = msg_type;
-	msg_h.msg_seq_num = htonl(connectbuf[con_id]->seqnr++);
+	seqnr = connectbuf[con_id]->seqnr++;
+	msg_h.msg_seq_num = htonl(seqnr);
 
 
 	iov[1].iov_len = iov[2].iov_len = 0;
@@ -419,6 +490,12 @@ void send_msg(int con_id, int msg_type, void* msg, int msg_len, bool truncable,
 	else
 		udpgen = connectbuf[con_id]->external_socketID.external_addr;
 
+	if (sParams->deadline > 0) {
+		struct timeval rel = { sParams->deadline / 1000, (sParams->deadline % 1000) * 1000 };
+		gettimeofday(&deadline, NULL);
+		timeradd(&deadline, &rel, &deadline);
+	}
+
 	do{
 #ifdef FEC
 		char *Pmsg = NULL;
@@ -430,6 +507,7 @@ void send_msg(int con_id, int msg_type, void* msg, int msg_len, bool truncable,
 		offset = 0;
 		retry = false;
 		// Monitoring layer hook
+		monitoring_con_id = con_id;
 		if(set_Monitoring_header_data_cb != NULL) {
 			iov[2].iov_len = ((set_Monitoring_header_data_cb) (&(connectbuf[con_id]->external_socketID), msg_type));
 		}
@@ -442,7 +520,7 @@ void send_msg(int con_id, int msg_type, void* msg, int msg_len, bool truncable,
 
 			sd_data_inf.remote_socketID = &(connectbuf[con_id]->external_socketID);
 #ifdef FEC
-			if(msg_type==17 && msg_len>connectbuf[con_id]->pmtusize){
+			if(msg_type==17 && msg_len>connectbuf[con_id]->pmtusize && !reliable){
 			   //@add padding bits to msg!
 			   int npaks=0;
 			   int toffset=0;
@@ -489,16 +567,22 @@ void send_msg(int con_id, int msg_type, void* msg, int msg_len, bool truncable,
 			sd_data_inf.padding = sParams->padding;
 			sd_data_inf.confirmation = sParams->confirmation;
 			sd_data_inf.reliable = sParams->reliable;
-			memset(&sd_data_inf.arrival_time, 0, sizeof(struct timeval));
+			memset(&sd_data_inf.arrival_time, 0, sizeof(sd_data_inf.arrival_time));
 
 			(get_Send_data_inf_cb) ((void *) &sd_data_inf);
 		}
 
+		// reliable messages are fragmented and paced by util/reliable.c
+		if (reliable)
+			return reliableSend(con_id, seqnr, msg_type, h_data, iov[2].iov_len, msg, msg_len, sParams->confirmation) ? -1 : seqnr;
+
 		do {
                         bool break2 = false;
 
 			if(set_Monitoring_header_pkt_cb != NULL) {
-				iov[1].iov_len = (set_Monitoring_header_pkt_cb) (&(connectbuf[con_id]->external_socketID), msg_type);
+				monitoring_con_id = con_id;
+				memset(h_pkt, 0, sizeof(h_pkt));
+				iov[1].iov_len = (set_Monitoring_header_pkt_cb) (&(connectbuf[con_id]->external_socketID), msg_type, h_pkt);
 			}
 #ifdef FEC
 			pkt_len = min(connectbuf[con_id]->pmtusize, chk_msg_len - offset) ;
@@ -529,16 +613,25 @@ void send_msg(int con_id, int msg_type, void* msg, int msg_len, bool truncable,
 #ifdef RTX
 				|| (msg_type == ML_NACK_MSG)
 #endif
+				|| (msg_type == ML_REL_ACK_MSG)
 			) { 
 				priority = HP & NO_RTX;
 			}
 
 			//fprintf(stderr,"*******************************ML.C: Sending packet: msg_h.offset: %d msg_h.msg_seq_num: %d\n",ntohl(msg_h.offset),ntohl(msg_h.msg_seq_num));
-			switch(queueOrSendPacket(socketfd, iov, 4, &udpgen,priority)) {
+			int ret = queueOrSendPacket(socketfd, iov, 4, &udpgen,priority, sParams->deadline > 0 ? &deadline : NULL, sParams->sched_priority);
+			// with UDP GSO, fragments are held back until the last one is passed
+#ifdef FEC
+			if (ret == OK && (truncable || offset + pkt_len == chk_msg_len)) ret = flushPackets(socketfd);
+#else
+			if (ret == OK && (truncable || offset + pkt_len == msg_len)) ret = flushPackets(socketfd);
+#endif
+			switch(ret) {
 				case MSGLEN:
 					info("ML: sending message failed, reducing MTU from %d to %d (to:%s conID:%d lconID:%d msgsize:%d offset:%d)\n", connectbuf[con_id]->pmtusize, pmtu_decrement(connectbuf[con_id]->pmtusize), conid_to_string(con_id), ntohl(msg_h.remote_con_id), ntohl(msg_h.local_con_id), msg_len, offset);
 					// TODO: pmtu decremented here, but not in the "truncable" packet. That is currently resent without changing the claimed pmtu. Might need to be changed.
 					connectbuf[con_id]->pmtusize = pmtu_decrement(connectbuf[con_id]->pmtusize);
+					STATS_ADD(con_id, pmtuChanges, 1);
 					if (connectbuf[con_id]->pmtusize > 0) {
 						connectbuf[con_id]->delay = true;
 						retry = true;
@@ -568,7 +661,10 @@ void send_msg(int con_id, int msg_type, void* msg, int msg_len, bool truncable,
 					iov[2].iov_len = 0;
 					break;
 			}
-			if (break2) break;
+			if (break2) {
+				flushPackets(socketfd);
+				break;
+			}
 #ifdef FEC
 		} while(offset != chk_msg_len && !truncable);
 		if(msg_type==17 && msg_len>connectbuf[con_id]->pmtusize){ //free the pointers.
@@ -586,10 +682,96 @@ void send_msg(int con_id, int msg_type, void* msg, int msg_len, bool truncable,
 	} while(retry);
 	//fprintf(stderr, "sentDataPktCounter after msg_seq_num = %d: %d\n", msg_h.msg_seq_num, counters.sentDataPktCounter);
 	//fprintf(stderr, "sentRTXDataPktCounter after msg_seq_num = %d: %d\n", msg_h.msg_seq_num, counters.sentRTXDataPktCtr);
+	return seqnr;
+}
+
+int send_rel_fragment(int con_id, struct rel_msg *m, int offset, int len, struct rel_data_hdr *hdr)
+{
+	struct sockaddr_storage udpgen;
+	struct msg_header msg_h;
+	struct iovec iov[4];
+	char h_pkt[MON_PKT_HEADER_SPACE];
+	char h_rel[sizeof(struct rel_data_hdr) + MON_DATA_HEADER_SPACE];
+	int ret;
+
+	if (connectbuf[con_id]->internal_connect)
+		udpgen = connectbuf[con_id]->external_socketID.internal_addr;
+	else
+		udpgen = connectbuf[con_id]->external_socketID.external_addr;
+
+	msg_h.magic = ML_MAGIC;
+	msg_h.version = ML_VERSION;
+	msg_h.local_con_id = htonl(con_id);
+	msg_h.remote_con_id = htonl(connectbuf[con_id]->external_connectionID);
+	msg_h.msg_type = ML_REL_DATA_MSG;
+	msg_h.msg_seq_num = htonl(m->seqnr);
+	msg_h.offset = htonl(offset);
+	msg_h.msg_length = htonl(m->len);
+	msg_h.len_mon_data_hdr = m->mon_hdr_len;
+
+	iov[0].iov_base = &msg_h;
+	iov[0].iov_len = MSG_HEADER_SIZE;
+	iov[1].iov_base = h_pkt;
+	iov[1].iov_len = 0;
+	if(set_Monitoring_header_pkt_cb != NULL) {
+		monitoring_con_id = con_id;
+		memset(h_pkt, 0, sizeof(h_pkt));
+		iov[1].iov_len = (set_Monitoring_header_pkt_cb) (&(connectbuf[con_id]->external_socketID), m->msgtype, h_pkt);
+	}
+	msg_h.len_mon_packet_hdr = iov[1].iov_len;
+
+	// the reliable header, then the monitoring data header in the first fragment
+	memcpy(h_rel, hdr, sizeof(struct rel_data_hdr));
+	iov[2].iov_base = h_rel;
+	iov[2].iov_len = sizeof(struct rel_data_hdr);
+	if (offset == 0) {
+		memcpy(h_rel + sizeof(struct rel_data_hdr), m->data, m->mon_hdr_len);
+		iov[2].iov_len += m->mon_hdr_len;
+	}
+	iov[3].iov_base = m->data + m->mon_hdr_len + offset;
+	iov[3].iov_len = len;
+
+	ret = queueOrSendPacket(socketfd, iov, 4, &udpgen, NO_RTX, NULL, 0);
+	switch(ret) {
+		case MSGLEN:
+			info("ML: sending reliable fragment failed, reducing MTU from %d to %d (to:%s conID:%d)\n", connectbuf[con_id]->pmtusize, pmtu_decrement(connectbuf[con_id]->pmtusize), conid_to_string(con_id), con_id);
+			connectbuf[con_id]->pmtusize = pmtu_decrement(connectbuf[con_id]->pmtusize);
+			STATS_ADD(con_id, pmtuChanges, 1);
+			break;
+	}
+	return ret;
 }
 
 void pmtu_timeout_cb(int fd, short event, void *arg);
 
+/* the kernel TX timestamp of a send, for all the packets it carried; the stamps of earlier sends were lost */
+static void tx_timestamp(uint32_t key, const struct timespec *ts)
+{
+	while (tx_stamps_len > 0 && (int32_t) (tx_stamps[tx_stamps_first].key - key) <= 0) {
+		int i = tx_stamps_first;
+
+		tx_stamps_first = (tx_stamps_first + 1) % TX_STAMP_RING;
+		tx_stamps_len--;
+		if (tx_stamps[i].key != key || !get_Send_pkt_ts_cb || connectbuf[tx_stamps[i].con_id] == NULL) continue;
+		mon_pkt_inf *pkt_info = &tx_stamps[i].pkt_info;
+		pkt_info->remote_socketID = &(connectbuf[tx_stamps[i].con_id]->external_socketID);
+		pkt_info->monitoringHeader = tx_stamps[i].monitoringHeader;
+		pkt_info->arrival_time = *ts;
+		(get_Send_pkt_ts_cb) ((void *) pkt_info);
+	}
+}
+
+/* the outcome of a packet, known only once its GSO batch is sent: packets and errors are counted here */
+static void tx_done(const struct iovec *iov, int len, int result)
+{
+	const struct msg_header *msg_h = (const struct msg_header *) iov[0].iov_base;
+
+	// STUN requests go through the socket too
+	if (iov[0].iov_len < MSG_HEADER_SIZE || msg_h->magic != ML_MAGIC) return;
+	if (result == OK) STATS_ADD(ntohl(msg_h->local_con_id), txPkts, 1);
+	else STATS_ADD(ntohl(msg_h->local_con_id), txErrors, 1);
+}
+
 int sendPacket(const int udpSocket, struct iovec *iov, int len, struct sockaddr_storage *socketaddr) {
 	//monitoring layer hook
 	if(get_Send_pkt_inf_cb != NULL && iov[1].iov_len) {
@@ -597,21 +779,41 @@ int sendPacket(const int udpSocket, struct iovec *iov, int len, struct sockaddr_
 
 		struct msg_header *msg_h  = (struct msg_header *) iov[0].iov_base;
 
-		memset(iov[1].iov_base,0,iov[1].iov_len);
-
 		pkt_info.remote_socketID = &(connectbuf[ntohl(msg_h->local_con_id)]->external_socketID);
 		pkt_info.buffer = iov[3].iov_base;
 		pkt_info.bufSize = iov[3].iov_len;
-		pkt_info.msgtype = msg_h->msg_type;
+		pkt_info.msgtype = msg_h->msg_type == ML_REL_DATA_MSG ? ((struct rel_data_hdr *) iov[2].iov_base)->msg_type : msg_h->msg_type;
 		pkt_info.dataID = ntohl(msg_h->msg_seq_num);
 		pkt_info.offset = ntohl(msg_h->offset);
 		pkt_info.datasize = ntohl(msg_h->msg_length);
 		pkt_info.monitoringHeaderLen = iov[1].iov_len;
 		pkt_info.monitoringHeader = iov[1].iov_base;
 		pkt_info.ttl = -1;
-		memset(&(pkt_info.arrival_time),0,sizeof(struct timeval));
+		// the send time as the event loop knows it, no clock read per packet
+		struct timeval now;
+		event_base_gettimeofday_cached(base, &now);
+		pkt_info.arrival_time.tv_sec = now.tv_sec;
+		pkt_info.arrival_time.tv_nsec = now.tv_usec * 1000;
 
+		monitoring_con_id = ntohl(msg_h->local_con_id);
 		(get_Send_pkt_inf_cb) ((void *) &pkt_info);
+
+		// the packet stays in its GSO batch, the kernel stamps the batch
+		uint32_t key;
+		int ret = sendPacketTimestamped(udpSocket, iov, len, socketaddr, &key);
+		// remember it for its kernel TX timestamp, the oldest gives way if nothing comes back
+		if (tx_stamps_on && ret == OK) {
+			int i = (tx_stamps_first + tx_stamps_len) % TX_STAMP_RING;
+			if (tx_stamps_len == TX_STAMP_RING) tx_stamps_first = (tx_stamps_first + 1) % TX_STAMP_RING;
+			else tx_stamps_len++;
+			tx_stamps[i].key = key;
+			tx_stamps[i].con_id = ntohl(msg_h->local_con_id);
+			tx_stamps[i].pkt_info = pkt_info;
+			tx_stamps[i].pkt_info.buffer = NULL;
+			tx_stamps[i].pkt_info.monitoringHeader = NULL;
+			memcpy(tx_stamps[i].monitoringHeader, iov[1].iov_base, iov[1].iov_len);
+		}
+		return ret;
 	}
 
  	//struct msg_header *msg_h;
@@ -741,7 +943,7 @@ void recv_conn_msg(struct msg_header *msg_h, char *msgbuf, int msg_size, struct
 		recv_data_inf.msgtype = msg_h->msg_type;
 		recv_data_inf.monitoringDataHeaderLen = msg_h->len_mon_data_hdr;
 		recv_data_inf.monitoringDataHeader = msg_h->len_mon_data_hdr ? msgbuf : NULL;
-		gettimeofday(&recv_data_inf.arrival_time, NULL);
+		recv_data_inf.arrival_time = pkt_arrival_time;
 		recv_data_inf.firstPacketArrived = true;
 		recv_data_inf.recvFragments = 1;
 		recv_data_inf.priority = false;
@@ -790,6 +992,7 @@ void recv_conn_msg(struct msg_header *msg_h, char *msgbuf, int msg_size, struct
 				}
 				connectbuf[free_con_id] = (connect_data *) malloc(sizeof(connect_data));
 				memset(connectbuf[free_con_id],0,sizeof(connect_data));
+				statsReset(&connectbuf[free_con_id]->stats);
 				connectbuf[free_con_id]->connection_head = connectbuf[free_con_id]->connection_last = NULL;
 				connectbuf[free_con_id]->starttime = time(NULL);
 				memcpy(&(connectbuf[free_con_id]->external_socketID), &(con_msg->sock_id), sizeof(socket_ID));
@@ -944,6 +1147,14 @@ void recv_timeout_cb(int fd, short event, void *arg)
 		return;
 	}
 
+	// the sender keeps retransmitting an incomplete reliable message
+	if (recvdatabuf[recv_id]->status == ACTIVE && recvdatabuf[recv_id]->reliable &&
+			connectbuf[recvdatabuf[recv_id]->connectionID] != NULL &&
+			reliableKeepWaiting(&recvdatabuf[recv_id]->firstArrival)) {
+		evtimer_add(recvdatabuf[recv_id]->timeout_event, &recvdatabuf[recv_id]->timeout_value);
+		return;
+	}
+
 	if(recvdatabuf[recv_id]->status == ACTIVE) {
 		// Monitoring layer hook
 		if(get_Recv_data_inf_cb != NULL) {
@@ -957,7 +1168,7 @@ void recv_timeout_cb(int fd, short event, void *arg)
 			recv_data_inf.monitoringDataHeaderLen = recvdatabuf[recv_id]->monitoringDataHeaderLen;
 			recv_data_inf.monitoringDataHeader = recvdatabuf[recv_id]->monitoringDataHeaderLen ?
 				recvdatabuf[recv_id]->recvbuf : NULL;
-			gettimeofday(&recv_data_inf.arrival_time, NULL);
+			clock_gettime(CLOCK_REALTIME, &recv_data_inf.arrival_time);
 			recv_data_inf.firstPacketArrived = recvdatabuf[recv_id]->firstPacketArrived;
 			recv_data_inf.recvFragments = recvdatabuf[recv_id]->recvFragments;
 			recv_data_inf.priority = false;
@@ -988,33 +1199,86 @@ void recv_timeout_cb(int fd, short event, void *arg)
 		//mlShowCounters();
 		//fprintf(stderr,"******Cleaning slot for inclomplete msg_seq_num: %d\n", recvdatabuf[recv_id]->seqnr);		
 #endif
+		STATS_ADD(recvdatabuf[recv_id]->connectionID, rxTimeoutDrops, 1);
  		//(receive_data_callback) (recvdatabuf[recv_id]->recvbuf + recvdatabuf[recv_id]->monitoringDataHeaderLen, recvdatabuf[recv_id]->bufsize - recvdatabuf[recv_id]->monitoringDataHeaderLen, recvdatabuf[recv_id]->msgtype, &rParams);
         }
 
 	//clean up
+	// the slot keeps its timers for the next message
 	if (recvdatabuf[recv_id]->timeout_event) {
-		debug("ML: freeing timeout for %d",recv_id);
 		event_del(recvdatabuf[recv_id]->timeout_event);
-		event_free(recvdatabuf[recv_id]->timeout_event);
 		recvdatabuf[recv_id]->timeout_event = NULL;
 	}
-	free(recvdatabuf[recv_id]->recvbuf);
+	poolFree(recvdatabuf[recv_id]->recvbuf, recvdatabuf[recv_id]->bufsize);
 #ifdef RTX
 	if (recvdatabuf[recv_id]->last_pkt_timeout_event) {
-		debug("ML: freeing last packet timeout for %d",recv_id);
 		event_del(recvdatabuf[recv_id]->last_pkt_timeout_event);
-		event_free(recvdatabuf[recv_id]->last_pkt_timeout_event);
 		recvdatabuf[recv_id]->last_pkt_timeout_event = NULL;
 	}
+	if (timerisset(&recvdatabuf[recv_id]->nackDue))
+		event_del(recv_slot_nack_timeout[recv_id]);
 #endif
 #ifdef FEC
 	free(recvdatabuf[recv_id]->pix);
 	free(recvdatabuf[recv_id]->pix_chk);
 #endif
-	free(recvdatabuf[recv_id]);
+	poolFree(recvdatabuf[recv_id], sizeof(recvdata));
 	recvdatabuf[recv_id] = NULL;
 }
 
+// returns the timer *ev of a recv_data slot, creating it on first use
+static struct event *recv_slot_timer(struct event **ev, event_callback_fn cb, int recv_id)
+{
+	if (*ev == NULL)
+		*ev = event_new(base, -1, EV_TIMEOUT, cb, (void *) (long) recv_id);
+	return *ev;
+}
+
+/*
+ * marks the payload bytes [from, to) of a message as arrived and returns how
+ * many of them had not arrived before, -1 if there is no room to track them
+ */
+static int add_arrived_range(recvdata *rd, int from, int to)
+{
+	int i, j, fresh = to - from;
+
+	// ranges i .. j-1 overlap or touch [from, to) and are merged with it
+	for (i = 0; i < rd->nArrived && rd->arrived[i].to < from; i++);
+	for (j = i; j < rd->nArrived && rd->arrived[j].from <= to; j++) {
+		int lo = from > rd->arrived[j].from ? from : rd->arrived[j].from;
+		int hi = to < rd->arrived[j].to ? to : rd->arrived[j].to;
+		if (hi > lo) fresh -= hi - lo;
+	}
+
+	if (j == i) {
+		if (rd->nArrived == RECV_MAX_RANGES) return -1;
+		memmove(&rd->arrived[i + 1], &rd->arrived[i], (rd->nArrived - i) * sizeof(struct byte_range));
+		rd->arrived[i].from = from;
+		rd->arrived[i].to = to;
+		rd->nArrived++;
+	} else {
+		if (from < rd->arrived[i].from) rd->arrived[i].from = from;
+		rd->arrived[i].to = to > rd->arrived[j - 1].to ? to : rd->arrived[j - 1].to;
+		memmove(&rd->arrived[i + 1], &rd->arrived[j], (rd->nArrived - j) * sizeof(struct byte_range));
+		rd->nArrived -= j - i - 1;
+	}
+	return fresh;
+}
+
+// zeroes the bytes of a message that were never written, pool buffers are not clean
+static void zero_missing_bytes(recvdata *rd)
+{
+	char *payload = rd->recvbuf + rd->monitoringDataHeaderLen;
+	int i, end = 0;
+
+	if (!rd->firstPacketArrived) memset(rd->recvbuf, 0, rd->monitoringDataHeaderLen);
+	for (i = 0; i < rd->nArrived; i++) {
+		memset(payload + end, 0, rd->arrived[i].from - end);
+		end = rd->arrived[i].to;
+	}
+	memset(payload + end, 0, rd->bufsize - rd->monitoringDataHeaderLen - end);
+}
+
 // process a single recv data message
 void recv_data_msg(struct msg_header *msg_h, char *msgbuf, int bufsize)
 {
@@ -1028,13 +1292,18 @@ void recv_data_msg(struct msg_header *msg_h, char *msgbuf, int bufsize)
 	debug("ML: received packet of size %d with rconID:%d lconID:%d type:%d offset:%d inlength: %d\n",bufsize,msg_h->remote_con_id,msg_h->local_con_id,msg_h->msg_type,msg_h->offset, msg_h->msg_length);
 
 	int recv_id, free_recv_id = -1;
-	int pmtusize;
+	int pmtusize, fresh;
+	struct timeval now;
 
 	if(connectbuf[msg_h->remote_con_id] == NULL) {
 		debug("ML: Received a message not related to any opened connection!\n");
 		return;
 	}
 	pmtusize = connectbuf[msg_h->remote_con_id]->pmtusize;
+	// the kernel stamp of this packet, no need to read the clock again
+	now.tv_sec = pkt_arrival_time.tv_sec;
+	now.tv_usec = pkt_arrival_time.tv_nsec / 1000;
+	STATS_ADD(msg_h->remote_con_id, rxPkts, 1);
 
 #ifdef RTX
 	counters.receivedDataPktCounter++;
@@ -1053,18 +1322,28 @@ void recv_data_msg(struct msg_header *msg_h, char *msgbuf, int bufsize)
 	if(recv_id == RECVDATABUFSIZE) {
 		debug(" recv id not found (free found: %d)\n", free_recv_id);
 		//no recv_data found: create one
+		recvdata *rd = free_recv_id == -1 ? NULL : (recvdata *) poolAlloc(sizeof(recvdata));
+		char *recvbuf = rd ? (char *) poolAlloc(msg_h->msg_length + msg_h->len_mon_data_hdr) : NULL;
+		if (recvbuf == NULL) {
+			poolFree(rd, sizeof(recvdata));
+			debug("ML: no room to reassemble message %d from conID:%d, dropping packet\n", msg_h->msg_seq_num, msg_h->remote_con_id);
+			STATS_ADD(msg_h->remote_con_id, rxNoBufDrops, 1);
+			return;
+		}
 		recv_id = free_recv_id;
-		recvdatabuf[recv_id] = (recvdata *) malloc(sizeof(recvdata));
+		recvdatabuf[recv_id] = rd;
 		memset(recvdatabuf[recv_id], 0, sizeof(recvdata));
 		recvdatabuf[recv_id]->connectionID = msg_h->remote_con_id;
 		recvdatabuf[recv_id]->seqnr = msg_h->msg_seq_num;
 		recvdatabuf[recv_id]->monitoringDataHeaderLen = msg_h->len_mon_data_hdr;
 		recvdatabuf[recv_id]->bufsize = msg_h->msg_length + msg_h->len_mon_data_hdr;
-		recvdatabuf[recv_id]->recvbuf = (char *) malloc(recvdatabuf[recv_id]->bufsize);
+		recvdatabuf[recv_id]->recvbuf = recvbuf;
 		recvdatabuf[recv_id]->arrivedBytes = 0;	//count this without the Mon headers
+		recvdatabuf[recv_id]->expectedOffset = 0;
+		recvdatabuf[recv_id]->firstArrival = now;
+		recvdatabuf[recv_id]->reliable = pkt_reliable;
 #ifdef RTX
 		recvdatabuf[recv_id]->txConnectionID = msg_h->local_con_id;
-		recvdatabuf[recv_id]->expectedOffset = 0;
 		recvdatabuf[recv_id]->gapCounter = 0;
 		recvdatabuf[recv_id]->last_pkt_timeout_event = NULL;
 #endif
@@ -1085,17 +1364,37 @@ void recv_data_msg(struct msg_header *msg_h, char *msgbuf, int bufsize)
 		  recvdatabuf[recv_id]->pix_chk = ( int * ) malloc ( (recvdatabuf[recv_id]->bufsize/pmtusize) * sizeof ( int ));
 		  for(i=0;i<(recvdatabuf[recv_id]->bufsize/pmtusize);i++)
 		      recvdatabuf[recv_id]->pix_chk[i] = 0;
+		  // the decoder reads whole fragments, also the missing ones
+		  memset(recvdatabuf[recv_id]->recvbuf, 0, recvdatabuf[recv_id]->bufsize);
 		}
 #endif
 
-		// fill the buffer with zeros
-		memset(recvdatabuf[recv_id]->recvbuf, 0, recvdatabuf[recv_id]->bufsize);
+		// no zero fill here, zero_missing_bytes() cleans up before delivery
 		debug(" new @ id:%d\n",recv_id);
 	} else {	//message structure already exists, no need to create new
 		debug(" found @ id:%d (arrived before this packet: bytes:%d fragments%d\n",recv_id, recvdatabuf[recv_id]->arrivedBytes, recvdatabuf[recv_id]->recvFragments);
 		if(recvdatabuf[recv_id]->status == COMPLETE) {
+		  STATS_ADD(msg_h->remote_con_id, rxLatePkts, 1);
 		  return;
 		}
+		if (recvdatabuf[recv_id]->bufsize != msg_h->msg_length + msg_h->len_mon_data_hdr) {
+			malformed_pkt("fragment does not match the length of its message", bufsize, NULL);
+			return;
+		}
+		STATS_HIST(msg_h->remote_con_id, fragmentInterArrival, statsElapsed(&recvdatabuf[recv_id]->lastArrival, &now));
+	}
+	recvdatabuf[recv_id]->lastArrival = now;
+
+	// only bytes that did not arrive before count, duplicates are ignored
+	fresh = bufsize - (msg_h->offset == 0 ? msg_h->len_mon_data_hdr : 0);
+	fresh = add_arrived_range(recvdatabuf[recv_id], msg_h->offset, msg_h->offset + fresh);
+	if (fresh < 0) {
+		STATS_ADD(msg_h->remote_con_id, rxNoBufDrops, 1);
+		return;
+	}
+	if (fresh == 0 && bufsize > (msg_h->offset == 0 ? msg_h->len_mon_data_hdr : 0)) {
+		STATS_ADD(msg_h->remote_con_id, rxDupPkts, 1);
+		return;
 	}
 
 	//if first packet extract mon data header and advance pointer
@@ -1111,7 +1410,7 @@ void recv_data_msg(struct msg_header *msg_h, char *msgbuf, int bufsize)
 	// increment fragmentnr
 	recvdatabuf[recv_id]->recvFragments++;
 	// increment the arrivedBytes
-	recvdatabuf[recv_id]->arrivedBytes += bufsize; 
+	recvdatabuf[recv_id]->arrivedBytes += fresh;
 
 	//fprintf(stderr,"Arrived bytes: %d Offset: %d Expected offset: %d\n",recvdatabuf[recv_id]->arrivedBytes/1349,msg_h->offset/1349,recvdatabuf[recv_id]->expectedOffset/1349);
 
@@ -1127,22 +1426,25 @@ void recv_data_msg(struct msg_header *msg_h, char *msgbuf, int bufsize)
 #endif
 
 #ifdef RTX
-	// detecting a new gap	
-	if (msg_h->offset > recvdatabuf[recv_id]->expectedOffset && recvdatabuf[recv_id]->gapCounter < RTX_MAX_GAPS) {
-		recvdatabuf[recv_id]->gapArray[recvdatabuf[recv_id]->gapCounter].offsetFrom = recvdatabuf[recv_id]->expectedOffset;
-		recvdatabuf[recv_id]->gapArray[recvdatabuf[recv_id]->gapCounter].offsetTo = msg_h->offset;
-		struct pkt_recv_timeout_cb_arg *args = malloc(sizeof *args);
-		args->recv_id = recv_id;
-		args->seqnr = recvdatabuf[recv_id]->seqnr;
-		args->gap = recvdatabuf[recv_id]->gapCounter++;
-		args->retry = RTX_RETRY;
-		event_base_once(base, -1, EV_TIMEOUT, &pkt_recv_timeout_cb, (void *) args, &pkt_recv_timeout);
+	// detecting a new gap (the sender of reliable messages retransmits by itself)
+	if (msg_h->offset > recvdatabuf[recv_id]->expectedOffset && recvdatabuf[recv_id]->gapCounter < RTX_MAX_GAPS && !recvdatabuf[recv_id]->reliable) {
+		struct gap *g = &recvdatabuf[recv_id]->gapArray[recvdatabuf[recv_id]->gapCounter++];
+		g->offsetFrom = recvdatabuf[recv_id]->expectedOffset;
+		g->offsetTo = msg_h->offset;
+		g->retry = RTX_RETRY;
+		timeradd(&now, &pkt_recv_timeout, &g->nackDue);
+		// one timer serves all the gaps of the message, it runs for the one due first
+		if (!timerisset(&recvdatabuf[recv_id]->nackDue) || timercmp(&g->nackDue, &recvdatabuf[recv_id]->nackDue, <)) {
+			recvdatabuf[recv_id]->nackDue = g->nackDue;
+			evtimer_add(recv_slot_timer(&recv_slot_nack_timeout[recv_id], &pkt_recv_timeout_cb, recv_id), &pkt_recv_timeout);
+		}
 	}
 	
 	//filling the gap by delayed packets
 	if (msg_h->offset < recvdatabuf[recv_id]->expectedOffset){
 		int i;
 		counters.receivedRTXDataPktCounter++;
+		STATS_ADD(msg_h->remote_con_id, rxRtxPkts, 1);
 			for (i = 0; i < recvdatabuf[recv_id]->gapCounter; i++){
 				if (msg_h->offset == recvdatabuf[recv_id]->gapArray[i].offsetFrom) {
 					recvdatabuf[recv_id]->gapArray[i].offsetFrom += bufsize;
@@ -1155,13 +1457,21 @@ void recv_data_msg(struct msg_header *msg_h, char *msgbuf, int bufsize)
 			}
 	}
 
-	//updating the expectedOffset	
-	if (msg_h->offset >= recvdatabuf[recv_id]->expectedOffset) recvdatabuf[recv_id]->expectedOffset = msg_h->offset + bufsize;
 #endif
 
+	//updating the expectedOffset
+	if (msg_h->offset >= recvdatabuf[recv_id]->expectedOffset) recvdatabuf[recv_id]->expectedOffset = msg_h->offset + bufsize;
+
 	//TODO very basic checkif all fragments arrived: has to be reviewed
 	if(recvdatabuf[recv_id]->arrivedBytes == recvdatabuf[recv_id]->bufsize - recvdatabuf[recv_id]->monitoringDataHeaderLen) {
 		recvdatabuf[recv_id]->status = COMPLETE; //buffer full -> msg completly arrived
+		STATS_ADD(msg_h->remote_con_id, rxMsgs, 1);
+		STATS_ADD(msg_h->remote_con_id, rxBytes, recvdatabuf[recv_id]->bufsize - recvdatabuf[recv_id]->monitoringDataHeaderLen);
+		STATS_HIST(msg_h->remote_con_id, reassemblyTime, statsElapsed(&recvdatabuf[recv_id]->firstArrival, &now));
+#ifdef RTX
+		if (recvdatabuf[recv_id]->nackTime.tv_sec)
+			STATS_HIST(msg_h->remote_con_id, nackRecoveryTime, statsElapsed(&recvdatabuf[recv_id]->nackTime, &now));
+#endif
 #ifdef FEC
 		if(recvdatabuf[recv_id]->msgtype==17 && recvdatabuf[recv_id]->bufsize>pmtusize){
 		  prev_sqnr=recvdatabuf[recv_id]->seqnr;
@@ -1194,6 +1504,9 @@ void recv_data_msg(struct msg_header *msg_h, char *msgbuf, int bufsize)
 		    toffset+=tpkt_len;
 		  }
 		  recvdatabuf[recv_id]->firstPacketArrived = 1;	//we've decoded the first packet as well
+		  recvdatabuf[recv_id]->nArrived = 1;	//and the rest of the message
+		  recvdatabuf[recv_id]->arrived[0].from = 0;
+		  recvdatabuf[recv_id]->arrived[0].to = recvdatabuf[recv_id]->bufsize - recvdatabuf[recv_id]->monitoringDataHeaderLen;
 		    fec_free(code);
 		    for(i=0; i<npaks; i++){
 		      free(src[i]);
@@ -1203,6 +1516,7 @@ void recv_data_msg(struct msg_header *msg_h, char *msgbuf, int bufsize)
 		    recvdatabuf[recv_id]->nix=0;
 		}
 #endif
+		zero_missing_bytes(recvdatabuf[recv_id]);
 	} else {
 		recvdatabuf[recv_id]->status = ACTIVE;
 #ifdef FEC
@@ -1228,16 +1542,17 @@ void recv_data_msg(struct msg_header *msg_h, char *msgbuf, int bufsize)
 				recv_data_inf.monitoringDataHeaderLen = recvdatabuf[recv_id]->monitoringDataHeaderLen;
 				recv_data_inf.monitoringDataHeader = recvdatabuf[recv_id]->monitoringDataHeaderLen ?
 					recvdatabuf[recv_id]->recvbuf : NULL;
-				gettimeofday(&recv_data_inf.arrival_time, NULL);
+				recv_data_inf.arrival_time = pkt_arrival_time;
 				recv_data_inf.firstPacketArrived = recvdatabuf[recv_id]->firstPacketArrived;
 				recv_data_inf.recvFragments = recvdatabuf[recv_id]->recvFragments;
 				recv_data_inf.priority = false;
 				recv_data_inf.padding = false;
 				recv_data_inf.confirmation = false;
-				recv_data_inf.reliable = false;
+				recv_data_inf.reliable = recvdatabuf[recv_id]->reliable;
 
 				// send data recv callback to monitoring module
 
+				monitoring_con_id = recvdatabuf[recv_id]->connectionID;
 				(get_Recv_data_inf_cb) ((void *) &recv_data_inf);
 			}
 
@@ -1276,11 +1591,13 @@ void recv_data_msg(struct msg_header *msg_h, char *msgbuf, int bufsize)
 		//start time out for cleaning up this slot
 		if (!recvdatabuf[recv_id]->timeout_event) {
 			//TODO make timeout at least a DEFINE
-			recvdatabuf[recv_id]->timeout_event = event_new(base, -1, EV_TIMEOUT, &recv_timeout_cb, (void *) (long)recv_id);
+			recvdatabuf[recv_id]->timeout_event = recv_slot_timer(&recv_slot_timeout[recv_id], &recv_timeout_cb, recv_id);
 			evtimer_add(recvdatabuf[recv_id]->timeout_event, &recv_timeout);
 #ifdef RTX
-			recvdatabuf[recv_id]->last_pkt_timeout_event = event_new(base, -1, EV_TIMEOUT, &last_pkt_recv_timeout_cb, (void *) (long)recv_id);
-			evtimer_add(recvdatabuf[recv_id]->last_pkt_timeout_event, &last_pkt_recv_timeout);
+			if (!recvdatabuf[recv_id]->reliable) {
+				recvdatabuf[recv_id]->last_pkt_timeout_event = recv_slot_timer(&recv_slot_last_pkt_timeout[recv_id], &last_pkt_recv_timeout_cb, recv_id);
+				evtimer_add(recvdatabuf[recv_id]->last_pkt_timeout_event, &last_pkt_recv_timeout);
+			}
 #endif
 		}
 	}
@@ -1328,6 +1645,7 @@ void pmtu_timeout_cb(int fd, short event, void *arg)
 		tout.tv_usec = PMTU_TIMEOUT * (1.0+ 0.1 *((double)rand()/(double)RAND_MAX-0.5));
 		info("\tML: decreasing pmtu estimate from %d to %d\n", connectbuf[con_id]->pmtusize, pmtu_decrement(connectbuf[con_id]->pmtusize));
 		connectbuf[con_id]->pmtusize = pmtu_decrement(connectbuf[con_id]->pmtusize);
+		STATS_ADD(con_id, pmtuChanges, 1);
 		connectbuf[con_id]->timeout_value = tout; 
 		connectbuf[con_id]->trials = 0;
 	}
@@ -1534,57 +1852,85 @@ void pmtu_error_cb_th(char *msg, int msglen)
 }
 
 /*
- * what to do once a packet arrived if it is a conn packet send it to
- * recv_conn handler if it is a data packet send it to the recv_data
- * handler
+ * Receive handlers by message type. recv_one_pkg checks what they rely on:
+ * the header, payload of at least min_size bytes after the monitoring data
+ * header and, if connected, an open connection remote_con_id.
  */
+typedef void (*recv_handler)(struct msg_header *msg_h, char *msgbuf, int msg_size, struct sockaddr_storage *recv_addr, struct rel_data_hdr *rel);
 
-//done --
-void recv_pkg(int fd, short event, void *arg)
+static void recv_conn_pkg(struct msg_header *msg_h, char *msgbuf, int msg_size, struct sockaddr_storage *recv_addr, struct rel_data_hdr *rel)
 {
-	debug("ML: recv_pkg called\n");
-
-	struct msg_header *msg_h;
-	char msgbuf[MAX];
-	pmtu recvSize = MAX;
-	char *bufptr = msgbuf;
-	int ttl;
-	struct sockaddr_storage recv_addr;
-	int msg_size;
-
-	recvPacket(fd, msgbuf, &recvSize, &recv_addr, pmtu_error_cb_th, &ttl);
+	debug("ML: received conn pkg\n");
+	recv_conn_msg(msg_h, msgbuf, msg_size, recv_addr);
+}
 
+#ifdef RTX
+static void recv_nack_pkg(struct msg_header *msg_h, char *msgbuf, int msg_size, struct sockaddr_storage *recv_addr, struct rel_data_hdr *rel)
+{
+	debug("ML: received nack pkg\n");
+	recv_nack_msg(msg_h, msgbuf, msg_size);
+}
+#endif
 
-	// check if it is not just an ERROR message
-	if(recvSize < 0)
-		return;
+static void recv_rel_ack_pkg(struct msg_header *msg_h, char *msgbuf, int msg_size, struct sockaddr_storage *recv_addr, struct rel_data_hdr *rel)
+{
+	debug("ML: received reliable ack pkg\n");
+	reliableRecvAck(msg_h->remote_con_id, (struct rel_ack_msg *) (msgbuf + msg_h->len_mon_data_hdr));
+}
 
-	// @TODO check if this simplistic STUN message recognition really always works, probably not
-	unsigned short stun_bind_response = 0x0101;
-	unsigned short * msgspot = (unsigned short *) msgbuf;
-	if (*msgspot == stun_bind_response) {
-		debug("ML: recv_pkg: parse stun message called on %d bytes\n", recvSize);
-		recv_stun_msg(msgbuf, recvSize);
-		return;
+static void recv_data_pkg(struct msg_header *msg_h, char *msgbuf, int msg_size, struct sockaddr_storage *recv_addr, struct rel_data_hdr *rel)
+{
+	debug("ML: received data pkg\n");
+	if (rel) {
+		if (!reliableRecv(msg_h->remote_con_id, rel))
+			return;
+		pkt_reliable = true;
 	}
+	recv_data_msg(msg_h, msgbuf, msg_size);
+	pkt_reliable = false;
+}
 
-	msg_h = (struct msg_header *) msgbuf;
+struct recv_handler_entry {
+	recv_handler handler;	// NULL: not an ML message type
+	int min_size;
+	bool connected;
+};
 
-        uint32_t inlen = ntohl(msg_h->msg_length);
-#ifdef FEC
-        if(inlen > 0x20000 || inlen == 0) {	//FEC packets have a larger offset value than msg_length
-#else
-        if(inlen > 0x20000 || inlen < ntohl(msg_h->offset) || inlen == 0) {
+// all the types below ML_CON_MSG are application data
+static const struct recv_handler_entry recv_data_handler = { recv_data_pkg, 0, true };
+
+static const struct recv_handler_entry recv_ctrl_handlers[256] = {
+	[ML_CON_MSG] = { recv_conn_pkg, sizeof(struct conn_msg), false },
+#ifdef RTX
+	[ML_NACK_MSG] = { recv_nack_pkg, sizeof(struct nack_msg), true },
 #endif
-//            warn("ML: BAD PACKET received from: %s:%d (len: %d < %d [=%08X] o:%d)", 
- //                 inet_ntoa(recv_addr.sin_addr), recv_addr.sin_port,
-  //                             recvSize, inlen, inlen, ntohl(msg_h->offset));
- warn("ML: received %d: %02X %02X %02X %02X %02X %02X - %02X %02X %02X %02X %02X %02X", recvSize,
-            msgbuf[0], msgbuf[1],msgbuf[2],msgbuf[3],msgbuf[4],msgbuf[5],
-            msgbuf[6],msgbuf[7],msgbuf[8],msgbuf[9],msgbuf[10],msgbuf[11]);
+	[ML_REL_ACK_MSG] = { recv_rel_ack_pkg, sizeof(struct rel_ack_msg), true },
+};
 
-            return;
-       }
+// process a single ML packet
+static void recv_one_pkg(char *msgbuf, int recvSize, struct sockaddr_storage *recv_addr, int ttl, const struct timespec *arrival)
+{
+	struct msg_header *msg_h = (struct msg_header *) msgbuf;
+	struct rel_data_hdr *rel = NULL;
+	unsigned char *bytes = (unsigned char *) msgbuf;
+	char *bufptr;
+	const struct recv_handler_entry *h;
+	int msg_size, payload, type;
+
+	if (recvSize < (int) MSG_HEADER_SIZE || msg_h->magic != ML_MAGIC) {
+		// STUN: two zero bits, then the type, and the length of what follows the header
+		if (recvSize >= (int) sizeof(StunMsgHdr) && !(bytes[0] & 0xC0) &&
+				(bytes[2] << 8 | bytes[3]) + (int) sizeof(StunMsgHdr) == recvSize) {
+			debug("ML: recv_pkg: parse stun message called on %d bytes\n", recvSize);
+			recv_stun_msg(msgbuf, recvSize);
+		} else
+			malformed_pkt("neither ML nor STUN", recvSize, recv_addr);
+		return;
+	}
+	if (msg_h->version != ML_VERSION) {
+		malformed_pkt("unsupported ML version", recvSize, recv_addr);
+		return;
+	}
 
 	/* convert header from network to host order */
 	msg_h->offset = ntohl(msg_h->offset);
@@ -1593,40 +1939,57 @@ void recv_pkg(int fd, short event, void *arg)
 	msg_h->remote_con_id = ntohl(msg_h->remote_con_id);
 	msg_h->msg_seq_num = ntohl(msg_h->msg_seq_num);
 
-	//verify minimum size
-	if (recvSize < sizeof(struct msg_header)) {
-	  info("UDP packet too small, can't be an ML packet");
-	  return;
+	bufptr = msgbuf + MSG_HEADER_SIZE + msg_h->len_mon_packet_hdr;
+	msg_size = recvSize - MSG_HEADER_SIZE - msg_h->len_mon_packet_hdr;
+	if (msg_size < 0) {
+		malformed_pkt("monitoring header beyond the packet", recvSize, recv_addr);
+		return;
 	}
 
-	//TODO add more verifications
-
-	bufptr += MSG_HEADER_SIZE + msg_h->len_mon_packet_hdr;
-	msg_size = recvSize - MSG_HEADER_SIZE - msg_h->len_mon_packet_hdr;
+	// peel the reliable header, the rest is handled as the message type it carries
+	if (msg_h->msg_type == ML_REL_DATA_MSG) {
+		rel = (struct rel_data_hdr *) bufptr;
+		if (msg_size < (int) sizeof(struct rel_data_hdr) || rel->msg_type >= ML_CON_MSG) {
+			malformed_pkt("bad reliable header", recvSize, recv_addr);
+			return;
+		}
+		msg_h->msg_type = rel->msg_type;
+		bufptr += sizeof(struct rel_data_hdr);
+		msg_size -= sizeof(struct rel_data_hdr);
+	}
 
-	//verify more fields
-	if (msg_size < 0) {
-	  info("Corrupted UDP packet received");
-	  return;
+	type = msg_h->msg_type;
+	h = type < ML_CON_MSG ? &recv_data_handler : &recv_ctrl_handlers[type];
+	if (!h->handler) {
+		malformed_pkt("unknown message type", recvSize, recv_addr);
+		return;
+	}
+	// only first fragments carry the monitoring data header
+	payload = msg_size - (msg_h->offset == 0 ? msg_h->len_mon_data_hdr : 0);
+	if (payload < h->min_size || msg_h->msg_length == 0 || msg_h->msg_length > 0x20000
+#ifndef FEC	//FEC packets have a larger offset value than msg_length
+			|| msg_h->offset > msg_h->msg_length || payload > msg_h->msg_length - msg_h->offset
+#endif
+			) {
+		malformed_pkt("lengths do not add up", recvSize, recv_addr);
+		return;
+	}
+	if (h->connected && (msg_h->remote_con_id < 0 ||
+			msg_h->remote_con_id >= CONNECTBUFSIZE || connectbuf[msg_h->remote_con_id] == NULL)) {
+		debug("ML: dropping packet type %d for non existent connection %d\n", type, msg_h->remote_con_id);
+		return;
 	}
 
+	pkt_arrival_time = *arrival;
 	if(get_Recv_pkt_inf_cb != NULL) {
 		mon_pkt_inf msginfNow;
 		msginfNow.monitoringHeaderLen = msg_h->len_mon_packet_hdr;
 		msginfNow.monitoringHeader = msg_h->len_mon_packet_hdr ? &msgbuf[0] + MSG_HEADER_SIZE : NULL;
-		//TODO rethink this ...
 		//TODO: fix endianess in ss_families of sock_id
-		if(msg_h->msg_type == ML_CON_MSG) {
-			struct conn_msg *c_msg = (struct conn_msg *) bufptr;
-			msginfNow.remote_socketID = &(c_msg->sock_id);
-		}
-                else if(msg_h->remote_con_id < 0 || 
-                       msg_h->remote_con_id >= CONNECTBUFSIZE || 
-                       connectbuf[msg_h->remote_con_id] == NULL) {
-			error("ML: received pkg called with non existent connection\n");
-			return;
-		} else
+		if (h->connected)
 			msginfNow.remote_socketID = &(connectbuf[msg_h->remote_con_id]->external_socketID);
+		else
+			msginfNow.remote_socketID = &(((struct conn_msg *) (bufptr + msg_h->len_mon_data_hdr))->sock_id);
 		msginfNow.buffer = bufptr;
 		msginfNow.bufSize = recvSize;
 		msginfNow.msgtype = msg_h->msg_type;
@@ -1634,31 +1997,42 @@ void recv_pkg(int fd, short event, void *arg)
 		msginfNow.dataID = msg_h->msg_seq_num;
 		msginfNow.offset = msg_h->offset;
 		msginfNow.datasize = msg_h->msg_length;
-		gettimeofday(&msginfNow.arrival_time, NULL);
+		msginfNow.arrival_time = *arrival;
+		monitoring_con_id = msg_h->remote_con_id;
 		(get_Recv_pkt_inf_cb) ((void *) &msginfNow);
 	}
 
+	h->handler(msg_h, bufptr, msg_size, recv_addr, rel);
+}
 
-	switch(msg_h->msg_type) {
-		case ML_CON_MSG:
-			debug("ML: received conn pkg\n");
-			recv_conn_msg(msg_h, bufptr, msg_size, &recv_addr);
-			break;
-#ifdef RTX
-		case ML_NACK_MSG:
-			debug("ML: received nack pkg\n");
-			recv_nack_msg(msg_h, bufptr, msg_size);
-			break;
-#endif
-		default:
-			if(msg_h->msg_type < 127) {
-				debug("ML: received data pkg\n");
-				recv_data_msg(msg_h, bufptr, msg_size);
-				break;
-			}
-			debug("ML: unrecognised msg_type\n");
-			break;
-	}
+/* the receive buffer of the socket, handed to recv_pkg */
+struct recv_buffer {
+	int size;
+	char data[];
+};
+
+void recv_pkg(int fd, short event, void *arg)
+{
+	debug("ML: recv_pkg called\n");
+
+	struct recv_buffer *rb = (struct recv_buffer *) arg;
+	char *msgbuf = rb->data;
+	int recvSize = rb->size;
+	int segSize, offset;
+	int ttl;
+	struct sockaddr_storage recv_addr;
+	struct timespec arrival;
+
+	recvPacket(fd, msgbuf, &recvSize, &recv_addr, pmtu_error_cb_th, &ttl, &segSize, &arrival);
+
+	// check if it is not just an ERROR message
+	if(recvSize < 0)
+		return;
+
+	// split GRO coalesced datagrams back into the original packets
+	if (segSize <= 0) segSize = recvSize;
+	for (offset = 0; offset < recvSize; offset += segSize)
+		recv_one_pkg(msgbuf + offset, min(segSize, recvSize - offset), &recv_addr, ttl, &arrival);
 }
 
 
@@ -1708,8 +2082,20 @@ int create_socket(const int port, const char *ipaddr)
 		return socketfd;
         }
 
+	if (get_Send_pkt_ts_cb) mlRegisterGetSendPktTimestamp(get_Send_pkt_ts_cb);
+	setTxDoneCallback(tx_done);
+
+	// GRO hands over up to 64 KB of coalesced datagrams at once
+	int recv_size = getUdpOffload() & UDP_OFFLOAD_GRO ? UDP_OFFLOAD_MAX_BYTES : MAX;
+	struct recv_buffer *rb = malloc(sizeof(struct recv_buffer) + recv_size);
+	if (!rb) {
+		error("ML: unable to allocate the receive buffer\n");
+		return -1;
+	}
+	rb->size = recv_size;
+
 	struct event *ev;
-	ev = event_new(base, socketfd, EV_READ | EV_PERSIST, recv_pkg, NULL);
+	ev = event_new(base, socketfd, EV_READ | EV_PERSIST, recv_pkg, rb);
 
 	event_add(ev, NULL);
 
@@ -1760,6 +2146,7 @@ int mlInit(bool recv_data_cb,struct timeval timeout_value,const int port,const c
 
 /*X*/ //  fprintf(stderr,"MLINIT1 %s, %d, %s, %d\n", ipaddr, port, stun_ipaddr, stun_port);
 	base = (struct event_base *) arg;
+	statsReset(&globalStats);
 //	printf("SIZE OF SOCKET_ID: %d",sizeof(socket_ID));
 	recv_data_callback = recv_data_cb;
 	mlSetRecvTimeout(timeout_value);
@@ -1781,7 +2168,29 @@ void mlSetRateLimiterParams(int bucketsize, int drainrate, int maxQueueSize, int
         setOutputRateParams(bucketsize, drainrate);
 	setQueuesParams (maxQueueSize, maxQueueSizeRTX, maxTimeToHold);
 }
+
+void mlSetAdaptiveRate(int minrate, int maxrate) {
+	setAdaptiveRateParams(minrate, maxrate);
+}
+
+void mlRateFeedback(socketID_handle peer, double delay, double loss) {
+	int con_id = mlConnectionExist(peer, false);
+
+	if (con_id >= 0) rateFeedback(con_id, delay, loss);
+}
+
+int mlGetOutputRate() {
+	return getOutputRate();
+}
+
+void mlSetTXQueueAQM(int target, int interval) {
+	setQueueAQMParams(target > 0 ? target * 1000 : 0, interval > 0 ? interval * 1000 : TXQ_AQM_INTERVAL_DEFAULT);
+}
      
+void mlSetUdpOffload(bool enable) {
+	setUdpOffload(enable);
+}
+
 void mlSetVerbosity (int log_level) {
 	setLogLevel(log_level);
 }
@@ -1806,6 +2215,16 @@ void mlRegisterGetSendPktInf(get_send_pkt_inf_cb  send_pkt_inf_cb){
 }
 
 
+void mlRegisterGetSendPktTimestamp(get_send_pkt_ts_cb send_pkt_ts_cb){
+	get_Send_pkt_ts_cb = send_pkt_ts_cb;
+	// applied by create_socket if there is no socket yet
+	if (socketfd <= 0) return;
+
+	tx_stamps_first = tx_stamps_len = 0;
+	tx_stamps_on = setTxTimestamps(socketfd, send_pkt_ts_cb ? tx_timestamp : NULL);
+	if (send_pkt_ts_cb && !tx_stamps_on) info("ML: kernel TX timestamps are not available\n");
+}
+
 void mlRegisterSetMonitoringHeaderPktCb(set_monitoring_header_pkt_cb monitoring_header_pkt_cb ){
 
 	if (monitoring_header_pkt_cb == NULL) {
@@ -2012,6 +2431,7 @@ int mlOpenConnection(socketID_handle external_socketID,receive_connection_cb con
 		if (connectbuf[con_id] == NULL) {
 			connectbuf[con_id] = (connect_data *) malloc(sizeof(connect_data));
 			memset(connectbuf[con_id],0,sizeof(connect_data));
+			statsReset(&connectbuf[con_id]->stats);
 			connectbuf[con_id]->starttime = time(NULL);
 			memcpy(&connectbuf[con_id]->external_socketID, external_socketID, sizeof(socket_ID));
 			connectbuf[con_id]->pmtusize = DSLSLIM;
@@ -2050,6 +2470,9 @@ void mlCloseConnection(const int connectionID){
 
 	// remove it from the connection array
 	if(connectbuf[connectionID]) {
+		struct rel_tx *rel_tx = connectbuf[connectionID]->rel_tx;
+		struct rel_rx *rel_rx = connectbuf[connectionID]->rel_rx;
+
 		if(connectbuf[connectionID]->ctrl_msg_buf) {
 			free(connectbuf[connectionID]->ctrl_msg_buf);
 		}
@@ -2067,33 +2490,44 @@ void mlCloseConnection(const int connectionID){
 			free(temp);
 		}
 
+		free(connectbuf[connectionID]->monitoring_data);
 		free(connectbuf[connectionID]);
 		connectbuf[connectionID] = NULL;
+		// last, the send confirmation callback may see the connection gone
+		reliableClose(connectionID, rel_tx, rel_rx);
 	}
 
 }
 
-void mlSendData(const int connectionID,char *sendbuf,int bufsize,unsigned char msgtype,send_params *sParams){
+int mlSendData(const int connectionID,char *sendbuf,int bufsize,unsigned char msgtype,send_params *sParams){
 
 	if (connectionID < 0) {
 		error("ML: send data failed: connectionID does not exist\n");
-		return;
+		return -1;
 	}
 
 	if (connectbuf[connectionID] == NULL) {
 		error("ML: send data failed: connectionID does not exist\n");
-		return;
+		return -1;
 	}
 	if (connectbuf[connectionID]->status != READY) {
 	    error("ML: send data failed: connection is not active\n");
-	    return;
+	    return -1;
 	}
 
 	if (sParams == NULL) {
 		sParams = &(connectbuf[connectionID]->defaultSendParams);
 	}
 
-	send_msg(connectionID, msgtype, sendbuf, bufsize, false, sParams);
+	STATS_ADD(connectionID, txMsgs, 1);
+	STATS_ADD(connectionID, txBytes, bufsize);
+	return send_msg(connectionID, msgtype, sendbuf, bufsize, false, sParams);
+
+}
+
+void mlRegisterSendConfirmationCb(send_confirmation_cb cb){
+
+	send_Confirmation_cb = cb;
 
 }
 
@@ -2276,6 +2710,7 @@ int mlRecvData(const int connectionID,char *recvbuf,int *bufsize,recv_params *rP
 
 				// send data recv callback to monitoring module
 
+				monitoring_con_id = connectionID;
 				(get_Recv_data_inf_cb) ((void *) &recv_data_inf);
 			}
 
@@ -2342,6 +2777,7 @@ int mlRecvData(const int connectionID,char *recvbuf,int *bufsize,recv_params *rP
 
 					// send data recv callback to monitoring module
 
+					monitoring_con_id = connectionID;
 					(get_Recv_data_inf_cb) ((void *) &recv_data_inf);
 				}
 
@@ -2552,6 +2988,30 @@ int mlGetPathMTU(int ConnectionId) {
 	return -1;
 }
 
+ml_stats *connStats(int con_id) {
+	if (con_id < 0 || con_id >= CONNECTBUFSIZE || connectbuf[con_id] == NULL)
+		return NULL;
+	return &connectbuf[con_id]->stats;
+}
+
+void **mlGetMonitoringData(socketID_handle remote_socketID) {
+	// only the socketID of the connection the callback is about is accepted, so a
+	// stale monitoring_con_id or a socketID taken from a packet give NULL
+	if (monitoring_con_id < 0 || monitoring_con_id >= CONNECTBUFSIZE || connectbuf[monitoring_con_id] == NULL)
+		return NULL;
+	if (remote_socketID != &connectbuf[monitoring_con_id]->external_socketID)
+		return NULL;
+	return &connectbuf[monitoring_con_id]->monitoring_data;
+}
+
+int mlGetStats(int connectionID, ml_stats *stats, bool reset) {
+	ml_stats *s = connectionID == -1 ? &globalStats : connStats(connectionID);
+	if (s == NULL)
+		return -1;
+	statsSnapshot(s, stats, reset);
+	return 0;
+}
+
 /**************************** END of GENERAL functions *************************/
 
 /**************************** NAT functions *************************/
@@ -49,6 +49,9 @@
 #include "transmissionHandler.h"
 #include "util/rateLimiter.h"
 #include "util/queueManagement.h"
+#include "util/bufferPool.h"
+#include "util/mlStats.h"
+#include "util/reliable.h"
 
 #define LOG_MODULE "[ml] "
 #include "ml_log.h"
@@ -25,12 +25,14 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <napa_trace.h>
 
 extern int ml_log_level;
 
 extern void setLogLevel(int ll);
 
-#define DPRINT(ll, format, ... )  {struct timeval tnow; if(ll <= ml_log_level) {gettimeofday(&tnow,NULL); fprintf(stderr, "%ld.%03ld "format, tnow.tv_sec, tnow.tv_usec/1000, ##__VA_ARGS__ );fprintf(stderr,format[strlen(format)-1] == '\n'?"":"\n"); fflush(stderr);}}
+/** Log to stderr, and to the trace if it is on (see napa_trace.h) */
+#define DPRINT(ll, format, ... )  {struct timeval tnow; napa_trace(ll, format, ##__VA_ARGS__ ); if(ll <= ml_log_level) {gettimeofday(&tnow,NULL); fprintf(stderr, "%ld.%03ld "format, tnow.tv_sec, tnow.tv_usec/1000, ##__VA_ARGS__ );fprintf(stderr,format[sizeof(format)-2] == '\n'?"":"\n"); fflush(stderr);}}
 
 #define debug(format, ... ) DPRINT(4 ,format, ##__VA_ARGS__ )
 /** Convenience macro to log LOG_INFO messages */
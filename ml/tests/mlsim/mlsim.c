@@ -0,0 +1,478 @@
+/*
+ * This file is part of the Messaging Library.
+ *
+ * The Messaging Library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * The Messaging Library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the Messaging Library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * @file mlsim.c
+ * @brief Deterministic messaging layer benchmark over the simulated network of netsim.c.
+ *
+ * Node 0 opens a connection to every other node and sends them a stream of
+ * messages at a fixed interval. Delivery ratio, goodput, delivery latency
+ * percentiles and link statistics are printed at the end. Everything runs on
+ * the virtual clock, so two runs with the same parameters and seed give the
+ * same numbers.
+ *
+ * With -R the messages are sent with confirmation: the messaging layer
+ * retransmits them until they are delivered, and the confirmations are counted.
+ * With -C the path MTU drops half way through the stream, so that the
+ * reliable messages cut at the old one have to be resolved.
+ * With -A the output rate of node 0 adapts to the links: the receivers report
+ * the delay of every message back to node 0, like the monitoring layer does.
+ *
+ * The exit status is 1 if less than the fraction of messages given with -e
+ * was delivered, if the 99th percentile of the latency is above the bound
+ * given with -L, or if the output rate adapted with -A, averaged over the
+ * second half of the stream, is more than 15% off the rate given with -O, or if
+ * a message sent with -R is neither confirmed nor given up at the end, so
+ * the program can be used as a regression test.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+
+#include "ml.h"
+#include "netsim.h"
+
+#define MSG_TYPE_SIM 20
+#define SIM_PORT 6000
+/* first bytes of an ML packet, ML_MAGIC and ML_VERSION of transmissionHandler.h */
+#define SIM_ML_MAGIC 0xA5
+#define SIM_ML_VERSION 1
+
+/* entry points of one messaging layer copy */
+struct ml_node_api {
+	int (*mlInit)(bool, struct timeval, const int, const char *, const int, const char *, receive_localsocketID_cb, void *);
+	void (*mlSetVerbosity)(int);
+	void (*mlRegisterRecvDataCb)(receive_data_cb, unsigned char);
+	int (*mlOpenConnection)(socketID_handle, receive_connection_cb, void *, const send_params);
+	int (*mlSendData)(const int, char *, int, unsigned char, send_params *);
+	void (*mlSetRateLimiterParams)(int, int, int, int, double);
+	int (*mlGetPathMTU)(int);
+	int (*mlGetStats)(int, ml_stats *, bool);
+	void (*mlRegisterSendConfirmationCb)(send_confirmation_cb);
+	void (*mlSetAdaptiveRate)(int, int);
+	void (*mlRateFeedback)(socketID_handle, double, double);
+	int (*mlGetOutputRate)();
+	void (*mlSetTXQueueAQM)(int, int);
+};
+
+#define ML_NODE_DECL(p) \
+	int p##mlInit(bool, struct timeval, const int, const char *, const int, const char *, receive_localsocketID_cb, void *); \
+	void p##mlSetVerbosity(int); \
+	void p##mlRegisterRecvDataCb(receive_data_cb, unsigned char); \
+	int p##mlOpenConnection(socketID_handle, receive_connection_cb, void *, const send_params); \
+	int p##mlSendData(const int, char *, int, unsigned char, send_params *); \
+	void p##mlSetRateLimiterParams(int, int, int, int, double); \
+	int p##mlGetPathMTU(int); \
+	int p##mlGetStats(int, ml_stats *, bool); \
+	void p##mlRegisterSendConfirmationCb(send_confirmation_cb); \
+	void p##mlSetAdaptiveRate(int, int); \
+	void p##mlRateFeedback(socketID_handle, double, double); \
+	int p##mlGetOutputRate(); \
+	void p##mlSetTXQueueAQM(int, int);
+
+#define ML_NODE_API(p) { p##mlInit, p##mlSetVerbosity, p##mlRegisterRecvDataCb, p##mlOpenConnection, \
+	p##mlSendData, p##mlSetRateLimiterParams, p##mlGetPathMTU, p##mlGetStats, p##mlRegisterSendConfirmationCb, \
+	p##mlSetAdaptiveRate, p##mlRateFeedback, p##mlGetOutputRate, p##mlSetTXQueueAQM }
+
+ML_NODE_DECL(n0_) ML_NODE_DECL(n1_) ML_NODE_DECL(n2_) ML_NODE_DECL(n3_)
+ML_NODE_DECL(n4_) ML_NODE_DECL(n5_) ML_NODE_DECL(n6_) ML_NODE_DECL(n7_)
+
+static struct ml_node_api api[SIM_MAX_NODES] = {
+	ML_NODE_API(n0_), ML_NODE_API(n1_), ML_NODE_API(n2_), ML_NODE_API(n3_),
+	ML_NODE_API(n4_), ML_NODE_API(n5_), ML_NODE_API(n6_), ML_NODE_API(n7_)
+};
+
+/* header of every test message */
+struct sim_msg {
+	uint32_t seq;
+	uint64_t sent;	///< virtual send time (us)
+} __attribute__((packed));
+
+static int nodes = 4;
+static int msgs = 500;
+static int msg_size = 20000;
+static sim_time_t interval = 20000;
+static sim_time_t drain_time = 10000000;
+static bool reliable;
+static int adaptive;
+static int deadline;
+static int prio_every;
+static int garbage_rate;
+static int lower_mtu;
+static long garbage_sent;
+static struct sim_link net_link;
+
+static socketID_handle local_id[SIM_MAX_NODES];
+static int con_id[SIM_MAX_NODES];
+static char *payload;
+static int next_seq;
+
+static long rx_msgs[SIM_MAX_NODES];
+static long rx_bytes[SIM_MAX_NODES];
+static long rx_dups[SIM_MAX_NODES];
+static char *rx_seen[SIM_MAX_NODES];
+static sim_time_t *latency;
+static long nr_latency;
+static sim_time_t *prio_latency;
+static long nr_prio_latency;
+static sim_time_t last_rx;
+static long confirmed, given_up;
+static double rate_sum;
+static long nr_rate;
+
+static void local_id_cb(socketID_handle id, int errorstatus)
+{
+	local_id[sim_current] = errorstatus ? NULL : id;
+}
+
+static void connection_cb(int connectionID, void *arg)
+{
+	*(int *) arg = connectionID;
+}
+
+struct sim_feedback {
+	int node;
+	double delay;
+};
+
+static void feedback(void *arg)
+{
+	struct sim_feedback *f = arg;
+
+	api[0].mlRateFeedback(local_id[f->node], f->delay, NAN);
+	free(f);
+}
+
+static void rx_cb(char *buffer, int buflen, unsigned char msgtype, recv_params *rparams)
+{
+	struct sim_msg *m = (struct sim_msg *) buffer;
+	int n = sim_current;
+
+	if (buflen < sizeof(struct sim_msg) || m->seq >= msgs) return;
+	if (rx_seen[n][m->seq]) {
+		rx_dups[n]++;
+		return;
+	}
+	rx_seen[n][m->seq] = 1;
+	rx_msgs[n]++;
+	rx_bytes[n] += buflen;
+	latency[nr_latency++] = sim_now() - m->sent;
+	if (prio_every && m->seq % prio_every == 0) prio_latency[nr_prio_latency++] = sim_now() - m->sent;
+	last_rx = sim_now();
+	if (adaptive) {
+		struct sim_feedback *f = malloc(sizeof(*f));
+		f->node = n;
+		f->delay = (sim_now() - m->sent) / 1000000.0;
+		sim_schedule(0, net_link.latency, feedback, f);
+	}
+}
+
+static void confirmation_cb(int connectionID, int msgID, unsigned char msgtype, bool delivered)
+{
+	if (delivered)
+		confirmed++;
+	else
+		given_up++;
+}
+
+static void send_next(void *arg)
+{
+	struct sim_msg *m = (struct sim_msg *) payload;
+	send_params sp;
+	int i;
+
+	memset(&sp, 0, sizeof(sp));
+	sp.confirmation = reliable;
+	sp.deadline = deadline;
+	sp.sched_priority = prio_every && next_seq % prio_every == 0 ? 1 : 0;
+	m->seq = next_seq++;
+	m->sent = sim_now();
+	for (i = 1; i < nodes; i++)
+		if (con_id[i] >= 0) api[0].mlSendData(con_id[i], payload, msg_size, MSG_TYPE_SIM, &sp);
+	/* the adaptive rate once it had the first half of the stream to settle */
+	if (adaptive && next_seq > msgs / 2) {
+		rate_sum += api[0].mlGetOutputRate() / 1000.0;
+		nr_rate++;
+	}
+	if (next_seq < msgs) sim_schedule(0, interval, send_next, NULL);
+}
+
+static void drop_mtu(void *arg)
+{
+	int i, j;
+
+	for (i = 0; i < nodes; i++)
+		for (j = 0; j < nodes; j++)
+			sim_get_link(i, j)->mtu = lower_mtu;
+}
+
+/* malformed packets from node 0 to a random receiver: random bytes, half of them behind an ML magic and version */
+static void send_garbage(void *arg)
+{
+	unsigned char buf[1400];
+	int len = rand() % sizeof(buf), i;
+
+	for (i = 0; i < len; i++) buf[i] = rand();
+	if (len >= 2 && rand() % 2) {
+		buf[0] = SIM_ML_MAGIC;
+		buf[1] = SIM_ML_VERSION;
+	}
+	sim_inject(0, 1 + rand() % (nodes - 1), buf, len);
+	garbage_sent++;
+	if (next_seq < msgs) sim_schedule(0, 1000000 / garbage_rate, send_garbage, NULL);
+}
+
+static int cmp_time(const void *a, const void *b)
+{
+	sim_time_t x = *(const sim_time_t *) a, y = *(const sim_time_t *) b;
+	return x < y ? -1 : x > y;
+}
+
+static double percentile(const sim_time_t *sorted, long n, double p)
+{
+	long i;
+	if (!n) return 0;
+	i = (long) (p * (n - 1) + 0.5);
+	return sorted[i] / 1000.0;
+}
+
+/* stateless helper, any copy will do */
+double n0_mlStatsPercentile(const ml_histogram *h, double p);
+#define mlStatsPercentile n0_mlStatsPercentile
+
+static void print_hist(const char *name, const ml_histogram *h)
+{
+	if (!h->count) return;
+	printf("    %-22s n %-7llu avg %8.2f  p50 <%8.2f  p99 <%8.2f  max %8.2f ms\n", name, (unsigned long long) h->count,
+		h->sum / 1000.0 / h->count, mlStatsPercentile(h, 0.5) / 1000.0, mlStatsPercentile(h, 0.99) / 1000.0, h->max / 1000.0);
+}
+
+static void print_stats(int node, const char *what, const ml_stats *s)
+{
+	printf("  node %d %s: tx msgs %llu pkts %llu rtx %llu nacks %llu queued %llu qdrops %llu errors %llu pmtu changes %llu\n"
+		"    aqm drops %llu deadline drops %llu reliable rtx %llu failures %llu\n"
+		"    rx msgs %llu pkts %llu rtx %llu late %llu dups %llu nacks %llu timeout drops %llu no buffer drops %llu malformed %llu\n", node, what,
+		(unsigned long long) s->txMsgs, (unsigned long long) s->txPkts, (unsigned long long) s->txRtxPkts,
+		(unsigned long long) s->txNacks, (unsigned long long) s->txQueued, (unsigned long long) s->txQueueDrops,
+		(unsigned long long) s->txErrors, (unsigned long long) s->pmtuChanges,
+		(unsigned long long) s->txAqmDrops, (unsigned long long) s->txDeadlineDrops,
+		(unsigned long long) s->txRelRtxPkts, (unsigned long long) s->txRelFailures,
+		(unsigned long long) s->rxMsgs, (unsigned long long) s->rxPkts, (unsigned long long) s->rxRtxPkts,
+		(unsigned long long) s->rxLatePkts, (unsigned long long) s->rxDupPkts, (unsigned long long) s->rxNacks,
+		(unsigned long long) s->rxTimeoutDrops, (unsigned long long) s->rxNoBufDrops, (unsigned long long) s->rxMalformedPkts);
+	print_hist("reassembly", &s->reassemblyTime);
+	print_hist("fragment inter-arrival", &s->fragmentInterArrival);
+	print_hist("tx queue", &s->txQueueTime);
+	print_hist("nack recovery", &s->nackRecoveryTime);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [options]\n"
+		"  -n nodes       number of nodes, 2..%d (default 4)\n"
+		"  -m messages    messages sent by node 0 to each peer (default 500)\n"
+		"  -s size        message size in bytes (default 20000)\n"
+		"  -i interval    time between messages in ms (default 20)\n"
+		"  -d delay       one way net_link latency in ms (default 20)\n"
+		"  -j jitter      uniform extra delay in ms, reorders packets (default 0)\n"
+		"  -l loss        packet loss probability (default 0)\n"
+		"  -b bandwidth   net_link bandwidth in kbit/s, 0 = unlimited (default 0)\n"
+		"  -M mtu         net_link MTU in bytes (default 1500)\n"
+		"  -C mtu         lower the net_link MTU to mtu half way through the stream\n"
+		"  -r rate        ML output rate limit in kbit/s, 0 = off (default 0)\n"
+		"  -A maxrate     adapt the output rate of node 0 up to maxrate kbit/s\n"
+		"  -Q target      keep the TX queue time of node 0 below target ms (AQM)\n"
+		"  -D deadline    drop messages still queued deadline ms after they were sent\n"
+		"  -P n           send every n-th message with a higher scheduling priority\n"
+		"  -G rate        inject rate malformed packets per second into the receivers\n"
+		"  -S seed        random seed (default 1)\n"
+		"  -R             send with confirmation (reliable delivery)\n"
+		"  -e ratio       exit with 1 if fewer messages are delivered (default 0)\n"
+		"  -L ms          exit with 1 if the p99 latency is higher, 0 = no bound (default 0)\n"
+		"  -O rate        exit with 1 if the adapted output rate is more than 15%% off rate kbit/s (default 0 = off)\n"
+		"  -v level       ML log level (default 1)\n"
+		"  -t             print the mlGetStats figures of every node\n", name, SIM_MAX_NODES);
+	exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+	struct timeval recv_timeout = {3, 0};
+	unsigned int seed = 1;
+	double min_ratio = 0, max_p99 = 0, expected_rate = 0;
+	int rate = 0, aqm = 0, verbosity = 1, stats = 0;
+	int opt, i, j;
+	long expected, delivered = 0, dups = 0, bytes = 0;
+	long sent_pkts = 0, lost = 0, qdrops = 0, mtu_err = 0;
+	sim_time_t start;
+
+	memset(&net_link, 0, sizeof(net_link));
+	net_link.latency = 20000;
+	net_link.mtu = 1500;
+	net_link.max_queue = 200000;
+
+	while ((opt = getopt(argc, argv, "n:m:s:i:d:j:l:b:M:C:r:A:Q:D:P:G:S:Re:L:O:v:th")) != -1) {
+		switch (opt) {
+			case 'n': nodes = atoi(optarg); break;
+			case 'm': msgs = atoi(optarg); break;
+			case 's': msg_size = atoi(optarg); break;
+			case 'i': interval = atof(optarg) * 1000; break;
+			case 'd': net_link.latency = atof(optarg) * 1000; break;
+			case 'j': net_link.jitter = atof(optarg) * 1000; break;
+			case 'l': net_link.loss = atof(optarg); break;
+			case 'b': net_link.bandwidth = atoll(optarg) * 1000; break;
+			case 'M': net_link.mtu = atoi(optarg); break;
+			case 'C': lower_mtu = atoi(optarg); break;
+			case 'r': rate = atoi(optarg); break;
+			case 'A': adaptive = atoi(optarg); break;
+			case 'Q': aqm = atoi(optarg); break;
+			case 'D': deadline = atoi(optarg); break;
+			case 'P': prio_every = atoi(optarg); break;
+			case 'G': garbage_rate = atoi(optarg); break;
+			case 'S': seed = atoi(optarg); break;
+			case 'R': reliable = true; break;
+			case 'e': min_ratio = atof(optarg); break;
+			case 'L': max_p99 = atof(optarg); break;
+			case 'O': expected_rate = atof(optarg); break;
+			case 'v': verbosity = atoi(optarg); break;
+			case 't': stats = 1; break;
+			default: usage(argv[0]);
+		}
+	}
+	if (nodes < 2 || nodes > SIM_MAX_NODES || msgs <= 0 || msg_size < (int) sizeof(struct sim_msg)) usage(argv[0]);
+
+	sim_init(nodes, seed);
+	srand(seed);
+	for (i = 0; i < nodes; i++)
+		for (j = 0; j < nodes; j++)
+			*sim_get_link(i, j) = net_link;
+
+	payload = calloc(1, msg_size);
+	latency = calloc((long) msgs * nodes, sizeof(sim_time_t));
+	prio_latency = calloc((long) msgs * nodes, sizeof(sim_time_t));
+
+	/* bring up the nodes */
+	for (i = 0; i < nodes; i++) {
+		char ip[32];
+		sprintf(ip, "10.0.0.%d", i + 1);
+		rx_seen[i] = calloc(msgs, 1);
+		con_id[i] = -1;
+		sim_current = i;
+		api[i].mlSetVerbosity(verbosity);
+		api[i].mlRegisterRecvDataCb(rx_cb, MSG_TYPE_SIM);
+		api[i].mlRegisterSendConfirmationCb(confirmation_cb);
+		//a bucket of 20 ms: a burst of a whole second would sit in the link queue and hide the TX queue
+		if (rate) api[i].mlSetRateLimiterParams(rate * 1000 / 8 / 50, rate * 1000, 10000 * 1000, 10000 * 1000, 5);
+		if (adaptive && i == 0) api[i].mlSetAdaptiveRate(100 * 1000, adaptive * 1000);
+		if (aqm && i == 0) api[i].mlSetTXQueueAQM(aqm, 0);
+		if (api[i].mlInit(true, recv_timeout, SIM_PORT, ip, 0, NULL, local_id_cb, sim_node_base(i)) < 0 || !local_id[i]) {
+			fprintf(stderr, "node %d: mlInit failed\n", i);
+			return 2;
+		}
+	}
+
+	/* node 0 connects to everybody */
+	for (i = 1; i < nodes; i++) {
+		send_params sp;
+		memset(&sp, 0, sizeof(sp));
+		sim_current = 0;
+		api[0].mlOpenConnection(local_id[i], connection_cb, &con_id[i], sp);
+	}
+	sim_run_until(sim_now() + 5000000);
+	for (i = 1; i < nodes; i++)
+		if (con_id[i] < 0) fprintf(stderr, "node %d: connection from node 0 not established\n", i);
+
+	/* stream */
+	start = sim_now();
+	sim_schedule(0, 0, send_next, NULL);
+	if (garbage_rate > 0) sim_schedule(0, 0, send_garbage, NULL);
+	if (lower_mtu > 0) sim_schedule(0, (sim_time_t) msgs * interval / 2, drop_mtu, NULL);
+	sim_run_until(start + (sim_time_t) msgs * interval + drain_time);
+
+	/* report */
+	for (i = 1; i < nodes; i++) {
+		delivered += rx_msgs[i];
+		dups += rx_dups[i];
+		bytes += rx_bytes[i];
+	}
+	for (i = 0; i < nodes; i++)
+		for (j = 0; j < nodes; j++) {
+			struct sim_link *l = sim_get_link(i, j);
+			sent_pkts += l->sent_pkts;
+			lost += l->lost_pkts;
+			qdrops += l->queue_drops;
+			mtu_err += l->mtu_errors;
+		}
+	expected = (long) msgs * (nodes - 1);
+	qsort(latency, nr_latency, sizeof(sim_time_t), cmp_time);
+	qsort(prio_latency, nr_prio_latency, sizeof(sim_time_t), cmp_time);
+
+	printf("nodes %d  messages %d x %d bytes every %.1f ms  net_link: %.1f ms +%.1f ms, loss %.3f, %lld kbit/s, mtu %d\n",
+		nodes, msgs, msg_size, interval / 1000.0, net_link.latency / 1000.0, net_link.jitter / 1000.0, net_link.loss,
+		(long long) net_link.bandwidth / 1000, net_link.mtu);
+	printf("delivered %ld/%ld (%.2f%%)  duplicates %ld  goodput %.3f Mbit/s\n", delivered, expected,
+		100.0 * delivered / expected, dups, last_rx > start ? bytes * 8.0 / (last_rx - start) : 0.0);
+	printf("latency ms: p50 %.2f  p90 %.2f  p99 %.2f  max %.2f\n", percentile(latency, nr_latency, 0.5),
+		percentile(latency, nr_latency, 0.9), percentile(latency, nr_latency, 0.99),
+		nr_latency ? latency[nr_latency - 1] / 1000.0 : 0.0);
+	if (prio_every) {
+		long prio_expected = (long) ((msgs + prio_every - 1) / prio_every) * (nodes - 1);
+		printf("priority messages delivered %ld/%ld  latency ms: p50 %.2f  p99 %.2f  max %.2f\n", nr_prio_latency,
+			prio_expected, percentile(prio_latency, nr_prio_latency, 0.5), percentile(prio_latency, nr_prio_latency, 0.99),
+			nr_prio_latency ? prio_latency[nr_prio_latency - 1] / 1000.0 : 0.0);
+	}
+	printf("packets: sent %ld  lost %ld  queue drops %ld  mtu errors %ld\n", sent_pkts, lost, qdrops, mtu_err);
+	if (reliable)
+		printf("confirmed %ld  given up %ld\n", confirmed, given_up);
+	if (garbage_rate > 0) {
+		ml_stats s;
+		long malformed = 0;
+		for (i = 1; i < nodes; i++) {
+			sim_current = i;
+			if (api[i].mlGetStats(-1, &s, false) == 0) malformed += s.rxMalformedPkts;
+		}
+		printf("malformed packets injected %ld  dropped as malformed %ld\n", garbage_sent, malformed);
+	}
+	if (adaptive) {
+		sim_current = 0;
+		printf("output rate %d kbit/s, %.0f kbit/s on average over the second half\n", api[0].mlGetOutputRate() / 1000,
+			nr_rate ? rate_sum / nr_rate : 0.0);
+	}
+	for (i = 1; i < nodes; i++) {
+		sim_current = 0;
+		printf("  node %d: %ld messages, path mtu %d\n", i, rx_msgs[i], con_id[i] >= 0 ? api[0].mlGetPathMTU(con_id[i]) : -1);
+	}
+	if (stats) {
+		ml_stats s;
+		for (i = 0; i < nodes; i++) {
+			sim_current = i;
+			if (api[i].mlGetStats(-1, &s, false) == 0) print_stats(i, "messaging layer", &s);
+		}
+	}
+
+	if (reliable && confirmed + given_up < expected) return 1;
+	if (max_p99 > 0 && percentile(latency, nr_latency, 0.99) > max_p99) return 1;
+	if (expected_rate > 0 && (!nr_rate || fabs(rate_sum / nr_rate - expected_rate) > 0.15 * expected_rate)) return 1;
+	return (double) delivered / expected < min_ratio ? 1 : 0;
+}
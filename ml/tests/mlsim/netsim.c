@@ -0,0 +1,530 @@
+/*
+ * This file is part of the Messaging Library.
+ *
+ * The Messaging Library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * The Messaging Library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the Messaging Library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <event2/event.h>
+#include <napa_trace.h>
+
+#include "netsim.h"
+
+#define SIM_FD_BASE 1000
+#define SIM_MAX_SOCKETS (SIM_MAX_NODES * 2)
+#define SIM_MAX_PKT 65536
+#define SIM_EPOCH 1300000000	// virtual time 0 as seen by gettimeofday
+#define SIM_TTL 64
+
+/* libevent replacement: timers and read events on simulated sockets */
+struct event {
+	int node;
+	evutil_socket_t fd;
+	short what;
+	event_callback_fn cb;
+	void *arg;
+	int once;	///< created by event_base_once, freed after firing
+	sim_time_t when;
+	uint64_t seq;	///< insertion order, makes equal times deterministic
+	int heap_idx;	///< position in the timer heap, -1 if not scheduled
+	void (*fn)(void *arg);	///< internal callbacks (packet delivery, sim_schedule)
+};
+
+struct sim_packet {
+	struct sim_packet *next;
+	struct sockaddr_storage from;
+	int len;
+	char data[];
+};
+
+struct sim_socket {
+	int used;
+	int node;
+	struct sockaddr_in addr;
+	struct sim_packet *head, *tail;
+	struct event *rev;	///< read event registered by the node
+};
+
+struct sim_delivery {
+	struct sim_socket *sock;
+	struct sim_packet *pkt;
+};
+
+int sim_current = 0;
+
+static int nr_nodes;
+static sim_time_t now;
+static uint64_t next_seq;
+static uint64_t rng_state;
+static char bases[SIM_MAX_NODES];
+static struct sim_link links[SIM_MAX_NODES][SIM_MAX_NODES];
+static struct sim_socket sockets[SIM_MAX_SOCKETS];
+
+static struct event **heap;
+static int heap_len, heap_size;
+
+/************************** helpers ********************************/
+
+static double rnd()
+{
+	// xorshift64*
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return ((rng_state * 2685821657736338717ULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static int ev_before(struct event *a, struct event *b)
+{
+	return a->when < b->when || (a->when == b->when && a->seq < b->seq);
+}
+
+static void heap_swap(int i, int j)
+{
+	struct event *t = heap[i];
+	heap[i] = heap[j];
+	heap[j] = t;
+	heap[i]->heap_idx = i;
+	heap[j]->heap_idx = j;
+}
+
+static void heap_up(int i)
+{
+	while (i > 0 && ev_before(heap[i], heap[(i - 1) / 2])) {
+		heap_swap(i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+}
+
+static void heap_down(int i)
+{
+	while (1) {
+		int l = 2 * i + 1, r = l + 1, m = i;
+		if (l < heap_len && ev_before(heap[l], heap[m])) m = l;
+		if (r < heap_len && ev_before(heap[r], heap[m])) m = r;
+		if (m == i) return;
+		heap_swap(i, m);
+		i = m;
+	}
+}
+
+static void timer_remove(struct event *ev)
+{
+	int i = ev->heap_idx;
+
+	if (i < 0) return;
+	heap_swap(i, --heap_len);
+	ev->heap_idx = -1;
+	if (i < heap_len) {
+		heap_down(i);
+		heap_up(i);
+	}
+}
+
+static void timer_add(struct event *ev, sim_time_t delay)
+{
+	timer_remove(ev);
+	if (heap_len == heap_size) {
+		heap_size = heap_size ? heap_size * 2 : 1024;
+		heap = realloc(heap, heap_size * sizeof(*heap));
+	}
+	ev->when = now + delay;
+	ev->seq = next_seq++;
+	ev->heap_idx = heap_len;
+	heap[heap_len++] = ev;
+	heap_up(ev->heap_idx);
+}
+
+static struct sim_socket *fd2sock(int fd)
+{
+	if (fd < SIM_FD_BASE || fd >= SIM_FD_BASE + SIM_MAX_SOCKETS || !sockets[fd - SIM_FD_BASE].used) return NULL;
+	return &sockets[fd - SIM_FD_BASE];
+}
+
+static struct event *new_event(int node)
+{
+	struct event *ev = calloc(1, sizeof(struct event));
+	ev->node = node;
+	ev->fd = -1;
+	ev->heap_idx = -1;
+	return ev;
+}
+
+/* let the node read all queued packets, as libevent would on a level triggered socket */
+static void notify_readable(struct sim_socket *s)
+{
+	while (s->head && s->rev) {
+		struct sim_packet *before = s->head;
+		sim_current = s->node;
+		s->rev->cb(s->rev->fd, EV_READ, s->rev->arg);
+		if (s->head == before) break;	// the node did not read
+	}
+}
+
+static void deliver(void *arg)
+{
+	struct sim_delivery *d = arg;
+
+	d->pkt->next = NULL;
+	if (d->sock->tail) d->sock->tail->next = d->pkt;
+	else d->sock->head = d->pkt;
+	d->sock->tail = d->pkt;
+	notify_readable(d->sock);
+	free(d);
+}
+
+/************************** simulator API ***************************/
+
+void sim_inject(int src, int dst, const void *data, int len)
+{
+	struct sim_socket *from = NULL, *to = NULL;
+	struct sim_packet *pkt;
+	int i;
+
+	for (i = 0; i < SIM_MAX_SOCKETS; i++) {
+		if (!sockets[i].used) continue;
+		if (!from && sockets[i].node == src) from = &sockets[i];
+		if (!to && sockets[i].node == dst) to = &sockets[i];
+	}
+	if (!from || !to) return;
+
+	pkt = malloc(sizeof(struct sim_packet) + len);
+	memset(&pkt->from, 0, sizeof(pkt->from));
+	memcpy(&pkt->from, &from->addr, sizeof(struct sockaddr_in));
+	pkt->len = len;
+	memcpy(pkt->data, data, len);
+	pkt->next = NULL;
+	if (to->tail) to->tail->next = pkt;
+	else to->head = pkt;
+	to->tail = pkt;
+	notify_readable(to);
+}
+
+void sim_init(int nodes, unsigned int seed)
+{
+	int i, j;
+
+	nr_nodes = nodes;
+	now = 0;
+	rng_state = seed ? seed : 1;
+	for (i = 0; i < SIM_MAX_NODES; i++)
+		for (j = 0; j < SIM_MAX_NODES; j++) {
+			memset(&links[i][j], 0, sizeof(struct sim_link));
+			links[i][j].mtu = 1500;
+			links[i][j].max_queue = 200000;
+		}
+}
+
+struct sim_link *sim_get_link(int src, int dst)
+{
+	return &links[src][dst];
+}
+
+void *sim_node_base(int node)
+{
+	return &bases[node];
+}
+
+sim_time_t sim_now()
+{
+	return now;
+}
+
+void sim_schedule(int node, sim_time_t delay, void (*fn)(void *arg), void *arg)
+{
+	struct event *ev = new_event(node);
+	ev->fn = fn;
+	ev->arg = arg;
+	ev->once = 1;
+	timer_add(ev, delay);
+}
+
+long sim_run_until(sim_time_t until)
+{
+	long n = 0;
+
+	while (heap_len && heap[0]->when <= until) {
+		struct event *ev = heap[0];
+		int once = ev->once;	// the callback may free its own event
+		timer_remove(ev);
+		now = ev->when;
+		sim_current = ev->node;
+		if (ev->fn) ev->fn(ev->arg);
+		else ev->cb(ev->fd, EV_TIMEOUT, ev->arg);
+		if (once) free(ev);
+		n++;
+	}
+	if (now < until) now = until;
+	return n;
+}
+
+/************************** clock *************************************/
+
+int sim_gettimeofday(struct timeval *tv, void *tz)
+{
+	tv->tv_sec = SIM_EPOCH + now / 1000000;
+	tv->tv_usec = now % 1000000;
+	return 0;
+}
+
+time_t sim_time(time_t *t)
+{
+	time_t s = SIM_EPOCH + now / 1000000;
+	if (t) *t = s;
+	return s;
+}
+
+int sim_clock_gettime(clockid_t clk, struct timespec *ts)
+{
+	ts->tv_sec = SIM_EPOCH + now / 1000000;
+	ts->tv_nsec = now % 1000000 * 1000;
+	return 0;
+}
+
+/************************** trace ***********************************/
+
+/* the messaging layer logs through napa_trace.h; tracing stays off in the simulator */
+int napa_trace_level = -1;
+
+void napaTraceWrite(struct napa_trace_site *site, ...)
+{
+}
+
+/************************** libevent ********************************/
+
+struct event *sim_event_new(struct event_base *base, evutil_socket_t fd, short what, event_callback_fn cb, void *arg)
+{
+	struct event *ev = new_event((char *) base - bases);
+	ev->fd = fd;
+	ev->what = what;
+	ev->cb = cb;
+	ev->arg = arg;
+	return ev;
+}
+
+int sim_event_add(struct event *ev, const struct timeval *tv)
+{
+	struct sim_socket *s;
+
+	if ((ev->what & EV_READ) && (s = fd2sock(ev->fd)) != NULL) {
+		s->rev = ev;
+	}
+	if (tv) timer_add(ev, (sim_time_t) tv->tv_sec * 1000000 + tv->tv_usec);
+	return 0;
+}
+
+int sim_event_del(struct event *ev)
+{
+	struct sim_socket *s;
+
+	timer_remove(ev);
+	if ((s = fd2sock(ev->fd)) != NULL && s->rev == ev) s->rev = NULL;
+	return 0;
+}
+
+void sim_event_free(struct event *ev)
+{
+	sim_event_del(ev);
+	free(ev);
+}
+
+int sim_event_base_once(struct event_base *base, evutil_socket_t fd, short what, event_callback_fn cb, void *arg, const struct timeval *tv)
+{
+	struct event *ev = sim_event_new(base, fd, what, cb, arg);
+	ev->once = 1;
+	timer_add(ev, tv ? (sim_time_t) tv->tv_sec * 1000000 + tv->tv_usec : 0);
+	return 0;
+}
+
+int sim_event_base_gettimeofday_cached(struct event_base *base, struct timeval *tv)
+{
+	return sim_gettimeofday(tv, NULL);
+}
+
+int sim_evutil_make_socket_nonblocking(evutil_socket_t fd)
+{
+	return 0;
+}
+
+/************************** sockets *********************************/
+
+int sim_socket(int domain, int type, int protocol)
+{
+	int i;
+
+	if (domain != AF_INET || type != SOCK_DGRAM) {
+		errno = EAFNOSUPPORT;
+		return -1;
+	}
+	for (i = 0; i < SIM_MAX_SOCKETS; i++) {
+		if (!sockets[i].used) {
+			memset(&sockets[i], 0, sizeof(struct sim_socket));
+			sockets[i].used = 1;
+			sockets[i].node = sim_current;
+			return SIM_FD_BASE + i;
+		}
+	}
+	errno = EMFILE;
+	return -1;
+}
+
+int sim_bind(int fd, const struct sockaddr *addr, socklen_t len)
+{
+	struct sim_socket *s = fd2sock(fd);
+
+	if (!s) {
+		errno = EBADF;
+		return -1;
+	}
+	memcpy(&s->addr, addr, sizeof(struct sockaddr_in));
+	return 0;
+}
+
+int sim_setsockopt(int fd, int level, int optname, const void *optval, socklen_t optlen)
+{
+	if (level == IPPROTO_UDP) {	// no UDP offload in the simulator
+		errno = ENOPROTOOPT;
+		return -1;
+	}
+	return fd2sock(fd) ? 0 : -1;
+}
+
+int sim_getsockopt(int fd, int level, int optname, void *optval, socklen_t *optlen)
+{
+	if (level == IPPROTO_IP && optname == IP_TTL && *optlen >= sizeof(int)) {
+		*(int *) optval = SIM_TTL;
+		return 0;
+	}
+	errno = ENOPROTOOPT;
+	return -1;
+}
+
+ssize_t sim_sendmsg(int fd, const struct msghdr *msg, int flags)
+{
+	struct sim_socket *s = fd2sock(fd), *d = NULL;
+	struct sockaddr_in *to = msg->msg_name;
+	struct sim_packet *pkt;
+	struct sim_delivery *dl;
+	struct sim_link *l;
+	sim_time_t start;
+	int i, len = 0;
+
+	if (!s) {
+		errno = EBADF;
+		return -1;
+	}
+	for (i = 0; i < msg->msg_iovlen; i++) len += msg->msg_iov[i].iov_len;
+
+	for (i = 0; i < SIM_MAX_SOCKETS; i++) {
+		if (sockets[i].used && sockets[i].addr.sin_port == to->sin_port &&
+				sockets[i].addr.sin_addr.s_addr == to->sin_addr.s_addr) {
+			d = &sockets[i];
+			break;
+		}
+	}
+	if (!d) return len;	// nobody listens: silently lost, as UDP would be
+
+	l = &links[s->node][d->node];
+	if (len + 28 > l->mtu) {
+		l->mtu_errors++;
+		errno = EMSGSIZE;
+		return -1;
+	}
+	l->sent_pkts++;
+	l->sent_bytes += len;
+
+	start = l->busy_until > now ? l->busy_until : now;
+	if (start - now > l->max_queue) {
+		l->queue_drops++;
+		return len;
+	}
+	if (l->bandwidth) l->busy_until = start + (sim_time_t) (len + 28) * 8 * 1000000 / l->bandwidth;
+	else l->busy_until = start;
+	if (l->loss > 0 && rnd() < l->loss) {
+		l->lost_pkts++;
+		return len;
+	}
+
+	pkt = malloc(sizeof(struct sim_packet) + len);
+	memset(&pkt->from, 0, sizeof(pkt->from));
+	memcpy(&pkt->from, &s->addr, sizeof(struct sockaddr_in));
+	pkt->len = 0;
+	for (i = 0; i < msg->msg_iovlen; i++) {
+		memcpy(pkt->data + pkt->len, msg->msg_iov[i].iov_base, msg->msg_iov[i].iov_len);
+		pkt->len += msg->msg_iov[i].iov_len;
+	}
+	dl = malloc(sizeof(struct sim_delivery));
+	dl->sock = d;
+	dl->pkt = pkt;
+	sim_schedule(d->node, l->busy_until - now + l->latency + (l->jitter ? (sim_time_t) (rnd() * l->jitter) : 0), deliver, dl);
+	return len;
+}
+
+ssize_t sim_recvmsg(int fd, struct msghdr *msg, int flags)
+{
+	struct sim_socket *s = fd2sock(fd);
+	struct sim_packet *pkt;
+	struct cmsghdr *cmsg;
+	int len;
+
+	if (!s || (flags & MSG_ERRQUEUE) || !s->head) {
+		errno = s ? EAGAIN : EBADF;
+		return -1;
+	}
+	pkt = s->head;
+	s->head = pkt->next;
+	if (!s->head) s->tail = NULL;
+
+	len = pkt->len < msg->msg_iov[0].iov_len ? pkt->len : msg->msg_iov[0].iov_len;
+	memcpy(msg->msg_iov[0].iov_base, pkt->data, len);
+	if (msg->msg_name) {
+		memcpy(msg->msg_name, &pkt->from, msg->msg_namelen < sizeof(pkt->from) ? msg->msg_namelen : sizeof(pkt->from));
+	}
+	if (msg->msg_control && msg->msg_controllen >= CMSG_SPACE(sizeof(int))) {
+		cmsg = CMSG_FIRSTHDR(msg);
+		cmsg->cmsg_level = IPPROTO_IP;
+		cmsg->cmsg_type = IP_TTL;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		*(int *) CMSG_DATA(cmsg) = SIM_TTL;
+		msg->msg_controllen = CMSG_SPACE(sizeof(int));
+	} else {
+		msg->msg_controllen = 0;
+	}
+	msg->msg_flags = pkt->len > len ? MSG_TRUNC : 0;
+	free(pkt);
+	return len;
+}
+
+int sim_close(int fd)
+{
+	struct sim_socket *s = fd2sock(fd);
+	struct sim_packet *pkt;
+
+	if (!s) return close(fd);
+	while ((pkt = s->head)) {
+		s->head = pkt->next;
+		free(pkt);
+	}
+	s->used = 0;
+	return 0;
+}
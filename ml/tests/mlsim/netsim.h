@@ -0,0 +1,108 @@
+/*
+ * This file is part of the Messaging Library.
+ *
+ * The Messaging Library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * The Messaging Library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the Messaging Library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * @file netsim.h
+ * @brief Discrete event network simulator for running several messaging layer instances in one process.
+ *
+ * Every node is a copy of the messaging layer object whose globals were renamed
+ * (see Makefile). The calls the messaging layer makes to the clock, to the UDP
+ * socket API and to libevent are redirected to the sim_* functions in netsim.c.
+ * They run on a virtual clock and deliver packets through an in-memory switch,
+ * where each directed link has its own latency, jitter, loss, bandwidth and MTU.
+ */
+
+#ifndef NETSIM_H
+#define NETSIM_H
+
+#include <stdint.h>
+
+/**
+ * Number of messaging layer copies linked into the simulator
+ */
+#define SIM_MAX_NODES 8
+
+/**
+ * Virtual time in microseconds
+ */
+typedef uint64_t sim_time_t;
+
+/**
+ * Parameters of a directed link
+ */
+struct sim_link {
+	sim_time_t latency;	///< propagation delay (us)
+	sim_time_t jitter;	///< uniformly distributed extra delay (us), reorders packets
+	double loss;		///< packet loss probability
+	int64_t bandwidth;	///< bits/s, 0 for unlimited
+	int mtu;		///< IP MTU, larger datagrams fail with EMSGSIZE
+	sim_time_t max_queue;	///< packets waiting longer than this for the link are dropped (us)
+
+	/* statistics */
+	long sent_pkts;
+	long sent_bytes;
+	long lost_pkts;	///< random loss
+	long queue_drops;	///< drops due to max_queue
+	long mtu_errors;	///< datagrams refused because of the MTU
+	sim_time_t busy_until;	///< end of the last serialization
+};
+
+/**
+ * Initialize the simulator
+ * @param nodes number of nodes (<= SIM_MAX_NODES)
+ * @param seed seed for loss and jitter
+ */
+void sim_init(int nodes, unsigned int seed);
+
+/**
+ * Get the link from node src to node dst
+ */
+struct sim_link *sim_get_link(int src, int dst);
+
+/**
+ * Get the event_base handle to be passed to mlInit of a node
+ */
+void *sim_node_base(int node);
+
+/**
+ * Node whose code is currently running
+ */
+extern int sim_current;
+
+/**
+ * Hand a datagram to the first socket of node dst, as if node src sent it, bypassing the link
+ */
+void sim_inject(int src, int dst, const void *data, int len);
+
+/**
+ * Current virtual time (us)
+ */
+sim_time_t sim_now();
+
+/**
+ * Run a function as node node after delay microseconds of virtual time
+ */
+void sim_schedule(int node, sim_time_t delay, void (*fn)(void *arg), void *arg);
+
+/**
+ * Process events until the virtual clock reaches until or nothing is left to do
+ * @return the number of events processed
+ */
+long sim_run_until(sim_time_t until);
+
+#endif
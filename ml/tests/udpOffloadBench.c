@@ -0,0 +1,137 @@
+/*
+ * This file is part of the Messaging Library.
+ *
+ * The Messaging Library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * The Messaging Library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the Messaging Library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * @file udpOffloadBench.c
+ * @brief Loopback benchmark of the udpSocket send/receive path with and without UDP GSO/GRO.
+ *
+ * Chunks are cut into MTU sized packets the same way send_msg does and sent
+ * to a second socket on 127.0.0.1, which receives and splits them as recv_pkg does.
+ * For each mode the received payload rate and the CPU time per byte are printed.
+ *
+ * Usage: udpOffloadBench [chunks] [chunk size in bytes] [port]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "ml_all.h"
+
+#define PKT_SIZE 1472
+#define HDR_SIZE 21
+
+static double now_s()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static double cpu_s()
+{
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+static long drain(int fd, char *buf, long *pkts, long *calls)
+{
+	long bytes = 0;
+	int recvSize, segSize, ttl, offset;
+	struct sockaddr_storage from;
+	struct timespec arrival;
+
+	while (1) {
+		recvSize = UDP_OFFLOAD_MAX_BYTES;
+		recvPacket(fd, buf, &recvSize, &from, NULL, &ttl, &segSize, &arrival);
+		if (recvSize <= 0) break;
+		(*calls)++;
+		if (segSize <= 0) segSize = recvSize;
+		for (offset = 0; offset < recvSize; offset += segSize) {
+			(*pkts)++;
+			bytes += (recvSize - offset < segSize ? recvSize - offset : segSize) - HDR_SIZE;
+		}
+	}
+	return bytes;
+}
+
+static void run(int offload, int chunks, int chunk_size, int port)
+{
+	static char rbuf[UDP_OFFLOAD_MAX_BYTES];
+	char hdr[HDR_SIZE];
+	char *chunk = malloc(chunk_size);
+	struct sockaddr_storage dst;
+	struct iovec iov[2];
+	long rx_bytes = 0, rx_pkts = 0, rx_calls = 0, tx_pkts = 0;
+	double t0, c0, t, c;
+	int rx, tx, i, offset, active;
+
+	memset(chunk, 0x5a, chunk_size);
+	memset(hdr, 0, sizeof(hdr));
+
+	setUdpOffload(offload);
+	rx = createSocket(port, "127.0.0.1");
+	active = getUdpOffload();
+	tx = createSocket(port + 1, "127.0.0.1");
+	active &= getUdpOffload();
+	if (rx < 0 || tx < 0) {
+		fprintf(stderr, "cannot create sockets on port %d\n", port);
+		exit(1);
+	}
+	init_sockaddr(&dst, port, "127.0.0.1");
+
+	t0 = now_s();
+	c0 = cpu_s();
+	for (i = 0; i < chunks; i++) {
+		for (offset = 0; offset < chunk_size; offset += iov[1].iov_len) {
+			iov[0].iov_base = hdr;
+			iov[0].iov_len = HDR_SIZE;
+			iov[1].iov_base = chunk + offset;
+			iov[1].iov_len = chunk_size - offset < PKT_SIZE - HDR_SIZE ? chunk_size - offset : PKT_SIZE - HDR_SIZE;
+			sendPacketFinal(tx, iov, 2, &dst);
+			tx_pkts++;
+		}
+		flushPackets(tx);
+		rx_bytes += drain(rx, rbuf, &rx_pkts, &rx_calls);
+	}
+	rx_bytes += drain(rx, rbuf, &rx_pkts, &rx_calls);
+	t = now_s() - t0;
+	c = cpu_s() - c0;
+
+	printf("%-8s gso:%d gro:%d  %8.1f Mbit/s  %6.2f ns CPU/byte  rx %ld/%ld pkts in %ld recv calls\n",
+		offload ? "offload" : "plain", !!(active & UDP_OFFLOAD_GSO), !!(active & UDP_OFFLOAD_GRO),
+		rx_bytes * 8 / t / 1e6, rx_bytes ? c * 1e9 / rx_bytes : 0.0, rx_pkts, tx_pkts, rx_calls);
+
+	closeSocket(rx);
+	closeSocket(tx);
+	free(chunk);
+}
+
+int main(int argc, char *argv[])
+{
+	int chunks = argc > 1 ? atoi(argv[1]) : 2000;
+	int chunk_size = argc > 2 ? atoi(argv[2]) : 100000;
+	int port = argc > 3 ? atoi(argv[3]) : 16000;
+
+	run(0, chunks, chunk_size, port);
+	run(1, chunks, chunk_size, port + 2);
+	return 0;
+}
@@ -70,6 +70,21 @@ typedef bool boolean;
 
 #define ML_NACK_MSG 128
 #endif
+
+/**
+ * Fragment of a message sent with send_params.reliable, see util/reliable.h
+ */
+#define ML_REL_DATA_MSG 129
+
+/**
+ * Acknowledgement of reliable fragments, see util/reliable.h
+ */
+#define ML_REL_ACK_MSG 130
+
+/**
+ * Number of fragments following the cumulative acknowledgement that are acknowledged selectively
+ */
+#define REL_SACK_BITS 256
 /**
  * This is the maximum size of the monitoring module header that can be added to the messaging layer header
  */
@@ -126,9 +141,25 @@ typedef struct _socket_ID {
 struct gap {
 	int offsetFrom;
 	int offsetTo;
+	int retry; ///< NACKs left to send for this gap
+	struct timeval nackDue; ///< when the next NACK for this gap is due
 };
 #endif
 
+/**
+ * Disjoint byte ranges of a message payload tracked while it is reassembled,
+ * fragments that would need more are dropped and retransmitted later
+ */
+#define RECV_MAX_RANGES 32
+
+/**
+ * A byte range [from, to) of a message payload
+ */
+struct byte_range {
+	int from;
+	int to;
+};
+
 /**
   * A struct that contains information about data that is being received
   */
@@ -144,14 +175,21 @@ typedef struct {
   char firstPacketArrived; ///< did the first packet arrive 
   int recvFragments; ///< the number of received framgents
   int arrivedBytes; ///< the number of received Bytes
+  int nArrived; ///< the number of ranges in arrived
+  struct byte_range arrived[RECV_MAX_RANGES]; ///< payload ranges received so far, sorted, disjoint and not adjacent
   int monitoringDataHeaderLen; ///< size of the monitoring data header (0 == no header)
   struct event *timeout_event; ///< a timeout event
   struct timeval timeout_value; ///< the value for a libevent timeout
   time_t starttime; ///< the start time
+  int expectedOffset; ///< end of the highest fragment received so far
+  struct timeval firstArrival; ///< arrival of the first fragment
+  struct timeval lastArrival; ///< arrival of the latest fragment
+  char reliable; ///< the message was sent with send_params.reliable
 #ifdef RTX
+  struct timeval nackTime; ///< when the first NACK for this message was sent, 0 if none
   struct event* last_pkt_timeout_event;
+  struct timeval nackDue; ///< expiry of the pending NACK timer, 0 if none
   int txConnectionID;
-  int expectedOffset;
   int gapCounter; //index of the first "free slot"
   struct gap gapArray[RTX_MAX_GAPS];
 #endif
@@ -191,6 +229,15 @@ typedef struct {
   struct receive_connection_cb_list *connection_last;
   send_params defaultSendParams;
   uint32_t keepalive_seq; 
+  ml_stats stats; ///< statistics of this connection, see mlGetStats
+  void *monitoring_data; ///< owned by the monitoring module, see mlGetMonitoringData
+  struct rel_tx *rel_tx; ///< sender state of reliable messages, NULL until the first one
+  struct rel_rx *rel_rx; ///< receiver state of reliable messages, NULL until the first one
+  double rate_base_delay[2]; ///< minimum one way delay reported in the current and the previous epoch (s), see rateFeedback
+  long rate_epoch; ///< epoch of rate_base_delay[0]
+  double rate_qdelay; ///< smoothed queuing delay reported for the path (s)
+  double rate_loss; ///< smoothed loss ratio reported for the path
+  struct timeval rate_updated; ///< time of the latest report, zero if none
 } connect_data;
 
 #define ML_CON_MSG 127
@@ -220,7 +267,39 @@ struct nack_msg {
 /************modifications-END**************/
 #endif
 
+/**
+ * Header in front of the payload of an ML_REL_DATA_MSG packet, after the monitoring packet header
+ */
+struct rel_data_hdr {
+	uint8_t msg_type;	///< the message type of the message
+	uint8_t reserved[3];
+	uint32_t frag_seq;	///< sequence number of the fragment on the connection
+	uint32_t base;	///< the sender does not retransmit fragments before this one any more
+	uint32_t ts;	///< send time (us, sender clock)
+} __attribute__((packed));
+
+/**
+ * Payload of an ML_REL_ACK_MSG packet
+ */
+struct rel_ack_msg {
+	uint32_t cum;	///< all fragments before this one arrived
+	uint32_t echo_ts;	///< ts of the latest fragment that arrived
+	uint32_t hold;	///< time (us) between the arrival of that fragment and this acknowledgement
+	uint32_t delay;	///< arrival time minus ts of that fragment (us, clock offset included)
+	uint32_t sack[REL_SACK_BITS / 32];	///< bit i: fragment cum + 1 + i arrived
+} __attribute__((packed));
+
+/**
+ * First bytes of every ML packet. STUN messages start with two zero bits
+ * (RFC 5389), so ML_MAGIC cannot be taken for one. Peers only understand
+ * packets of their own ML_VERSION.
+ */
+#define ML_MAGIC 0xA5
+#define ML_VERSION 1
+
 struct msg_header {
+	uint8_t magic;	///< ML_MAGIC
+	uint8_t version;	///< ML_VERSION
 	uint32_t offset;
 	uint32_t msg_length;
 	int32_t local_con_id;	///> the local connection id
@@ -235,4 +314,8 @@ struct msg_header {
 
 int sendPacket(const int udpSocket, struct iovec *iov, int len, struct sockaddr_storage *socketaddr);
 
+int send_msg(int con_id, int msg_type, void* msg, int msg_len, bool truncable, send_params * sParams);
+
+const char *conid_to_string(int con_id);
+
 #endif
@@ -0,0 +1,99 @@
+/*
+ * This file is part of the Messaging Library.
+ *
+ * The Messaging Library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * The Messaging Library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the Messaging Library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "../ml_all.h"
+
+#define POOL_CLASSES (POOL_MAX_SHIFT - POOL_MIN_SHIFT + 1)
+
+// free blocks are chained through their first bytes
+struct free_block {
+	struct free_block *next;
+};
+
+static struct free_block *freeLists[POOL_CLASSES];
+
+static struct pool_stats stats;
+
+// index of the smallest class that holds size bytes, -1 if too big
+static int sizeClass(int size)
+{
+	int c = 0;
+
+	while (c < POOL_CLASSES && (1 << (c + POOL_MIN_SHIFT)) < size) c++;
+	return c < POOL_CLASSES ? c : -1;
+}
+
+void *poolAlloc(int size)
+{
+	struct free_block *block;
+	int c = sizeClass(size);
+
+	stats.allocs++;
+	if (c < 0) {
+		stats.oversized++;
+		return malloc(size);
+	}
+
+	block = freeLists[c];
+	if (block) {
+		freeLists[c] = block->next;
+		stats.cachedBytes -= 1 << (c + POOL_MIN_SHIFT);
+		stats.hits++;
+		return block;
+	}
+
+	return malloc(1 << (c + POOL_MIN_SHIFT));
+}
+
+void poolFree(void *ptr, int size)
+{
+	struct free_block *block = ptr;
+	int c;
+
+	if (!ptr) return;
+
+	c = sizeClass(size);
+	if (c < 0 || stats.cachedBytes + (1 << (c + POOL_MIN_SHIFT)) > POOL_MAX_CACHED_BYTES) {
+		if (c >= 0) stats.released++;
+		free(ptr);
+		return;
+	}
+
+	block->next = freeLists[c];
+	freeLists[c] = block;
+	stats.cachedBytes += 1 << (c + POOL_MIN_SHIFT);
+}
+
+void poolFlush()
+{
+	int c;
+	struct free_block *block;
+
+	for (c = 0; c < POOL_CLASSES; c++) {
+		while ((block = freeLists[c])) {
+			freeLists[c] = block->next;
+			free(block);
+		}
+	}
+	stats.cachedBytes = 0;
+}
+
+void poolGetStats(struct pool_stats *s)
+{
+	*s = stats;
+}
@@ -0,0 +1,71 @@
+/*
+ * This file is part of the Messaging Library.
+ *
+ * The Messaging Library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * The Messaging Library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the Messaging Library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+/**
+ * Size-class pool for the receive path.
+ *
+ * Blocks are grouped in power-of-two classes from 1<<POOL_MIN_SHIFT to
+ * 1<<POOL_MAX_SHIFT bytes. Released blocks are kept on a per-class free
+ * list and handed out again instead of going through malloc. Requests
+ * larger than the biggest class are passed straight to malloc/free.
+ * Memory is never zeroed by the pool.
+ */
+
+#define POOL_MIN_SHIFT 6	///< smallest class: 64 bytes
+#define POOL_MAX_SHIFT 21	///< biggest class: 2 MB
+#define POOL_MAX_CACHED_BYTES (32*1024*1024)	///< upper bound for memory kept on the free lists
+
+/**
+ * Pool usage counters
+ */
+struct pool_stats {
+	unsigned long allocs;	///< number of poolAlloc calls
+	unsigned long hits;	///< allocations served from a free list
+	unsigned long oversized;	///< allocations bigger than the biggest class
+	unsigned long released;	///< blocks given back to the system because the pool was full
+	unsigned long cachedBytes;	///< memory currently held on the free lists
+};
+
+/**
+ * Get a block of at least size bytes. The content is undefined.
+ * @param size requested size in bytes
+ * @return pointer to the block or NULL if out of memory
+ */
+void *poolAlloc(int size);
+
+/**
+ * Give a block back to the pool.
+ * @param block a pointer obtained from poolAlloc (NULL is ignored)
+ * @param size the size that was passed to poolAlloc
+ */
+void poolFree(void *block, int size);
+
+/**
+ * Release all cached blocks to the system.
+ */
+void poolFlush();
+
+/**
+ * Copy the current pool counters into stats.
+ */
+void poolGetStats(struct pool_stats *stats);
+
+#endif
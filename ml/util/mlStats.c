@@ -0,0 +1,94 @@
+/*
+ * This file is part of the Messaging Library.
+ *
+ * The Messaging Library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * The Messaging Library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the Messaging Library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "../ml_all.h"
+
+ml_stats globalStats;
+
+void statsHistAdd(ml_histogram *h, uint64_t us)
+{
+	int b = 0;
+	uint64_t v = us;
+
+	// bucket index = number of significant bits
+	while (v && b < ML_HIST_BUCKETS - 1) {
+		v >>= 1;
+		b++;
+	}
+	STATS_INC(h->bucket[b], 1);
+	STATS_INC(h->count, 1);
+	STATS_INC(h->sum, us);
+	// the event loop thread is the only writer
+	if (us > STATS_GET(h->max)) STATS_SET(h->max, us);
+}
+
+uint64_t statsElapsed(const struct timeval *from, const struct timeval *to)
+{
+	int64_t us = (int64_t) (to->tv_sec - from->tv_sec) * 1000000 + (to->tv_usec - from->tv_usec);
+	return us > 0 ? us : 0;
+}
+
+void statsReset(ml_stats *stats)
+{
+	memset(stats, 0, sizeof(ml_stats));
+	gettimeofday(&stats->since, NULL);
+}
+
+/* the counters of an ml_stats: every member after since is an uint64_t, histograms included */
+#define STATS_WORDS ((sizeof(ml_stats) - offsetof(ml_stats, txMsgs)) / sizeof(uint64_t))
+
+void statsSnapshot(ml_stats *stats, ml_stats *copy, bool reset)
+{
+	uint64_t *from = &stats->txMsgs, *to = &copy->txMsgs;
+	struct timeval now;
+	size_t i;
+
+	copy->since.tv_sec = STATS_GET(stats->since.tv_sec);
+	copy->since.tv_usec = STATS_GET(stats->since.tv_usec);
+	for (i = 0; i < STATS_WORDS; i++) {
+		// the queue occupation is a state, not a counter
+		if (reset && &from[i] != &stats->txQueuePkts && &from[i] != &stats->txQueueBytes)
+			to[i] = __atomic_exchange_n(&from[i], 0, __ATOMIC_RELAXED);
+		else
+			to[i] = STATS_GET(from[i]);
+	}
+	if (!reset) return;
+	STATS_SET(stats->txQueueMaxBytes, STATS_GET(stats->txQueueBytes));
+	gettimeofday(&now, NULL);
+	STATS_SET(stats->since.tv_sec, now.tv_sec);
+	STATS_SET(stats->since.tv_usec, now.tv_usec);
+}
+
+double mlStatsPercentile(const ml_histogram *h, double p)
+{
+	uint64_t rank, seen = 0;
+	int b;
+
+	if (h->count == 0) return 0;
+	if (p < 0) p = 0;
+	if (p > 1) p = 1;
+	rank = (uint64_t) (p * (h->count - 1)) + 1;
+	for (b = 0; b < ML_HIST_BUCKETS - 1; b++) {
+		seen += h->bucket[b];
+		if (seen >= rank) {
+			uint64_t upper = b ? (((uint64_t) 1 << b) - 1) : 0;
+			return upper < h->max ? upper : h->max;
+		}
+	}
+	return h->max;
+}
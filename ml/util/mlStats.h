@@ -0,0 +1,93 @@
+/*
+ * This file is part of the Messaging Library.
+ *
+ * The Messaging Library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * The Messaging Library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the Messaging Library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef ML_STATS_H
+#define ML_STATS_H
+
+/**
+ * Bookkeeping behind mlGetStats.
+ *
+ * Every event is accounted in the global ml_stats and in the ml_stats of the
+ * connection it belongs to. Only the event loop thread writes the counters,
+ * with relaxed atomics, so that mlGetStats can read them from any thread
+ * without locks; a snapshot is exact per counter, not across counters.
+ */
+
+/**
+ * Statistics of the whole messaging layer
+ */
+extern ml_stats globalStats;
+
+/**
+ * Get the statistics of a connection (defined in ml.c)
+ * @return NULL if con_id is not an open connection
+ */
+ml_stats *connStats(int con_id);
+
+/**
+ * Relaxed atomic access to a single counter
+ */
+#define STATS_INC(var, n) __atomic_fetch_add(&(var), (n), __ATOMIC_RELAXED)
+#define STATS_DEC(var, n) __atomic_fetch_sub(&(var), (n), __ATOMIC_RELAXED)
+#define STATS_SET(var, v) __atomic_store_n(&(var), (v), __ATOMIC_RELAXED)
+#define STATS_GET(var) __atomic_load_n(&(var), __ATOMIC_RELAXED)
+
+/**
+ * Add n to a counter of the global and of the connection statistics
+ */
+#define STATS_ADD(con_id, field, n) do { \
+	ml_stats *_cs = connStats(con_id); \
+	STATS_INC(globalStats.field, (n)); \
+	if (_cs) STATS_INC(_cs->field, (n)); \
+} while (0)
+
+/**
+ * Add a sample (us) to a histogram of the global and of the connection statistics
+ */
+#define STATS_HIST(con_id, field, us) do { \
+	ml_stats *_cs = connStats(con_id); \
+	uint64_t _us = (us); \
+	statsHistAdd(&globalStats.field, _us); \
+	if (_cs) statsHistAdd(&_cs->field, _us); \
+} while (0)
+
+/**
+ * Add a sample to a histogram
+ * @param us the sample in microseconds
+ */
+void statsHistAdd(ml_histogram *h, uint64_t us);
+
+/**
+ * Time from from to to in microseconds, 0 if to is earlier
+ */
+uint64_t statsElapsed(const struct timeval *from, const struct timeval *to);
+
+/**
+ * Clear all counters and histograms and start a new interval now.
+ * Only for statistics no other thread reads yet.
+ */
+void statsReset(ml_stats *stats);
+
+/**
+ * Copy the statistics counter by counter, and with reset clear each counter as
+ * it is read, so that no event is lost, and start a new interval.
+ * Safe against the event loop thread updating the statistics meanwhile.
+ */
+void statsSnapshot(ml_stats *stats, ml_stats *copy, bool reset);
+
+#endif
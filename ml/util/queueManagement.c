@@ -32,15 +32,134 @@ int RTXmaxSize = 6000*1500;			//bytes
 
 struct timeval maxTimeToHold = {5,0};
 
-PacketContainer* createPacketContainer(const int uSoc,struct iovec *ioVector,int iovlen,struct sockaddr_storage *sockAddress, unsigned char prior) {
+//TX queue AQM, see queueManagement.h. Times in us
+static int64_t aqmTarget = 0;			//0: disabled
+static int64_t aqmInterval = TXQ_AQM_INTERVAL_DEFAULT;
+static int64_t aqmFirstAbove = 0;		//when the waiting time may start dropping, 0 while it is below target
+static int64_t aqmBelowSince = 0;		//while dropping, since when the waiting time is below target, 0 if above
+static int64_t aqmDropNext;
+static bool aqmDropping = false;
+static unsigned int aqmCount = 0, aqmLastCount = 0;
+static struct timeval earliestDeadline;	//no queued packet has an earlier deadline, zero if none has one
+
+static PacketContainer *lastAdded = NULL;	//the latest packet queued, its message's next fragment goes after it
+static PacketContainer *oldestQueued = NULL, *newestQueued = NULL;	//ends of the arrival order of the TX queue
+
+static int packetConnection(PacketContainer *packet) {
+	return ntohl(((struct msg_header *) packet->iov[0].iov_base)->local_con_id);
+}
+
+static int64_t usecs(const struct timeval *tv) {
+	return (int64_t) tv->tv_sec * 1000000 + tv->tv_usec;
+}
+
+static bool packetExpired(PacketContainer *packet, const struct timeval *now) {
+	return timerisset(&packet->deadline) && !timercmp(now, &packet->deadline, <);
+}
+
+static bool sameMessage(PacketContainer *a, PacketContainer *b) {
+	struct msg_header *msg_a = (struct msg_header *) a->iov[0].iov_base;
+	struct msg_header *msg_b = (struct msg_header *) b->iov[0].iov_base;
+	return msg_a->local_con_id == msg_b->local_con_id && msg_a->msg_seq_num == msg_b->msg_seq_num;
+}
+
+//whether packet a is to be sent before packet b: the earliest deadline first, then the highest priority
+static bool packetBefore(PacketContainer *a, PacketContainer *b) {
+	if (timerisset(&a->deadline) != timerisset(&b->deadline)) return timerisset(&a->deadline);
+	if (timerisset(&a->deadline) && timercmp(&a->deadline, &b->deadline, !=)) return timercmp(&a->deadline, &b->deadline, <);
+	return a->schedPriority > b->schedPriority;
+}
+
+static void noteDeadline(PacketContainer *packet) {
+	if (timerisset(&packet->deadline) && (!timerisset(&earliestDeadline) || timercmp(&packet->deadline, &earliestDeadline, <)))
+		earliestDeadline = packet->deadline;
+}
+
+//only whole data messages are dropped: not control messages nor reliable fragments, which are retransmitted
+static bool packetDroppable(PacketContainer *packet) {
+	return ((struct msg_header *) packet->iov[0].iov_base)->msg_type < 127;
+}
+
+static void unlinkArrival(PacketContainer *packet) {
+	if (packet->older) packet->older->newer = packet->newer;
+	else oldestQueued = packet->newer;
+	if (packet->newer) packet->newer->older = packet->older;
+	else newestQueued = packet->older;
+	packet->older = packet->newer = NULL;
+}
+
+//whether none of the message of packet was sent: its first fragment is still queued
+static bool packetUnstarted(PacketContainer *packet) {
+	return packetDroppable(packet) && ((struct msg_header *) packet->iov[0].iov_base)->offset == 0;
+}
+
+//the message dropped to make room or by the AQM: the lowest ranked one not started, the oldest among equals
+static PacketContainer *dropVictim() {
+	PacketContainer *tmp, *victim = NULL;
+
+	for (tmp = TXqueue.head; tmp != NULL; tmp = tmp->next)
+		if (packetUnstarted(tmp) && (victim == NULL || packetBefore(victim, tmp))) victim = tmp;
+	return victim;
+}
+
+//removes the queued packets of the message of packet (packet itself if queued too), returns how many
+static int removeMessage(PacketContainer *packet) {
+	struct msg_header *msg_h = (struct msg_header *) packet->iov[0].iov_base;
+	int32_t connID = msg_h->local_con_id, msgSeqNum = msg_h->msg_seq_num;
+	PacketContainer **link = &TXqueue.head, *prev = NULL, *tmp;
+	int removed = 0;
+
+	while ((tmp = *link) != NULL) {
+		msg_h = (struct msg_header *) tmp->iov[0].iov_base;
+		if (msg_h->local_con_id == connID && msg_h->msg_seq_num == msgSeqNum) {
+			*link = tmp->next;
+			TXqueue.size -= tmp->pktLen;
+			STATS_DEC(globalStats.txQueuePkts, 1);
+			if (tmp == lastAdded) lastAdded = NULL;
+			unlinkArrival(tmp);
+			destroyPacketContainer(tmp);
+			removed++;
+		} else {
+			prev = tmp;
+			link = &tmp->next;
+		}
+	}
+	TXqueue.tail = prev;
+	STATS_SET(globalStats.txQueueBytes, TXqueue.size);
+	return removed;
+}
+
+//drops the messages past their deadline, then looks for the next deadline
+static void removeExpired(const struct timeval *now) {
+	PacketContainer *tmp = TXqueue.head;
+
+	timerclear(&earliestDeadline);
+	while (tmp != NULL) {
+		if (packetExpired(tmp, now)) {
+			STATS_ADD(packetConnection(tmp), txDeadlineDrops, 1);
+			removeMessage(tmp);
+			tmp = TXqueue.head;	//start over, the packet was freed
+			timerclear(&earliestDeadline);
+			continue;
+		}
+		noteDeadline(tmp);
+		tmp = tmp->next;
+	}
+}
+
+PacketContainer* createPacketContainer(const int uSoc,struct iovec *ioVector,int iovlen,struct sockaddr_storage *sockAddress, unsigned char prior, const struct timeval *deadline, double schedPriority) {
 	
 	PacketContainer *packet = malloc(sizeof(PacketContainer));
 	packet->udpSocket = uSoc;
 	packet->iovlen = iovlen;
 	packet->next = NULL;
+	packet->older = packet->newer = NULL;
 	packet->pktLen = ioVector[0].iov_len + ioVector[1].iov_len + ioVector[2].iov_len + ioVector[3].iov_len;
 
 	packet->priority = prior;
+	if (deadline) packet->deadline = *deadline;
+	else timerclear(&packet->deadline);
+	packet->schedPriority = schedPriority;
 
  	int i;
         packet->iov = malloc(sizeof(struct iovec) * iovlen);
@@ -70,20 +189,57 @@ void destroyPacketContainer(PacketContainer* pktContainer){
 
 int addPacketTXqueue(PacketContainer *packet) {
 //	fprintf(stderr,"[DEBUG] add packet in tx queue\n");
+	//the fragments of a message are queued in one go, they share the stamp of the first one
+	if (lastAdded != NULL && sameMessage(lastAdded, packet)) packet->timeStamp = lastAdded->timeStamp;
+	else gettimeofday(&packet->timeStamp, NULL);
+	if ((TXqueue.size + packet->pktLen) > TXmaxSize && timerisset(&earliestDeadline) && !timercmp(&packet->timeStamp, &earliestDeadline, <))
+		removeExpired(&packet->timeStamp);
+	//a full queue makes room by dropping the messages ranked below this one
+	while ((TXqueue.size + packet->pktLen) > TXmaxSize) {
+		PacketContainer *victim = dropVictim();
+		if (victim == NULL || !packetBefore(packet, victim)) break;
+		STATS_ADD(packetConnection(victim), txQueueDrops, removeMessage(victim));
+	}
 	if ((TXqueue.size + packet->pktLen) > TXmaxSize) {
-		fprintf(stderr,"[queueManagement::addPacketTXqueue] -- Sorry! Max size for TX queue. Packet will be discarded. \n");
+		//the message is dropped whole: its fragments already queued, and the caller sends no more of it
+		int removed = packetDroppable(packet) ? removeMessage(packet) : 0;
+		debug("ML: TX queue full, dropping %d packets\n", removed + 1);
+		STATS_ADD(packetConnection(packet), txQueueDrops, removed + 1);
 		destroyPacketContainer(packet);
 		return THROTTLE;
 	}
 	TXqueue.size += packet->pktLen;	
+	noteDeadline(packet);
+	STATS_ADD(packetConnection(packet), txQueued, 1);
+	STATS_INC(globalStats.txQueuePkts, 1);
+	STATS_SET(globalStats.txQueueBytes, TXqueue.size);
+	if (TXqueue.size > STATS_GET(globalStats.txQueueMaxBytes)) STATS_SET(globalStats.txQueueMaxBytes, TXqueue.size);
 
 	if (TXqueue.head == NULL) {			//adding first element
 		TXqueue.head = packet;
 		TXqueue.tail = packet;		
-	} else {					//adding at the end of the queue
+	} else if (lastAdded != NULL && sameMessage(lastAdded, packet)) {	//after the previous fragment of its message
+		packet->next = lastAdded->next;
+		lastAdded->next = packet;
+		if (TXqueue.tail == lastAdded) TXqueue.tail = packet;
+	} else if (!packetBefore(packet, TXqueue.tail)) {	//adding at the end of the queue
 		TXqueue.tail->next = packet;
 		TXqueue.tail = packet;
+	} else {					//before the first packet it outranks
+		PacketContainer *prev = NULL, *tmp = TXqueue.head;
+		while (!packetBefore(packet, tmp)) {
+			prev = tmp;
+			tmp = tmp->next;
+		}
+		packet->next = tmp;
+		if (prev == NULL) TXqueue.head = packet;
+		else prev->next = packet;
 	}
+	lastAdded = packet;
+	packet->older = newestQueued;
+	if (newestQueued) newestQueued->newer = packet;
+	else oldestQueued = packet;
+	newestQueued = packet;
 	
 	return OK;
 }
@@ -94,8 +250,12 @@ PacketContainer* takePacketToSend() {			//returns pointer to packet or NULL if q
 		PacketContainer *packet = TXqueue.head;
 		
 		TXqueue.size -= packet->pktLen;
+		STATS_DEC(globalStats.txQueuePkts, 1);
+		STATS_SET(globalStats.txQueueBytes, TXqueue.size);
 		TXqueue.head = TXqueue.head->next;
 		packet->next = NULL;
+		if (packet == lastAdded) lastAdded = NULL;
+		unlinkArrival(packet);
 		if (TXqueue.head == NULL) TXqueue.tail = NULL;					
 //		fprintf(stderr,"[DEBUG] Choosed packet\n");
 		return packet;
@@ -103,6 +263,98 @@ PacketContainer* takePacketToSend() {			//returns pointer to packet or NULL if q
 	else return NULL;	
 }
 
+static int64_t aqmControlLaw(int64_t t) {
+	return t + (int64_t) (aqmInterval / sqrt(aqmCount));
+}
+
+//whether the oldest packet waited more than the target, and is not alone
+static bool aqmAbove(int64_t now) {
+	return oldestQueued != NULL && oldestQueued != newestQueued && now - usecs(&oldestQueued->timeStamp) >= aqmTarget;
+}
+
+//whether the oldest packet waited long enough to drop (RFC 8289 dodequeue)
+static bool aqmOkToDrop(int64_t now) {
+	if (!aqmAbove(now)) {
+		aqmFirstAbove = 0;
+		return false;
+	}
+	if (aqmFirstAbove == 0) {
+		aqmFirstAbove = now + aqmInterval;
+		return false;
+	}
+	return now >= aqmFirstAbove;
+}
+
+//whether the packet at the head starts a data message, which can be dropped without wasting what was sent of it
+static bool headDroppable() {
+	return TXqueue.head != NULL && packetUnstarted(TXqueue.head);
+}
+
+//drops victim, or the next message to drop if NULL
+static bool aqmDrop(PacketContainer *victim) {
+	if (victim == NULL && (victim = dropVictim()) == NULL) return false;
+	STATS_ADD(packetConnection(victim), txAqmDrops, 1);
+	removeMessage(victim);
+	return true;
+}
+
+//the next message to drop if it waited more than the target
+static PacketContainer *aqmLateVictim(int64_t now) {
+	PacketContainer *victim = dropVictim();
+
+	return victim != NULL && now - usecs(&victim->timeStamp) >= aqmTarget ? victim : NULL;
+}
+
+void manageTXqueue() {
+	struct timeval tv;
+	int64_t now;
+	bool okToDrop;
+	PacketContainer *victim;
+
+	gettimeofday(&tv, NULL);
+	while (headDroppable() && packetExpired(TXqueue.head, &tv)) {
+		STATS_ADD(packetConnection(TXqueue.head), txDeadlineDrops, 1);
+		removeMessage(TXqueue.head);
+	}
+	if (TXqueue.head == NULL) timerclear(&earliestDeadline);
+	if (!aqmTarget) return;
+
+	//RFC 8289 dequeue on the waiting time of the oldest packet, dropping the messages of dropVictim().
+	//The senders of live data do not slow down on drops, the control law alone would take seconds to
+	//catch up with them: while dropping, the messages that waited more than the target go at once, and
+	//the dropping state ends only after the waiting time stayed below the target for an interval.
+	now = usecs(&tv);
+	okToDrop = aqmOkToDrop(now);
+	if (aqmDropping) {
+		while ((victim = aqmLateVictim(now)) != NULL) {
+			aqmDrop(victim);
+			aqmCount++;
+		}
+		if (aqmAbove(now)) {
+			aqmBelowSince = 0;
+			while (now >= aqmDropNext && aqmAbove(now) && aqmDrop(NULL)) {
+				aqmCount++;
+				aqmDropNext = aqmControlLaw(aqmDropNext);
+			}
+		} else if (aqmBelowSince == 0) {
+			aqmBelowSince = now;
+		} else if (now - aqmBelowSince >= aqmInterval) {
+			aqmDropping = false;
+		}
+	} else if (okToDrop) {
+		unsigned int delta;
+
+		if (!aqmDrop(NULL)) return;
+		aqmOkToDrop(now);
+		aqmDropping = true;
+		aqmBelowSince = 0;
+		delta = aqmCount - aqmLastCount;
+		aqmCount = delta > 1 && now - aqmDropNext < 16 * aqmInterval ? delta : 1;
+		aqmDropNext = aqmControlLaw(now);
+		aqmLastCount = aqmCount;
+	}
+}
+
 #ifdef RTX
 void addPacketRTXqueue(PacketContainer *packet) {
 	//removing old packets - because of maxTimeToHold
@@ -164,6 +416,14 @@ void setQueuesParams (int TXsize, int RTXsize, double maxTTHold) { //in bytes, b
 	maxTimeToHold.tv_usec = (int)(1000000.0 * fmod(maxTTHold, 1.0));
 }
 
+void setQueueAQMParams (int target, int interval) { //in us
+	aqmTarget = target > 0 ? target : 0;
+	aqmInterval = interval > 0 ? interval : TXQ_AQM_INTERVAL_DEFAULT;
+	aqmDropping = false;
+	aqmFirstAbove = 0;
+	aqmCount = aqmLastCount = 0;
+}
+
 int isQueueEmpty() {
 	
 	if (TXqueue.head == NULL) return 1;
@@ -218,16 +478,25 @@ int rtxPacketsFromTo(int connID, int msgSeqNum, int offsetFrom, int offsetTo) {
         int offset = offsetFrom;
         //fprintf(stderr,"\t\t\t\t Retransmission request From: %d To: %d\n",offsetFrom, offsetTo);
 
+        int udpSocket = -1;
+        int ret = 0;
+
         while (offset < offsetTo) {
                 PacketContainer *packetToRTX = searchPacketInRTX(connID,msgSeqNum,offset,1);
-                if (packetToRTX == NULL) return 1;
+                if (packetToRTX == NULL) {
+                        ret = 1;
+                        break;
+                }
 
                 //sending packet
                 //fprintf(stderr,"\t\t\t\t\t Retransmitting packet: %d of msg_seq_num %d.\n",offset/1349,msgSeqNum);
+                udpSocket = packetToRTX->udpSocket;
                 sendPacket(packetToRTX->udpSocket, packetToRTX->iov, 4, packetToRTX->socketaddr);
                 sentRTXDataPktCounter++;
+                STATS_ADD(packetConnection(packetToRTX), txRtxPkts, 1);
                 offset += packetToRTX->iov[3].iov_len;
         }
-        return 0;
+        if (udpSocket >= 0) flushPackets(udpSocket);
+        return ret;
 }
 #endif
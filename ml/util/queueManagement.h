@@ -37,7 +37,10 @@ typedef struct PktContainer {
 
 	int pktLen;		//kB
 	struct timeval timeStamp;
+	struct timeval deadline;	//the message is of no use after this time, zero if none
+	double schedPriority;		//rank among the queued messages with the same deadline, higher first
 	struct PktContainer *next;
+	struct PktContainer *older, *newer;	//arrival order in the TX queue
 	unsigned char priority;
 } PacketContainer;
 
@@ -51,12 +54,41 @@ typedef struct PktQueue {
 } PacketQueue;
 
 
-PacketContainer* createPacketContainer (const int uSoc,struct iovec *ioVector,int iovlen,struct sockaddr_storage *sockAddress, unsigned char prior);
+/*
+ * TX queue AQM (CoDel, RFC 8289, on the time the oldest queued packet has
+ * waited): once it waited more than the target for a whole interval, messages
+ * are dropped at intervals shrinking with the square root of the drops so
+ * far, and those that waited more than the target at once, until the waiting
+ * time stayed below the target for an interval. The message dropped is the
+ * lowest ranked one, the oldest among equals, so that higher ranked messages
+ * keep their latency. Messages are dropped whole, and only before their first
+ * fragment was sent: a message that lost a fragment is of no use, the
+ * fragments sent would be wasted uplink.
+ * Messages past their deadline are dropped whole when they reach the head of
+ * the queue, if none of them was sent yet, and first when the queue is full;
+ * a full queue then drops the lowest ranked messages to make room for a
+ * higher ranked one.
+ * Reliable fragments and control messages are never dropped by the AQM.
+ *
+ * The queue is kept in sending order: messages with a deadline first, the
+ * earliest first, then by scheduling priority, in arrival order among equals.
+ * A message takes its place fragment by fragment, so it overtakes the rest of
+ * a lower ranked message that is being sent.
+ */
+#define TXQ_AQM_TARGET_DEFAULT 20000	//us, longer than in network queues as messages arrive as bursts of fragments
+#define TXQ_AQM_INTERVAL_DEFAULT 200000	//us
+
+PacketContainer* createPacketContainer (const int uSoc,struct iovec *ioVector,int iovlen,struct sockaddr_storage *sockAddress, unsigned char prior, const struct timeval *deadline, double schedPriority);
+
+void destroyPacketContainer(PacketContainer* pktContainer);
 
 int addPacketTXqueue(PacketContainer *packet);
 
 PacketContainer* takePacketToSend();
 
+//drops the messages at the head of the TX queue past their deadline, or by the AQM
+void manageTXqueue();
+
 int removeOldestPacket() ;
 
 int isQueueEmpty();
@@ -65,6 +97,8 @@ int getFirstPacketSize();
 
 void setQueuesParams (int TXsize, int RTXsize, double maxTimeToHold); //in  bytes, bytes, seconds
 
+void setQueueAQMParams (int target, int interval); //in us, target 0 disables the AQM
+
 #ifdef RTX
 void addPacketRTXqueue(PacketContainer *packet);
 
@@ -25,16 +25,73 @@
 #include <ml_all.h>
 
 extern struct event_base *base;
+extern connect_data *connectbuf[];
 static long bucket_size = 0;
 static int64_t drain_rate = 0;
 
+/* adaptive mode, bytes/s, off if max_rate is 0 */
+static int64_t min_rate = 0, max_rate = 0;
+static struct event *rate_event = NULL;
+static bool rate_armed = false;
+/* the limiter held packets during the current interval */
+static bool rate_limited = false;
+/* time the latest packet sent spent in the TX queue (s), and at the previous adjustment */
+static double residence = 0, rate_residence = 0;
+/* bytes let through since the previous adjustment */
+static int64_t rate_sent = 0;
+/* queuing delay at the previous adjustment (s) */
+static double rate_qdelay = NAN;
+/* samples of the residence by the time the packet was queued, see rateFeedback */
+static struct {
+	int64_t queued;	//us
+	double residence;
+} residence_samples[RATE_RESIDENCE_SAMPLES];
+static int residence_next = 0;
+static int64_t residence_sampled = 0;
+/* when the queue seen at the latest decrease drained (us), whether a packet sent since was reported,
+ * and the queuing delay then (s) */
+static int64_t rate_cut = 0;
+static bool rate_cut_reported = true;
+static double rate_cut_qdelay = 0;
+/* connections that reported, see rateFeedback */
+static int rate_paths[RATE_MAX_PATHS];
+static int rate_paths_n = 0;
+
 
 static long bytes_in_bucket = 0;
 struct timeval bib_then = { 0, 0};
 
 void planFreeSpaceInBucketEvent();
 
+/* the latest packet sent left the TX queue at now */
+static void setResidence(const struct timeval *now, double r) {
+	int64_t t = now->tv_sec * 1000000LL + now->tv_usec;
+
+	residence = r;
+	if (!max_rate || t - residence_sampled < RATE_RESIDENCE_STEP) return;
+	residence_sampled = t;
+	residence_samples[residence_next].queued = t - (int64_t) (r * 1000000);
+	residence_samples[residence_next].residence = r;
+	residence_next = (residence_next + 1) % RATE_RESIDENCE_SAMPLES;
+}
+
+/* the residence of the sampled packet queued the closest to queued (us), the latest one if none */
+static double residenceAt(int64_t queued) {
+	double r = residence;
+	int64_t best = -1;
+	int i;
+
+	for (i = 0; i < RATE_RESIDENCE_SAMPLES; i++) {
+		int64_t d = llabs(residence_samples[i].queued - queued);
+		if (!residence_samples[i].queued || (best >= 0 && d >= best)) continue;
+		best = d;
+		r = residence_samples[i].residence;
+	}
+	return r;
+}
+
 void freeSpaceInBucket_cb (int fd, short event,void *arg) {
+	int udpSocket = -1;
 
 	/*struct timeval test;
 
@@ -50,6 +107,7 @@ void freeSpaceInBucket_cb (int fd, short event,void *arg) {
 	fprintf(stderr,"Event scheduled in: %d microseconds\n",us);*/
 //	fprintf(stderr,"[DEBUG] Free space callback!\n");
 
+	manageTXqueue();
 	while((!isQueueEmpty()) && (outputRateControl(getFirstPacketSize()) == OK)) {	
 
 //		fprintf(stderr,"[DEBUG] Pick a packet\n");
@@ -60,7 +118,11 @@ void freeSpaceInBucket_cb (int fd, short event,void *arg) {
 		struct timeval now;
    		gettimeofday(&now, NULL);
 		bib_then = now;
+		uint64_t waited = statsElapsed(&packet->timeStamp, &now);
+		STATS_HIST(ntohl(((struct msg_header *) packet->iov[0].iov_base)->local_con_id), txQueueTime, waited);
+		setResidence(&now, waited / 1000000.0);
 
+		udpSocket = packet->udpSocket;
 		sendPacket(packet->udpSocket, packet->iov, 4, packet->socketaddr);
 
 #ifdef RTX
@@ -69,8 +131,9 @@ void freeSpaceInBucket_cb (int fd, short event,void *arg) {
 #else
 		destroyPacketContainer(packet);
 #endif
-
+		manageTXqueue();
 	}
+	if (udpSocket >= 0) flushPackets(udpSocket);
 
 //	if (isQueueEmpty()) fprintf(stderr,"[DEBUG] Tx Queue is empty.\n");
 //	else fprintf(stderr,"Rate control stopped.\n");
@@ -96,21 +159,170 @@ void planFreeSpaceInBucketEvent(int bytes) {		//plan the event for time when the
 	event_add(ev, &TXtime);
 }
 
-int queueOrSendPacket(const int udpSocket, struct iovec *iov, int len, struct sockaddr_storage *socketaddr, unsigned char priority)
+static void rate_cb(int fd, short event, void *arg);
+
+static void armRateTimer()
 {
-	PacketContainer *newPacket = createPacketContainer(udpSocket,iov,len,socketaddr,priority);
+	struct timeval tv = { RATE_INTERVAL / 1000000, RATE_INTERVAL % 1000000 };
+
+	if (!max_rate || rate_armed || !base) return;
+	if (!rate_event) rate_event = evtimer_new(base, rate_cb, NULL);
+	evtimer_add(rate_event, &tv);
+	rate_armed = true;
+}
+
+static void rate_cb(int fd, short event, void *arg)
+{
+	struct timeval now;
+	double qdelay = NAN, loss = NAN, rate, sent;
+	int i;
+
+	rate_armed = false;
+	if (!max_rate) return;
+	gettimeofday(&now, NULL);
+
+	// the least congested path with a recent report, forgetting the others
+	for (i = 0; i < rate_paths_n; ) {
+		connect_data *c = connectbuf[rate_paths[i]];
+		if (!c || (!c->rate_updated.tv_sec && !c->rate_updated.tv_usec) || statsElapsed(&c->rate_updated, &now) > RATE_FRESH) {
+			rate_paths[i] = rate_paths[--rate_paths_n];
+			continue;
+		}
+		if (!isnan(c->rate_qdelay) && (isnan(qdelay) || c->rate_qdelay < qdelay)) qdelay = c->rate_qdelay;
+		if (!isnan(c->rate_loss) && (isnan(loss) || c->rate_loss < loss)) loss = c->rate_loss;
+		i++;
+	}
+	rate = drain_rate;
+	sent = rate_sent * 1000000.0 / RATE_INTERVAL;
+	if (sent <= 0 || sent > rate) sent = rate;
+	// a decrease waits for the reports on the packets sent at the previous one, after the queue it
+	// saw, unless the queuing delay keeps growing; it cuts the rate actually sent, if the application
+	// sends less
+	if (!isnan(qdelay) && qdelay > RATE_TARGET) {
+		if (rate_cut_reported || qdelay > 2 * rate_cut_qdelay)
+			rate = sent * (1 - RATE_DECREASE_GAIN * (qdelay - RATE_TARGET) / qdelay);
+	} else if (!isnan(loss) && loss > RATE_LOSS_TARGET) {
+		if (rate_cut_reported) rate = sent * RATE_LOSS_DECREASE;
+	}
+	// otherwise the application sends less than the rate, there is nothing to learn; a growing
+	// queuing delay means the rate is past the path already, and with no report, a growing TX
+	// queue may as well be the uplink not taking more
+	else if (rate_limited && (isnan(qdelay) || isnan(rate_qdelay) || qdelay <= rate_qdelay + RATE_GROWTH) &&
+			(!isnan(qdelay) || !isnan(loss) || residence <= rate_residence))
+		rate *= !isnan(qdelay) && qdelay < RATE_TARGET / 2 ? RATE_INCREASE_FAST : RATE_INCREASE;
+	if (rate < min_rate) rate = min_rate;
+	if (rate > max_rate) rate = max_rate;
+	if ((int64_t) rate != drain_rate) {
+		debug("ML: output rate %lld kbit/s (queuing %.1f ms, loss %.3f, TX queue %.1f ms)\n", (long long) rate * 8 / 1000,
+			qdelay * 1000, loss, residence * 1000);
+		outputRateControl(0);	// leak at the old rate up to now
+		if (rate < drain_rate) {
+			rate_cut = now.tv_sec * 1000000LL + now.tv_usec + (isnan(qdelay) ? 0 : (int64_t) (qdelay * 1000000));
+			rate_cut_reported = false;
+			rate_cut_qdelay = isnan(qdelay) ? 0 : qdelay;
+		}
+		drain_rate = rate;
+	}
+
+	rate_limited = !isQueueEmpty();
+	rate_residence = residence;
+	rate_qdelay = qdelay;
+	rate_sent = 0;
+	armRateTimer();
+}
+
+void setAdaptiveRateParams(int minrate, int maxrate) { //given in Bits/s
+	min_rate = minrate > 0 ? minrate >> 3 : 0;
+	max_rate = maxrate > 0 ? maxrate >> 3 : 0;
+	if (!max_rate) {
+		if (rate_armed) event_del(rate_event);
+		rate_armed = false;
+		return;
+	}
+	if (min_rate > max_rate) min_rate = max_rate;
+	if (bucket_size <= 0) bucket_size = RATE_DEFAULT_BUCKET;
+	outputRateControl(0);
+	if (drain_rate <= 0 || drain_rate > max_rate) drain_rate = max_rate;
+	if (drain_rate < min_rate) drain_rate = min_rate;
+	armRateTimer();
+}
+
+void rateFeedback(int con_id, double delay, double loss) {
+	connect_data *c = connectbuf[con_id];
+	struct timeval now;
+	double base_delay, qdelay, r;
+	int64_t queued;
+	long epoch;
+	int i;
+
+	if (!c) return;
+	gettimeofday(&now, NULL);
+	epoch = now.tv_sec / RATE_EPOCH;
+	if (!c->rate_updated.tv_sec && !c->rate_updated.tv_usec) {
+		c->rate_base_delay[0] = c->rate_base_delay[1] = NAN;
+		c->rate_qdelay = c->rate_loss = NAN;
+		c->rate_epoch = epoch;
+	}
+	for (i = 0; i < rate_paths_n && rate_paths[i] != con_id; i++);
+	if (i == rate_paths_n) {
+		if (rate_paths_n == RATE_MAX_PATHS) return;
+		rate_paths[rate_paths_n++] = con_id;
+	}
+	c->rate_updated = now;
+
+	if (!isnan(delay)) {
+		if (epoch != c->rate_epoch) {
+			c->rate_base_delay[1] = epoch == c->rate_epoch + 1 ? c->rate_base_delay[0] : NAN;
+			c->rate_base_delay[0] = NAN;
+			c->rate_epoch = epoch;
+		}
+		if (isnan(c->rate_base_delay[0]) || delay < c->rate_base_delay[0]) c->rate_base_delay[0] = delay;
+		base_delay = c->rate_base_delay[0];
+		if (!isnan(c->rate_base_delay[1]) && c->rate_base_delay[1] < base_delay) base_delay = c->rate_base_delay[1];
+		// the packet was stamped when it entered the TX queue, delay before it was received, the report
+		// taking about the base delay back
+		queued = now.tv_sec * 1000000LL + now.tv_usec - (int64_t) ((delay + base_delay) * 1000000);
+		r = residenceAt(queued);
+		if (queued + (int64_t) (r * 1000000) >= rate_cut) rate_cut_reported = true;
+		qdelay = delay - base_delay - r;
+		if (qdelay < 0) qdelay = 0;
+		if (isnan(c->rate_qdelay)) c->rate_qdelay = qdelay;
+		else c->rate_qdelay += (qdelay - c->rate_qdelay) / 8;
+	}
+	if (!isnan(loss)) {
+		if (isnan(c->rate_loss)) c->rate_loss = loss;
+		else c->rate_loss += (loss - c->rate_loss) / 64;
+	}
+	armRateTimer();
+}
+
+int getOutputRate() {
+	return drain_rate > 0 ? drain_rate << 3 : 0;
+}
+
+int queueOrSendPacket(const int udpSocket, struct iovec *iov, int len, struct sockaddr_storage *socketaddr, unsigned char priority, const struct timeval *deadline, double schedPriority)
+{
+	PacketContainer *newPacket = createPacketContainer(udpSocket,iov,len,socketaddr,priority,deadline,schedPriority);
 
 	if(!(priority & HP)) {
 		if (!isQueueEmpty()) {						//some packets are already waiting, "I am for sure after them"
 //			fprintf(stderr,"[DEBUG] packet queued\n");
+			rate_limited = true;
 			return addPacketTXqueue(newPacket);
 		}	
 		else if(outputRateControl(newPacket->pktLen) != OK) {			//queue is empty, not enough space in bucket - "I will be first in the queue"
 //			fprintf(stderr,"[DEBUG] planning free space\n");
 			planFreeSpaceInBucketEvent(newPacket->pktLen);		//when there will be enough space in the bucket for the first packet from the queue
+			rate_limited = true;
+			armRateTimer();
 			return addPacketTXqueue(newPacket);
 		}
 	}
+	if (isQueueEmpty()) {
+		struct timeval now;
+		gettimeofday(&now, NULL);
+		setResidence(&now, 0);
+	}
 #ifdef RTX
 	if (!(priority & NO_RTX)) addPacketRTXqueue(newPacket);
 	else destroyPacketContainer(newPacket);
@@ -151,6 +363,7 @@ int outputRateControl(int len) {
 		bib_then = now;
 		if(bytes_in_bucket + len <= bucket_size) {
 			bytes_in_bucket += len;
+			rate_sent += len;
 			return OK;
 		} else {
 			return THROTTLE;
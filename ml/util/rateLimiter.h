@@ -37,5 +37,42 @@ void planFreeSpaceInBucketEvent();
 
 void freeSpaceInBucket_cb (int fd, short event,void *arg);
 
-int queueOrSendPacket(const int udpSocket, struct iovec *iov, int len, struct sockaddr_storage *socketaddr, unsigned char priority);
+int queueOrSendPacket(const int udpSocket, struct iovec *iov, int len, struct sockaddr_storage *socketaddr, unsigned char priority, const struct timeval *deadline, double schedPriority);
+
+/*
+ * Adaptive output rate: every RATE_INTERVAL the drain rate is cut if the paths
+ * report a queuing delay beyond RATE_TARGET or loss beyond RATE_LOSS_TARGET,
+ * and raised if packets waited in the TX queue, i.e. the limiter itself is the
+ * bottleneck. The queuing delay of a path is its one way delay above the
+ * minimum of the last two RATE_EPOCH long epochs, less the time the packet
+ * reported spent in the TX queue (the monitoring layer stamps packets before
+ * they are queued), looked up in the residence times sampled every
+ * RATE_RESIDENCE_STEP. The least congested path with a recent report counts,
+ * as only the queuing the paths have in common, at the uplink, is due to the
+ * drain rate. A cut applies to the rate actually sent, and the next one waits
+ * for the reports on the packets sent once the queue that caused it drained,
+ * unless the queuing delay doubled. The rate is not raised while the queuing
+ * delay grows, nor, without a recent report, while the time spent in the TX
+ * queue grows: the packets may be stuck in the uplink.
+ */
+#define RATE_INTERVAL 100000	//us between adjustments
+#define RATE_TARGET 0.025	//queuing delay aimed at (s)
+#define RATE_LOSS_TARGET 0.02
+#define RATE_FRESH 1000000	//reports older than this (us) are ignored
+#define RATE_EPOCH 10	//s
+#define RATE_DECREASE_GAIN 0.5	//the rate is cut by this fraction of the queuing delay beyond RATE_TARGET
+#define RATE_LOSS_DECREASE 0.85
+#define RATE_INCREASE 1.02
+#define RATE_INCREASE_FAST 1.05	//while the queuing delay is below RATE_TARGET / 2
+#define RATE_GROWTH 0.005	//s, the rate is not raised while the queuing delay grows more in an interval
+#define RATE_DEFAULT_BUCKET 65536	//bytes, if none was configured
+#define RATE_MAX_PATHS 64	//connections reporting at the same time that are taken into account
+#define RATE_RESIDENCE_STEP 20000	//us between samples of the TX queue residence time
+#define RATE_RESIDENCE_SAMPLES 128
+
+void setAdaptiveRateParams(int minrate, int maxrate);
+
+void rateFeedback(int con_id, double delay, double loss);
+
+int getOutputRate();
 
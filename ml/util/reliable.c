@@ -0,0 +1,616 @@
+/*
+ * This file is part of the Messaging Library.
+ *
+ * The Messaging Library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * The Messaging Library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the Messaging Library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ *	reliable delivery with LEDBAT congestion control, see reliable.h
+ */
+
+#include "../ml_all.h"
+
+extern struct event_base *base;
+extern connect_data *connectbuf[];
+extern evutil_socket_t socketfd;
+
+/* congestion window in MSS (the path MTU of the connection): initial and minimum */
+#define REL_INIT_CWND 2
+#define REL_MIN_CWND 2
+/* LEDBAT gain and the most the window may exceed the flight size by, in MSS */
+#define REL_GAIN 1.0
+#define REL_ALLOWED_INCREASE 1
+/* minutes of one way delay minima kept for the base delay */
+#define REL_BASE_HISTORY 10
+/* latest one way delay samples the current delay is the minimum of */
+#define REL_CUR_FILTER 4
+
+struct rel_tx {
+	int con_id;
+	struct rel_msg *head, *tail;	///< messages not done yet, in send order
+	struct rel_msg *next;	///< first message with bytes never sent
+	struct rel_msg *done;	///< messages done, waiting for their confirmation, in order
+	int queued_bytes;
+
+	struct rel_frag frag[REL_WINDOW];
+	uint32_t una;	///< oldest fragment not acknowledged
+	uint32_t nxt;	///< next new fragment
+	int lost;	///< fragments waiting for their retransmission
+	uint32_t tx_order;	///< transmissions so far
+	uint32_t acked_order;	///< latest transmission acknowledged
+	uint32_t acked_sent;	///< when the latest transmission acknowledged was sent (us)
+
+	double cwnd;	///< bytes
+	int flight;	///< bytes sent and neither acknowledged nor lost
+	bool slow_start;
+	struct timeval last_reduction;
+
+	int64_t srtt, rttvar, rto;	///< us, srtt is 0 before the first sample
+	struct event *rto_event;
+	bool rto_armed;
+
+	uint32_t base_delay[REL_BASE_HISTORY];	///< minimum one way delay per minute, latest first
+	int base_n;
+	long base_minute;
+	uint32_t cur_delay[REL_CUR_FILTER];
+	int cur_n, cur_i;
+};
+
+struct rel_rx {
+	int con_id;
+	uint32_t cum;	///< all fragments before this one arrived
+	uint32_t bits[REL_WINDOW / 32];	///< fragments from cum on that arrived, by sequence number modulo REL_WINDOW
+	uint32_t echo_ts, delay;	///< of the latest fragment
+	struct timeval echo_arrival;
+	int pending;	///< fragments arrived since the last acknowledgement
+	struct event *ack_event;
+	bool ack_armed;
+};
+
+static struct timeval give_up = REL_GIVE_UP;
+
+static uint32_t now_us(struct timeval *now)
+{
+	gettimeofday(now, NULL);
+	return (uint32_t) ((uint64_t) now->tv_sec * 1000000 + now->tv_usec);
+}
+
+/* a is an earlier delay than b, in the modulo 2^32 clock */
+static bool delay_before(uint32_t a, uint32_t b)
+{
+	return (int32_t) (a - b) < 0;
+}
+
+static int mss(struct rel_tx *t)
+{
+	return connectbuf[t->con_id]->pmtusize > 0 ? connectbuf[t->con_id]->pmtusize : MIN;
+}
+
+/**************************** sender ****************************/
+
+static void rto_cb(int fd, short event, void *arg);
+
+static struct rel_tx *tx_state(int con_id)
+{
+	struct rel_tx *t = connectbuf[con_id]->rel_tx;
+
+	if (t) return t;
+	t = calloc(1, sizeof(struct rel_tx));
+	if (!t) return NULL;
+	t->con_id = con_id;
+	t->cwnd = REL_INIT_CWND * mss(t);
+	t->slow_start = true;
+	t->rto = REL_RTO_INIT;
+	t->rto_event = event_new(base, -1, EV_TIMEOUT, &rto_cb, (void *) (long) con_id);
+	connectbuf[con_id]->rel_tx = t;
+	return t;
+}
+
+static void arm_rto(struct rel_tx *t)
+{
+	struct timeval tv = { t->rto / 1000000, t->rto % 1000000 };
+	evtimer_add(t->rto_event, &tv);
+	t->rto_armed = true;
+}
+
+/* the message is done: move it to the done list */
+static void finish_msg(struct rel_tx *t, struct rel_msg *m, bool delivered)
+{
+	struct rel_msg **p;
+
+	for (p = &t->head; *p && *p != m; p = &(*p)->next);
+	if (!*p) return;
+	*p = m->next;
+	if (t->tail == m) {
+		struct rel_msg *last = t->head;
+		while (last && last->next) last = last->next;
+		t->tail = last;
+	}
+	if (t->next == m) t->next = m->next;
+	t->queued_bytes -= m->len;
+	m->delivered = delivered;
+	m->next = NULL;
+	for (p = &t->done; *p; p = &(*p)->next);
+	*p = m;
+}
+
+/* returns the bytes newly acknowledged */
+static int ack_frag(struct rel_tx *t, struct rel_frag *f)
+{
+	struct rel_msg *m = f->msg;
+
+	if (f->acked || !m) return 0;
+	f->acked = 1;
+	if (f->in_flight) {
+		f->in_flight = 0;
+		t->flight -= f->len;
+	}
+	if (f->lost) {
+		f->lost = 0;
+		t->lost--;
+	}
+	if ((int32_t) (f->tx_order - t->acked_order) > 0) {
+		t->acked_order = f->tx_order;
+		t->acked_sent = f->sent_us;
+	}
+	if (--m->unacked == 0 && m->sent == m->len) finish_msg(t, m, true);
+	return f->len;
+}
+
+static void advance_una(struct rel_tx *t)
+{
+	while (t->una != t->nxt && t->frag[t->una % REL_WINDOW].acked) {
+		t->frag[t->una % REL_WINDOW].msg = NULL;
+		t->una++;
+	}
+}
+
+static void fail_msg(struct rel_tx *t, struct rel_msg *m)
+{
+	uint32_t seq;
+
+	for (seq = t->una; seq != t->nxt; seq++) {
+		struct rel_frag *f = &t->frag[seq % REL_WINDOW];
+		if (f->msg != m || f->acked) continue;
+		f->acked = 1;
+		if (f->in_flight) t->flight -= f->len;
+		if (f->lost) t->lost--;
+		f->in_flight = f->lost = 0;
+	}
+	STATS_ADD(t->con_id, txRelFailures, 1);
+	finish_msg(t, m, false);
+	advance_una(t);
+}
+
+/* give up the messages waiting for too long */
+static void expire(struct rel_tx *t)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	while (t->head && statsElapsed(&t->head->queued, &now) > give_up.tv_sec * 1000000ULL + give_up.tv_usec) {
+		warn("ML: reliable message %d to %s given up\n", t->head->seqnr, conid_to_string(t->con_id));
+		fail_msg(t, t->head);
+	}
+}
+
+static void mark_lost(struct rel_tx *t, struct rel_frag *f)
+{
+	if (f->in_flight) {
+		f->in_flight = 0;
+		t->flight -= f->len;
+	}
+	if (!f->lost) {
+		f->lost = 1;
+		t->lost++;
+	}
+}
+
+static int transmit(struct rel_tx *t, uint32_t seq, struct rel_frag *f)
+{
+	struct rel_data_hdr h;
+	struct timeval now;
+	int ret;
+
+	memset(&h, 0, sizeof(h));
+	h.msg_type = f->msg->msgtype;
+	h.frag_seq = htonl(seq);
+	h.base = htonl(t->una);
+	f->sent_us = now_us(&now);
+	h.ts = htonl(f->sent_us);
+	ret = send_rel_fragment(t->con_id, f->msg, f->offset, f->len, &h);
+	if (ret == MSGLEN) return ret;
+	// refused or dropped packets count as sent, they are lost
+	f->tx_order = ++t->tx_order;
+	f->in_flight = 1;
+	t->flight += f->len;
+	return ret;
+}
+
+/* send retransmissions, then new fragments, while the congestion window allows */
+static void pump(struct rel_tx *t)
+{
+	uint32_t seq, lost_from = t->una;
+	bool sent = false;
+
+	for (;;) {
+		struct rel_frag *f = NULL;
+
+		if (t->lost) {
+			for (seq = lost_from; seq != t->nxt; seq++)
+				if (t->frag[seq % REL_WINDOW].lost) break;
+			lost_from = seq;
+			if (seq != t->nxt) f = &t->frag[seq % REL_WINDOW];
+		}
+		if (f) {
+			if (t->flight && t->flight + f->len > t->cwnd) break;
+			f->lost = 0;
+			t->lost--;
+			if (transmit(t, seq, f) == MSGLEN) {
+				// cut before the path MTU was lowered, its sequence number cannot take a smaller fragment
+				warn("ML: reliable message %d to %s given up, the path MTU dropped below its fragments\n", f->msg->seqnr, conid_to_string(t->con_id));
+				fail_msg(t, f->msg);
+				continue;
+			}
+			STATS_ADD(t->con_id, txRelRtxPkts, 1);
+			sent = true;
+			continue;
+		}
+
+		struct rel_msg *m = t->next;
+		int len;
+		if (!m || t->nxt - t->una >= REL_WINDOW || connectbuf[t->con_id]->pmtusize <= 0) break;
+		len = connectbuf[t->con_id]->pmtusize - MSG_HEADER_SIZE - MON_PKT_HEADER_SPACE - sizeof(struct rel_data_hdr) -
+			(m->sent ? 0 : m->mon_hdr_len);
+		if (len > m->len - m->sent) len = m->len - m->sent;
+		if (len <= 0 || (t->flight && t->flight + len > t->cwnd)) break;
+
+		seq = t->nxt++;
+		f = &t->frag[seq % REL_WINDOW];
+		memset(f, 0, sizeof(*f));
+		f->msg = m;
+		f->offset = m->sent;
+		f->len = len;
+		m->sent += len;
+		m->unacked++;
+		if (m->sent == m->len) t->next = m->next;
+		if (transmit(t, seq, f) == MSGLEN) {
+			// the path MTU was lowered, cut the fragment again
+			t->nxt--;
+			m->sent = f->offset;
+			m->unacked--;
+			t->next = m;
+			f->msg = NULL;
+			continue;
+		}
+		sent = true;
+	}
+	if (sent) flushPackets(socketfd);
+
+	if (t->flight || t->lost) {
+		if (!t->rto_armed) arm_rto(t);
+	} else if (t->rto_armed) {
+		event_del(t->rto_event);
+		t->rto_armed = false;
+	}
+}
+
+/* report the messages done, the callback may send or close the connection */
+static void confirm_done(struct rel_tx *t)
+{
+	int con_id = t->con_id;
+
+	while (t->done) {
+		struct rel_msg *m = t->done;
+		t->done = m->next;
+		if (m->confirm && send_Confirmation_cb) (send_Confirmation_cb) (con_id, m->seqnr, m->msgtype, m->delivered);
+		free(m->data);
+		free(m);
+		if (!connectbuf[con_id] || connectbuf[con_id]->rel_tx != t) return;
+	}
+}
+
+static void rto_cb(int fd, short event, void *arg)
+{
+	int con_id = (long) arg;
+	struct rel_tx *t = connectbuf[con_id]->rel_tx;
+	uint32_t seq;
+
+	t->rto_armed = false;
+	expire(t);
+	if (t->flight) {
+		debug("ML: reliable retransmission timeout on %s (rto %lld us)\n", conid_to_string(con_id), (long long) t->rto);
+		for (seq = t->una; seq != t->nxt; seq++) {
+			struct rel_frag *f = &t->frag[seq % REL_WINDOW];
+			if (f->in_flight) mark_lost(t, f);
+		}
+		t->cwnd = mss(t);
+		t->slow_start = false;
+		t->rto = t->rto * 2 < REL_RTO_MAX ? t->rto * 2 : REL_RTO_MAX;
+	}
+	pump(t);
+	confirm_done(t);
+}
+
+static void rtt_sample(struct rel_tx *t, int64_t rtt)
+{
+	if (!t->srtt) {
+		t->srtt = rtt;
+		t->rttvar = rtt / 2;
+	} else {
+		t->rttvar = (3 * t->rttvar + (t->srtt > rtt ? t->srtt - rtt : rtt - t->srtt)) / 4;
+		t->srtt = (7 * t->srtt + rtt) / 8;
+	}
+	t->rto = t->srtt + 4 * t->rttvar;
+	if (t->rto < REL_RTO_MIN) t->rto = REL_RTO_MIN;
+	if (t->rto > REL_RTO_MAX) t->rto = REL_RTO_MAX;
+}
+
+/* LEDBAT window update for bytes newly acknowledged with a one way delay sample */
+static void ledbat(struct rel_tx *t, uint32_t delay, int acked, int flight, const struct timeval *now)
+{
+	uint32_t base_delay, cur_delay;
+	double max_cwnd, min_cwnd = REL_MIN_CWND * mss(t);
+	int32_t queuing;
+	int i;
+
+	if (!t->base_n || now->tv_sec / 60 != t->base_minute) {
+		if (t->base_n < REL_BASE_HISTORY) t->base_n++;
+		memmove(t->base_delay + 1, t->base_delay, (t->base_n - 1) * sizeof(uint32_t));
+		t->base_delay[0] = delay;
+		t->base_minute = now->tv_sec / 60;
+	} else if (delay_before(delay, t->base_delay[0])) {
+		t->base_delay[0] = delay;
+	}
+	base_delay = t->base_delay[0];
+	for (i = 1; i < t->base_n; i++)
+		if (delay_before(t->base_delay[i], base_delay)) base_delay = t->base_delay[i];
+
+	t->cur_delay[t->cur_i] = delay;
+	t->cur_i = (t->cur_i + 1) % REL_CUR_FILTER;
+	if (t->cur_n < REL_CUR_FILTER) t->cur_n++;
+	cur_delay = t->cur_delay[0];
+	for (i = 1; i < t->cur_n; i++)
+		if (delay_before(t->cur_delay[i], cur_delay)) cur_delay = t->cur_delay[i];
+
+	queuing = (int32_t) (cur_delay - base_delay);
+	if (queuing < 0) queuing = 0;
+
+	if (t->slow_start && queuing < REL_TARGET / 2) {
+		t->cwnd += acked;
+	} else {
+		t->slow_start = false;
+		t->cwnd += REL_GAIN * (REL_TARGET - queuing) / REL_TARGET * acked * mss(t) / t->cwnd;
+	}
+	max_cwnd = flight + REL_ALLOWED_INCREASE * mss(t);
+	if (t->cwnd > max_cwnd) t->cwnd = max_cwnd;
+	if (t->cwnd < min_cwnd) t->cwnd = min_cwnd;
+}
+
+int reliableSend(int con_id, int seqnr, unsigned char msgtype, const char *mon_hdr, int mon_hdr_len, const char *msg, int msg_len, bool confirm)
+{
+	struct rel_tx *t = tx_state(con_id);
+	struct rel_msg *m;
+
+	if (!t || msg_len <= 0 || t->queued_bytes + msg_len > REL_MAX_QUEUE) return -1;
+	m = calloc(1, sizeof(struct rel_msg));
+	if (!m) return -1;
+	m->data = malloc(mon_hdr_len + msg_len);
+	if (!m->data) {
+		free(m);
+		return -1;
+	}
+	memcpy(m->data, mon_hdr, mon_hdr_len);
+	memcpy(m->data + mon_hdr_len, msg, msg_len);
+	m->seqnr = seqnr;
+	m->msgtype = msgtype;
+	m->mon_hdr_len = mon_hdr_len;
+	m->len = msg_len;
+	m->confirm = confirm;
+	gettimeofday(&m->queued, NULL);
+
+	if (t->tail) t->tail->next = m;
+	else t->head = m;
+	t->tail = m;
+	if (!t->next) t->next = m;
+	t->queued_bytes += msg_len;
+
+	expire(t);
+	pump(t);
+	confirm_done(t);
+	return 0;
+}
+
+void reliableRecvAck(int con_id, const struct rel_ack_msg *ack)
+{
+	struct rel_tx *t = connectbuf[con_id]->rel_tx;
+	uint32_t seq, cum = ntohl(ack->cum);
+	struct timeval now;
+	uint32_t now32 = now_us(&now);
+	int flight, acked = 0, i;
+	int32_t rtt;
+
+	if (!t || (int32_t) (cum - t->nxt) > 0) return;
+
+	flight = t->flight;
+	for (seq = t->una; (int32_t) (seq - cum) < 0; seq++)
+		acked += ack_frag(t, &t->frag[seq % REL_WINDOW]);
+	for (i = 0; i < REL_SACK_BITS; i++) {
+		if (!(ntohl(ack->sack[i / 32]) & (1u << (i % 32)))) continue;
+		seq = cum + 1 + i;
+		if ((int32_t) (seq - t->una) >= 0 && (int32_t) (seq - t->nxt) < 0)
+			acked += ack_frag(t, &t->frag[seq % REL_WINDOW]);
+	}
+	advance_una(t);
+
+	rtt = (int32_t) (now32 - ntohl(ack->echo_ts) - ntohl(ack->hold));
+	if (rtt > 0) rtt_sample(t, rtt);
+
+	if (acked) {
+		ledbat(t, ntohl(ack->delay), acked, flight, &now);
+		if (t->flight || t->lost) arm_rto(t);
+	}
+
+	// fragments sent a reordering window before an acknowledged one are lost
+	bool loss = false;
+	int32_t reorder = (t->srtt ? t->srtt : t->rto) / REL_REORDER_DIV;
+	if (reorder < REL_REORDER_MIN) reorder = REL_REORDER_MIN;
+	for (seq = t->una; seq != t->nxt; seq++) {
+		struct rel_frag *f = &t->frag[seq % REL_WINDOW];
+		if (f->in_flight && (int32_t) (t->acked_order - f->tx_order) > 0 &&
+				(int32_t) (t->acked_sent - f->sent_us) > reorder) {
+			mark_lost(t, f);
+			loss = true;
+		}
+	}
+	if (loss && statsElapsed(&t->last_reduction, &now) > (t->srtt ? t->srtt : t->rto)) {
+		t->cwnd /= 2;
+		if (t->cwnd < REL_MIN_CWND * mss(t)) t->cwnd = REL_MIN_CWND * mss(t);
+		t->slow_start = false;
+		t->last_reduction = now;
+	}
+
+	expire(t);
+	pump(t);
+	confirm_done(t);
+}
+
+/**************************** receiver ****************************/
+
+static bool rx_has(struct rel_rx *r, uint32_t seq)
+{
+	return r->bits[(seq % REL_WINDOW) / 32] & (1u << (seq % 32));
+}
+
+static void rx_advance(struct rel_rx *r)
+{
+	while (rx_has(r, r->cum)) {
+		r->bits[(r->cum % REL_WINDOW) / 32] &= ~(1u << (r->cum % 32));
+		r->cum++;
+	}
+}
+
+static void send_ack(struct rel_rx *r)
+{
+	struct rel_ack_msg ack;
+	struct timeval now;
+	int i;
+
+	gettimeofday(&now, NULL);
+	memset(&ack, 0, sizeof(ack));
+	ack.cum = htonl(r->cum);
+	ack.echo_ts = htonl(r->echo_ts);
+	ack.hold = htonl((uint32_t) statsElapsed(&r->echo_arrival, &now));
+	ack.delay = htonl(r->delay);
+	for (i = 0; i < REL_SACK_BITS && i < REL_WINDOW - 1; i++)
+		if (rx_has(r, r->cum + 1 + i)) ack.sack[i / 32] |= 1u << (i % 32);
+	for (i = 0; i < REL_SACK_BITS / 32; i++) ack.sack[i] = htonl(ack.sack[i]);
+
+	r->pending = 0;
+	if (r->ack_armed) {
+		event_del(r->ack_event);
+		r->ack_armed = false;
+	}
+	send_msg(r->con_id, ML_REL_ACK_MSG, &ack, sizeof(ack), true, &(connectbuf[r->con_id]->defaultSendParams));
+}
+
+static void ack_cb(int fd, short event, void *arg)
+{
+	struct rel_rx *r = connectbuf[(long) arg]->rel_rx;
+
+	r->ack_armed = false;
+	if (r->pending) send_ack(r);
+}
+
+bool reliableRecv(int con_id, const struct rel_data_hdr *hdr)
+{
+	struct rel_rx *r = connectbuf[con_id]->rel_rx;
+	uint32_t seq = ntohl(hdr->frag_seq), from = ntohl(hdr->base);
+	bool fresh;
+	int32_t d;
+
+	if (!r) {
+		r = calloc(1, sizeof(struct rel_rx));
+		if (!r) return false;
+		r->con_id = con_id;
+		r->ack_event = event_new(base, -1, EV_TIMEOUT, &ack_cb, (void *) (long) con_id);
+		connectbuf[con_id]->rel_rx = r;
+	}
+
+	// the sender gave up the fragments before from
+	d = (int32_t) (from - r->cum);
+	if (d >= REL_WINDOW) {
+		memset(r->bits, 0, sizeof(r->bits));
+		r->cum = from;
+	} else {
+		for (; d > 0; d--) {
+			r->bits[(r->cum % REL_WINDOW) / 32] &= ~(1u << (r->cum % 32));
+			r->cum++;
+		}
+	}
+	rx_advance(r);
+
+	d = (int32_t) (seq - r->cum);
+	fresh = d >= 0 && d < REL_WINDOW && !rx_has(r, seq);
+	if (fresh) {
+		r->bits[(seq % REL_WINDOW) / 32] |= 1u << (seq % 32);
+		rx_advance(r);
+	}
+	r->echo_ts = ntohl(hdr->ts);
+	r->delay = now_us(&r->echo_arrival) - r->echo_ts;
+
+	if (!fresh || d != 0 || ++r->pending >= 2) {
+		send_ack(r);
+	} else if (!r->ack_armed) {
+		struct timeval tv = { 0, REL_ACK_DELAY };
+		evtimer_add(r->ack_event, &tv);
+		r->ack_armed = true;
+	}
+	return fresh;
+}
+
+bool reliableKeepWaiting(const struct timeval *first)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return statsElapsed(first, &now) < give_up.tv_sec * 1000000ULL + give_up.tv_usec;
+}
+
+void reliableClose(int con_id, struct rel_tx *t, struct rel_rx *r)
+{
+	if (r) {
+		if (r->ack_armed) event_del(r->ack_event);
+		event_free(r->ack_event);
+		free(r);
+	}
+	if (t) {
+		if (t->rto_armed) event_del(t->rto_event);
+		event_free(t->rto_event);
+		while (t->head) {
+			STATS_ADD(con_id, txRelFailures, 1);
+			finish_msg(t, t->head, false);
+		}
+		// the connection is gone, nothing the callbacks do can reach t
+		while (t->done) {
+			struct rel_msg *m = t->done;
+			t->done = m->next;
+			if (m->confirm && send_Confirmation_cb) (send_Confirmation_cb) (con_id, m->seqnr, m->msgtype, m->delivered);
+			free(m->data);
+			free(m);
+		}
+		free(t);
+	}
+}
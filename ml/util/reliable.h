@@ -0,0 +1,156 @@
+/*
+ * This file is part of the Messaging Library.
+ *
+ * The Messaging Library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * The Messaging Library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the Messaging Library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef RELIABLE_H
+#define RELIABLE_H
+
+/**
+ * Reliable, congestion controlled delivery of messages sent with
+ * send_params.reliable (or confirmation).
+ *
+ * The fragments of reliable messages are numbered per connection and sent as
+ * ML_REL_DATA_MSG packets. The receiver acknowledges them cumulatively and
+ * selectively for REL_SACK_BITS fragments beyond (ML_REL_ACK_MSG), echoing
+ * the send time of the latest fragment and its one way delay. The sender
+ * keeps an RTT estimate for its retransmission timeout (RFC 6298) and
+ * retransmits a fragment once a fragment sent more than a reordering window
+ * after it is acknowledged (RACK, RFC 8985), so that reordering by jitter is
+ * not taken for loss. Its congestion window follows LEDBAT (RFC 6817): it grows
+ * while the queuing delay, the one way delay above its minimum, is below
+ * REL_TARGET and shrinks above, so reliable transfers make way for the live
+ * traffic sharing the bottleneck.
+ *
+ * Messages not completely acknowledged within REL_GIVE_UP are given up, and so
+ * are those with a fragment to retransmit that a lowered path MTU no longer
+ * lets through (fragments are cut once, new ones at the new MTU). The
+ * send confirmation callback (mlRegisterSendConfirmationCb) reports the
+ * outcome of the messages sent with confirmation.
+ */
+
+/**
+ * Fragments a connection may have in flight and the receiver keeps track of
+ */
+#define REL_WINDOW 1024
+
+/**
+ * Reordering window: a fraction of the smoothed RTT (1/n), and its minimum (us)
+ */
+#define REL_REORDER_DIV 4
+#define REL_REORDER_MIN 1000
+
+/**
+ * Queuing delay the congestion controller aims at (us)
+ */
+#define REL_TARGET 100000
+
+/**
+ * Initial, minimum and maximum retransmission timeout (us)
+ */
+#define REL_RTO_INIT 1000000
+#define REL_RTO_MIN 200000
+#define REL_RTO_MAX 10000000
+
+/**
+ * Acknowledge in order fragments after at most this time (us) or every second fragment
+ */
+#define REL_ACK_DELAY 10000
+
+/**
+ * Give up messages (and the receiver their reassembly) not complete after this time
+ */
+#define REL_GIVE_UP { 30, 0 }
+
+/**
+ * Bytes of reliable messages a connection may have queued
+ */
+#define REL_MAX_QUEUE (16*1024*1024)
+
+/**
+ * A reliable message waiting for its acknowledgements
+ */
+struct rel_msg {
+	struct rel_msg *next;
+	int seqnr;	///< msg_seq_num of the message
+	unsigned char msgtype;
+	char *data;	///< monitoring data header followed by the message
+	int mon_hdr_len;	///< length of the monitoring data header
+	int len;	///< length of the message
+	int sent;	///< bytes of the message sent at least once
+	int unacked;	///< fragments sent and not yet acknowledged
+	bool confirm;	///< report the outcome to the send confirmation callback
+	bool delivered;	///< the outcome, once the message is done
+	struct timeval queued;
+};
+
+/**
+ * A fragment sent, by fragment sequence number modulo REL_WINDOW
+ */
+struct rel_frag {
+	struct rel_msg *msg;
+	int offset;
+	int len;
+	uint32_t tx_order;	///< position of its latest transmission among all transmissions
+	uint32_t sent_us;	///< time of its latest transmission (us, modulo 2^32)
+	char acked;	///< acknowledged (or given up with its message)
+	char in_flight;	///< counted in the flight size
+	char lost;	///< waiting for its retransmission
+};
+
+/**
+ * Send confirmation callback, set by mlRegisterSendConfirmationCb (defined in ml.c)
+ */
+extern send_confirmation_cb send_Confirmation_cb;
+
+/**
+ * Queue a message for reliable delivery and send what the congestion window allows
+ * @param mon_hdr the monitoring data header of the message
+ * @return 0, or -1 if the queue of the connection is full
+ */
+int reliableSend(int con_id, int seqnr, unsigned char msgtype, const char *mon_hdr, int mon_hdr_len, const char *msg, int msg_len, bool confirm);
+
+/**
+ * Account for an ML_REL_DATA_MSG packet and acknowledge it
+ * @param hdr the reliable header of the packet, in network byte order
+ * @return true if the fragment is new and is to be reassembled, false for duplicates
+ */
+bool reliableRecv(int con_id, const struct rel_data_hdr *hdr);
+
+/**
+ * Process an ML_REL_ACK_MSG packet
+ */
+void reliableRecvAck(int con_id, const struct rel_ack_msg *ack);
+
+/**
+ * Release the reliable state of a connection that was closed, its pending messages fail
+ * @param tx the sender state the connection had (may be NULL)
+ * @param rx the receiver state the connection had (may be NULL)
+ */
+void reliableClose(int con_id, struct rel_tx *tx, struct rel_rx *rx);
+
+/**
+ * Whether an incomplete reliable message that arrived first at first is still worth waiting for
+ */
+bool reliableKeepWaiting(const struct timeval *first);
+
+/**
+ * Send a fragment of a reliable message (defined in ml.c)
+ * @return the error code of queueOrSendPacket
+ */
+int send_rel_fragment(int con_id, struct rel_msg *m, int offset, int len, struct rel_data_hdr *hdr);
+
+#endif
@@ -132,6 +132,7 @@ int send_stun_request(const int udpSocket,struct sockaddr_storage *stunServ)
   iov.iov_base = buf;
   debug("Sending STUN with sendPacketFinal %d, %d!!!!!\n",len, udpSocket); 
   sendPacketFinal(udpSocket,&iov,1,stunServ);
+  flushPackets(udpSocket);
 
   return 0;
 
@@ -25,8 +25,10 @@
 #ifdef __linux__
 #include <linux/types.h>
 #include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
 #include <linux/if.h>
 #include <ifaddrs.h>
+#include <netinet/udp.h>
 #else
 #define MSG_ERRQUEUE 0
 #endif
@@ -42,6 +44,47 @@
 /* debug varible: set to 1 if you want debug output  */
 int verbose = 0;
 
+/* kernel timestamps of the packets sent with sendPacketTimestamped, NULL if not asked for */
+static tx_timestamp_cb tx_timestamp_callback = NULL;
+
+/* the number the kernel gives the timestamp of the next sendmsg that asks for one */
+static uint32_t tx_stamp_next = 0;
+
+/* the outcome of every packet sent, NULL if nobody asked for it */
+static tx_done_cb tx_done_callback = NULL;
+
+/* UDP segmentation/receive offload: requested by the application, active if the kernel accepted it */
+static int offload_requested = 0;
+static int offload_active = 0;
+
+#ifdef UDP_SEGMENT
+/* Packets waiting to be sent as one GSO super-datagram */
+static struct {
+	int udpSocket;
+	struct sockaddr_storage addr;
+	int segSize;	///< size of every segment but the last
+	int nseg;	///< number of staged segments
+	int len;	///< bytes used in buf
+	int txstamp;	///< a staged packet asked for a TX timestamp
+	char buf[UDP_OFFLOAD_MAX_BYTES];
+} gso_batch;
+#endif
+
+void setTxDoneCallback(tx_done_cb cb)
+{
+	tx_done_callback = cb;
+}
+
+void setUdpOffload(int enable)
+{
+	offload_requested = enable;
+}
+
+int getUdpOffload()
+{
+	return offload_active;
+}
+
 void resolve_hostname(char* ipaddr,const char *hostname,int str_maxlen)
 {
 	struct addrinfo hints, *result;
@@ -215,6 +258,27 @@ int createSocket(const int port,const char *ipaddr)
 
 #endif
 
+#ifdef SO_TIMESTAMPNS
+  /* The kernel stamps the arrival of every packet, we get it in the ancillary data */
+  if(setsockopt(udpSocket,SOL_SOCKET,SO_TIMESTAMPNS,&yes,size))
+  {
+	error("setsockopt: cannot set SO_TIMESTAMPNS. ERRNO %d\n",errno);
+  }
+#endif
+
+#ifdef UDP_SEGMENT
+  offload_active = 0;
+  if (offload_requested) {
+	int gso_size = 0;	//the size is given per sendmsg, this only probes kernel support
+	if (!setsockopt(udpSocket, SOL_UDP, UDP_SEGMENT, &gso_size, size))
+		offload_active |= UDP_OFFLOAD_GSO;
+	if (!setsockopt(udpSocket, SOL_UDP, UDP_GRO, &yes, size))
+		offload_active |= UDP_OFFLOAD_GRO;
+	info("ML: UDP offload requested, GSO %s, GRO %s\n", offload_active & UDP_OFFLOAD_GSO ? "on" : "off",
+		offload_active & UDP_OFFLOAD_GRO ? "on" : "off");
+  }
+#endif
+
 #ifdef _WIN32 //TODO: verify whether this fix is needed on other OSes. Verify why this is needed on Win (libevent?)
   int intval = 64*1024;
   if(setsockopt(udpSocket,SOL_SOCKET, SO_RCVBUF, (char *) &intval,sizeof(intval)) < 0) {
@@ -254,7 +318,7 @@ int getTTL(const int udpSocket,uint8_t *ttl){
 #endif
 }
 
-int sendPacketFinal(const int udpSocket, struct iovec *iov, int len, struct sockaddr_storage *socketaddr)
+static int sendIov(const int udpSocket, struct iovec *iov, int len, struct sockaddr_storage *socketaddr, int txstamp)
 {
 	int error, ret;
 	struct msghdr msgh;
@@ -265,23 +329,192 @@ int sendPacketFinal(const int udpSocket, struct iovec *iov, int len, struct sock
 	msgh.msg_iovlen = len;
 	msgh.msg_flags = 0;
 
-	/* we do not send ancilliary data  */
+	/* the only ancilliary data we send is the request of a TX timestamp */
 	msgh.msg_control = NULL;
 	msgh.msg_controllen = 0;
+#ifdef SO_TIMESTAMPING
+	char control[CMSG_SPACE(sizeof(uint32_t))];
+	if (txstamp) {
+		struct cmsghdr *cmsg;
+		msgh.msg_control = control;
+		msgh.msg_controllen = sizeof(control);
+		cmsg = CMSG_FIRSTHDR(&msgh);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SO_TIMESTAMPING;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(uint32_t));
+		*((uint32_t *) CMSG_DATA(cmsg)) = SOF_TIMESTAMPING_TX_SOFTWARE;
+	}
+#endif
 
 	/* send the message  */
 	ret = sendmsg(udpSocket,&msgh,0);
 	if (ret  < 0){
 		error = errno;
 		info("ML: sendmsg failed errno %d: %s\n", error, strerror(error));
-		switch(error) {
-			case EMSGSIZE:
-				return MSGLEN;
-			default:
-				return FAILURE;
+		ret = error == EMSGSIZE ? MSGLEN : FAILURE;
+	}
+	else {
+		ret = OK;
+		if (txstamp) tx_stamp_next++;
+	}
+	if (tx_done_callback) tx_done_callback(iov, len, ret);
+	return ret;
+}
+
+#ifdef UDP_SEGMENT
+static int sameAddr(const struct sockaddr_storage *a, const struct sockaddr_storage *b)
+{
+	if (a->ss_family != b->ss_family) return 0;
+	if (a->ss_family == AF_INET)
+		return ((struct sockaddr_in *)a)->sin_port == ((struct sockaddr_in *)b)->sin_port &&
+			((struct sockaddr_in *)a)->sin_addr.s_addr == ((struct sockaddr_in *)b)->sin_addr.s_addr;
+	if (a->ss_family == AF_INET6)
+		return ((struct sockaddr_in6 *)a)->sin6_port == ((struct sockaddr_in6 *)b)->sin6_port &&
+			!memcmp(&((struct sockaddr_in6 *)a)->sin6_addr, &((struct sockaddr_in6 *)b)->sin6_addr, sizeof(struct in6_addr));
+	return 0;
+}
+#endif
+
+int flushPackets(const int udpSocket)
+{
+#ifdef UDP_SEGMENT
+	struct msghdr msgh;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	char control[CMSG_SPACE(sizeof(uint16_t)) + CMSG_SPACE(sizeof(uint32_t))];
+	int nseg = gso_batch.nseg;
+	int offset, error, segRet, ret = OK;
+
+	if (nseg == 0 || gso_batch.udpSocket != udpSocket) return OK;
+	gso_batch.nseg = 0;
+
+	iov.iov_base = gso_batch.buf;
+	iov.iov_len = gso_batch.len;
+	if (nseg == 1) return sendIov(udpSocket, &iov, 1, &gso_batch.addr, gso_batch.txstamp);
+
+	memset(&msgh, 0, sizeof(msgh));
+	msgh.msg_name = &gso_batch.addr;
+	msgh.msg_namelen = sizeof(struct sockaddr_storage);
+	msgh.msg_iov = &iov;
+	msgh.msg_iovlen = 1;
+	msgh.msg_control = control;
+	msgh.msg_controllen = sizeof(control);
+	cmsg = CMSG_FIRSTHDR(&msgh);
+	cmsg->cmsg_level = SOL_UDP;
+	cmsg->cmsg_type = UDP_SEGMENT;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+	*((uint16_t *) CMSG_DATA(cmsg)) = gso_batch.segSize;
+	msgh.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+#ifdef SO_TIMESTAMPING
+	/* one timestamp for the whole super-datagram, its segments leave together */
+	if (gso_batch.txstamp) {
+		msgh.msg_controllen += CMSG_SPACE(sizeof(uint32_t));
+		cmsg = CMSG_NXTHDR(&msgh, cmsg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SO_TIMESTAMPING;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(uint32_t));
+		*((uint32_t *) CMSG_DATA(cmsg)) = SOF_TIMESTAMPING_TX_SOFTWARE;
+	}
+#endif
+
+	if (sendmsg(udpSocket, &msgh, 0) >= 0) {
+		if (gso_batch.txstamp) tx_stamp_next++;
+		for (offset = 0; tx_done_callback && offset < gso_batch.len; offset += gso_batch.segSize) {
+			iov.iov_base = gso_batch.buf + offset;
+			iov.iov_len = gso_batch.len - offset < gso_batch.segSize ? gso_batch.len - offset : gso_batch.segSize;
+			tx_done_callback(&iov, 1, OK);
 		}
+		return OK;
+	}
+
+	/* The kernel refused the super-datagram: either the device cannot
+	 * segment, or a segment exceeds the path MTU. Sending the segments
+	 * one by one tells the two apart and gives each its own error code.
+	 */
+	error = errno;
+	for (offset = 0; offset < gso_batch.len; offset += gso_batch.segSize) {
+		iov.iov_base = gso_batch.buf + offset;
+		iov.iov_len = gso_batch.len - offset < gso_batch.segSize ? gso_batch.len - offset : gso_batch.segSize;
+		segRet = sendIov(udpSocket, &iov, 1, &gso_batch.addr, offset == 0 && gso_batch.txstamp);
+		if (ret == OK) ret = segRet;
+	}
+	if (ret == OK && error != EAGAIN && error != EWOULDBLOCK) {
+		info("ML: UDP GSO send failed (errno %d: %s), falling back to single datagrams\n", error, strerror(error));
+		offload_active &= ~UDP_OFFLOAD_GSO;
 	}
+	return ret;
+#else
 	return OK;
+#endif
+}
+
+/* Sends a packet, or stages it for GSO; *key is set to the number of its TX timestamp */
+static int sendOrStage(const int udpSocket, struct iovec *iov, int len, struct sockaddr_storage *socketaddr, int txstamp, uint32_t *key)
+{
+#ifdef UDP_SEGMENT
+	int i, pktLen = 0;
+
+	if (offload_active & UDP_OFFLOAD_GSO) {
+		for (i = 0; i < len; i++) pktLen += iov[i].iov_len;
+
+		/* only equal sized packets to the same peer can share a batch, a shorter one closes it;
+		 * the errors of the batch belong to its packets, they are not this packet's */
+		if (gso_batch.nseg && (gso_batch.udpSocket != udpSocket || !sameAddr(&gso_batch.addr, socketaddr) ||
+				pktLen > gso_batch.segSize || gso_batch.len % gso_batch.segSize ||
+				gso_batch.nseg == UDP_OFFLOAD_MAX_SEGMENTS || gso_batch.len + pktLen > UDP_OFFLOAD_MAX_BYTES))
+			flushPackets(gso_batch.udpSocket);
+
+		if (pktLen <= UDP_OFFLOAD_MAX_BYTES) {
+			if (gso_batch.nseg == 0) {
+				gso_batch.udpSocket = udpSocket;
+				memcpy(&gso_batch.addr, socketaddr, sizeof(struct sockaddr_storage));
+				gso_batch.segSize = pktLen;
+				gso_batch.len = 0;
+				gso_batch.txstamp = 0;
+			}
+			for (i = 0; i < len; i++) {
+				memcpy(gso_batch.buf + gso_batch.len, iov[i].iov_base, iov[i].iov_len);
+				gso_batch.len += iov[i].iov_len;
+			}
+			gso_batch.nseg++;
+			/* the stamped packets of a batch share the timestamp of its sendmsg */
+			if (txstamp) gso_batch.txstamp = 1;
+			if (key) *key = tx_stamp_next;
+			return OK;
+		}
+	}
+#endif
+	if (key) *key = tx_stamp_next;
+	return sendIov(udpSocket, iov, len, socketaddr, txstamp);
+}
+
+int sendPacketFinal(const int udpSocket, struct iovec *iov, int len, struct sockaddr_storage *socketaddr)
+{
+	return sendOrStage(udpSocket, iov, len, socketaddr, 0, NULL);
+}
+
+int sendPacketTimestamped(const int udpSocket, struct iovec *iov, int len, struct sockaddr_storage *socketaddr, uint32_t *key)
+{
+	return sendOrStage(udpSocket, iov, len, socketaddr, tx_timestamp_callback != NULL, key);
+}
+
+int setTxTimestamps(const int udpSocket, tx_timestamp_cb cb)
+{
+#ifdef SO_TIMESTAMPING
+	/* report software stamps, numbered, without the packet; the packets to stamp ask for it themselves */
+	int flags = cb ? SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY : 0;
+
+	if (setsockopt(udpSocket, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags))) {
+		info("ML: TX timestamps not supported, ERRNO %d\n", errno);
+		tx_timestamp_callback = NULL;
+		return 0;
+	}
+	tx_timestamp_callback = cb;
+	tx_stamp_next = 0;
+	return cb != NULL;
+#else
+	return 0;
+#endif
 }
 
 /* A general error handling function on socket operations
@@ -289,13 +522,8 @@ int sendPacketFinal(const int udpSocket, struct iovec *iov, int len, struct sock
  *
  */
 
-//This function has to deal with what to do when an icmp is received
-//--check the connection array, look to which connection-establishment the icmp belongs
-//--invoke a retransmission
-int handleSocketError(const int udpSocket,const int iofunc,char *buf,int *bufsize,struct sockaddr_storage *addr,icmp_error_cb icmpcb_value,int *ttl){
-
-
-	if(verbose == 1) debug("handle Socket error is called\n");
+/* Read and handle one entry of the error queue, -1 if it is empty */
+static int readSocketError(const int udpSocket,char *buf,int *bufsize,icmp_error_cb icmpcb_value){
 
 	/* variables  */
 	struct msghdr msgh;
@@ -308,6 +536,9 @@ int handleSocketError(const int udpSocket,const int iofunc,char *buf,int *bufsiz
 	int recvbufsize = 1500;
 	char recvbuf[recvbufsize];
 	int icmp = 0;
+	struct timespec *txstamp = NULL;
+	uint32_t txkey = 0;
+	int txstamped = 0;
 
 	/* initialize recvmsg data  */
 	msgh.msg_name = &sender_addr;
@@ -324,16 +555,31 @@ int handleSocketError(const int udpSocket,const int iofunc,char *buf,int *bufsiz
 	//initialize pointer
 	errptr = NULL;
 
-	/* get the error from the error que:  */
+	/* get the error from the error que (TX timestamps come without data):  */
 	returnStatus = recvmsg(udpSocket,&msgh,MSG_ERRQUEUE|MSG_DONTWAIT);
-	if (returnStatus <= 0) {
+	if (returnStatus < 0) {
 		return -1;
 	}
 	for (cmsg = CMSG_FIRSTHDR(&msgh); cmsg != NULL; cmsg = CMSG_NXTHDR(&msgh,cmsg)){
 #ifdef __linux__
+#ifdef SO_TIMESTAMPING
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_TIMESTAMPING) {
+			/* software stamp first, the others are for hardware timestamping */
+			txstamp = &((struct scm_timestamping *)CMSG_DATA(cmsg))->ts[0];
+		}
+#endif
 		//fill the error pointer
-		if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_RECVERR) {
+		if ((cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_RECVERR) ||
+			(cmsg->cmsg_level == IPPROTO_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)) {
 			errptr = (struct sock_extended_err *)CMSG_DATA(cmsg);
+#ifdef SO_EE_ORIGIN_TIMESTAMPING
+			/* the stamp of a packet we sent, numbered by SOF_TIMESTAMPING_OPT_ID */
+			if (errptr->ee_origin == SO_EE_ORIGIN_TIMESTAMPING) {
+				txkey = errptr->ee_data;
+				txstamped = 1;
+				continue;
+			}
+#endif
 //			if (errptr == NULL){
 //			if(verbose == 1)
 //				error("no acillary error data \n");
@@ -379,6 +625,25 @@ int handleSocketError(const int udpSocket,const int iofunc,char *buf,int *bufsiz
             ;
 	} //end of for
 
+	if (txstamped && txstamp && tx_timestamp_callback) (tx_timestamp_callback)(txkey, txstamp);
+	return 0;
+}
+
+//This function has to deal with what to do when an icmp is received
+//--check the connection array, look to which connection-establishment the icmp belongs
+//--invoke a retransmission
+int handleSocketError(const int udpSocket,const int iofunc,char *buf,int *bufsize,struct sockaddr_storage *addr,icmp_error_cb icmpcb_value,int *ttl){
+
+	int read = 0;
+
+	if(verbose == 1) debug("handle Socket error is called\n");
+
+	/* drain the queue, TX timestamps pile up there until the socket has no data to read */
+	while (readSocketError(udpSocket,buf,bufsize,icmpcb_value) == 0) read++;
+	if (read == 0) {
+		return -1;
+	}
+
 	/* after the error is read from the socket error queue the
 	* socket operation that was interrupeted by reading the error queue
 	* has to be carried out
@@ -413,7 +678,7 @@ better error handling might be needed */
 
 
 
-void recvPacket(const int udpSocket,char *buffer,int *recvSize,struct sockaddr_storage *udpdst,icmp_error_cb icmpcb_value,int *ttl)
+void recvPacket(const int udpSocket,char *buffer,int *recvSize,struct sockaddr_storage *udpdst,icmp_error_cb icmpcb_value,int *ttl,int *segSize,struct timespec *arrival)
 {
 
 	/* variables  */
@@ -439,8 +704,8 @@ void recvPacket(const int udpSocket,char *buffer,int *recvSize,struct sockaddr_s
 	*  This shows the receiving of TTL within the ancillary data of recvmsg
 	*/
 	
-	// ancilliary data buffer 
-	char ttlbuf[CMSG_SPACE(sizeof(int))];
+	// ancilliary data buffer: TTL, GRO segment size, and the arrival time (also as SCM_TIMESTAMPING if TX timestamps are on)
+	char ttlbuf[CMSG_SPACE(sizeof(int)) * 2 + CMSG_SPACE(sizeof(struct timespec)) * 4];
 	
 	//set the size of the control data
 	msgh.msg_control = ttlbuf;
@@ -450,6 +715,7 @@ void recvPacket(const int udpSocket,char *buffer,int *recvSize,struct sockaddr_s
 	msgh.msg_iov->iov_len = returnStatus;
 
 	*recvSize = returnStatus;
+	*segSize = returnStatus;
 	/* receive the message */
 	if (returnStatus < 0) {
 		if(verbose == 1) {
@@ -469,16 +735,28 @@ void recvPacket(const int udpSocket,char *buffer,int *recvSize,struct sockaddr_s
 		if(verbose == 1)
 			debug("udpSocket_recvPacket: Message received.\n");
 
+		arrival->tv_sec = 0;
 		for (cmsg = CMSG_FIRSTHDR(&msgh); cmsg != NULL; cmsg = CMSG_NXTHDR(&msgh,cmsg)) {
+#ifdef SO_TIMESTAMPNS
+			if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_TIMESTAMPNS) {
+				memcpy(arrival, CMSG_DATA(cmsg), sizeof(struct timespec));
+			}
+#endif
 			if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_TTL) {
 				ttlptr = (int *) CMSG_DATA(cmsg);
 				received_ttl = *ttlptr;
 				memcpy(ttl,ttlptr,4);
 				if(verbose == 1)
 					debug("received ttl true: %i  \n ",received_ttl);
-				break;
 			}
+#ifdef UDP_GRO
+			if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+				memcpy(segSize, CMSG_DATA(cmsg), sizeof(int));
+			}
+#endif
 		}
+		/* no kernel timestamp (or its cmsg was truncated) */
+		if (arrival->tv_sec == 0) clock_gettime(CLOCK_REALTIME, arrival);
 	}
 }
 
@@ -566,11 +844,19 @@ int sendPacketFinal(const int udpSocket, struct iovec *iov, int len, struct sock
   ret = sendto(udpSocket, buf, total_len, 0, (struct sockaddr *)socketaddr, sizeof(*socketaddr));
 debug("Sent %d bytes (%d) to %d\n",ret, WSAGetLastError(), udpSocket);
   if(buf != stack_buffer) free(buf);
-  return ret == total_len ? OK:FAILURE; 
+  ret = ret == total_len ? OK : FAILURE;
+  if(tx_done_callback) tx_done_callback(iov, len, ret);
+  return ret;
+}
+
+int flushPackets(const int udpSocket)
+{
+  return OK;
 }
 
-void recvPacket(const int udpSocket,char *buffer,int *recvSize,struct sockaddr_storage *udpdst,icmp_error_cb icmpcb_value,int *ttl)
+void recvPacket(const int udpSocket,char *buffer,int *recvSize,struct sockaddr_storage *udpdst,icmp_error_cb icmpcb_value,int *ttl,int *segSize,struct timespec *arrival)
 {
+  struct timeval now;
   debug("recvPacket");
   int salen = sizeof(struct sockaddr_storage);
   int ret;
@@ -587,7 +873,22 @@ void recvPacket(const int udpSocket,char *buffer,int *recvSize,struct sockaddr_s
       *recvSize = -1;
       return;
   }
+  *segSize = ret;
   *ttl=10;
+  gettimeofday(&now, NULL);
+  arrival->tv_sec = now.tv_sec;
+  arrival->tv_nsec = now.tv_usec * 1000;
+}
+
+int sendPacketTimestamped(const int udpSocket, struct iovec *iov, int len, struct sockaddr_storage *socketaddr, uint32_t *key)
+{
+  *key = 0;
+  return sendPacketFinal(udpSocket, iov, len, socketaddr);
+}
+
+int setTxTimestamps(const int udpSocket, tx_timestamp_cb cb)
+{
+  return 0;
 }
 
 int getTTL(const int udpSocket,uint8_t *ttl){
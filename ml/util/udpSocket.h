@@ -92,6 +92,28 @@ struct iovec {
 
 typedef enum {OK = 0, MSGLEN, FAILURE, THROTTLE} error_codes;
 
+/// @{
+/**
+  * UDP offload flags returned by getUdpOffload: kernel segmentation (GSO) on send
+  */
+#define UDP_OFFLOAD_GSO 1
+
+/**
+  * UDP offload flags returned by getUdpOffload: kernel coalescing (GRO) on receive
+  */
+#define UDP_OFFLOAD_GRO 2
+/// @}
+
+/**
+ * Maximum number of packets sent in one GSO super-datagram (kernel limit is 64)
+ */
+#define UDP_OFFLOAD_MAX_SEGMENTS 64
+
+/**
+ * Maximum size of a GSO super-datagram or of a GRO coalesced receive
+ */
+#define UDP_OFFLOAD_MAX_BYTES 65507
+
 /** 
  * A callback functions for received pmtu errors (icmp packets type 3 code 4) 
  * @param buf TODO
@@ -99,6 +121,21 @@ typedef enum {OK = 0, MSGLEN, FAILURE, THROTTLE} error_codes;
  */
 typedef void(*icmp_error_cb)(char *buf,int bufsize);
 
+/**
+ * A callback function for the kernel TX timestamps of sent packets
+ * @param key The number of the packet among the timestamped ones, from 0
+ * @param ts The time the kernel handed the packet to the device
+ */
+typedef void(*tx_timestamp_cb)(uint32_t key,const struct timespec *ts);
+
+/**
+ * A callback function for the outcome of every packet sent
+ * @param iov The parts of the packet, the first one starts with its header
+ * @param len The number of parts
+ * @param result OK, MSGLEN or FAILURE
+ */
+typedef void(*tx_done_cb)(const struct iovec *iov,int len,int result);
+
 /**
 * Initialize a sockaddr_storage structure with an IPv4 or IPv6 address
 */
@@ -119,6 +156,19 @@ void get_sockaddr_ip(const struct sockaddr_storage* addr, char* dst, size_t str_
  */
 int createSocket(const int port,const char *ipaddr);
 
+/**
+ * Request UDP segmentation and receive offload (Linux UDP_SEGMENT/UDP_GRO) for sockets created afterwards.
+ * If the kernel does not support it, the socket silently works without offload.
+ * @param enable 1 to request offload, 0 to disable it
+ */
+void setUdpOffload(int enable);
+
+/**
+ * Get the offloads accepted by the kernel for the last created socket.
+ * @return a combination of UDP_OFFLOAD_GSO and UDP_OFFLOAD_GRO
+ */
+int getUdpOffload();
+
 /** 
  * A function to get the standard TTL from the operating system. 
  * @param udpSocket The file descriptor of the udpSocket. 
@@ -129,13 +179,56 @@ int getTTL(const int udpSocket,uint8_t *ttl);
 
 /** 
  * Sends a udp packet.
+ * With GSO active, equal sized packets to the same destination are collected and
+ * sent as one super-datagram on the next flushPackets() call or when a packet
+ * that does not fit the batch arrives.
  * @param udpSocket The udpSocket file descriptor.
  * @param *buffer A pointer to the send buffer. 
  * @param bufferSize The size of the send buffer. 
  * @param *socketaddr The address of the remote socket
+ * @return OK or an error code. A packet collected for GSO returns OK, its outcome is only known
+ * when its batch is sent and is reported to the setTxDoneCallback callback, like that of every packet.
  */
 int sendPacketFinal(const int udpSocket, struct iovec *iov, int len, struct sockaddr_storage *socketaddr);
 
+/**
+ * Sends a udp packet like sendPacketFinal, asking the kernel for its TX timestamp if setTxTimestamps is on.
+ * A packet collected for GSO gets the timestamp of its super-datagram, which it shares with the other
+ * packets of the batch.
+ * @param udpSocket The udpSocket file descriptor.
+ * @param *iov The parts of the packet.
+ * @param len The number of parts.
+ * @param *socketaddr The address of the remote socket
+ * @param *key Set to the number the timestamp of the packet will be reported with.
+ * @return OK or an error code, like sendPacketFinal
+ */
+int sendPacketTimestamped(const int udpSocket, struct iovec *iov, int len, struct sockaddr_storage *socketaddr, uint32_t *key);
+
+/**
+ * Switch kernel TX timestamps of the packets sent with sendPacketTimestamped on or off.
+ * The kernel numbers the sends that ask for a timestamp from 0 when they are switched on, and reports
+ * their software TX timestamp on the error queue, which handleSocketError reads.
+ * @param udpSocket The udpSocket file descriptor.
+ * @param cb The callback the number and the timestamp of each packet are given to, NULL to switch them off.
+ * @return 1 if the timestamps are on, 0 if not (or not supported)
+ */
+int setTxTimestamps(const int udpSocket, tx_timestamp_cb cb);
+
+/**
+ * Send the packets collected by sendPacketFinal for GSO.
+ * If the kernel refuses the super-datagram, the packets are sent one by one and GSO is switched off
+ * unless the refusal was due to the packet size.
+ * @param udpSocket The udpSocket file descriptor.
+ * @return OK or the error code of the first packet that could not be sent
+ */
+int flushPackets(const int udpSocket);
+
+/**
+ * Set the callback told the outcome of every packet once it is sent or refused by the socket.
+ * @param cb The callback, NULL for none.
+ */
+void setTxDoneCallback(tx_done_cb cb);
+
 
 /**
  * Receive a udp packet
@@ -145,8 +238,10 @@ int sendPacketFinal(const int udpSocket, struct iovec *iov, int len, struct sock
  * @param *udpdst The socket address from the remote socket that send the packet.
  * @param icmpcb_value A function pointer to a callback function from type icmp_error_cb.   
  * @param *ttl A pointer to an int that is used to store the ttl information.
+ * @param *segSize A pointer to an int that is used to store the size of the packets coalesced by GRO into buffer (equal to *recvSize if not coalesced).
+ * @param *arrival A pointer to a timespec that is used to store the time the kernel received the packet (the current time if the kernel gave none).
  */
-void recvPacket(const int udpSocket,char *buffer,int *recvSize,struct sockaddr_storage *udpdst,icmp_error_cb icmpcb_value,int *ttl);
+void recvPacket(const int udpSocket,char *buffer,int *recvSize,struct sockaddr_storage *udpdst,icmp_error_cb icmpcb_value,int *ttl,int *segSize,struct timespec *arrival);
 
 /** 
  * This function is used for Error Handling. If an icmp packet is received it processes the packet. 
@@ -72,6 +72,7 @@ enum eResultIdPkt { /* Result availbale only at PKT level */
 	R_HOPCOUNT,
 	R_DATA_ID,
 	R_DATA_OFFSET,
+	R_SAMPLE_WEIGHT, /* packets the current one stands for when sampling (1 otherwise) */
 	R_LAST_PKT //do not remove, must be last
 };
 
@@ -117,6 +118,9 @@ enum eDefaultParam {
 	P_INIT_NAN_ZERO,
 	P_DEBUG_FILE,
 	P_OOB_FREQUENCY,
+	P_SAMPLING_MODE,
+	P_SAMPLING_RATE,
+	P_RECORD,
 	P_LAST_DEFAULT_PARAM
 };
 
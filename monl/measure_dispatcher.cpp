@@ -86,6 +86,8 @@ void MeasureDispatcher::addMeasureToExecLists(SocketIdMt h_dst, class MonMeasure
 					dispatcherList[h_dst]->el_rx_data_local[mp->getId()] = m;
 			}
 		}
+		if(m->flags & PACKET)
+			updateSampling(dispatcherList[h_dst]);
 	}
 }
 
@@ -149,9 +151,90 @@ void MeasureDispatcher::delMeasureFromExecLists(MonMeasure *m) {
 				}
 			}
 		}
+		if(m->flags & PACKET)
+			updateSampling(dispatcherList[h_dst]);
 	}
 }
 
+void MeasureDispatcher::updateSampling(DestinationSocketIdMtData *dd) {
+	ExecutionList *lists[] = {&dd->el_rx_pkt_local, &dd->el_rx_pkt_remote, &dd->el_tx_pkt_local, &dd->el_tx_pkt_remote};
+	ExecutionList::iterator it;
+	struct PacketSampling *ps = &dd->sampling;
+	bool measured = false;
+
+	ps->every = 0;
+	ps->random = false;
+	ps->budget = 0;
+
+	/* sample the packets any of the measures wants */
+	for(int i = 0; i < 4; i++) {
+		for(it = lists[i]->begin(); it != lists[i]->end(); it++) {
+			MonParameterValue n = it->second->param_values[P_SAMPLING_RATE];
+			measured = true;
+			switch((int)it->second->param_values[P_SAMPLING_MODE]) {
+				case 0:
+					ps->every = 1;
+					ps->random = false;
+					break;
+				case 1:
+				case 2:
+					if(ps->every == 0 || n < ps->every || (n == ps->every && ps->random)) {
+						ps->every = (int)n;
+						ps->random = it->second->param_values[P_SAMPLING_MODE] == 2.0;
+					}
+					break;
+				case 3:
+					if(n > ps->budget)
+						ps->budget = n;
+					break;
+			}
+		}
+	}
+	if(!measured || ps->every == 1) {
+		ps->every = 1;
+		ps->random = false;
+		ps->budget = 0;
+	}
+
+	memset(&dd->rx_sampler, 0, sizeof(dd->rx_sampler));
+	memset(&dd->tx_sampler, 0, sizeof(dd->tx_sampler));
+}
+
+int MeasureDispatcher::updateSampling(class MonMeasure *m) {
+	DestinationSocketIdMtData *dd;
+
+	if(!(m->flags & IN_BAND) || !(m->flags & PACKET))
+		return EOK;
+
+	dd = lookupDestination((SocketId) m->dst_socketid, m->msg_type);
+	if(dd != NULL)
+		updateSampling(dd);
+	return EOK;
+}
+
+/* Decide whether the packet is sampled, and if so the number of packets it stands for */
+static bool samplePacket(const struct PacketSampling *ps, struct PacketSampler *s, double now, result *weight) {
+	bool sampled;
+
+	s->count++;
+	if(ps->random)
+		sampled = rand() % ps->every == 0;
+	else
+		sampled = ps->every > 0 && s->count >= (uint32_t)ps->every;
+	if(ps->budget > 0) {
+		if(now >= s->next)
+			sampled = true;
+		if(sampled)
+			s->next = now + 1.0 / ps->budget;
+	}
+	if(!sampled)
+		return false;
+
+	*weight = s->count;
+	s->count = 0;
+	return true;
+}
+
 int MeasureDispatcher::sendCtrlMsg(SocketId dst, Buffer &buffer)
 {
 	int con_id,res;
@@ -305,6 +388,17 @@ int MeasureDispatcher::remoteResultsRx(SocketId sid, MsgType mt, char *cbuf) {
 				if(mm->mMeasureInstances[rmp[i].mh]->rb != NULL) {
 						mm->mMeasureInstances[rmp[i].mh]->rb->newSample(rmp[i].res);
 				}
+				/* the peer measured our packets: feed the adaptive output rate of the messaging layer */
+				if(mm->mMeasureInstances[rmp[i].mh]->flags & PACKET) {
+					switch(mm->mMeasureInstances[rmp[i].mh]->measure_plugin->getId()) {
+						case CORRECTED_DELAY:
+							mlRateFeedback(sid, rmp[i].res, NAN);
+							break;
+						case LOSS:
+							mlRateFeedback(sid, NAN, rmp[i].res);
+							break;
+					}
+				}
 			}
 		}
 	}
@@ -603,10 +697,43 @@ error:
 	return ret;
 }
 
+DestinationSocketIdMtData* MeasureDispatcher::lookupDestination(SocketId sid, MsgType mt) {
+	struct SocketIdMt h_dst;
+	DispatcherListSocketIdMt::iterator it;
+	struct DispatchCache *cache = NULL;
+	void **slot;
+
+	/* connection bound socket ids have a cache slot in the messaging layer */
+	slot = mlGetMonitoringData(sid);
+	if(slot != NULL) {
+		if(*slot == NULL)
+			*slot = calloc(1, sizeof(struct DispatchCache));
+		cache = (struct DispatchCache *) *slot;
+	}
+	if(cache != NULL) {
+		struct DispatchCacheEntry *e = &cache->entry[mt % DISPATCH_CACHE_SIZE];
+		if(e->generation == generation && e->mt == mt)
+			return e->dd;
+	}
+
+	h_dst.sid = sid;
+	h_dst.mt = mt;
+	it = dispatcherList.find(h_dst);
+
+	if(cache != NULL) {
+		struct DispatchCacheEntry *e = &cache->entry[mt % DISPATCH_CACHE_SIZE];
+		e->generation = generation;
+		e->mt = mt;
+		e->dd = it != dispatcherList.end() ? it->second : NULL;
+	}
+	return it != dispatcherList.end() ? it->second : NULL;
+}
+
 void MeasureDispatcher::createDestinationSocketIdMtData(struct SocketIdMt h_dst) {
 	DestinationSocketIdMtData *dd;
 	
 	dd = new DestinationSocketIdMtData;
+	generation++;
 
 	memcpy(dd->sid, (uint8_t*) h_dst.sid, SOCKETID_SIZE);
 	dd->h_dst.sid = (SocketId) &(dd->sid);
@@ -622,6 +749,9 @@ void MeasureDispatcher::createDestinationSocketIdMtData(struct SocketIdMt h_dst)
 		dispatcherList[dd->h_dst]->pkt_r_tx_remote[i] = NAN;
 	}
 	dispatcherList[dd->h_dst]->pkt_tx_seq_num = 0;
+	for(int i = 0; i < TX_PENDING_PKTS; i++)
+		dispatcherList[dd->h_dst]->pkt_tx_pending[i].seq = 0;
+	updateSampling(dd);
 
 	for(int i = 0; i < R_LAST_DATA; i++) {
 		dispatcherList[dd->h_dst]->data_r_rx_local[i] = NAN;
@@ -644,6 +774,7 @@ void MeasureDispatcher::destroyDestinationSocketIdMtData(SocketId dst, MsgType m
 	if(it != dispatcherList.end()) {
 		dd = it->second;
 		dispatcherList.erase(it);
+		generation++;
 		delete dd;
 	}
 	else
@@ -723,6 +854,8 @@ void MeasureDispatcher::cbRxPkt(void *arg) {
 	int i,j;
 	mon_pkt_inf *pkt_info = (mon_pkt_inf *)arg;
 	struct MonPacketHeader *mph = (MonPacketHeader*) pkt_info->monitoringHeader;
+	DestinationSocketIdMtData *dd;
+	result weight = 1;
 	struct SocketIdMt h_dst;
 	h_dst.sid = pkt_info->remote_socketID;
 	h_dst.mt = pkt_info->msgtype;
@@ -734,12 +867,30 @@ void MeasureDispatcher::cbRxPkt(void *arg) {
 	if(dispatcherList.size() == 0)
 		return;
 
-	if(dispatcherList.find(h_dst) == dispatcherList.end())
+	dd = lookupDestination(h_dst.sid, h_dst.mt);
+	if(dd == NULL)
 		return;
 
+	/* sampled packet? */
+	if(dd->sampling.every != 1) {
+		struct PacketSampler *s = &dd->rx_sampler;
+		if(mph != NULL)
+			s->hdr_seen = true;
+		if(s->hdr_seen) {
+			/* the peer samples: take the packets it put a header on, so that their sequence numbers stay consecutive */
+			s->count++;
+			if(mph == NULL)
+				return;
+			weight = s->count;
+			s->count = 0;
+		} else if(!samplePacket(&dd->sampling, s, pkt_info->arrival_time.tv_sec + pkt_info->arrival_time.tv_nsec / 1000000000.0, &weight))
+			return;
+	}
+
 	//we have a result vector to fill
-	r_loc = dispatcherList[h_dst]->pkt_r_rx_local;
-	r_rem = dispatcherList[h_dst]->pkt_r_rx_remote;
+	r_loc = dd->pkt_r_rx_local;
+	r_rem = dd->pkt_r_rx_remote;
+	r_rem[R_SAMPLE_WEIGHT] = r_loc[R_SAMPLE_WEIGHT] = weight;
 
 	//TODO: add standard fields
 	if(mph != NULL) {
@@ -755,14 +906,14 @@ void MeasureDispatcher::cbRxPkt(void *arg) {
 	r_rem[R_TTL] = r_loc[R_TTL] = pkt_info->ttl;
 	r_rem[R_DATA_ID] = r_loc[R_DATA_ID] = pkt_info->dataID;
 	r_rem[R_DATA_OFFSET] = r_loc[R_DATA_OFFSET] = pkt_info->offset;
-	r_rem[R_RECEIVE_TIME] = r_loc[R_RECEIVE_TIME] = pkt_info->arrival_time.tv_usec / 1000000.0;
+	r_rem[R_RECEIVE_TIME] = r_loc[R_RECEIVE_TIME] = pkt_info->arrival_time.tv_nsec / 1000000000.0;
 	r_rem[R_RECEIVE_TIME] = r_loc[R_RECEIVE_TIME] += pkt_info->arrival_time.tv_sec;
 
 
 	// are there local in band measures?
-	if (dispatcherList[h_dst]->el_rx_pkt_local.size() > 0) {
+	if (dd->el_rx_pkt_local.size() > 0) {
 		/* yes! */
-		ExecutionList *el_ptr_loc = &(dispatcherList[h_dst]->el_rx_pkt_local);
+		ExecutionList *el_ptr_loc = &(dd->el_rx_pkt_local);
 	
 		/* Call measures in order */
 		for( it = el_ptr_loc->begin(); it != el_ptr_loc->end(); it++)
@@ -770,9 +921,9 @@ void MeasureDispatcher::cbRxPkt(void *arg) {
 				it->second->RxPktLocal(el_ptr_loc);
 	}
 
-	if (dispatcherList[h_dst]->el_rx_pkt_remote.size() > 0) {
+	if (dd->el_rx_pkt_remote.size() > 0) {
 		/* And remotes */
-		ExecutionList *el_ptr_rem = &(dispatcherList[h_dst]->el_rx_pkt_remote);
+		ExecutionList *el_ptr_rem = &(dd->el_rx_pkt_remote);
 	
 		/* Call measurees in order */
 		j = 0;
@@ -793,6 +944,7 @@ void MeasureDispatcher::cbRxData(void *arg) {
 	int i,j;
 	mon_data_inf *data_info = (mon_data_inf *)arg;
 	struct MonDataHeader *mdh = (MonDataHeader*) data_info->monitoringDataHeader;
+	DestinationSocketIdMtData *dd;
 	struct SocketIdMt h_dst;
 	h_dst.sid = data_info->remote_socketID;
 	h_dst.mt = data_info->msgtype;
@@ -804,12 +956,13 @@ void MeasureDispatcher::cbRxData(void *arg) {
 	if(dispatcherList.size() == 0)
 		return;
 
-	if(dispatcherList.find(h_dst) == dispatcherList.end())
+	dd = lookupDestination(h_dst.sid, h_dst.mt);
+	if(dd == NULL)
 		return;
 
 	//we have a result vector to fill
-	r_loc = dispatcherList[h_dst]->data_r_rx_local;
-	r_rem = dispatcherList[h_dst]->data_r_rx_remote;
+	r_loc = dd->data_r_rx_local;
+	r_rem = dd->data_r_rx_remote;
 
 	//TODO: add standard fields
 	if(mdh != NULL) {
@@ -820,13 +973,13 @@ void MeasureDispatcher::cbRxData(void *arg) {
 		r_rem[R_REPLY_TIME] = r_loc[R_REPLY_TIME] = r_loc[R_REPLY_TIME] + ntohl(mdh->ans_ts_sec);
 	}
 	r_rem[R_SIZE] = r_loc[R_SIZE] = data_info->bufSize;
-	r_rem[R_RECEIVE_TIME] = r_loc[R_RECEIVE_TIME] = data_info->arrival_time.tv_usec / 1000000.0;
+	r_rem[R_RECEIVE_TIME] = r_loc[R_RECEIVE_TIME] = data_info->arrival_time.tv_nsec / 1000000000.0;
 	r_rem[R_RECEIVE_TIME] = r_loc[R_RECEIVE_TIME] += data_info->arrival_time.tv_sec;
 
-	if (dispatcherList[h_dst]->el_rx_data_local.size() > 0) {
+	if (dd->el_rx_data_local.size() > 0) {
 		/* yes! */
 		/* Locals first */
-		ExecutionList *el_ptr_loc = &(dispatcherList[h_dst]->el_rx_data_local);
+		ExecutionList *el_ptr_loc = &(dd->el_rx_data_local);
 	
 	
 		/* Call measurees in order */
@@ -837,10 +990,10 @@ void MeasureDispatcher::cbRxData(void *arg) {
 		}
 	}
 
-	if (dispatcherList[h_dst]->el_rx_data_remote.size() > 0) {
+	if (dd->el_rx_data_remote.size() > 0) {
 		/* And remotes */
 	
-		ExecutionList *el_ptr_rem = &(dispatcherList[h_dst]->el_rx_data_remote);
+		ExecutionList *el_ptr_rem = &(dd->el_rx_data_remote);
 	
 		/* Call measurees in order */
 		j = 0;
@@ -861,7 +1014,7 @@ void MeasureDispatcher::cbTxPkt(void *arg) {
 	int i,j;
 	mon_pkt_inf *pkt_info = (mon_pkt_inf *)arg;
 	struct MonPacketHeader *mph = (MonPacketHeader*) pkt_info->monitoringHeader;
-	struct timeval ts;
+	DestinationSocketIdMtData *dd;
 	struct SocketIdMt h_dst;
 	h_dst.sid = pkt_info->remote_socketID;
 	h_dst.mt = pkt_info->msgtype;
@@ -873,26 +1026,35 @@ void MeasureDispatcher::cbTxPkt(void *arg) {
 	if(dispatcherList.size() == 0)
 		return;
 
-	if(dispatcherList.find(h_dst) == dispatcherList.end())
+	dd = lookupDestination(h_dst.sid, h_dst.mt);
+	if(dd == NULL)
 		return;
 
 	/* yes! */
 
-	r_loc = dispatcherList[h_dst]->pkt_r_tx_local;
-	r_rem = dispatcherList[h_dst]->pkt_r_tx_remote;
+	r_loc = dd->pkt_r_tx_local;
+	r_rem = dd->pkt_r_tx_remote;
 
 	/* prepare initial result vector (based on header information) */
 		
-	r_rem[R_SEQNUM] = r_loc[R_SEQNUM] = ++(dispatcherList[h_dst]->pkt_tx_seq_num);
+	r_rem[R_SEQNUM] = r_loc[R_SEQNUM] = ++(dd->pkt_tx_seq_num);
 	r_rem[R_SIZE] = r_loc[R_SIZE] = pkt_info->bufSize;
+	/* the weight cbHdrPkt left in the header, the packet may have waited in the TX queue since */
+	r_rem[R_SAMPLE_WEIGHT] = r_loc[R_SAMPLE_WEIGHT] = mph != NULL && mph->seq_num ? mph->seq_num : 1;
 	r_rem[R_INITIAL_TTL] = r_loc[R_INITIAL_TTL] = initial_ttl;
-	gettimeofday(&ts,NULL);	
-	r_rem[R_SEND_TIME] = r_loc[R_SEND_TIME] = ts.tv_usec / 1000000.0;
-	r_rem[R_SEND_TIME] = r_loc[R_SEND_TIME] =  r_loc[R_SEND_TIME] + ts.tv_sec;
+	/* the ML gives the send time of the event loop, the kernel TX timestamp follows if enabled */
+	r_rem[R_SEND_TIME] = r_loc[R_SEND_TIME] = pkt_info->arrival_time.tv_nsec / 1000000000.0;
+	r_rem[R_SEND_TIME] = r_loc[R_SEND_TIME] =  r_loc[R_SEND_TIME] + pkt_info->arrival_time.tv_sec;
 
-	if(dispatcherList[h_dst]->el_tx_pkt_local.size() > 0) {
+	if(dd->el_tx_pkt_local.size() > 0 && tx_stamps) {
+		/* cbTxPktTs runs them with the kernel TX timestamp */
+		struct PendingTxPkt *p = &dd->pkt_tx_pending[dd->pkt_tx_seq_num % TX_PENDING_PKTS];
+		p->seq = dd->pkt_tx_seq_num;
+		p->size = r_loc[R_SIZE];
+		p->weight = r_loc[R_SAMPLE_WEIGHT];
+	} else if(dd->el_tx_pkt_local.size() > 0) {
 
-		ExecutionList *el_ptr_loc = &(dispatcherList[h_dst]->el_tx_pkt_local);
+		ExecutionList *el_ptr_loc = &(dd->el_tx_pkt_local);
 
 		/* Call measurees in order */
 		for( it = el_ptr_loc->begin(); it != el_ptr_loc->end(); it++)
@@ -900,9 +1062,9 @@ void MeasureDispatcher::cbTxPkt(void *arg) {
 				it->second->TxPktLocal(el_ptr_loc);
 	}
 
-	if(dispatcherList[h_dst]->el_tx_pkt_remote.size() > 0) {
+	if(dd->el_tx_pkt_remote.size() > 0) {
 		/* And remotes */
-		ExecutionList *el_ptr_rem = &(dispatcherList[h_dst]->el_tx_pkt_remote);
+		ExecutionList *el_ptr_rem = &(dd->el_tx_pkt_remote);
 	
 		/* Call measurees in order */
 		j = 0;
@@ -930,6 +1092,48 @@ void MeasureDispatcher::cbTxPkt(void *arg) {
 	}
 }
 
+void MeasureDispatcher::cbTxPktTs(void *arg) {
+	ExecutionList::iterator it;
+	result *r_loc;
+	mon_pkt_inf *pkt_info = (mon_pkt_inf *)arg;
+	struct MonPacketHeader *mph = (MonPacketHeader*) pkt_info->monitoringHeader;
+	struct PendingTxPkt *p;
+	DestinationSocketIdMtData *dd;
+	uint32_t seq;
+
+	if(pkt_info->remote_socketID == NULL || mph == NULL)
+		return;
+
+	/* from now on the local TX measures wait for the timestamps */
+	tx_stamps = true;
+
+	if(dispatcherList.size() == 0)
+		return;
+
+	dd = lookupDestination(pkt_info->remote_socketID, pkt_info->msgtype);
+	if(dd == NULL)
+		return;
+
+	/* sent before the timestamps showed up, or its entry was reused: already done or lost */
+	seq = ntohl(mph->seq_num);
+	p = &dd->pkt_tx_pending[seq % TX_PENDING_PKTS];
+	if(seq == 0 || p->seq != seq)
+		return;
+	p->seq = 0;
+
+	r_loc = dd->pkt_r_tx_local;
+	r_loc[R_SEQNUM] = seq;
+	r_loc[R_SIZE] = p->size;
+	r_loc[R_SAMPLE_WEIGHT] = p->weight;
+	r_loc[R_INITIAL_TTL] = initial_ttl;
+	r_loc[R_SEND_TIME] = pkt_info->arrival_time.tv_sec + pkt_info->arrival_time.tv_nsec / 1000000000.0;
+
+	ExecutionList *el_ptr_loc = &(dd->el_tx_pkt_local);
+	for( it = el_ptr_loc->begin(); it != el_ptr_loc->end(); it++)
+		if(it->second->status == RUNNING)
+			it->second->TxPktLocal(el_ptr_loc);
+}
+
 void MeasureDispatcher::cbTxData(void *arg) {
 	ExecutionList::iterator it;
 	result *r_loc,*r_rem;
@@ -938,6 +1142,7 @@ void MeasureDispatcher::cbTxData(void *arg) {
 	mon_data_inf *data_info = (mon_data_inf *)arg;
 	struct MonDataHeader *mdh = (MonDataHeader*) data_info->monitoringDataHeader;
 	struct timeval ts;
+	DestinationSocketIdMtData *dd;
 	struct SocketIdMt h_dst;
 	h_dst.sid = data_info->remote_socketID;
 	h_dst.mt = data_info->msgtype;
@@ -949,23 +1154,24 @@ void MeasureDispatcher::cbTxData(void *arg) {
 	if(dispatcherList.size() == 0)
 		return;
 
-	if(dispatcherList.find(h_dst) == dispatcherList.end())
+	dd = lookupDestination(h_dst.sid, h_dst.mt);
+	if(dd == NULL)
 		return;
 	
 	/* yes! */
-	r_loc = dispatcherList[h_dst]->data_r_tx_local;
-	r_rem = dispatcherList[h_dst]->data_r_tx_remote;
+	r_loc = dd->data_r_tx_local;
+	r_rem = dd->data_r_tx_remote;
 
 	
 	//TODO add fields
 	r_rem[R_SIZE] = r_loc[R_SIZE] = data_info->bufSize;
-	r_rem[R_SEQNUM] = r_loc[R_SEQNUM] = ++(dispatcherList[h_dst]->data_tx_seq_num);
+	r_rem[R_SEQNUM] = r_loc[R_SEQNUM] = ++(dd->data_tx_seq_num);
 	gettimeofday(&ts,NULL);
 	r_rem[R_SEND_TIME] = r_loc[R_SEND_TIME] = ts.tv_usec / 1000000.0;
 	r_rem[R_SEND_TIME] = r_loc[R_SEND_TIME] = r_loc[R_SEND_TIME] + ts.tv_sec;
 
-	if(dispatcherList[h_dst]->el_tx_data_local.size() > 0) {
-		ExecutionList *el_ptr_loc = &(dispatcherList[h_dst]->el_tx_data_local);
+	if(dd->el_tx_data_local.size() > 0) {
+		ExecutionList *el_ptr_loc = &(dd->el_tx_data_local);
 
 		/* Call measures in order */
 		for( it = el_ptr_loc->begin(); it != el_ptr_loc->end(); it++)
@@ -973,9 +1179,9 @@ void MeasureDispatcher::cbTxData(void *arg) {
 				it->second->TxDataLocal(el_ptr_loc);
 	}
 
-	if(dispatcherList[h_dst]->el_tx_data_remote.size() > 0) {
+	if(dd->el_tx_data_remote.size() > 0) {
 		/* And remote */
-		ExecutionList *el_ptr_rem = &(dispatcherList[h_dst]->el_tx_data_remote);
+		ExecutionList *el_ptr_rem = &(dd->el_tx_data_remote);
 	
 		/* Call measures in order */
 		j = 0;
@@ -1002,10 +1208,10 @@ void MeasureDispatcher::cbTxData(void *arg) {
 	}
 }
 
-int MeasureDispatcher::cbHdrPkt(SocketId sid, MsgType mt) {
-	struct SocketIdMt h_dst;
-	h_dst.sid = sid;
-	h_dst.mt = mt;
+int MeasureDispatcher::cbHdrPkt(SocketId sid, MsgType mt, void *hdr) {
+	DestinationSocketIdMtData *dd;
+	struct timeval ts = {0,0};
+	result weight = 1;
 
 	if(sid == NULL)
 		return 0;
@@ -1014,18 +1220,25 @@ int MeasureDispatcher::cbHdrPkt(SocketId sid, MsgType mt) {
 	if(dispatcherList.size() == 0)
 		return 0;
 
-	if(dispatcherList.find(h_dst) == dispatcherList.end())
+	dd = lookupDestination(sid, mt);
+	if(dd == NULL)
 		return 0;
 
-	/* yes! */
+	/* for this packet? Unsampled ones get no header, and so no cbTxPkt */
+	if(dd->sampling.every != 1) {
+		if(dd->sampling.budget > 0)
+			gettimeofday(&ts,NULL);
+		if(!samplePacket(&dd->sampling, &dd->tx_sampler, ts.tv_sec + ts.tv_usec / 1000000.0, &weight))
+			return 0;
+	}
+
+	/* yes! The weight travels with the packet, in place of the sequence number cbTxPkt writes */
+	if(hdr != NULL)
+		((struct MonPacketHeader *) hdr)->seq_num = (uint32_t) weight;
 	return MON_PACKET_HEADER_SIZE;
 }
 
 int MeasureDispatcher::cbHdrData(SocketId sid, MsgType mt) {
-	struct SocketIdMt h_dst;
-	h_dst.sid = sid;
-	h_dst.mt = mt;
-
 	if(sid == NULL)
 		return 0;
 
@@ -1033,7 +1246,7 @@ int MeasureDispatcher::cbHdrData(SocketId sid, MsgType mt) {
 	if(dispatcherList.size() == 0)
 		return 0;
 
-	if(dispatcherList.find(h_dst) == dispatcherList.end())
+	if(lookupDestination(sid, mt) == NULL)
 		return 0;
 
 	/* yes! return the space we need */
@@ -65,6 +65,29 @@ struct socketIdMtHash
 	}
 };
 
+/* Packet sampling of a destination: the densest one asked by its packet measures (see P_SAMPLING_MODE) */
+struct PacketSampling {
+	int every;	/* 1 in every packets, 1: all of them, 0: only the budget ones */
+	bool random;	/* 1 in every on average, at random */
+	double budget;	/* at most budget packets per second besides, 0: no budget */
+};
+
+/* Sampling state of one direction */
+struct PacketSampler {
+	uint32_t count;	/* packets seen since the last sampled one */
+	double next;	/* the budget allows the next sample from then on */
+	bool hdr_seen;	/* rx: the peer samples too, its monitoring headers tell which packets */
+};
+
+#define TX_PENDING_PKTS 64
+
+/* A sent packet whose local TX measures wait for its kernel TX timestamp */
+struct PendingTxPkt {
+	uint32_t seq;	/* 0: free */
+	result size;
+	result weight;
+};
+
 typedef struct {
 	ExecutionList el_rx_pkt_local;
 	ExecutionList el_rx_pkt_remote;
@@ -80,6 +103,11 @@ typedef struct {
 	result pkt_r_tx_local[R_LAST_PKT];
 	result pkt_r_tx_remote[R_LAST_PKT];
 	uint32_t pkt_tx_seq_num;
+	struct PendingTxPkt pkt_tx_pending[TX_PENDING_PKTS];	/* by sequence number */
+
+	struct PacketSampling sampling;
+	struct PacketSampler rx_sampler;
+	struct PacketSampler tx_sampler;
 
 	result data_r_rx_local[R_LAST_DATA];
 	result data_r_rx_remote[R_LAST_DATA];
@@ -98,10 +126,26 @@ typedef struct {
 
 typedef std::tr1::unordered_map<struct SocketIdMt, DestinationSocketIdMtData*, socketIdMtHash, socketIdMtCompare> DispatcherListSocketIdMt;
 
+#define DISPATCH_CACHE_SIZE 16
+
+/* Result of a dispatcherList lookup, valid while generation is unchanged */
+struct DispatchCacheEntry {
+	uint32_t generation;
+	MsgType mt;
+	DestinationSocketIdMtData *dd;	/* NULL: nothing to monitor */
+};
+
+/* Per connection lookup cache, kept in the ML connection (see mlGetMonitoringData) */
+struct DispatchCache {
+	struct DispatchCacheEntry entry[DISPATCH_CACHE_SIZE];	/* indexed by msgtype */
+};
+
 class MeasureDispatcher {
 
 	/* Execution lists for the message layer hooks */
 	DispatcherListSocketIdMt dispatcherList;
+	/* changed whenever an entry is added to or removed from dispatcherList */
+	uint32_t generation;
 	
 	void addMeasureToExecLists(SocketIdMt h_dst, class MonMeasure *m);
 	void delMeasureFromExecLists(MonMeasure *m);
@@ -110,6 +154,8 @@ class MeasureDispatcher {
 	void createDestinationSocketIdMtData(struct SocketIdMt h_dst);
 	void destroyDestinationSocketIdMtData(SocketId dst, MsgType mt);
 
+	DestinationSocketIdMtData* lookupDestination(SocketId sid, MsgType mt);
+	void updateSampling(DestinationSocketIdMtData *dd);
 	class MonMeasure* findMeasureFromId(DestinationSocketIdMtData *dd, MeasurementCapabilities flags, MeasurementId mid);
 
 	int sendCtrlMsg(SocketId dst, Buffer &buffer);
@@ -134,11 +180,13 @@ protected:
 	class MeasureManager *mm;
 
 	uint8_t initial_ttl;
+	/* kernel TX timestamps come back, the local TX packet measures wait for them */
+	bool tx_stamps;
 
 	friend class MeasureManager;
 	friend class MonMeasure;
 public:
-	MeasureDispatcher(): initial_ttl(0) {
+	MeasureDispatcher(): generation(1), initial_ttl(0), tx_stamps(false) {
 		int error1, error2;
 		uint8_t ttl;
 		error2 = mlGetStandardTTL(mlGetLocalSocketID(&error1), &initial_ttl);
@@ -151,6 +199,9 @@ public:
 
 	int oobDataTx(class MonMeasure *m, char *buf, int buf_len);
 
+	/* recompute the packet sampling of the destination of m after a parameter change */
+	int updateSampling(class MonMeasure *m);
+
 	int scheduleMeasure(MonHandler mh);
 	int schedulePublish(MonHandler mh);
 
@@ -158,8 +209,9 @@ public:
 	void cbRxPkt(void *arg);
 	void cbRxData(void *arg);
 	void cbTxPkt(void *arg);
+	void cbTxPktTs(void *arg);
 	void cbTxData(void *arg);
-	int cbHdrPkt(SocketId sid, MsgType mt);
+	int cbHdrPkt(SocketId sid, MsgType mt, void *hdr);
 	int cbHdrData(SocketId sid, MsgType mt);
 };
 
@@ -281,12 +281,16 @@ public:
 		cDispatcher.cbTxPkt(arg);
 	};
 
+	void cbTxPktTs(void *arg) {
+		cDispatcher.cbTxPktTs(arg);
+	};
+
 	void cbTxData(void *arg) {
 		cDispatcher.cbTxData(arg);
 	};
 
-	int cbHdrPkt(SocketId sid, MsgType mt) {
-		return cDispatcher.cbHdrPkt(sid, mt);
+	int cbHdrPkt(SocketId sid, MsgType mt, void *hdr) {
+		return cDispatcher.cbHdrPkt(sid, mt, hdr);
 	};
 
 	int cbHdrData(SocketId sid, MsgType mt) {
@@ -317,7 +321,7 @@ public:
 		if(!isValidMonHandler(mh))
 			return NAN;
 
-		if(mMeasureInstances[mh]->rb == NULL)
+		if(mMeasureInstances[mh]->rb == NULL || st < 0 || st >= LAST_STAT_TYPE)
 			return NAN;
 
 		mMeasureInstances[mh]->rb->updateStats();
@@ -353,7 +357,7 @@ public:
 		}
 
 		/* check if the specific measure is storing results */
-		if(m->rb  == NULL) {
+		if(m->rb  == NULL || st < 0 || st >= LAST_STAT_TYPE) {
 			return NAN;
 		}
 
@@ -361,6 +365,55 @@ public:
 		return m->rb->stats[st];
 	}
 
+	int monRetrieveResults(const MonResultColumn *columns, int n_columns, uint32_t since, MonResultRow *rows, result *values, int max_rows, uint32_t *epoch) {
+		DispatcherListSocketIdMt::iterator it;
+		std::vector<MonMeasure *> m(n_columns > 0 ? n_columns : 0);
+		int i, n = 0;
+
+		if(n_columns < 0 || max_rows < 0 || (max_rows > 0 && (rows == NULL || values == NULL)))
+			return -EINVAL;
+		if(n_columns > 0 && columns == NULL)
+			return -EINVAL;
+		for(i = 0; i < n_columns; i++)
+			if(columns[i].st < 0 || columns[i].st >= LAST_STAT_TYPE)
+				return -EINVAL;
+
+		for(it = cDispatcher.dispatcherList.begin(); it != cDispatcher.dispatcherList.end(); it++) {
+			bool active = false, changed = false;
+
+			for(i = 0; i < n_columns; i++) {
+				m[i] = cDispatcher.findMeasureFromId(it->second, columns[i].flags, columns[i].mid);
+				if(m[i] != NULL && m[i]->rb == NULL)
+					m[i] = NULL;
+				if(m[i] != NULL) {
+					active = true;
+					if(m[i]->rb->changed > since)
+						changed = true;
+				}
+			}
+			if(!active || !changed)
+				continue;
+
+			if(n < max_rows) {
+				rows[n].peer = it->second->h_dst.sid;
+				rows[n].mt = it->second->h_dst.mt;
+				for(i = 0; i < n_columns; i++) {
+					if(m[i] != NULL) {
+						m[i]->rb->updateStats();
+						values[n * n_columns + i] = m[i]->rb->stats[columns[i].st];
+					} else
+						values[n * n_columns + i] = NAN;
+				}
+			}
+			n++;
+		}
+
+		if(epoch != NULL)
+			*epoch = ResultBuffer::epoch;
+		ResultBuffer::epoch++;
+		return n;
+	}
+
 
 	void monParseConfig(void *);
 
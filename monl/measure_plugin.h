@@ -59,6 +59,9 @@ public:
 		addParameter(new MinMaxParameter("Init NAN or 0","Initialize stats to NAN or to 0", 0, 1, 0), P_INIT_NAN_ZERO);
 		addParameter(new MinMaxParameter("Debug Output","Activate/deactive debug output to file (1), to log (2) or both (3)", 0, 3, 0), P_DEBUG_FILE);
 		addParameter(new MonParameter("Exectuion Frequency","How often should it be run"), P_OOB_FREQUENCY);
+		addParameter(new MinMaxParameter("Packet Sampling","In-band packets measured: all (0), 1 in N (1), 1 in N at random (2), at most N per second (3)", 0, 3, 0), P_SAMPLING_MODE);
+		addParameter(new MinParameter("Packet Sampling Rate","The N of the packet sampling",1,10), P_SAMPLING_RATE);
+		addParameter(new MinMaxParameter("Record","Record every sample with monRecordOpen() (1) or not (0)", 0, 1, 0), P_RECORD);
 	};
 
 	virtual ~MeasurePlugin() {
@@ -21,43 +21,49 @@
 #include <event2/event.h>
 
 #include "measure_dispatcher.h"
+#include "errors.h"
+#include "napa.h"
+
+/* Runs and publishes go on the shared NAPA timer wheel: every measure has one
+   timer for each, re-armed in place, so scheduling allocates nothing and a
+   destroyed measure cannot be called back. */
 
 struct event_base *eventb = NULL;
 
-struct measure_disp_pair {
-	class MeasureDispatcher *ptrDispatcher;
-	MonHandler mh;
-};
+static void schedule_measure_cb(HANDLE h, void *arg);
+static void schedule_publish_cb(HANDLE h, void *arg);
 
-void schedule_measure_cb(evutil_socket_t fd, short what, void *arg);
-void schedule_publish_cb(evutil_socket_t fd, short what, void *arg);
+static int schedule(void **timer, void(*cb)(HANDLE h, void *arg), struct timeval *tv, MonMeasure *m) {
+	if(*timer == NULL && (*timer = napaTimerNew(cb, m)) == NULL)
+		return -ENOMEM;
+	napaTimerAdd(*timer, tv);
+	return EOK;
+}
 
 int schedule_measure(struct timeval *tv, MonMeasure *m) {
-	struct measure_disp_pair *m_disp = new struct measure_disp_pair;
-	m_disp->ptrDispatcher = m->ptrDispatcher;
-	m_disp->mh = m->mh_local;
-	return event_base_once(eventb, -1, EV_TIMEOUT, schedule_measure_cb, m_disp, tv);
+	return schedule(&m->measure_timer, schedule_measure_cb, tv, m);
 }
 
 int schedule_publish(struct timeval *tv, MonMeasure *m) {
-	struct measure_disp_pair *m_disp = new struct measure_disp_pair;
-	m_disp->ptrDispatcher = m->ptrDispatcher;
-	m_disp->mh = m->mh_local;
-	return event_base_once(eventb, -1, EV_TIMEOUT, schedule_publish_cb, m_disp, tv);
+	return schedule(&m->publish_timer, schedule_publish_cb, tv, m);
+}
+
+void unschedule(MonMeasure *m) {
+	napaTimerFree(m->measure_timer);
+	napaTimerFree(m->publish_timer);
+	m->measure_timer = m->publish_timer = NULL;
 }
 
 void init_mon_event(void *eb) {
 	eventb = (struct event_base *) eb;
 }
 
-void schedule_measure_cb(evutil_socket_t fd, short what, void *arg) {
-	struct measure_disp_pair *m_disp = (struct measure_disp_pair *) arg;
-	m_disp->ptrDispatcher->scheduleMeasure(m_disp->mh);
-	delete m_disp;
+static void schedule_measure_cb(HANDLE h, void *arg) {
+	MonMeasure *m = (MonMeasure *) arg;
+	m->ptrDispatcher->scheduleMeasure(m->mh_local);
 }
 
-void schedule_publish_cb(evutil_socket_t fd, short what, void *arg) {
-	struct measure_disp_pair *m_disp = (struct measure_disp_pair *) arg;
-	m_disp->ptrDispatcher->schedulePublish(m_disp->mh);
-	delete m_disp;
+static void schedule_publish_cb(HANDLE h, void *arg) {
+	MonMeasure *m = (MonMeasure *) arg;
+	m->ptrDispatcher->schedulePublish(m->mh_local);
 }
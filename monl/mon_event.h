@@ -25,6 +25,8 @@
 
 int schedule_measure(struct timeval *tv, MonMeasure *m);
 int schedule_publish(struct timeval *tv, MonMeasure *m);
+/* Cancel the scheduled run and publish of a measure being destroyed */
+void unschedule(MonMeasure *m);
 
 void init_mon_event(void *eb);
 
@@ -38,6 +38,8 @@ MonMeasure::MonMeasure(class MeasurePlugin *mp, MeasurementCapabilities mc, clas
 	mh_remote = -1;
 	ptrDispatcher = ptrDisp;
 	dst_socketid_publish = false;
+	measure_timer = publish_timer = NULL;
+	record_peer = -1;
 
 	/* Initialise default values */
 	int i;
@@ -60,6 +62,17 @@ int MonMeasure::sendOobData(char* buf, int buf_len) {
 	return ptrDispatcher->oobDataTx(this, buf, buf_len);
 }
 
+int MonMeasure::samplingChange() {
+	return ptrDispatcher->updateSampling(this);
+}
+
+MonMeasure::~MonMeasure() {
+	unschedule(this);
+	delete[] param_values;
+	if(rb != NULL)
+		delete rb;
+}
+
 int MonMeasure::scheduleNextIn(struct timeval *tv) {
 	return schedule_measure(tv, this);
 }
@@ -112,10 +125,10 @@ void MonMeasure::debugStop() {
 void MonMeasure::debugOutput(char *out) {
 	switch((int)param_values[P_DEBUG_FILE]) {
 	case	1:
-			output_file << out << std::endl;
+			output_file << out << '\n';
 			break;
 	case 	3:
-			output_file << out << std::endl;
+			output_file << out << '\n';
 	case	2:
 			debug("%s",out);
 			break;
@@ -30,6 +30,7 @@
 #include <math.h>
 #include "result_buffer.h"
 #include "ml.h"
+#include "mon_record.h"
 
 #include "napa_log.h"
 
@@ -91,6 +92,11 @@ protected:
 	void debugStop();
 	std::fstream output_file;
 
+	/* index of the peer in the recorder, -1 until the first recorded sample */
+	int record_peer;
+	const char *record_peer_name;
+	friend void monRecordSample(class MonMeasure *m, double value);
+
 	int paramChangeDefault(MonParameterType ph, MonParameterValue p) {
 		if(ph == P_WINDOW_SIZE && rb != NULL)
 			return rb->resizeBuffer((int)ceil(p/tx_every));
@@ -103,6 +109,8 @@ protected:
 				debugStop();
 			return EOK;
 		}
+		if((ph == P_SAMPLING_MODE || ph == P_SAMPLING_RATE) && (r_rx_list != NULL || r_tx_list != NULL))
+			return samplingChange();
 		if(ph < P_LAST_DEFAULT_PARAM)
 			return EOK;
 		return paramChange(ph,p);
@@ -127,15 +135,15 @@ public:
 	class MeasureDispatcher *ptrDispatcher;
 	MonHandler mh_local;
 
+	/* Timers of the next scheduled run and publish (see mon_event.cpp), NULL until first used */
+	void *measure_timer;
+	void *publish_timer;
+
 	/* Functions */
 	/* Constructor: MUST BE CALLED BY DERIVED CLASSES*/
 	MonMeasure(class MeasurePlugin *mp, MeasurementCapabilities mc, class MeasureDispatcher *ptrDisp, int tx_every=1);
 
-	virtual ~MonMeasure() {
-		delete[] param_values;
-		if(rb != NULL)
-			delete rb;
-	};
+	virtual ~MonMeasure();
 
 	/* Get vector of MonParameterValues (pointers to the MonParameterValue instances) */
 	std::vector<class MonParameter* >& listParameters(void) {
@@ -204,6 +212,7 @@ public:
 	};
 
 	void defaultInit() {
+		record_peer = -1;
 		init();
 		if(param_values[P_DEBUG_FILE] == 1.0 || param_values[P_DEBUG_FILE] == 3.0)
 			debugInit(measure_plugin->name.c_str());
@@ -224,13 +233,13 @@ public:
 	void RxPktLocal(ExecutionList *el) {
 		if(r_rx_list == NULL)
 			return;
-		newSample(RxPkt(r_rx_list, el));
+		newSample(RxPkt(r_rx_list, el), r_rx_list[R_SAMPLE_WEIGHT]);
 	};
 	void RxPktRemote(struct res_mh_pair *rmp, int &i, ExecutionList *el) {
 		if(r_rx_list == NULL)
 			return;
 		result r = RxPkt(r_rx_list, el);
-		newSample(r);
+		newSample(r, r_rx_list[R_SAMPLE_WEIGHT]);
 		if(!isnan(r)) {
 			rmp[i].res = r;
 			rmp[i].mh = mh_remote;
@@ -258,13 +267,13 @@ public:
 	void TxPktLocal(ExecutionList *el) {
 		if(r_tx_list == NULL)
 			return;
-		newSample(TxPkt(r_tx_list, el));
+		newSample(TxPkt(r_tx_list, el), r_tx_list[R_SAMPLE_WEIGHT]);
 	};
 	void TxPktRemote(struct res_mh_pair *rmp, int &i, ExecutionList *el) {
 		if(r_tx_list == NULL)
 			return;
 		result r = TxPkt(r_tx_list, el);
-		newSample(r);
+		newSample(r, r_tx_list[R_SAMPLE_WEIGHT]);
 		if(!isnan(r)) {
 			rmp[i].res = r;
 			rmp[i].mh = mh_remote;
@@ -289,9 +298,12 @@ public:
 		}
 	};
 
-	int newSample(result r) {
+	/* weight: the number of packets r stands for when they are sampled */
+	int newSample(result r, result weight = 1.0) {
+		if(!isnan(r) && param_values[P_RECORD] != 0.0)
+			monRecordSample(this, r);
 		if(!isnan(r) && rb != NULL) {
-			rb->newSample(r);
+			rb->newSample(r, weight);
 			return EOK;
 		}
 		else
@@ -306,6 +318,9 @@ public:
 
 	int sendOobData(char* buf, int buf_len);
 
+	/* apply a change of P_SAMPLING_MODE or P_SAMPLING_RATE to the running measure */
+	int samplingChange();
+
 	/* Functions processing a message (packet and data) and extracting the measure to be stored */
 	virtual result RxPkt(result *r, ExecutionList *) {return NAN;};
 	virtual result RxData(result *r, ExecutionList *) {return NAN;};
@@ -0,0 +1,200 @@
+/*
+ * This file implements the measurement recorder (see mon_record.h).
+ *
+ * The current segment is mapped; a sample is its fields stored in the columns
+ * and the count increased, no system call. A full segment is unmapped and the
+ * next one created, removing the oldest one beyond the number to keep.
+ * Peers and measures are added to the dictionary of a segment the first time
+ * one of its records refers to them.
+ */
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include "mon_record.h"
+#include "mon_measure.h"
+#include "napa_log.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+static struct {
+	std::string prefix;
+	uint32_t capacity;
+	int keep;
+	char *base;
+	size_t length;
+	struct mon_record_header *header;
+	uint32_t seq;
+	/* global peer indices, and the segment each was last described in (+1) */
+	std::map<std::string, uint32_t> peer_index;
+	std::vector<uint32_t> peer_segment;
+	uint32_t measure_segment[LAST_ID];
+} rec;
+
+static void segmentName(char *name, size_t size, uint32_t seq) {
+	snprintf(name, size, "%s.%06u", rec.prefix.c_str(), seq);
+}
+
+static void closeSegment() {
+#ifndef _WIN32
+	if(rec.base)
+		munmap(rec.base, rec.length);
+#endif
+	rec.base = NULL;
+	rec.header = NULL;
+}
+
+/* Start the next segment, skipping the names in use */
+static int openSegment() {
+#ifndef _WIN32
+	char name[1024];
+	int fd;
+
+	closeSegment();
+	for(;;) {
+		segmentName(name, sizeof(name), rec.seq);
+		fd = open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+		if(fd >= 0 || errno != EEXIST)
+			break;
+		rec.seq++;
+	}
+	if(fd < 0) {
+		error("MONL: unable to create record segment %s", name);
+		return -EFAILED;
+	}
+	rec.length = MON_RECORD_SEGMENT_SIZE(rec.capacity);
+	if(ftruncate(fd, rec.length)) {
+		error("MONL: unable to size record segment %s", name);
+		close(fd);
+		return -EFAILED;
+	}
+	char *base = (char *) mmap(NULL, rec.length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(base == MAP_FAILED) {
+		error("MONL: unable to map record segment %s", name);
+		return -EFAILED;
+	}
+
+	if(rec.keep > 0 && rec.seq >= (uint32_t) rec.keep) {
+		char old[1024];
+		segmentName(old, sizeof(old), rec.seq - rec.keep);
+		unlink(old);
+	}
+
+	rec.base = base;
+	rec.header = (struct mon_record_header *) base;
+	rec.header->version = MON_RECORD_VERSION;
+	rec.header->seq = rec.seq;
+	rec.header->capacity = rec.capacity;
+	rec.header->count = 0;
+	rec.header->peers = 0;
+	rec.header->measures = 0;
+	rec.header->peer_offset = MON_RECORD_HEADER_SIZE;
+	rec.header->measure_offset = rec.header->peer_offset + MON_RECORD_MAX_PEERS * sizeof(struct mon_record_name);
+	rec.header->time_offset = rec.header->measure_offset + MON_RECORD_MAX_MEASURES * sizeof(struct mon_record_name);
+	rec.header->value_offset = rec.header->time_offset + (uint64_t) rec.capacity * sizeof(uint64_t);
+	rec.header->peer_col_offset = rec.header->value_offset + (uint64_t) rec.capacity * sizeof(double);
+	rec.header->measure_col_offset = rec.header->peer_col_offset + (uint64_t) rec.capacity * sizeof(uint32_t);
+	rec.header->mt_col_offset = rec.header->measure_col_offset + (uint64_t) rec.capacity * sizeof(uint16_t);
+	rec.header->flags_col_offset = rec.header->mt_col_offset + (uint64_t) rec.capacity * sizeof(uint8_t);
+	/* last, a reader seeing the magic sees a valid header */
+	__sync_synchronize();
+	memcpy(rec.header->magic, MON_RECORD_MAGIC, sizeof(MON_RECORD_MAGIC));
+	rec.seq++;
+	return EOK;
+#else
+	return -EFAILED;
+#endif
+}
+
+/* Describe an id in the segment, false if its table is full */
+static bool addName(uint64_t offset, uint32_t *used, uint32_t max, uint32_t id, const char *name) {
+	struct mon_record_name *e;
+
+	if(*used == max)
+		return false;
+	e = (struct mon_record_name *) (rec.base + offset) + *used;
+	e->id = id;
+	strncpy(e->name, name, sizeof(e->name) - 1);
+	e->name[sizeof(e->name) - 1] = 0;
+	__sync_synchronize();
+	(*used)++;
+	return true;
+}
+
+int monRecordOpen(const char *prefix, int records, int keep) {
+	monRecordClose();
+	if(prefix == NULL || records <= 0 || keep < 0)
+		return -EINVAL;
+
+	rec.prefix = prefix;
+	rec.capacity = records;
+	rec.keep = keep;
+	rec.seq = 0;
+	/* measures keep their cached peer index and name across a reopen: keep
+	 * the indices, but the new segments describe them again */
+	std::fill(rec.peer_segment.begin(), rec.peer_segment.end(), 0);
+	memset(rec.measure_segment, 0, sizeof(rec.measure_segment));
+	return openSegment();
+}
+
+void monRecordClose() {
+	closeSegment();
+}
+
+void monRecordSample(class MonMeasure *m, double value) {
+	struct mon_record_header *h = rec.header;
+	struct timespec now;
+	uint32_t i, mid;
+
+	if(h == NULL)
+		return;
+	if(h->count == h->capacity) {
+		if(openSegment() != EOK)
+			return;
+		h = rec.header;
+	}
+
+	/* the peer, from the cache of the measure */
+	if(m->record_peer < 0) {
+		char sid_string[SOCKETID_STRING_SIZE] = "";
+		if(m->dst_socketid_publish)
+			mlSocketIDToString((SocketId) m->dst_socketid, sid_string, sizeof(sid_string));
+		std::map<std::string, uint32_t>::iterator it = rec.peer_index.find(sid_string);
+		if(it == rec.peer_index.end()) {
+			it = rec.peer_index.insert(std::make_pair(std::string(sid_string), (uint32_t) rec.peer_segment.size())).first;
+			rec.peer_segment.push_back(0);
+		}
+		m->record_peer = it->second;
+		m->record_peer_name = it->first.c_str();
+	}
+	if(rec.peer_segment[m->record_peer] != h->seq + 1 &&
+			addName(h->peer_offset, &h->peers, MON_RECORD_MAX_PEERS, m->record_peer, m->record_peer_name))
+		rec.peer_segment[m->record_peer] = h->seq + 1;
+
+	mid = m->measure_plugin->getId();
+	if(mid < LAST_ID && rec.measure_segment[mid] != h->seq + 1 &&
+			addName(h->measure_offset, &h->measures, MON_RECORD_MAX_MEASURES, mid, m->measure_plugin->getName().c_str()))
+		rec.measure_segment[mid] = h->seq + 1;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	i = h->count;
+	((uint64_t *) (rec.base + h->time_offset))[i] = (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+	((double *) (rec.base + h->value_offset))[i] = value;
+	((uint32_t *) (rec.base + h->peer_col_offset))[i] = m->record_peer;
+	((uint16_t *) (rec.base + h->measure_col_offset))[i] = mid;
+	((uint8_t *) (rec.base + h->mt_col_offset))[i] = m->msg_type;
+	((uint8_t *) (rec.base + h->flags_col_offset))[i] = (m->flags & REMOTE) ? MON_RECORD_REMOTE : 0;
+	/* last, so that the record is complete when a reader sees it */
+	__sync_synchronize();
+	h->count = i + 1;
+}
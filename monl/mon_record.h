@@ -0,0 +1,70 @@
+/*
+ * Layout of the measurement recorder segment files, shared by the writer
+ * (mon_record.cpp) and the reader (mon_record_read.c).
+ *
+ * The recorder appends a fixed size record per sample of the measures with
+ * P_RECORD set: when, towards which peer, which measure and the value. Records
+ * go to segment files of a fixed number of records, prefix.000000,
+ * prefix.000001, ... A segment is a header page, a dictionary of the peers
+ * and one of the measures it refers to, then one column per record field.
+ * Records are in the order they were taken, so a column of times is sorted
+ * unless the clock was set back.
+ * All numbers are in the byte order of the machine that wrote the segment.
+ */
+
+#ifndef _MON_RECORD_H
+#define _MON_RECORD_H
+
+#include	<stdint.h>
+
+#define MON_RECORD_MAGIC	"NAPAMON"
+#define MON_RECORD_VERSION	1
+#define MON_RECORD_HEADER_SIZE	4096
+#define MON_RECORD_MAX_PEERS	4096
+#define MON_RECORD_MAX_MEASURES	256
+#define MON_RECORD_NAME_SIZE	120
+
+/** flags of a record */
+#define MON_RECORD_REMOTE	1	//!< the measure is the remote counterpart of a measure of the peer
+
+struct mon_record_header {
+	char magic[8];
+	uint32_t version;
+	/** segment number, from 0 */
+	uint32_t seq;
+	/** records the segment can hold */
+	uint32_t capacity;
+	/** records in the segment, updated after each record is complete */
+	uint32_t count;
+	/** dictionary entries in use, updated after each entry is complete */
+	uint32_t peers;
+	uint32_t measures;
+	uint64_t peer_offset;
+	uint64_t measure_offset;
+	/** offsets of the columns: uint64_t time, double value, uint32_t peer, uint16_t measure, uint8_t msg type, uint8_t flags */
+	uint64_t time_offset;
+	uint64_t value_offset;
+	uint64_t peer_col_offset;
+	uint64_t measure_col_offset;
+	uint64_t mt_col_offset;
+	uint64_t flags_col_offset;
+};
+
+/** Dictionary entry: the socket ID (as a string) of a peer, or the name of a measure */
+struct mon_record_name {
+	/** the index of the peer in the peer column, the measure id in the measure column */
+	uint32_t id;
+	uint32_t reserved;
+	char name[MON_RECORD_NAME_SIZE];
+};
+
+#define MON_RECORD_SEGMENT_SIZE(capacity) (MON_RECORD_HEADER_SIZE + \
+	(MON_RECORD_MAX_PEERS + MON_RECORD_MAX_MEASURES) * sizeof(struct mon_record_name) + \
+	(uint64_t)(capacity) * (sizeof(uint64_t) + sizeof(double) + sizeof(uint32_t) + sizeof(uint16_t) + 2 * sizeof(uint8_t)))
+
+#ifdef __cplusplus
+/** Record a sample of a measure with P_RECORD set, if monRecordOpen() was called */
+void monRecordSample(class MonMeasure *m, double value);
+#endif
+
+#endif
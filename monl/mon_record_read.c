@@ -0,0 +1,103 @@
+/*
+ * This file implements the reader of the measurement recorder segment files
+ * (see mon_record_read.h).
+ */
+
+#include	<string.h>
+#include	<fcntl.h>
+#include	<unistd.h>
+#include	<sys/mman.h>
+#include	<sys/stat.h>
+#include	"mon_record_read.h"
+
+/* whether a column of capacity elements of the given size lies in the file */
+static int column_fits(const struct mon_record_header *h, size_t size, uint64_t offset, size_t elem) {
+	return offset <= size && (size - offset) / elem >= h->capacity && offset % elem == 0;
+}
+
+int mon_record_map(const char *path, struct mon_record_segment *s) {
+	const struct mon_record_header *h;
+	struct stat st;
+	const char *base;
+	int fd;
+
+	memset(s, 0, sizeof(*s));
+	fd = open(path, O_RDONLY);
+	if (fd < 0) return -1;
+	if (fstat(fd, &st) || (size_t)st.st_size < MON_RECORD_HEADER_SIZE) {
+		close(fd);
+		return -1;
+	}
+	base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) return -1;
+
+	h = (const struct mon_record_header *)base;
+	if (memcmp(h->magic, MON_RECORD_MAGIC, sizeof(MON_RECORD_MAGIC)) || h->version != MON_RECORD_VERSION ||
+		h->peer_offset > (size_t)st.st_size ||
+		((size_t)st.st_size - h->peer_offset) / sizeof(struct mon_record_name) < MON_RECORD_MAX_PEERS ||
+		h->measure_offset > (size_t)st.st_size ||
+		((size_t)st.st_size - h->measure_offset) / sizeof(struct mon_record_name) < MON_RECORD_MAX_MEASURES ||
+		!column_fits(h, st.st_size, h->time_offset, sizeof(uint64_t)) ||
+		!column_fits(h, st.st_size, h->value_offset, sizeof(double)) ||
+		!column_fits(h, st.st_size, h->peer_col_offset, sizeof(uint32_t)) ||
+		!column_fits(h, st.st_size, h->measure_col_offset, sizeof(uint16_t)) ||
+		!column_fits(h, st.st_size, h->mt_col_offset, sizeof(uint8_t)) ||
+		!column_fits(h, st.st_size, h->flags_col_offset, sizeof(uint8_t))) {
+		munmap((void *)base, st.st_size);
+		return -1;
+	}
+
+	s->base = base;
+	s->size = st.st_size;
+	s->header = h;
+	s->time = (const uint64_t *)(base + h->time_offset);
+	s->value = (const double *)(base + h->value_offset);
+	s->peer = (const uint32_t *)(base + h->peer_col_offset);
+	s->measure = (const uint16_t *)(base + h->measure_col_offset);
+	s->mt = (const uint8_t *)(base + h->mt_col_offset);
+	s->flags = (const uint8_t *)(base + h->flags_col_offset);
+	return 0;
+}
+
+void mon_record_unmap(struct mon_record_segment *s) {
+	if (s->base) munmap((void *)s->base, s->size);
+	memset(s, 0, sizeof(*s));
+}
+
+uint32_t mon_record_count(const struct mon_record_segment *s) {
+	uint32_t count = ((volatile const struct mon_record_header *)s->header)->count;
+	__sync_synchronize();
+	return count <= s->header->capacity ? count : s->header->capacity;
+}
+
+uint32_t mon_record_find(const struct mon_record_segment *s, uint64_t time) {
+	uint32_t lo = 0, hi = mon_record_count(s);
+
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		if (s->time[mid] < time) lo = mid + 1;
+		else hi = mid;
+	}
+	return lo;
+}
+
+static const char *lookup(const struct mon_record_segment *s, uint64_t offset, uint32_t used, uint32_t max, uint32_t id) {
+	const struct mon_record_name *e = (const struct mon_record_name *)(s->base + offset);
+	uint32_t i;
+
+	__sync_synchronize();
+	if (used > max) used = max;
+	for (i = 0; i != used; i++)
+		if (e[i].id == id && memchr(e[i].name, 0, sizeof(e[i].name)))
+			return e[i].name;
+	return NULL;
+}
+
+const char *mon_record_peer_name(const struct mon_record_segment *s, uint32_t peer) {
+	return lookup(s, s->header->peer_offset, ((volatile const struct mon_record_header *)s->header)->peers, MON_RECORD_MAX_PEERS, peer);
+}
+
+const char *mon_record_measure_name(const struct mon_record_segment *s, uint32_t measure) {
+	return lookup(s, s->header->measure_offset, ((volatile const struct mon_record_header *)s->header)->measures, MON_RECORD_MAX_MEASURES, measure);
+}
@@ -0,0 +1,58 @@
+/*
+ * Reader of the measurement recorder segment files (see mon_record.h), for
+ * tools that read them while or after the recorder writes them.
+ */
+
+#ifndef _MON_RECORD_READ_H
+#define _MON_RECORD_READ_H
+
+#include	<stddef.h>
+#include	<stdint.h>
+#include	"mon_record.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct mon_record_segment {
+	const char *base;
+	size_t size;
+	const struct mon_record_header *header;
+	/* the columns */
+	const uint64_t *time;
+	const double *value;
+	const uint32_t *peer;
+	const uint16_t *measure;
+	const uint8_t *mt;
+	const uint8_t *flags;
+};
+
+/**
+  Map a segment file read-only and check its layout
+
+  @param[in] path the segment file
+  @param[out] s the segment
+  @return 0 on success, -1 if the file cannot be mapped or is not a segment
+*/
+int mon_record_map(const char *path, struct mon_record_segment *s);
+
+/** Unmap a segment mapped with mon_record_map() */
+void mon_record_unmap(struct mon_record_segment *s);
+
+/** The number of complete records of a segment, which grows while the recorder writes it */
+uint32_t mon_record_count(const struct mon_record_segment *s);
+
+/** The first record taken at or after time (nanoseconds since the epoch), mon_record_count() if none */
+uint32_t mon_record_find(const struct mon_record_segment *s, uint64_t time);
+
+/** The socket ID of a peer of the peer column, "" for samples towards no peer, NULL if unknown */
+const char *mon_record_peer_name(const struct mon_record_segment *s, uint32_t peer);
+
+/** The name of a measure of the measure column, NULL if unknown */
+const char *mon_record_measure_name(const struct mon_record_segment *s, uint32_t measure);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,73 @@
+/*
+ * mon_recorddump: print the records of measurement recorder segment files
+ * (see mon_record.h) as CSV: time, peer, measure, message type, remote, value.
+ *
+ * Usage: mon_recorddump [-f from] [-t to] [-p peer] [-m measure] <segment>...
+ *  from, to: unix time in seconds (with decimals), the records taken in [from, to)
+ *  peer: the socket ID of the peer, as printed
+ *  measure: the name of the measure, as printed
+ */
+
+#include	<stdio.h>
+#include	<stdlib.h>
+#include	<stdint.h>
+#include	<string.h>
+#include	<unistd.h>
+#include	"mon_record_read.h"
+
+static uint64_t parse_time(const char *arg) {
+	char *end;
+	double t = strtod(arg, &end);
+	if (*end || t < 0) {
+		fprintf(stderr, "invalid time %s\n", arg);
+		exit(1);
+	}
+	return (uint64_t)(t * 1e9);
+}
+
+static int dump_segment(const char *path, uint64_t from, uint64_t to, const char *peer, const char *measure) {
+	struct mon_record_segment s;
+	uint32_t i, n;
+
+	if (mon_record_map(path, &s)) {
+		fprintf(stderr, "%s is not a monitoring record segment\n", path);
+		return -1;
+	}
+	n = mon_record_count(&s);
+	for (i = mon_record_find(&s, from); i < n && s.time[i] < to; i++) {
+		const char *p = mon_record_peer_name(&s, s.peer[i]);
+		const char *m = mon_record_measure_name(&s, s.measure[i]);
+		if (!p) p = "?";
+		if (!m) m = "?";
+		if ((peer && strcmp(peer, p)) || (measure && strcmp(measure, m))) continue;
+		printf("%llu.%09llu,%s,%s,%u,%d,%.17g\n", (unsigned long long)(s.time[i] / 1000000000),
+			(unsigned long long)(s.time[i] % 1000000000), p, m, s.mt[i], (s.flags[i] & MON_RECORD_REMOTE) != 0, s.value[i]);
+	}
+	mon_record_unmap(&s);
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	uint64_t from = 0, to = UINT64_MAX;
+	const char *peer = NULL, *measure = NULL;
+	int c, ret = 0;
+
+	while ((c = getopt(argc, argv, "f:t:p:m:")) != -1) {
+		switch (c) {
+			case 'f': from = parse_time(optarg); break;
+			case 't': to = parse_time(optarg); break;
+			case 'p': peer = optarg; break;
+			case 'm': measure = optarg; break;
+			default: optind = argc + 1;
+		}
+	}
+	if (optind >= argc) {
+		fprintf(stderr, "Usage: %s [-f from] [-t to] [-p peer] [-m measure] <segment>...\n", argv[0]);
+		return 1;
+	}
+
+	printf("time,peer,measure,msg_type,remote,value\n");
+	for (; optind < argc; optind++)
+		if (dump_segment(argv[optind], from, to, peer, measure)) ret = 1;
+	return ret;
+}
@@ -45,6 +45,7 @@ int measure_array_len;
 extern "C" {
 void monPktRxcb(void *arg);
 void monPktTxcb(void *arg);
+void monPktTxTscb(void *arg);
 int monPktHdrSetcb(void *arg,send_pkt_type_and_dst_inf *send_pkt_inf);
 void monDataRxcb(void *arg);
 void monDataTxcb(void *arg);
@@ -66,9 +67,14 @@ void monPktTxcb(void *arg){
 	man->cbTxPkt(arg);
 }
 
-int monPktHdrSetcb(socketID_handle remote_socketID, uint8_t msgtype){
+void monPktTxTscb(void *arg){
+	debug("received a TX packet timestamp notification");
+	man->cbTxPktTs(arg);
+}
+
+int monPktHdrSetcb(socketID_handle remote_socketID, uint8_t msgtype, void *hdr){
 	debug("set monitoring module packet header");
-	return man->cbHdrPkt(remote_socketID, msgtype);
+	return man->cbHdrPkt(remote_socketID, msgtype, hdr);
 }
 
 void monDataRxcb(void *arg){
@@ -174,6 +180,7 @@ int monInit(void *eb, void *repo_client) {
 	/* measurement */
 	mlRegisterGetRecvPktInf(&monPktRxcb);
 	mlRegisterGetSendPktInf(&monPktTxcb);
+	mlRegisterGetSendPktTimestamp(&monPktTxTscb);
 	mlRegisterSetMonitoringHeaderPktCb(&monPktHdrSetcb);
 	mlRegisterGetRecvDataInf(&monDataRxcb);
 	mlRegisterSetMonitoringHeaderDataCb(&monDataHdrSetcb);
@@ -259,6 +266,10 @@ result monRetrieveResultById(SocketId src, MsgType mt, MeasurementCapabilities f
 	return man->monRetrieveResultById(src, mt, flags, mid, st);
 }
 
+int monRetrieveResults(const MonResultColumn *columns, int n_columns, uint32_t since, MonResultRow *rows, result *values, int max_rows, uint32_t *epoch) {
+	return man->monRetrieveResults(columns, n_columns, since, rows, values, max_rows, epoch);
+}
+
 int monNewSample(MonHandler mh, result r){
 	return man->monNewSample(mh,r);
 }
@@ -30,34 +30,34 @@ double ClockdriftMeasure::y_axis_inter(double a1, double b1, double a2, double b
 	return a1 * x_axis_inter(a1, b1, a2, b2) + b1;
 }
 
-bool clockdrift_sort_function (struct clockdrift_sample i,struct clockdrift_sample j)
-{ return (i.tx_time<j.tx_time); }
-
 ClockdriftMeasure::ClockdriftMeasure(class MeasurePlugin *m, MeasurementCapabilities mc, class MeasureDispatcher *md): MonMeasure(m,mc,md) {
-	if(param_values[P_CLOCKDRIFT_ALGORITHM] != 1) {
-		n = new int[(int)param_values[P_CLOCKDRIFT_WIN_SIZE]];
-		samples.reserve((int)param_values[P_CLOCKDRIFT_WIN_SIZE]);
-	} else
-		n = NULL;
+	if(param_values[P_CLOCKDRIFT_ALGORITHM] != 1)
+		samples.resize((int)param_values[P_CLOCKDRIFT_WIN_SIZE]);
 	a = 0;
 	b = 0;
 	first_tx = 0;
+	resetWindow();
 }
 
 ClockdriftMeasure::~ClockdriftMeasure() {
-	if(n != NULL) {
-		delete[] n;
-		n = NULL;
-	}
 }
 
+void ClockdriftMeasure::resetWindow() {
+	win_next = 0;
+	win_n = 0;
+	m_t = m_d = c_tt = c_td = 0;
+	win_split = 0;
+	front.clear();
+	front_hidden.clear();
+	back.clear();
+	last_tx = -INFINITY;
+}
 
 void ClockdriftMeasure::init() {
-	samples.clear();
 	first_tx = NAN;
-	pos = 0;
 	pnum = 0;
 	sum_t = sum_d = sum_t_v = sum_d_v = sum_td_v = 0;
+	resetWindow();
 }
 
 void ClockdriftMeasure::stop() {
@@ -67,45 +67,145 @@ void ClockdriftMeasure::stop() {
 int ClockdriftMeasure::paramChange(MonParameterType ph, MonParameterValue p){
 		switch(ph) {
 		case P_CLOCKDRIFT_ALGORITHM:
-			if(p != 1) {
-				if(n == NULL) {
-					n = new int[(int)param_values[P_CLOCKDRIFT_WIN_SIZE]];
-					samples.reserve((int)param_values[P_CLOCKDRIFT_WIN_SIZE]);
-					//TODO: possibly? keep old data
-					samples.clear();
-					first_tx = NAN;
-					pos = 0;
-					pnum = 0;
-					sum_t = sum_d = sum_t_v = sum_d_v = sum_td_v = 0;
-				}
-			} else {
-				if(n != NULL) {
-					delete[] n;
-					n = NULL;
-				}
-			}
-			return EOK;
 		case P_CLOCKDRIFT_WIN_SIZE:
-			if(n != NULL) {
-				delete[] n;
-				n = new int[(int)p];
-				samples.reserve((int)p);
-			}
+			if(param_values[P_CLOCKDRIFT_ALGORITHM] != 1)
+				samples.resize((int)param_values[P_CLOCKDRIFT_WIN_SIZE]);
+			else
+				samples.clear();
 			//TODO: possibly? keep old data
-			samples.clear();
-			first_tx = NAN;
-			pos = 0;
-			pnum = 0;
-			sum_t = sum_d = sum_t_v = sum_d_v = sum_td_v = 0;
+			init();
 			return EOK;
 		default:
 			return EOK;
 	}
 }
 
+/* > 0 if p0, p1, p2 turn counterclockwise: p1 is then on the lower hull between them */
+static double turn(struct clockdrift_sample *p0, struct clockdrift_sample *p1, struct clockdrift_sample *p2) {
+	return (p1->tx_time - p0->tx_time) * (p2->delay - p0->delay) - (p1->delay - p0->delay) * (p2->tx_time - p0->tx_time);
+}
+
+/* Move all the samples of the window to the front hull, built from the newest */
+void ClockdriftMeasure::rebuildFront() {
+	uint64_t i;
+
+	front.clear();
+	front_hidden.clear();
+	back.clear();
+	for(i = win_next; i-- > win_next - win_n; ) {
+		struct clockdrift_sample *p = sample(i);
+		if(p->hidden < 0)
+			continue;
+		p->hidden = 0;
+		while(front.size() >= 2 && turn(p, sample(front.back()), sample(front[front.size() - 2])) <= 0) {
+			front_hidden.push_back(front.back());
+			front.pop_back();
+			p->hidden++;
+		}
+		front.push_back(i);
+	}
+	win_split = win_next;
+}
+
+/* Slide the window by one sample, updating means, co-moments and hull in O(1) amortized */
+void ClockdriftMeasure::addSample(double tx_time, double delay) {
+	struct clockdrift_sample *p;
+	double dt;
+
+	/* the oldest sample leaves */
+	if(win_n == samples.size()) {
+		uint64_t old = win_next - win_n;
+		if(old >= win_split)
+			rebuildFront();
+		p = sample(old);
+		win_n--;
+		if(win_n > 0) {
+			dt = p->tx_time - m_t;
+			m_t -= dt / win_n;
+			m_d -= (p->delay - m_d) / win_n;
+			c_tt -= dt * (p->tx_time - m_t);
+			c_td -= dt * (p->delay - m_d);
+		} else
+			m_t = m_d = c_tt = c_td = 0;
+		/* it is on top of the front hull, the vertices it hid come back */
+		if(p->hidden >= 0) {
+			front.pop_back();
+			for(; p->hidden > 0; p->hidden--) {
+				front.push_back(front_hidden.back());
+				front_hidden.pop_back();
+			}
+		}
+	}
+
+	p = sample(win_next);
+	p->tx_time = tx_time;
+	p->delay = delay;
+	win_n++;
+	dt = tx_time - m_t;
+	m_t += dt / win_n;
+	m_d += (delay - m_d) / win_n;
+	c_tt += dt * (tx_time - m_t);
+	c_td += dt * (delay - m_d);
+
+	/* samples come in tx time order: a reordered one is left out of the hull */
+	if(tx_time <= last_tx) {
+		p->hidden = -1;
+		win_next++;
+		return;
+	}
+	last_tx = tx_time;
+	p->hidden = 0;
+	while(back.size() >= 2 && turn(sample(back[back.size() - 2]), sample(back.back()), p) <= 0)
+		back.pop_back();
+	back.push_back(win_next++);
+}
+
+/* The edge of the window hull over the mean tx time of the window */
+void ClockdriftMeasure::hullEstimate() {
+	size_t f = 0, k = 0, nf, n, lo, hi;
+	struct clockdrift_sample *p0, *p1;
+	bool moved;
+
+	/* the window hull joins the front hull up to front[f] to the back hull from back[k] */
+	if(!front.empty() && !back.empty()) {
+		do {
+			moved = false;
+			while(f + 1 < front.size() && turn(sample(front[f + 1]), sample(front[f]), sample(back[k])) <= 0) {
+				f++;
+				moved = true;
+			}
+			while(k + 1 < back.size() && turn(sample(front[f]), sample(back[k]), sample(back[k + 1])) <= 0) {
+				k++;
+				moved = true;
+			}
+		} while(moved);
+	}
+
+	nf = front.size() - f;
+	n = nf + back.size() - k;
+	if(n < 2)
+		return;
+#define VERTEX(v) sample((v) < nf ? front[front.size() - 1 - (v)] : back[k + (v) - nf])
+	/* first vertex at or after the mean */
+	lo = 1; hi = n - 1;
+	while(lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		if(VERTEX(mid)->tx_time < m_t)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	p0 = VERTEX(lo - 1);
+	p1 = VERTEX(lo);
+#undef VERTEX
+
+	b = x_axis_inter(p0->tx_time, -p0->delay, p1->tx_time, -p1->delay);
+	a = -y_axis_inter(p0->tx_time, -p0->delay, p1->tx_time, -p1->delay);
+}
+
 result ClockdriftMeasure::RxPkt(result *r,ExecutionList *el) {
 	double tx_time, delay;
-	result res = NAN;
+	int algorithm = (int)param_values[P_CLOCKDRIFT_ALGORITHM];
 
 	if(isnan(first_tx))
 		first_tx = r[R_SEND_TIME];
@@ -114,98 +214,41 @@ result ClockdriftMeasure::RxPkt(result *r,ExecutionList *el) {
 	delay = fabs(r[R_SEND_TIME] - r[R_RECEIVE_TIME]);
 	pnum++;
 
-	if(param_values[P_CLOCKDRIFT_ALGORITHM] == 1 || param_values[P_CLOCKDRIFT_ALGORITHM] == 0) {
+	/* all the estimates follow every packet */
+	if(algorithm == 1 || algorithm == 0) {
 		sum_t += tx_time;
-		sum_t_v += pow(tx_time - sum_t/pnum, 2);
+		sum_t_v += (tx_time - sum_t/pnum) * (tx_time - sum_t/pnum);
 		sum_d += delay;
-		sum_d_v += pow(delay - sum_d/pnum, 2);
+		sum_d_v += (delay - sum_d/pnum) * (delay - sum_d/pnum);
 		sum_td_v += (delay - sum_d/pnum) * (tx_time - sum_t/pnum);
-	}
-
-	if(param_values[P_CLOCKDRIFT_ALGORITHM] != 1) {
-		samples[pos].tx_time = tx_time;
-		samples[pos].delay = delay;
-	}
-
-	pos++;
-
-	if(pos % (int)param_values[P_CLOCKDRIFT_PKT_TH] == 0) {
-		int i,j,k,end;
-		double m_t, m_d, v_t, v_d, v_td, sum;
-		m_t = m_d = 0;
-
-		if(param_values[P_CLOCKDRIFT_ALGORITHM] == 1 || param_values[P_CLOCKDRIFT_ALGORITHM] == 0) {
+		if(sum_t_v > 0) {
 			r[R_CLOCKDRIFT] = b = sum_td_v / sum_t_v;
 			a = sum_d/pnum - b * sum_t/pnum;
-
-			char dbg[512];
-			snprintf(dbg, sizeof(dbg), "Ts: %f Clockdrift 1 a: %f b: %f", r[R_RECEIVE_TIME], a, b);
-			debugOutput(dbg);
 		}
+	}
 
-		end = pnum > (int)param_values[P_CLOCKDRIFT_WIN_SIZE] ? (int)param_values[P_CLOCKDRIFT_WIN_SIZE] : pos;
+	if(algorithm != 1) {
+		addSample(tx_time, delay);
 
-		if(param_values[P_CLOCKDRIFT_ALGORITHM] == 2 || param_values[P_CLOCKDRIFT_ALGORITHM] == 0) {
-			for(i = 0; i < end; i++) {
-				m_t += samples[i].tx_time;
-				m_d += samples[i].delay;
-			}
-			m_t = m_t /i; m_d = m_d /i;
-	
-			v_t = v_d = v_td = 0;
-			for(i = 0; i < end; i++) {
-				v_t += pow(samples[i].tx_time - m_t, 2);
-				v_d += pow(samples[i].delay - m_d, 2);
-				v_td += (samples[i].tx_time - m_t) * (samples[i].delay - m_d);
-			}
-	
-			r[R_CLOCKDRIFT] = b = v_td / v_t;
+		if((algorithm == 2 || algorithm == 0) && c_tt > 0) {
+			r[R_CLOCKDRIFT] = b = c_td / c_tt;
 			a = m_d - b * m_t;
-
-			char dbg[512];
-			snprintf(dbg, sizeof(dbg), "Ts: %f Clockdrift 2 a: %f b: %f", r[R_RECEIVE_TIME], a, b);
-			debugOutput(dbg);
 		}
 
-		if(param_values[P_CLOCKDRIFT_ALGORITHM] == 3 || param_values[P_CLOCKDRIFT_ALGORITHM] == 0) {
-			std::sort(samples.begin(), samples.begin() + end, clockdrift_sort_function);
-	
-			/* start estimation */
-			n[0] = 0; n[1] = 1; k = 1;
-			for (i = 2; i < end; i++) {
-				for (j = k; j >= 1; j--) {
-					if (x_axis_inter(samples[i].tx_time, -samples[i].delay, samples[n[j]].tx_time, -samples[n[j]].delay)
-							< x_axis_inter(samples[n[j]].tx_time, -samples[n[j]].delay,samples[n[j-1]].tx_time, -samples[n[j-1]].delay))
-						break;
-				}
-				k = j + 1;
-				n[k] = i;
-			}
-	
-			sum = 0.0;
-			for (i = 0; i < end; i++)
-				sum += samples[i].tx_time;
-	
-			sum /= end;
-			for (i = 0; i < k - 1; i++) {
-				if (samples[n[i]].tx_time< sum && sum <= samples[n[i+1]].tx_time) {
-					r[R_CLOCKDRIFT] = b = x_axis_inter(samples[n[i]].tx_time, -samples[n[i]].delay, samples[n[i+1]].tx_time, -samples[n[i+1]].delay);
-					a = -y_axis_inter(samples[n[i]].tx_time, -samples[n[i]].delay, samples[n[i+1]].tx_time, -samples[n[i+1]].delay);
-					break;
-				}
-			}
-
-			char dbg[512];
-			snprintf(dbg, sizeof(dbg), "Ts: %f Clockdrift 3 a: %f b: %f", r[R_RECEIVE_TIME], a, b);
-			debugOutput(dbg);
+		if((algorithm == 3 || algorithm == 0) && front.size() + back.size() >= 2) {
+			hullEstimate();
+			r[R_CLOCKDRIFT] = b;
 		}
-		res = r[R_CLOCKDRIFT];
 	}
 
-	if(pos == param_values[P_CLOCKDRIFT_WIN_SIZE])
-		pos = 0;
+	/* and are reported every P_CLOCKDRIFT_PKT_TH packets */
+	if(pnum % (int)param_values[P_CLOCKDRIFT_PKT_TH] != 0)
+		return NAN;
 
-	return res;
+	char dbg[512];
+	snprintf(dbg, sizeof(dbg), "Ts: %f Clockdrift %d a: %f b: %f", r[R_RECEIVE_TIME], algorithm, a, b);
+	debugOutput(dbg);
+	return r[R_CLOCKDRIFT];
 }
 
 result ClockdriftMeasure::RxData(result *r,ExecutionList *el) {
@@ -219,6 +262,6 @@ ClockdriftMeasurePlugin::ClockdriftMeasurePlugin() {
 	id = CLOCKDRIFT;
 	/* end of mandatory properties */
 	addParameter(new MinMaxParameter("Algorithm","1 - Linear regression (interactive), 2 - Linear regression, 3 - Linear programming",0,3,0), P_CLOCKDRIFT_ALGORITHM);
-	addParameter(new MinParameter("Packet threshold","How often to compute the drift",100,100), P_CLOCKDRIFT_PKT_TH);
+	addParameter(new MinParameter("Packet threshold","How often to report the drift",100,100), P_CLOCKDRIFT_PKT_TH);
 	addParameter(new MinParameter("Window size","The window size on which to compute",100,1000), P_CLOCKDRIFT_WIN_SIZE);
 }
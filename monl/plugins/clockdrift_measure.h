@@ -22,23 +22,40 @@
 
 #include "measure_plugin.h"
 #include "mon_measure.h"
-#include <algorithm>
+#include <stdint.h>
 
 struct clockdrift_sample {
 	double tx_time;
 	double delay;
+	int hidden;	/* vertices of the front hull it hid, -1 if not on the hull (reordered) */
 };
 
 class ClockdriftMeasure : public MonMeasure {
 	double x_axis_inter(double a1, double b1, double a2, double b2);
 	double y_axis_inter(double a1, double b1, double a2, double b2);
 
-	int pos;
-	int *n;
 	int pnum;
 
 	double sum_t, sum_d, sum_t_v, sum_d_v, sum_td_v;
 
+	/* Sliding window of algorithms 2 and 3: sample i is samples[i % size] */
+	uint64_t win_next;	/* number of the next sample */
+	size_t win_n;		/* samples in the window */
+	double m_t, m_d, c_tt, c_td;	/* their means and co-moments */
+
+	/* Their lower convex hull, in two parts: the hull of the samples from the oldest to win_split
+	 * (a stack, oldest on top, the vertices each sample hid kept in front_hidden until it leaves)
+	 * and the hull of the later ones (newest last) */
+	uint64_t win_split;
+	std::vector<uint64_t> front, front_hidden, back;
+	double last_tx;
+
+	struct clockdrift_sample *sample(uint64_t i) {return &samples[i % samples.size()];};
+	void resetWindow();
+	void rebuildFront();
+	void addSample(double tx_time, double delay);
+	void hullEstimate();
+
 public:
 	double a, b, first_tx;
 
@@ -36,6 +36,8 @@
 //- check if pubblishing was succesfull
 
 
+uint32_t ResultBuffer::epoch = 1;
+
 const char* ResultBuffer::stat_suffixes[] = {
 	"_last",
 	"_avg",
@@ -138,6 +140,8 @@ int ResultBuffer::init() {
 		stats[i] = (m->param_values[P_INIT_NAN_ZERO] == 0.0 ? NAN : 0);
 	for(i = 0; i < size; i++)
 		circular_buffer[i] = NAN;
+	win_stats_valid = false;
+	changed = epoch;
 	return EOK;
 }
 
@@ -167,6 +171,7 @@ int ResultBuffer::resizeBuffer(int s) {
 			j = j + old_size;
 		newSampleWin(old_buffer[j]);
 	}
+	win_stats_valid = false;
 
 	
 	delete[] old_buffer;
@@ -175,7 +180,9 @@ int ResultBuffer::resizeBuffer(int s) {
 };
 
 /* This function is used to update internal variables with data from a new sample */
-int ResultBuffer::newSample(result r) {
+/* The sample stands for weight packets when they are sampled: sums and rate are */
+/* scaled by it, the other statistics are over the samples themselves */
+int ResultBuffer::newSample(result r, result weight) {
 	samples++;
 
 	stats[LAST] = r;
@@ -183,16 +190,16 @@ int ResultBuffer::newSample(result r) {
 	//TODO add statistical data like avg
 
 	if(isnan(stats[SUM]))
-		stats[SUM] = r;
+		stats[SUM] = r * weight;
 	else
-		stats[SUM] += r;
+		stats[SUM] += r * weight;
 
 	if(isnan(stats[PERIOD_SUM]))
-		stats[PERIOD_SUM] = r;
+		stats[PERIOD_SUM] = r * weight;
 	else
-		stats[PERIOD_SUM] += r;
+		stats[PERIOD_SUM] += r * weight;
 
-	rate_sum_samples += r;
+	rate_sum_samples += r * weight;
 
 	/* Average  */
 	if(isnan(stats[AVG]))
@@ -213,6 +220,8 @@ int ResultBuffer::newSample(result r) {
 		stats[MAX] = r;
 
 	newSampleWin(r);
+	win_stats_valid = false;
+	changed = epoch;
 
 	new_data = true;
 
@@ -254,6 +263,9 @@ void ResultBuffer::updateStats(void) {
 
 	/* Note: some stats are already updated on the fly in newSample() */
 	/* This function is to update the more time consuming not recursive statitistics */
+	if(win_stats_valid)
+		return;
+	win_stats_valid = true;
 
 	stats[WIN_AVG] = stats[WIN_SUM]/n_samples;
 
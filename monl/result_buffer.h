@@ -62,9 +62,17 @@ private:
 
 	int newSampleWin(result r);
 
+	/* false when samples came since updateStats() */
+	bool win_stats_valid;
+
 public:
 	result stats[LAST_STAT_TYPE];
 
+	/* The results epoch, advanced by each monRetrieveResults() */
+	static uint32_t epoch;
+	/* The epoch of the newest sample */
+	uint32_t changed;
+
 	ResultBuffer(int s, const char *pname, char** oname, MonMeasure *ptr_m): size(s), publish(NULL), publish_length(0), new_data(false), m(ptr_m) {
 		last_publish = 0.0;
 		circular_buffer = new result[s];
@@ -112,7 +120,7 @@ public:
 
 	int publishResults(void);
 	int resizeBuffer(int s);
-	int newSample(result r);
+	int newSample(result r, result weight = 1.0);
 	void updateStats(void);
 };
 
@@ -0,0 +1,184 @@
+/***************************************************************************
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ ***********************************************************************/
+
+/*
+ * Test of monRetrieveResults(): the rows a call returns for a since epoch, and
+ * the rejection of bad columns.
+ *
+ * The monitoring layer runs on a stand-in for the messaging layer: the ML
+ * functions it calls are defined here, and packets are "sent" by invoking the
+ * callbacks it registered, the way the ML send path does.
+ */
+
+#include <event2/event.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "napa.h"
+#include "repoclient.h"
+#include "ml.h"
+#include "mon.h"
+#include "ids.h"
+#include "errors.h"
+
+/**************************** messaging layer stand-in ****************************/
+
+static set_monitoring_header_pkt_cb hdr_pkt_cb;
+static get_send_pkt_inf_cb send_pkt_cb;
+
+extern "C" {
+
+int mlCompareSocketIDs(socketID_handle sock1, socketID_handle sock2) {
+	return memcmp(sock1, sock2, SOCKETID_SIZE) != 0;
+}
+
+int mlHashSocketID(socketID_handle sock) {
+	return ((uint8_t *) sock)[0];
+}
+
+int mlSocketIDToString(socketID_handle socketID, char* socketID_string, size_t len) {
+	snprintf(socketID_string, len, "peer%d", ((uint8_t *) socketID)[0]);
+	return 0;
+}
+
+/* no local socket yet: nothing is published or written to files */
+socketID_handle mlGetLocalSocketID(int *errorstatus) {
+	*errorstatus = 1;
+	return NULL;
+}
+
+int mlGetStandardTTL(socketID_handle socketID, uint8_t *ttl) { return 0; }
+void **mlGetMonitoringData(socketID_handle remote_socketID) { return NULL; }
+int mlConnectionExist(socketID_handle socketID, bool ready) { return -1; }
+int mlGetConnectionStatus(int connectionID) { return 0; }
+int mlOpenConnection(socketID_handle external_socketID, receive_connection_cb connection_cb, void *arg, const send_params default_send_params) { return -1; }
+int mlSendData(const int connectionID, char *sendbuf, int bufsize, unsigned char msgtype, send_params *sParams) { return 0; }
+void mlRateFeedback(socketID_handle peer, double delay, double loss) {}
+
+void mlRegisterGetRecvPktInf(get_recv_pkt_inf_cb recv_pkt_inf_cb) {}
+void mlRegisterGetSendPktInf(get_send_pkt_inf_cb send_pkt_inf_cb) { send_pkt_cb = send_pkt_inf_cb; }
+void mlRegisterGetSendPktTimestamp(get_send_pkt_ts_cb send_pkt_ts_cb) {}
+void mlRegisterSetMonitoringHeaderPktCb(set_monitoring_header_pkt_cb monitoring_header_pkt_cb) { hdr_pkt_cb = monitoring_header_pkt_cb; }
+void mlRegisterGetRecvDataInf(get_recv_data_inf_cb recv_data_inf_cb) {}
+void mlRegisterGetSendDataInf(get_send_data_inf_cb send_data_inf_cb) {}
+void mlRegisterSetMonitoringHeaderDataCb(set_monitoring_header_data_cb monitoring_header_data_cb) {}
+void mlRegisterRecvDataCb(receive_data_cb data_cb, unsigned char msgtype) {}
+
+HANDLE repPublish(HANDLE rep, cb_repPublish cb, void *cbarg, MeasurementRecord *r) { return NULL; }
+
+}
+
+#define MT 12
+
+static uint8_t peer[2][SOCKETID_SIZE];
+
+/* a packet of size bytes to p, through the monitoring hooks of the ML send path */
+static void send_pkt(int p, int size) {
+	char hdr[32];
+	mon_pkt_inf pkt_info;
+
+	memset(hdr, 0, sizeof(hdr));
+	memset(&pkt_info, 0, sizeof(pkt_info));
+	pkt_info.remote_socketID = (socketID_handle) peer[p];
+	pkt_info.msgtype = MT;
+	pkt_info.bufSize = size;
+	pkt_info.monitoringHeaderLen = hdr_pkt_cb((socketID_handle) peer[p], MT, hdr);
+	pkt_info.monitoringHeader = pkt_info.monitoringHeaderLen ? hdr : NULL;
+	pkt_info.ttl = -1;
+	send_pkt_cb(&pkt_info);
+}
+
+/**************************** test ****************************/
+
+static int failures;
+
+#define CHECK(cond) do { \
+	if(!(cond)) { \
+		fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+		failures++; \
+	} \
+} while(0)
+
+/* the row of p among the n rows, -1 if none */
+static int find_row(MonResultRow *rows, int n, int p) {
+	for(int i = 0; i < n; i++)
+		if(rows[i].peer != NULL && memcmp(rows[i].peer, peer[p], SOCKETID_SIZE) == 0)
+			return i;
+	return -1;
+}
+
+int main(int argc, char *argv[]) {
+	MonResultColumn col = { TX_BYTE, PACKET | IN_BAND | TXLOC, LAST };
+	MonResultRow rows[4];
+	result values[4];
+	uint32_t epoch, since;
+	MonHandler mh;
+	int n, i;
+
+	napaInit(event_base_new());
+	if(monInit(eventbase, NULL) != EOK) {
+		fprintf(stderr, "monInit failed\n");
+		return 2;
+	}
+	for(i = 0; i < 2; i++) {
+		peer[i][0] = i + 1;
+		mh = monCreateMeasure(TX_BYTE, PACKET | IN_BAND | TXLOC);
+		CHECK(mh >= 0);
+		CHECK(monActivateMeasure(mh, (SocketId) peer[i], MT) == EOK);
+	}
+
+	/* since 0: every peer with the measure active */
+	send_pkt(0, 100);
+	send_pkt(1, 200);
+	n = monRetrieveResults(&col, 1, 0, rows, values, 4, &since);
+	CHECK(n == 2);
+	CHECK(find_row(rows, n, 0) >= 0 && values[find_row(rows, n, 0)] == 100);
+	CHECK(find_row(rows, n, 1) >= 0 && values[find_row(rows, n, 1)] == 200);
+
+	/* unchanged since the last epoch: no rows */
+	n = monRetrieveResults(&col, 1, since, rows, values, 4, &epoch);
+	CHECK(n == 0);
+	CHECK(epoch != since);
+	since = epoch;
+
+	/* new since the last epoch: only the peer that got a sample */
+	send_pkt(1, 300);
+	n = monRetrieveResults(&col, 1, since, rows, values, 4, &epoch);
+	CHECK(n == 1);
+	CHECK(find_row(rows, n, 1) == 0 && values[0] == 300);
+
+	/* and nothing again after it */
+	n = monRetrieveResults(&col, 1, epoch, rows, values, 4, &epoch);
+	CHECK(n == 0);
+
+	/* a table too small: the count of all the rows, only max_rows of them filled */
+	n = monRetrieveResults(&col, 1, 0, rows, values, 1, NULL);
+	CHECK(n == 2);
+
+	/* a statistical type out of range */
+	col.st = LAST_STAT_TYPE;
+	CHECK(monRetrieveResults(&col, 1, 0, rows, values, 4, NULL) == -EINVAL);
+	col.st = (enum stat_types) -1;
+	CHECK(monRetrieveResults(&col, 1, 0, rows, values, 4, NULL) == -EINVAL);
+	CHECK(isnan(monRetrieveResultById((SocketId) peer[0], MT, col.flags, col.mid, LAST_STAT_TYPE)));
+	CHECK(monRetrieveResultById((SocketId) peer[0], MT, col.flags, col.mid, LAST) == 100);
+
+	if(failures == 0)
+		printf("retrieve_test: all checks passed\n");
+	return failures ? 1 : 0;
+}
@@ -1,21 +1,55 @@
 #define LOG_MODULE "[rep] "
 #include        "repoclient_impl.h"
 
+/** Block of the arena holding the strings of received records */
+struct arena_block {
+	struct arena_block *next;
+	size_t size;
+	size_t used;
+	char data[];
+};
+
+/** State of a GetMeasurements response being parsed */
+struct measurement_stream {
+	HANDLE rep;
+	void *cbarg;
+	/** exactly one of them is set */
+	cb_repGetMeasurements cb;
+	cb_repMeasurementBatch batch_cb;
+	/** maxresults, <= 0 for unlimited */
+	int max;
+	/** records parsed so far */
+	int count;
+	/** received bytes not parsed yet (the last, incomplete line) */
+	struct evbuffer *carry;
+	/** the lines of the records not delivered yet, the records point into them */
+	struct arena_block *arena;
+	MeasurementRecord *records;
+	int n;
+	int size;
+};
+
+void _getMeasurements_chunk(struct evhttp_request *req,void *arg);
 void _getMeasurements_callback(struct evhttp_request *req,void *arg);
 
-HANDLE repGetMeasurements(HANDLE rep, cb_repGetMeasurements cb, void *cbarg, int maxResults, const char *originator, const char *targetA, const char *targetB, const char *name, const char *channel) {
-	static int id = 1;
+static HANDLE get_measurements(HANDLE rep, cb_repGetMeasurements cb, cb_repMeasurementBatch batch_cb, void *cbarg, int maxResults, const char *originator, const char *targetA, const char *targetB, const char *name, const char *channel) {
 	if (!check_handle(rep, __FUNCTION__)) return NULL;
 
 	debug("About to call repGetMeasurements, maxresults: %d, originator: %s, targetA: %s, targetB: %s, name: %s", maxResults, originator, targetA, targetB, name);
 
 	char uri[1024];
-	request_data *rd = (request_data *)calloc(sizeof(request_data),1);
-	if (!rd) return NULL;
-	rd->id = (void *)rd;
-	rd->server = rep;
-	rd->cb = cb;
-	rd->data = maxResults;
+	struct measurement_stream *s = (struct measurement_stream *)calloc(sizeof(struct measurement_stream),1);
+	if (!s) return NULL;
+	s->rep = rep;
+	s->cb = cb;
+	s->batch_cb = batch_cb;
+	s->cbarg = cbarg;
+	s->max = maxResults;
+	s->carry = evbuffer_new();
+	if (!s->carry) {
+		free(s);
+		return NULL;
+	}
 
         sprintf(uri, "/GetMeasurements?maxresults=%d", maxResults);
 	char buf[256];
@@ -26,100 +60,245 @@ HANDLE repGetMeasurements(HANDLE rep, cb_repGetMeasurements cb, void *cbarg, int
 	if (channel) { sprintf(buf, "&channel=%s", channel); strcat(uri, buf); }
 	debug("URI: %s", uri);
 
-	make_request(uri, _getMeasurements_callback, (void *)rd);
-	return (HANDLE)(rd);
+	if (make_streaming_request((struct reposerver *)rep, uri, _getMeasurements_chunk, _getMeasurements_callback, (void *)s)) {
+		evbuffer_free(s->carry);
+		free(s);
+		return NULL;
+	}
+	return (HANDLE)(s);
 }
 
-void _getMeasurements_callback(struct evhttp_request *req,void *arg) {
-	if (req == NULL || arg == NULL) return;
-	request_data *cbdata = (request_data *)arg;
-
-	void (*user_cb)(HANDLE rep, HANDLE id, void *cbarg, MeasurementRecord *result, int nResults) = cbdata->cb;	
-	HANDLE id = cbdata->id;
-	HANDLE rep = cbdata->server;
-	int max = cbdata->data;
-	if (max <= 0) max = 10000;
-	free(cbdata);
-
-	if (req->response_code != HTTP_OK) {
-		warn("Failed repository operation (id %p, error is %d %s): %s", 
-			id, req->response_code, req->response_code_line, req->uri);
-		size_t response_len = evbuffer_get_length(req->input_buffer);
-		if (response_len) {
-			char *response = malloc(response_len + 1);
-			evbuffer_remove(req->input_buffer, response, response_len);
-			response[response_len] = 0;
-			debug("Response string (len %d): %s", response_len, response);
-			free(response);
+HANDLE repGetMeasurements(HANDLE rep, cb_repGetMeasurements cb, void *cbarg, int maxResults, const char *originator, const char *targetA, const char *targetB, const char *name, const char *channel) {
+	return get_measurements(rep, cb, NULL, cbarg, maxResults, originator, targetA, targetB, name, channel);
+}
+
+HANDLE repGetMeasurementsBatched(HANDLE rep, cb_repMeasurementBatch cb, void *cbarg, int maxResults, const char *originator, const char *targetA, const char *targetB, const char *name, const char *channel) {
+	if (!cb) return NULL;
+	return get_measurements(rep, NULL, cb, cbarg, maxResults, originator, targetA, targetB, name, channel);
+}
+
+static char *arena_alloc(struct measurement_stream *s, size_t len) {
+	struct arena_block *b = s->arena;
+	if (!b || b->size - b->used < len) {
+		size_t size = len > REPO_ARENA_BLOCK ? len : REPO_ARENA_BLOCK;
+		b = malloc(sizeof(struct arena_block) + size);
+		if (!b) fatal("Out of memory!");
+		b->next = s->arena;
+		b->size = size;
+		b->used = 0;
+		s->arena = b;
+	}
+	b->used += len;
+	return b->data + b->used - len;
+}
+
+/** Empty the arena, keeping its newest block for the next batch */
+static void arena_reset(struct measurement_stream *s) {
+	struct arena_block *b;
+	if (!s->arena) return;
+	while ((b = s->arena->next) != NULL) {
+		s->arena->next = b->next;
+		free(b);
+	}
+	s->arena->used = 0;
+}
+
+static void arena_free(struct measurement_stream *s) {
+	while (s->arena) {
+		struct arena_block *b = s->arena;
+		s->arena = b->next;
+		free(b);
+	}
+}
+
+static void free_stream(struct measurement_stream *s) {
+	arena_free(s);
+	evbuffer_free(s->carry);
+	free(s->records);
+	free(s);
+}
+
+/** Copy the records and their strings into one allocation the user can free() */
+static MeasurementRecord *pack_records(struct measurement_stream *s) {
+	size_t strings = 0;
+	int i;
+
+#define STRING_SIZE(f) if (s->records[i].f) strings += strlen(s->records[i].f) + 1
+	for (i = 0; i != s->n; i++) {
+		STRING_SIZE(originator);
+		STRING_SIZE(targetA);
+		STRING_SIZE(targetB);
+		STRING_SIZE(published_name);
+		STRING_SIZE(string_value);
+		STRING_SIZE(channel);
+	}
+#undef STRING_SIZE
+
+	size_t size = s->n * sizeof(MeasurementRecord) + strings;
+	MeasurementRecord *result = malloc(size ? size : 1);
+	if (!result) fatal("Out of memory!");
+	char *p = (char *)(result + s->n);
+
+#define COPY_STRING(f) if (result[i].f) { size_t l = strlen(result[i].f) + 1; memcpy(p, result[i].f, l); result[i].f = p; p += l; }
+	for (i = 0; i != s->n; i++) {
+		result[i] = s->records[i];
+		COPY_STRING(originator);
+		COPY_STRING(targetA);
+		COPY_STRING(targetB);
+		COPY_STRING(published_name);
+		COPY_STRING(string_value);
+		COPY_STRING(channel);
+	}
+#undef COPY_STRING
+	return result;
+}
+
+/** Hand the records parsed so far to a batch callback */
+static void deliver_batch(struct measurement_stream *s, int done) {
+	s->batch_cb(s->rep, (HANDLE)s, s->cbarg, s->records, s->n, done);
+	s->n = 0;
+	arena_reset(s);
+}
+
+/** Parse the complete lines in the carry buffer, and the incomplete last one if the response is complete */
+static void parse_lines(struct measurement_stream *s, int complete) {
+	while (s->max <= 0 || s->count < s->max) {
+		size_t eol_len = 0;
+		struct evbuffer_ptr eol = evbuffer_search_eol(s->carry, NULL, &eol_len, EVBUFFER_EOL_ANY);
+		size_t len;
+
+		if (eol.pos >= 0) len = eol.pos;
+		else if (complete && evbuffer_get_length(s->carry)) len = evbuffer_get_length(s->carry);
+		else return;
+
+		if (len == 0) {
+			evbuffer_drain(s->carry, eol_len);
+			continue;
 		}
-		if (user_cb) user_cb(rep, id, cbdata->cbarg, NULL, 0);
-		return;
+
+		char *line = arena_alloc(s, len + 1);
+		evbuffer_remove(s->carry, line, len);
+		evbuffer_drain(s->carry, eol_len);
+		line[len] = 0;
+
+		if (s->n == s->size) {
+			s->size = s->size ? 2 * s->size : REPO_MEASUREMENT_BATCH;
+			s->records = realloc(s->records, s->size * sizeof(MeasurementRecord));
+			if (!s->records) fatal("Out of memory!");
+		}
+		if (parse_measurementrecord(line, &s->records[s->n])) continue;
+		s->n++;
+		s->count++;
+
+		if (s->batch_cb && s->n == REPO_MEASUREMENT_BATCH) deliver_batch(s, 0);
 	}
+	/* maxresults reached, ignore the rest */
+	evbuffer_drain(s->carry, evbuffer_get_length(s->carry));
+}
 
-	MeasurementRecord *result = calloc(max, sizeof(MeasurementRecord));
-	int i = 0;
-	char ts[1024];
+void _getMeasurements_chunk(struct evhttp_request *req,void *arg) {
+	struct measurement_stream *s = (struct measurement_stream *)arg;
+	if (req->response_code != HTTP_OK) return;
 
-	while (1) {
-		char *line = evbuffer_readln(req->input_buffer, NULL, EVBUFFER_EOL_ANY);
-		if (!line || i == max) break;
+	/* moves the chain, libevent drains its input buffer when we return */
+	evbuffer_add_buffer(s->carry, req->input_buffer);
+	parse_lines(s, 0);
+	if (s->batch_cb && s->n) deliver_batch(s, 0);
+}
 
-		debug("Line received (i: %d, max: %d): %s", i, max, line);
-		result[i++] = parse_measurementrecord(line);
+void _getMeasurements_callback(struct evhttp_request *req,void *arg) {
+	if (arg == NULL) return;
+	struct measurement_stream *s = (struct measurement_stream *)arg;
 
-		if (i % 10000 == 0) {
-			max += 10000;
-			result = realloc(result, max * sizeof(MeasurementRecord));
+	if (req == NULL || req->response_code != HTTP_OK) {
+		if (req) {
+			warn("Failed repository operation (id %p, error is %d %s): %s",
+				s, req->response_code, req->response_code_line, req->uri);
+			size_t response_len = evbuffer_get_length(req->input_buffer);
+			if (response_len) {
+				char *response = malloc(response_len + 1);
+				evbuffer_remove(req->input_buffer, response, response_len);
+				response[response_len] = 0;
+				debug("Response string (len %d): %s", response_len, response);
+				free(response);
+			}
 		}
+		else warn("Failed repository operation (id %p): no response", s);
+		if (s->cb) s->cb(s->rep, (HANDLE)s, s->cbarg, NULL, 0);
+		else s->batch_cb(s->rep, (HANDLE)s, s->cbarg, NULL, 0, -1);
+		free_stream(s);
+		return;
 	}
 
-	if (user_cb) user_cb(rep, id, cbdata->cbarg, result, i);
+	evbuffer_add_buffer(s->carry, req->input_buffer);
+	parse_lines(s, 1);
+	debug("GetMeasurements id %p: %d records", s, s->count);
+
+	if (s->batch_cb) deliver_batch(s, 1);
+	else if (s->cb) s->cb(s->rep, (HANDLE)s, s->cbarg, pack_records(s), s->n);
+	free_stream(s);
+}
+
+static const double exact_pow10[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/** Parse a value. Plain decimals of up to 15 digits are exact in a double, like the
+    power of ten dividing them, so one division rounds correctly; strtod does the rest. */
+static double parse_value(const char *str) {
+	const char *p = str;
+	unsigned long long m = 0;
+	int neg = 0, digits = 0, frac = 0;
+
+	if (*p == '-' || *p == '+') neg = *p++ == '-';
+	for (; *p >= '0' && *p <= '9'; p++, digits++) m = m * 10 + (*p - '0');
+	if (*p == '.') {
+		for (p++; *p >= '0' && *p <= '9'; p++, digits++, frac++) m = m * 10 + (*p - '0');
+	}
+	if (*p || digits == 0 || digits > 15 || frac > 22) {
+		char *end;
+		double v = strtod(str, &end);
+		return end == str ? NAN : v;
+	}
+	double v = (double)m / exact_pow10[frac];
+	return neg ? -v : v;
 }
 
-MeasurementRecord parse_measurementrecord(const char *line) {
-#ifdef __MINGW32__
-        extern char *strtok_r(char *str, const char *delim, char **savep); // mingw fails to define this
-#endif
-	MeasurementRecord r;
-	char *work = strdup(line);
-	char *fieldptr;
-
-	r.originator = "(Unknown)";
-	r.targetA = "(Unknown)";
-	r.targetB = NULL;
-	r.published_name = "(Unknown)";
-	r.value = FP_NAN;
-	r.string_value = NULL;
-	r.channel = NULL;
-	r.timestamp.tv_sec = 0;
-	r.timestamp.tv_usec = 0;
-
-	char *token = strtok_r(work, "&", &fieldptr);
-	if (!token) {
+int parse_measurementrecord(char *line, MeasurementRecord *r) {
+	char *field = line;
+
+	r->originator = "(Unknown)";
+	r->targetA = "(Unknown)";
+	r->targetB = NULL;
+	r->published_name = "(Unknown)";
+	r->value = NAN;
+	r->string_value = NULL;
+	r->channel = NULL;
+	r->timestamp.tv_sec = 0;
+	r->timestamp.tv_usec = 0;
+
+	if (!strchr(line, '=')) {
 		warn("Invalid measurement record received: %s\n", line);
-		return r;
+		return -1;
 	}
-	while (token) {
-		char *eqptr;
-
-		char *field = strdup(token);
-		char *name = strtok_r(field, "=", &eqptr);
-		char *value = strtok_r(NULL, "=", &eqptr);
-
-		if (!strcmp("originator", name)) r.originator = strdup(value);
-		else if (!strcmp("published_name", name)) r.published_name = strdup(value);
-		else if (!strcmp("string_value", name)) r.string_value = strdup(value);
-		else if (!strcmp("value", name)) {
-			sscanf(value, "%lf", &r.value);
-		}
-		else if (!strcmp("targetA", name)) r.targetA = strdup(value);
-		else if (!strcmp("targetB", name)) r.targetB = strdup(value);
-		else if (!strcmp("channel", name)) r.channel = strdup(value);
+	while (field) {
+		char *next = strchr(field, '&');
+		if (next) *next++ = 0;
 
-		free(field);
-		token = strtok_r(NULL, "&", &fieldptr);
+		char *value = strchr(field, '=');
+		if (value) *value++ = 0;
+		else value = field + strlen(field);
+
+		if (!strcmp("originator", field)) r->originator = value;
+		else if (!strcmp("published_name", field)) r->published_name = value;
+		else if (!strcmp("string_value", field)) r->string_value = value;
+		else if (!strcmp("value", field)) r->value = parse_value(value);
+		else if (!strcmp("targetA", field)) r->targetA = value;
+		else if (!strcmp("targetB", field)) r->targetB = value;
+		else if (!strcmp("channel", field)) r->channel = value;
+
+		field = next;
 	}
- 	free(work);	
-	return r;
+	return 0;
 }
-
@@ -1,66 +1,294 @@
 #define LOG_MODULE "[rep] "
 #include        "repoclient_impl.h"
 
-HANDLE repGetPeers(HANDLE rep, cb_repGetPeers cb, void *cbarg, int maxResults, Constraint *cons, int clen, 
-	Ranking *ranks, int rlen, const char *ch) {
-	if (!check_handle(rep, __FUNCTION__)) return NULL;
-	debug("About to call getPeers with maxResults %d, constaints %s and rankings %s", 
-		maxResults, constraints2str(cons, clen), rankings2str(ranks, rlen));
-
-	char uri[10240];
-	request_data *rd = (request_data *)malloc(sizeof(request_data));
-	if (!rd) return NULL;
-	rd->id = (void *)rd;
-	rd->cb = cb;
-	rd->cbarg = cbarg;
-	rd->server = rep;
-	rd->data = maxResults;
-
-        sprintf(uri, "/GetPeers?maxresults=%d&%s%s%s",  
-		maxResults, constraints2str(cons, clen), 
-		(rlen ? "&" : ""), rankings2str(ranks, rlen));
-	if (ch) {
-		if (clen + rlen > 0) strcat(uri, "&");
-		strcat(uri, "channel=");
-		strcat(uri, ch);
+/** Append a parameter value to the request string, escaped */
+static void add_escaped(struct evbuffer *uri, const char *value) {
+	char *escaped = evhttp_encode_uri(value ? value : "");
+	if (!escaped) fatal("Out of memory!");
+	evbuffer_add(uri, escaped, strlen(escaped));
+	free(escaped);
+}
+
+/** Append Constraints in the HTTP encoding (constraints=mtype,min,max;mtype,str;...) */
+static void add_constraints(struct evbuffer *uri, Constraint *cons, int len) {
+	int i;
+	if (!len) return;
+
+	evbuffer_add_printf(uri, "&constraints=");
+	for (i = 0; i != len; i++) {
+		if (i) evbuffer_add_printf(uri, ";");
+		add_escaped(uri, cons[i].published_name);
+		evbuffer_add_printf(uri, ",");
+		if (cons[i].strValue) add_escaped(uri, cons[i].strValue);
+		else evbuffer_add_printf(uri, "%f,%f", cons[i].minValue, cons[i].maxValue);
 	}
-	debug("Making getPeers request with URI %s", uri);
-	
-	make_request(uri, _stringlist_callback, (void *)rd);
-	return (HANDLE)(rd);
 }
 
-const char *constraints2str(Constraint *cons, int len) {
-	static char buf[1024];
-	buf[0] = 0;
-	if (len) strcat(buf, "constraints=");
+/** Append Rankings in the HTTP encoding (rankings=mtype,w;...) */
+static void add_rankings(struct evbuffer *uri, Ranking *ranks, int len) {
 	int i;
+	if (!len) return;
 
+	evbuffer_add_printf(uri, "&rankings=");
 	for (i = 0; i != len; i++) {
-		char tmp[1024] = "";
+		if (i) evbuffer_add_printf(uri, ";");
+		add_escaped(uri, ranks[i].published_name);
+		evbuffer_add_printf(uri, ",%f", ranks[i].weight);
+	}
+}
 
-		if (i) strcat(buf, ";");
-		if (cons[i].strValue) sprintf(tmp, "%s,%s", cons[i].published_name, cons[i].strValue);
-		else sprintf(tmp, "%s,%f,%f", cons[i].published_name, (float)cons[i].minValue, (float)cons[i].maxValue);
+/** Build a GetPeers/CountPeers request string, NULL if it would be longer than REPO_MAX_URI */
+static char *peers_uri(const char *path, int maxResults, Constraint *cons, int clen, Ranking *ranks, int rlen, const char *ch) {
+	struct evbuffer *buf = evbuffer_new();
+	char *uri = NULL;
+	if (!buf) return NULL;
+
+	evbuffer_add_printf(buf, "%s?maxresults=%d", path, maxResults);
+	add_constraints(buf, cons, clen);
+	add_rankings(buf, ranks, rlen);
+	if (ch) {
+		evbuffer_add_printf(buf, "&channel=");
+		add_escaped(buf, ch);
+	}
 
-		strcat(buf, tmp);
+	size_t len = evbuffer_get_length(buf);
+	if (len < REPO_MAX_URI && (uri = malloc(len + 1)) != NULL) {
+		evbuffer_remove(buf, uri, len);
+		uri[len] = 0;
 	}
-	return buf;
+	else warn("%s request longer than %d bytes, not sent", path, REPO_MAX_URI);
+	evbuffer_free(buf);
+	return uri;
+}
+
+static void free_peers(char **peers, int num) {
+	int i;
+	if (!peers) return;
+	for (i = 0; i != num; i++) free(peers[i]);
+	free(peers);
 }
 
-const char *rankings2str(Ranking *ranks, int len) {
-	static char buf[1024];
-	buf[0] = 0;
-	if (len) strcat(buf, "rankings=");
+/** A copy of the cached GetPeers answer, to be freed by the callback */
+static char **copy_peers(struct peer_query *q) {
+	char **peers = calloc(q->num ? q->num : 1, sizeof(char *));
 	int i;
+	if (!peers) fatal("Out of memory!");
+	for (i = 0; i != q->num; i++) {
+		if ((peers[i] = strdup(q->peers[i])) == NULL) fatal("Out of memory!");
+	}
+	return peers;
+}
+
+static void free_query(struct peer_query *q) {
+	while (q->waiters) {
+		struct peer_waiter *w = q->waiters;
+		q->waiters = w->next;
+		free(w);
+	}
+	event_free(q->deliver_ev);
+	free_peers(q->peers, q->num);
+	free(q->uri);
+	free(q);
+}
+
+static void answer_waiters(struct peer_query *q, int ok);
+
+void free_peer_queries(struct reposerver *server) {
+	struct peer_query *q;
+
+	/* callers of a cached answer not delivered yet */
+	for (q = server->peer_queries; q; q = q->next) {
+		q->valid = 0;
+		if (q->waiters) answer_waiters(q, 0);
+	}
+	while (server->peer_queries) {
+		struct peer_query *q = server->peer_queries;
+		server->peer_queries = q->next;
+		free_query(q);
+	}
+}
+
+/** Answer everyone waiting for q, with the answer of q if ok, with an error if not */
+static void answer_waiters(struct peer_query *q, int ok) {
+	struct reposerver *server = q->server;
+	struct peer_waiter *w, *waiters = q->waiters;
+	int count = q->count, num = ok ? q->num : 0;
+	char ***results = NULL;
+	int i, n = 0;
+
+	/* copies first: the callbacks may ask again or even close the server */
+	q->waiters = NULL;
+	for (w = waiters; w; w = w->next) n++;
+	if (ok && !count) {
+		results = malloc(n * sizeof(char **));
+		if (!results) fatal("Out of memory!");
+		for (i = 0; i != n; i++) results[i] = copy_peers(q);
+	}
+	if (!q->valid) {
+		free_peers(q->peers, q->num);
+		q->peers = NULL;
+		q->num = 0;
+	}
+
+	for (i = 0, w = waiters; w; i++) {
+		struct peer_waiter *next = w->next;
+		if (count) {
+			cb_repCountPeers cb = (cb_repCountPeers)w->cb;
+			if (cb) cb((HANDLE)server, (HANDLE)w, w->cbarg, ok ? num : -1);
+		}
+		else {
+			cb_repGetPeers cb = (cb_repGetPeers)w->cb;
+			if (cb) cb((HANDLE)server, (HANDLE)w, w->cbarg, ok ? results[i] : NULL, num);
+			else if (ok) free_peers(results[i], num);
+		}
+		free(w);
+		w = next;
+	}
+	if (results) free(results);
+}
 
-	for (i = 0; i!= len; i++) {
-	char tmp[128];
+void _peers_callback(struct evhttp_request *req, void *arg) {
+	struct peer_query *q = (struct peer_query *)arg;
+	int ok = req != NULL && req->response_code == HTTP_OK;
 
-	if (i) strcat(tmp, ";");
-	sprintf(tmp, "%s,%f", ranks[i].published_name, ranks[i].weight);
-	strcat(buf, tmp);
+	q->in_flight = 0;
+	if (!ok) {
+		if (req) warn("Failed repository operation %s (error is %d %s)", q->uri, req->response_code, req->response_code_line);
+		else warn("Failed repository operation %s: no response", q->uri);
+		q->valid = 0;
+		answer_waiters(q, 0);
+		return;
+	}
+
+	free_peers(q->peers, q->num);
+	q->peers = NULL;
+	q->num = 0;
+	if (q->count) {
+		char *line = evbuffer_readln(req->input_buffer, NULL, EVBUFFER_EOL_ANY);
+		if (!line || sscanf(line, "%d", &q->num) != 1) {
+			warn("Invalid CountPeers answer to %s", q->uri);
+			ok = 0;
+		}
+		if (line) free(line);
+	}
+	else {
+		int size = 0;
+		char *line;
+		while ((line = evbuffer_readln(req->input_buffer, NULL, EVBUFFER_EOL_ANY)) != NULL) {
+			if (q->num == size) {
+				size = size ? 2 * size : 64;
+				q->peers = realloc(q->peers, size * sizeof(char *));
+				if (!q->peers) fatal("Out of memory!");
+			}
+			q->peers[q->num++] = line;
+		}
 	}
-return buf;
+
+	q->valid = ok && q->server->peers_cache_ttl > 0;
+	if (q->valid) {
+		struct timeval ttl = { q->server->peers_cache_ttl / 1000, (q->server->peers_cache_ttl % 1000) * 1000 };
+		gettimeofday(&q->expires, NULL);
+		timeradd(&q->expires, &ttl, &q->expires);
+	}
+	debug("%s answered", q->uri);
+	answer_waiters(q, ok);
+}
+
+static void _deliver_cached(evutil_socket_t fd, short what, void *arg) {
+	answer_waiters((struct peer_query *)arg, 1);
 }
 
+/** Free the queries that have neither callers nor a valid answer */
+static void purge_queries(struct reposerver *server, const struct timeval *now) {
+	struct peer_query **p = &server->peer_queries;
+	while (*p) {
+		struct peer_query *q = *p;
+		if (q->valid && timercmp(now, &q->expires, >=)) q->valid = 0;
+		if (!q->valid && !q->in_flight && !q->waiters) {
+			*p = q->next;
+			free_query(q);
+		}
+		else p = &q->next;
+	}
+}
+
+/** Ask a GetPeers or CountPeers query, or join the same one in flight, or get its cached answer */
+static HANDLE query_peers(struct reposerver *server, char *uri, int count, void *cb, void *cbarg) {
+	struct peer_query *q;
+	struct peer_waiter *w, **last;
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	purge_queries(server, &now);
+	for (q = server->peer_queries; q && strcmp(q->uri, uri); q = q->next);
+	if (q) free(uri);
+	else {
+		q = (struct peer_query *)calloc(1, sizeof(struct peer_query));
+		if (!q) {
+			free(uri);
+			return NULL;
+		}
+		q->server = server;
+		q->uri = uri;
+		q->count = count;
+		q->deliver_ev = evtimer_new(eventbase, _deliver_cached, q);
+		if (!q->deliver_ev) fatal("Out of memory!");
+		q->next = server->peer_queries;
+		server->peer_queries = q;
+	}
+
+	w = (struct peer_waiter *)malloc(sizeof(struct peer_waiter));
+	if (!w) return NULL;
+	w->cb = cb;
+	w->cbarg = cbarg;
+	w->next = NULL;
+	for (last = &q->waiters; *last; last = &(*last)->next);
+	*last = w;
+
+	if (q->in_flight) {
+		debug("%s already in flight, waiting for its answer", q->uri);
+	}
+	else if (q->valid) {
+		/* answered from the event loop, like a request */
+		struct timeval asap = { 0, 0 };
+		if (!evtimer_pending(q->deliver_ev, NULL)) evtimer_add(q->deliver_ev, &asap);
+	}
+	else {
+		debug("Making request with URI %s", q->uri);
+		q->in_flight = 1;
+		if (make_request(server, q->uri, _peers_callback, q)) {
+			q->in_flight = 0;
+			*last = NULL;
+			free(w);
+			return NULL;
+		}
+	}
+	return (HANDLE)w;
+}
+
+HANDLE repGetPeers(HANDLE rep, cb_repGetPeers cb, void *cbarg, int maxResults, Constraint *cons, int clen, 
+	Ranking *ranks, int rlen, const char *ch) {
+	if (!check_handle(rep, __FUNCTION__)) return NULL;
+
+	char *uri = peers_uri("/GetPeers", maxResults, cons, clen, ranks, rlen, ch);
+	if (!uri) return NULL;
+	return query_peers((struct reposerver *)rep, uri, 0, (void *)cb, cbarg);
+}
+
+HANDLE repCountPeers(HANDLE rep, cb_repCountPeers cb, void *cbarg, Constraint *cons, int clen, const char *ch) {
+	if (!check_handle(rep, __FUNCTION__)) return NULL;
+
+	char *uri = peers_uri("/CountPeers", 0, cons, clen, NULL, 0, ch);
+	if (!uri) return NULL;
+	return query_peers((struct reposerver *)rep, uri, 1, (void *)cb, cbarg);
+}
+
+void repSetPeersCacheTTL(HANDLE rep, int ttl_ms) {
+	if (!check_handle(rep, __FUNCTION__)) return;
+	struct reposerver *server = (struct reposerver *)rep;
+	struct peer_query *q;
+
+	server->peers_cache_ttl = ttl_ms;
+	/* answers cached under the old setting are not reused */
+	for (q = server->peer_queries; q; q = q->next) q->valid = 0;
+}
@@ -0,0 +1,228 @@
+#define LOG_MODULE "[rep] "
+#include	"repoclient_impl.h"
+#include	"neighborlist.h"
+
+#define NEIGHBORLIST_MAGIC	0xAACC
+
+/** Internal structure of a NeighborList instance */
+struct neighborlist {
+	/** magic number to check handle validity */
+	int magic;
+	/** repoclient the peers are asked from */
+	HANDLE rep;
+	int desired_size;
+	char *channel;
+	cb_NeighborListChange notifier;
+	void *notifier_arg;
+	/** periodic refresh, NULL if the list is only filled once */
+	HANDLE periodic;
+	/** the current list, in the order the peers were first seen */
+	NeighborListEntry *list;
+	int num;
+	int size;
+	/** refresh in which each entry was last returned by the repository */
+	unsigned *seen;
+	unsigned generation;
+	/** open addressing hash on list, index + 1 or 0 for an empty slot */
+	int *buckets;
+	int mask;
+	/** a GetPeers request is being answered */
+	int in_flight;
+	/** neighborlist_close was called while a request was in flight */
+	int closing;
+};
+
+static int check_neighborlist(HANDLE h, const char *fn) {
+	struct neighborlist *nl = (struct neighborlist *)h;
+	if (!nl || nl->magic != NEIGHBORLIST_MAGIC) {
+		error("Trying to use an invalid NeighborList handle in fn %s", fn);
+		return 0;
+	}
+	return 1;
+}
+
+static unsigned hash_peer(const char *peer) {
+	unsigned h = 2166136261u;
+	while (*peer) h = (h ^ (unsigned char)*peer++) * 16777619u;
+	return h;
+}
+
+/** Index of peer in the list, -1 if it is not there; *slot is where it is or should go */
+static int find_peer(struct neighborlist *nl, const char *peer, int *slot) {
+	int s = hash_peer(peer) & nl->mask;
+	while (nl->buckets[s]) {
+		int i = nl->buckets[s] - 1;
+		if (!strcmp(nl->list[i].peer, peer)) {
+			if (slot) *slot = s;
+			return i;
+		}
+		s = (s + 1) & nl->mask;
+	}
+	if (slot) *slot = s;
+	return -1;
+}
+
+static void rebuild_index(struct neighborlist *nl) {
+	int i, slot;
+	memset(nl->buckets, 0, (nl->mask + 1) * sizeof(int));
+	for (i = 0; i != nl->num; i++) {
+		find_peer(nl, nl->list[i].peer, &slot);
+		nl->buckets[slot] = i + 1;
+	}
+}
+
+/** Make room for at least n entries, keeping the hash at most half full */
+static void reserve(struct neighborlist *nl, int n) {
+	if (n <= nl->size) return;
+
+	int size = nl->size ? nl->size : 16;
+	while (size < n) size *= 2;
+	nl->list = realloc(nl->list, size * sizeof(NeighborListEntry));
+	nl->seen = realloc(nl->seen, size * sizeof(unsigned));
+	free(nl->buckets);
+	nl->buckets = malloc(2 * size * sizeof(int));
+	if (!nl->list || !nl->seen || !nl->buckets) fatal("Out of memory!");
+	nl->size = size;
+	nl->mask = 2 * size - 1;
+	rebuild_index(nl);
+}
+
+static void free_neighborlist(struct neighborlist *nl) {
+	nl->magic = 0;
+	free(nl->list);
+	free(nl->seen);
+	free(nl->buckets);
+	if (nl->channel) free(nl->channel);
+	free(nl);
+}
+
+/** Merge a GetPeers result into the list, return whether the list changed */
+static int merge_peers(struct neighborlist *nl, char **result, int n) {
+	struct timeval now;
+	int i, slot, added = 0, removed = 0;
+
+	gettimeofday(&now, NULL);
+	nl->generation++;
+	reserve(nl, nl->num + n);
+
+	for (i = 0; i != n; i++) {
+		char peer[sizeof(nl->list[0].peer)];
+		strncpy(peer, result[i], sizeof(peer) - 1);
+		peer[sizeof(peer) - 1] = 0;
+
+		int j = find_peer(nl, peer, &slot);
+		if (j < 0) {
+			j = nl->num++;
+			strcpy(nl->list[j].peer, peer);
+			nl->buckets[slot] = j + 1;
+			added++;
+		}
+		nl->list[j].update_timestamp = now;
+		nl->seen[j] = nl->generation;
+	}
+
+	/* drop the peers the repository did not return this time */
+	for (i = 0; i != nl->num; i++) {
+		if (nl->seen[i] != nl->generation) {
+			removed++;
+			continue;
+		}
+		if (removed) {
+			nl->list[i - removed] = nl->list[i];
+			nl->seen[i - removed] = nl->seen[i];
+		}
+	}
+	if (removed) {
+		nl->num -= removed;
+		rebuild_index(nl);
+	}
+
+	debug("NeighborList %p refreshed: %d peers, %d added, %d removed", nl, nl->num, added, removed);
+	return added || removed;
+}
+
+static void _neighborlist_peers_cb(HANDLE rep, HANDLE id, void *cbarg, char **result, int n) {
+	struct neighborlist *nl = (struct neighborlist *)cbarg;
+	int i, changed = 0;
+
+	nl->in_flight = 0;
+	/* on error, keep the list we have */
+	if (result && !nl->closing) changed = merge_peers(nl, result, n);
+	if (result) {
+		for (i = 0; i != n; i++) free(result[i]);
+		free(result);
+	}
+
+	if (nl->closing) free_neighborlist(nl);
+	else if (changed && nl->notifier) nl->notifier((HANDLE)nl, nl->notifier_arg);
+}
+
+/** Ask the repository for the peers, unless the previous answer is still on its way */
+static void refresh(HANDLE h, void *arg) {
+	struct neighborlist *nl = (struct neighborlist *)arg;
+
+	if (nl->in_flight) {
+		debug("NeighborList %p: previous query still in flight, not asking again", nl);
+		return;
+	}
+	/* set first, the callback may run before repGetPeers returns */
+	nl->in_flight = 1;
+	if (!repGetPeers(nl->rep, _neighborlist_peers_cb, nl, nl->desired_size, NULL, 0, NULL, 0, nl->channel)) {
+		warn("NeighborList %p: GetPeers query failed", nl);
+		nl->in_flight = 0;
+	}
+}
+
+HANDLE neighborlist_init(HANDLE rep, int desired_size, int update_freq, const char *channel, cb_NeighborListChange notifier, void *notifier_arg) {
+	if (!check_handle(rep, __FUNCTION__)) return NULL;
+
+	struct neighborlist *nl = (struct neighborlist *)calloc(sizeof(struct neighborlist), 1);
+	if (!nl) return NULL;
+	nl->magic = NEIGHBORLIST_MAGIC;
+	nl->rep = rep;
+	nl->desired_size = desired_size;
+	nl->channel = channel ? strdup(channel) : NULL;
+	nl->notifier = notifier;
+	nl->notifier_arg = notifier_arg;
+	reserve(nl, desired_size > 0 ? desired_size : 1);
+
+	info("NeighborList %p: %d peers, refreshed every %d s, channel %s", nl, desired_size, update_freq, channel ? channel : "(any)");
+	if (update_freq > 0) nl->periodic = napaSchedulePeriodic(NULL, 1.0 / update_freq, refresh, nl);
+	else refresh(NULL, nl);
+	return (HANDLE)nl;
+}
+
+void neighborlist_close(HANDLE h) {
+	if (!check_neighborlist(h, __FUNCTION__)) return;
+	struct neighborlist *nl = (struct neighborlist *)h;
+
+	if (nl->periodic) napaStopPeriodic(nl->periodic);
+	/* the GetPeers callback frees it */
+	if (nl->in_flight) nl->closing = 1;
+	else free_neighborlist(nl);
+}
+
+int neighborlist_query(HANDLE h, NeighborListEntry *result, int *n) {
+	if (!check_neighborlist(h, __FUNCTION__)) return -1;
+	struct neighborlist *nl = (struct neighborlist *)h;
+
+	if (!result || !n || *n < 0) return -2;
+	if (*n > nl->num) *n = nl->num;
+	memcpy(result, nl->list, *n * sizeof(NeighborListEntry));
+	return 0;
+}
+
+int neighborlist_count(HANDLE h) {
+	if (!check_neighborlist(h, __FUNCTION__)) return 0;
+	return ((struct neighborlist *)h)->num;
+}
+
+int neighborlist_get(HANDLE h, char *peer, NeighborListEntry *result) {
+	if (!check_neighborlist(h, __FUNCTION__) || !peer) return 0;
+	struct neighborlist *nl = (struct neighborlist *)h;
+
+	int i = find_peer(nl, peer, NULL);
+	if (i < 0) return 0;
+	if (result) *result = nl->list[i];
+	return 1;
+}
@@ -82,13 +82,19 @@ const char *encode_measurementrecord(const MeasurementRecord *r) {
 }
 
 void _publish_callback(struct evhttp_request *req,void *arg) {
-	if (req == NULL || arg == NULL) return;
+	if (arg == NULL) return;
 	request_data *cbdata = (request_data *)arg;
 	struct reposerver *server = cbdata->server;
 	cb_repPublish user_cb = cbdata->cb;
+	void *cbarg = cbdata->cbarg;
 	HANDLE id = cbdata->id;
 	free(cbdata);
-	
+
+	if (req == NULL) {
+		warn("Failed PUBLISH operation (server %s:%hu, id %p): no response", server->address, server->port, id);
+		if (user_cb) user_cb((HANDLE)server, id, cbarg, -1);
+		return;
+	}
 	if (req->response_code != HTTP_OK) {
 		warn("Failed PUBLISH operation (server %s:%hu,id %p, error is %d %s): %s", 
 			server->address, server->port, id, req->response_code, req->response_code_line, req->uri);
@@ -100,10 +106,10 @@ void _publish_callback(struct evhttp_request *req,void *arg) {
 			debug("Response string (len %d): %s", response_len, response);
 			free(response);
 		}	
-		if (user_cb) user_cb((HANDLE)server, id, cbdata->cbarg, req->response_code ? req->response_code : -1);
+		if (user_cb) user_cb((HANDLE)server, id, cbarg, req->response_code ? req->response_code : -1);
 		return;
 	}
-	if (user_cb) user_cb((HANDLE)server, id, cbdata->cbarg,0);
+	if (user_cb) user_cb((HANDLE)server, id, cbarg, 0);
 }
 
 HANDLE repPublish(HANDLE h, cb_repPublish cb, void *cbarg, MeasurementRecord *r) {
@@ -143,18 +149,24 @@ HANDLE repPublish(HANDLE h, cb_repPublish cb, void *cbarg, MeasurementRecord *r)
 	}
 	else {
 		sprintf(uri, "/Publish?%s", encode_measurementrecord(r));
-		make_request(uri, _publish_callback, (void *)rd);
+		if (make_request(rep, uri, _publish_callback, (void *)rd)) {
+			free(rd);
+			return NULL;
+		}
 	}
 	return (HANDLE)(rd);
 }
 
 /** libevent callback for deferred publishing */
 void _batch_publish_callback(struct evhttp_request *req,void *arg) {
-	if (req == NULL || arg == NULL) return;
+	if (arg == NULL) return;
 	struct reposerver *rep = (struct reposerver *)arg;
-	int response = req->response_code;
+	int response = req ? req->response_code : -1;
 
-	if (response != HTTP_OK) {
+	if (req == NULL) {
+		warn("Failed BATCH PUBLISH operation (server %s:%hu): no response", rep->address, rep->port);
+	}
+	else if (response != HTTP_OK) {
 		warn("Failed BATCH PUBLISH operation (server %s:%hu, error is %d %s)", 
 			rep->address, rep->port, req->response_code, req->response_code_line);
 		size_t response_len = evbuffer_get_length(req->input_buffer);
@@ -171,9 +183,10 @@ void _batch_publish_callback(struct evhttp_request *req,void *arg) {
 	for (i = 0; i != rep->in_transit_entries; i++) {
 		request_data *cbdata = rep->in_transit[i].requestdata;
 		cb_repPublish user_cb = cbdata->cb;
+		void *cbarg = cbdata->cbarg;
 		HANDLE id = cbdata->id;
 		free(cbdata);
-		if (user_cb) user_cb((HANDLE)rep, id, cbdata->cbarg, response == 200 ? 0 : response);
+		if (user_cb) user_cb((HANDLE)rep, id, cbarg, response == HTTP_OK ? 0 : response ? response : -1);
 		free_measurementrecord(&(rep->in_transit[i].r));
 	}
 	debug("Freeing up %d in-transit entries", rep->in_transit_entries);
@@ -208,18 +221,29 @@ void deferred_publish_cb(evutil_socket_t fd, short what, void *arg) {
 			}
 		}
 
-		make_post_request("/BatchPublish", post_data,
-				_batch_publish_callback, rep);
-
-		rep->in_transit = rep->publish_buffer;
-		rep->in_transit_entries = rep->publish_buffer_entries;
-		rep->publish_buffer_entries = 0;
-		rep->publish_buffer = calloc(sizeof(struct deferred_publish),
-				PUBLISH_BUFFER_SIZE);
-		if (!rep->publish_buffer) fatal("Out of memory");
-
+		int queued = make_post_request(rep, "/BatchPublish", post_data,
+				_batch_publish_callback, rep) == 0;
 		free(post_data);
 
+		if (!queued) {
+			/* the records fail here and the buffer is reused */
+			for (i = 0; i != rep->publish_buffer_entries; i++) {
+				request_data *cbdata = rep->publish_buffer[i].requestdata;
+				cb_repPublish user_cb = cbdata->cb;
+				if (user_cb) user_cb((HANDLE)rep, cbdata->id, cbdata->cbarg, -1);
+				free(cbdata);
+				free_measurementrecord(&(rep->publish_buffer[i].r));
+			}
+			rep->publish_buffer_entries = 0;
+		}
+		else {
+			rep->in_transit = rep->publish_buffer;
+			rep->in_transit_entries = rep->publish_buffer_entries;
+			rep->publish_buffer_entries = 0;
+			rep->publish_buffer = calloc(sizeof(struct deferred_publish),
+					PUBLISH_BUFFER_SIZE);
+			if (!rep->publish_buffer) fatal("Out of memory");
+		}
 	}
 
 	if (rep->publish_delay) {
@@ -38,12 +38,23 @@ HANDLE repOpen(const char *server, int publish_delay) {
 	rep->publish_delay = publish_delay;
 	rep->in_transit = NULL;
 	rep->in_transit_entries = 0;
+	rep->pending = rep->pending_last = NULL;
+	rep->pending_entries = 0;
+	rep->peer_queries = NULL;
+	rep->peers_cache_ttl = REPO_PEERS_CACHE_TTL;
 	parse_serverspec(server, &(rep->address), &(rep->port));
 
 	info("Opening repository client %p to http://%s:%d", rep, rep->address,  rep->port);
 
-	if ((rep->evhttp_conn = evhttp_connection_base_new(eventbase,  rep->address,  rep->port)) == NULL) 
-		fatal("Unable to establish connection to %s:%d", rep->address, rep->port);
+	int i;
+	for (i = 0; i != REPO_POOL_SIZE; i++) {
+		struct repo_connection *c = &rep->pool[i];
+		c->current = NULL;
+		if ((c->evhttp_conn = evhttp_connection_base_new(eventbase, NULL, rep->address, rep->port)) == NULL) 
+			fatal("Unable to establish connection to %s:%d", rep->address, rep->port);
+		/* a kept-alive connection may have been closed by the server meanwhile */
+		evhttp_connection_set_retries(c->evhttp_conn, 1);
+	}
 
 	if (publish_delay) {
 		rep->publish_buffer = calloc(sizeof(struct deferred_publish), PUBLISH_BUFFER_SIZE);
@@ -57,17 +68,39 @@ HANDLE repOpen(const char *server, int publish_delay) {
         return rep;
 }
 
+static void cancel_request(struct repo_request *rr);
+
 /** Close the repoclient instance and free resources */
 void repClose(HANDLE h) {
 	if (!check_handle(h, __FUNCTION__)) return;
 	struct reposerver *rep = (struct reposerver *)h;
 
 	debug("Closing repository client %p to %s:%hu", h, rep->address, rep->port);
-	evhttp_connection_free(rep->evhttp_conn);
+	/* first, so that the callbacks of the cancelled requests cannot use it */
 	rep->magic=0;
+	int i;
+	for (i = 0; i != REPO_POOL_SIZE; i++) {
+		/* libevent frees the request without calling back */
+		struct repo_request *rr = rep->pool[i].current;
+		rep->pool[i].current = NULL;
+		evhttp_connection_free(rep->pool[i].evhttp_conn);
+		cancel_request(rr);
+	}
+	while (rep->pending) {
+		struct repo_request *rr = rep->pending;
+		rep->pending = rr->next;
+		rep->pending_entries--;
+		cancel_request(rr);
+	}
+	rep->pending_last = NULL;
+	free_peer_queries(rep);
 	if (rep->publish_buffer_entries && rep->publish_buffer) {
 		while (rep->publish_buffer_entries) {
-			free_measurementrecord(&(rep->publish_buffer[--rep->publish_buffer_entries].r));
+			struct deferred_publish *p = &rep->publish_buffer[--rep->publish_buffer_entries];
+			cb_repPublish user_cb = p->requestdata->cb;
+			if (user_cb) user_cb((HANDLE)rep, p->requestdata->id, p->requestdata->cbarg, -1);
+			free(p->requestdata);
+			free_measurementrecord(&p->r);
 		}
 	}
 	if (rep->publish_buffer) free(rep->publish_buffer);
@@ -94,49 +127,186 @@ HANDLE repListMeasurementNames(HANDLE rep, cb_repListMeasurementNames cb, void *
 	rd->data = maxResults;
 
 	sprintf(uri, "/ListMeasurementNames?maxResults=%d",  maxResults);
-	make_request(uri, _stringlist_callback, (void *)rd);
+	if (make_request(rd->server, uri, _stringlist_callback, (void *)rd)) {
+		free(rd);
+		return NULL;
+	}
 	return (HANDLE)(rd);
 }
 
-void make_request(const char *uri, void (*callback)(struct evhttp_request *, void *), void *cb_arg) {
-	struct evhttp_request *req = evhttp_request_new(callback, cb_arg);
-	request_data *rd = (request_data *)cb_arg;
+#define PUBLISH_URI "/Publish?"
 
-        if (!req) {
-                error("Failed to create request object");
-		return;
+/** An idle connection of the pool, or NULL */
+static struct repo_connection *idle_connection(struct reposerver *rep) {
+	int i;
+	for (i = 0; i != REPO_POOL_SIZE; i++) {
+		if (rep->pool[i].current == NULL) return &rep->pool[i];
 	}
-        evhttp_add_header(req->output_headers, "Connection", "close");
+	return NULL;
+}
 
-        if (evhttp_make_request(rd->server->evhttp_conn, req, EVHTTP_REQ_GET, uri)) {
-                warn("evhttp_make_request failed");
-        }
+static int is_publish(const struct repo_request *rr) {
+	return rr->type == EVHTTP_REQ_GET && !strncmp(rr->uri, PUBLISH_URI, strlen(PUBLISH_URI));
 }
 
-int make_post_request(const char *uri, const char *data, void (*callback)(struct evhttp_request *, void *), void *cb_arg) {
-	struct evhttp_request *req = evhttp_request_new(callback, cb_arg);
-	struct reposerver *rep = (struct reposerver *)cb_arg;
-	
-        if (!req) {
-                error("Failed to create request object");
-		return -1;
+static void free_request(struct repo_request *rr) {
+	free(rr->uri);
+	if (rr->data) free(rr->data);
+	free(rr);
+}
+
+/** Drop a request and the publishes merged into it, their callbacks see no response */
+static void cancel_request(struct repo_request *rr) {
+	while (rr) {
+		struct repo_request *next = rr->merged;
+		rr->callback(NULL, rr->cb_arg);
+		free_request(rr);
+		rr = next;
 	}
+}
 
-        if (evhttp_add_header(req->output_headers, "Connection", "close") < 0) {
-                error("Failed to add header");
-		return -2;
-        }
+static struct repo_request *pop_pending(struct reposerver *rep) {
+	struct repo_request *rr = rep->pending;
+	rep->pending = rr->next;
+	if (!rep->pending) rep->pending_last = NULL;
+	rep->pending_entries--;
+	return rr;
+}
 
-	if (evbuffer_add(req->output_buffer, data, strlen(data) + 1) < 0) {
-                error("Failed to add data to request");
-		return -3;
+/** Turn a waiting publish and the ones queued behind it into one BatchPublish */
+static void merge_publishes(struct reposerver *rep, struct repo_request *rr) {
+	struct repo_request *tail = rr;
+	size_t len = strlen(rr->uri);
+	int n = 1;
+
+	while (rep->pending && is_publish(rep->pending) && n != REPO_BATCH_MAX) {
+		tail->merged = pop_pending(rep);
+		tail = tail->merged;
+		len += strlen(tail->uri);
+		n++;
 	}
+	if (n == 1) return;
+
+	char *data = malloc(len + 1);
+	if (!data) fatal("Out of memory!");
+	data[0] = 0;
+	for (tail = rr; tail; tail = tail->merged) {
+		strcat(data, tail->uri + strlen(PUBLISH_URI));
+		strcat(data, "\n");
+	}
+	debug("Sending %d waiting publishes as one BatchPublish", n);
 
-        if (evhttp_make_request(rep->evhttp_conn, req, EVHTTP_REQ_POST, uri) < 0) {
-                warn("evhttp_make_request failed");
-		return -4;
-        }
-        return 0;
+	free(rr->uri);
+	rr->uri = strdup("/BatchPublish");
+	rr->data = data;
+	rr->type = EVHTTP_REQ_POST;
+}
+
+/** libevent callback for pooled requests: frees the connection, then calls the callbacks */
+static void request_done(struct evhttp_request *req, void *arg);
+
+static void request_chunk(struct evhttp_request *req, void *arg) {
+	struct repo_request *rr = (struct repo_request *)arg;
+	rr->chunk_callback(req, rr->cb_arg);
+}
+
+/** Send waiting requests as long as there is an idle connection */
+static void dispatch_requests(struct reposerver *rep) {
+	struct repo_connection *c;
+
+	while (rep->pending && (c = idle_connection(rep)) != NULL) {
+		struct repo_request *rr = pop_pending(rep);
+		if (is_publish(rr)) merge_publishes(rep, rr);
+
+		struct evhttp_request *req = evhttp_request_new(request_done, rr);
+		if (!req) {
+			error("Failed to create request object");
+			request_done(NULL, rr);
+			continue;
+		}
+		if (rr->chunk_callback) evhttp_request_set_chunked_cb(req, request_chunk);
+		evhttp_add_header(evhttp_request_get_output_headers(req), "Host", rep->address);
+		if (rr->data && evbuffer_add(evhttp_request_get_output_buffer(req), rr->data, strlen(rr->data) + 1) < 0) {
+			error("Failed to add data to request");
+			evhttp_request_free(req);
+			request_done(NULL, rr);
+			continue;
+		}
+		rr->conn = c;
+		c->current = rr;
+		if (evhttp_make_request(c->evhttp_conn, req, rr->type, rr->uri)) {
+			warn("evhttp_make_request failed");
+			request_done(NULL, rr);
+			continue;
+		}
+	}
+}
+
+static void request_done(struct evhttp_request *req, void *arg) {
+	struct repo_request *rr = (struct repo_request *)arg;
+
+	/* the callbacks may close the server, so refill the connection first */
+	if (rr->conn) {
+		rr->conn->current = NULL;
+		dispatch_requests(rr->server);
+	}
+
+	while (rr) {
+		struct repo_request *next = rr->merged;
+		rr->callback(req, rr->cb_arg);
+		free_request(rr);
+		rr = next;
+	}
+}
+
+/** Queue a request for the pool */
+static int queue_request(struct reposerver *rep, enum evhttp_cmd_type type, const char *uri, const char *data,
+		void (*chunk_callback)(struct evhttp_request *, void *), void (*callback)(struct evhttp_request *, void *),
+		void *cb_arg) {
+	if (rep->pending_entries >= REPO_MAX_PENDING) {
+		warn("Repository server %s:%hu is lagging, %d requests pending, dropping %s",
+			rep->address, rep->port, rep->pending_entries, uri);
+		return -1;
+	}
+
+	struct repo_request *rr = (struct repo_request *)calloc(1, sizeof(struct repo_request));
+	if (!rr) return -1;
+	rr->server = rep;
+	rr->type = type;
+	rr->uri = strdup(uri);
+	rr->data = data ? strdup(data) : NULL;
+	rr->callback = callback;
+	rr->cb_arg = cb_arg;
+	rr->chunk_callback = chunk_callback;
+	if (!rr->uri || (data && !rr->data)) {
+		free_request(rr);
+		return -1;
+	}
+
+	if (rep->pending_last) rep->pending_last->next = rr;
+	else rep->pending = rr;
+	rep->pending_last = rr;
+	rep->pending_entries++;
+
+	dispatch_requests(rep);
+	return 0;
+}
+
+int make_request(struct reposerver *server, const char *uri, void (*callback)(struct evhttp_request *, void *), void *cb_arg) {
+	return queue_request(server, EVHTTP_REQ_GET, uri, NULL, NULL, callback, cb_arg);
+}
+
+int make_streaming_request(struct reposerver *server, const char *uri, void (*chunk_callback)(struct evhttp_request *, void *),
+		void (*callback)(struct evhttp_request *, void *), void *cb_arg) {
+	return queue_request(server, EVHTTP_REQ_GET, uri, NULL, chunk_callback, callback, cb_arg);
+}
+
+int make_post_request(struct reposerver *server, const char *uri, const char *data, void (*callback)(struct evhttp_request *, void *), void *cb_arg) {
+	if (queue_request(server, EVHTTP_REQ_POST, uri, data, NULL, callback, cb_arg)) {
+		error("Failed to queue POST request");
+		return -1;
+	}
+	return 0;
 }
 
 /** Parse a server specification of the form addr:port */
@@ -156,54 +326,3 @@ int parse_serverspec(const char *rep, char **addr, unsigned short *port) {
 	return 0;
 }
 
-#if 0
-
-void _countPeers_callback(struct evhttp_request *req,void *arg) {
-	if (req == NULL || arg == NULL) return;
-	request_data *cbdata = (request_data *)arg;
-
-	void (*user_cb)(HANDLE rep, HANDLE id, int result) = cbdata->cb;	
-	HANDLE id = cbdata->id;
-	free(cbdata);
-
-	int result = -1;
-	if (req->response_code != HTTP_OK) {
-		warn("Failed repository operation (id %p, error is %d %s): %s", 
-			id, req->response_code, req->response_code_line, req->uri);
-		size_t response_len = evbuffer_get_length(req->input_buffer);
-		if (response_len) {
-			char *response = malloc(response_len + 1);
-			evbuffer_remove(req->input_buffer, response, response_len);
-			response[response_len] = 0;
-			debug("Response string (len %d): %s", response_len, response);
-			free(response);
-		}
-		if (user_cb) user_cb(client, id, result);
-		return;
-	}
-
-	char *line = evbuffer_readln(req->input_buffer, NULL, EVBUFFER_EOL_ANY);
-	if (line) sscanf(line, "%d", &result);
-	if (user_cb && result >= 0) user_cb(client, id, result);
-}
-
-HANDLE countPeers(HANDLE rep, cb_countPeers cb, Constraint *cons, int clen) {
-
-	static int id = 1;
-	if (!check_handle(rep, __FUNCTION__)) return NULL;
-	debug("About to call countPeers with  constaints %s", constraints2str(cons, clen, 0));
-
-	char uri[10240];
-	request_data *rd = (request_data *)malloc(sizeof(request_data));
-	if (!rd) return NULL;
-	rd->id = (void *)id;
-	rd->cb = cb;
-
-        sprintf(uri, "/CountPeers?%s",  constraints2str(cons, clen, 0));
-	debug("Making countPeers request with URI %s", uri);
-	make_request(uri, _stringlist_callback, (void *)rd);
-	return (HANDLE)(id++);
-}
-
-#endif
-
@@ -29,6 +29,21 @@
 #define PUBLISH_BUFFER_SIZE	1024
 #define SB_INCREMENT 		512
 
+/** Number of persistent HTTP connections kept to each reposerver */
+#define REPO_POOL_SIZE		4
+/** Waiting publishes sent together in one BatchPublish request */
+#define REPO_BATCH_MAX		256
+/** Requests waiting for a connection before new ones are refused */
+#define REPO_MAX_PENDING	65536
+/** Measurement records handed to a batch callback at once */
+#define REPO_MEASUREMENT_BATCH	512
+/** Size of the blocks holding the strings of received records */
+#define REPO_ARENA_BLOCK	65536
+/** Longest GetPeers/CountPeers request string */
+#define REPO_MAX_URI		8192
+/** Default time (ms) a GetPeers/CountPeers answer is reused for the same query */
+#define REPO_PEERS_CACHE_TTL	1000
+
 /** Struct maintaining streambuffer data. Used internally */
 struct streambuffer {
 #if !_WIN32 && !MAC_OS
@@ -43,6 +58,68 @@ struct streambuffer {
 extern struct streambuffer publish_streambuffer;
 
 struct deferred_publish;
+struct repo_connection;
+
+/** A request waiting for, or sent on, one of the pooled connections */
+struct repo_request {
+	/** the server this request goes to */
+	struct reposerver *server;
+	/** the connection it was sent on, NULL while pending */
+	struct repo_connection *conn;
+	/** EVHTTP_REQ_GET or EVHTTP_REQ_POST */
+	enum evhttp_cmd_type type;
+	/** request string */
+	char *uri;
+	/** POST data or NULL */
+	char *data;
+	/** response callback and its argument */
+	void (*callback)(struct evhttp_request *, void *);
+	void *cb_arg;
+	/** called with cb_arg as parts of the body arrive, or NULL */
+	void (*chunk_callback)(struct evhttp_request *, void *);
+	/** next pending request */
+	struct repo_request *next;
+	/** further publishes answered by the same BatchPublish */
+	struct repo_request *merged;
+};
+
+/** One persistent HTTP connection of the pool */
+struct repo_connection {
+	/** http connection from libevent */
+	struct evhttp_connection *evhttp_conn;
+	/** the request sent on it and not answered yet, NULL if idle
+	    (libevent waits for a response before it sends the next one) */
+	struct repo_request *current;
+};
+
+/** A caller waiting for the answer of a GetPeers or CountPeers query */
+struct peer_waiter {
+	/** cb_repGetPeers or cb_repCountPeers and its argument */
+	void *cb;
+	void *cbarg;
+	struct peer_waiter *next;
+};
+
+/** A GetPeers or CountPeers query, shared by all callers asking the same */
+struct peer_query {
+	struct reposerver *server;
+	/** request string, identifies the query */
+	char *uri;
+	/** 1 for CountPeers, 0 for GetPeers */
+	int count;
+	/** callers to be answered */
+	struct peer_waiter *waiters;
+	/** the HTTP request is on its way */
+	int in_flight;
+	/** answers waiters from the cached answer */
+	struct event *deliver_ev;
+	/** the last answer is cached until expires */
+	int valid;
+	struct timeval expires;
+	char **peers;
+	int num;
+	struct peer_query *next;
+};
 
 /** Internal structure to store a reposerver's connection data */
 struct reposerver {
@@ -50,8 +127,13 @@ struct reposerver {
 	char *address;
 	/** Port part of the server URI */
 	unsigned short port;
-	/** http connection from libevent */
-	struct evhttp_connection *evhttp_conn;
+	/** persistent http connections, requests go to an idle one */
+	struct repo_connection pool[REPO_POOL_SIZE];
+	/** requests waiting while all connections are busy */
+	struct repo_request *pending;
+	struct repo_request *pending_last;
+	/** pending request counter */
+	int pending_entries;
 	/** publish_delay */
 	int publish_delay;
 	/** publish buffer */
@@ -62,6 +144,10 @@ struct reposerver {
 	struct deferred_publish *in_transit;
 	/** in-transit buffer counter */
 	int in_transit_entries;
+	/** GetPeers/CountPeers queries in flight or answered recently */
+	struct peer_query *peer_queries;
+	/** how long (ms) an answer is reused */
+	int peers_cache_ttl;
 	/** magic value for paranoid people */
 	int magic;
 };
@@ -104,44 +190,59 @@ int check_handle(HANDLE h, const char *fn);
 
 /** Helper for HTTP GET queries 
 
+  Requests go out on persistent connections. When all of them are busy,
+  requests wait in the order they were made, and waiting Publish requests
+  are sent together as one BatchPublish.
+
+  @param server the reposerver to ask
   @param uri request string
   @param callback callback function
   @param cb_arg callback arg
+  @retun 0 on success, <0 on error (the callback will not be called)
+*/
+int make_request(struct reposerver *server, const char *uri, void (*callback)(struct evhttp_request *, void *), void *cb_arg);
+
+/** Helper for HTTP GET queries with long responses
+
+  Like make_request(), but chunk_callback is called whenever a part of the
+  response body arrived. The part is in the input buffer of the request,
+  which libevent empties after chunk_callback returns.
+
+  @param server the reposerver to ask
+  @param uri request string
+  @param chunk_callback called for every part of the body
+  @param callback callback function, called once the response is complete
+  @param cb_arg argument of both callbacks
+  @retun 0 on success, <0 on error (the callbacks will not be called)
 */
-void make_request(const char *uri, void (*callback)(struct evhttp_request *, void *), void *cb_arg);
+int make_streaming_request(struct reposerver *server, const char *uri, void (*chunk_callback)(struct evhttp_request *, void *),
+		void (*callback)(struct evhttp_request *, void *), void *cb_arg);
 
 /** Helper for HTTP POST queries 
 
+  @param server the reposerver to post to
   @param uri request string
   @param data POST DATA (as 0-terminated string)
   @param callback callback function
   @param cb_arg callback arg
   @retun 0 on success, <0 on error
 */
-int make_post_request(const char *uri, const char *data, void (*callback)(struct evhttp_request *, void *), void *cb_arg);
-
-/** Parse a measurement record from the HTTP encoding 
-
-  @param line the line as sent by the repo server
-  @return the record parsed or NULL if invalid. The record is dynamically allocated and needs to be freed by the caller.
-*/
-MeasurementRecord parse_measurementrecord(const char *line);
+int make_post_request(struct reposerver *server, const char *uri, const char *data, void (*callback)(struct evhttp_request *, void *), void *cb_arg);
 
-/** print a Constraint array according to the HTTP encoding used in the reposerver communication 
+/** Parse a measurement record from the HTTP encoding in place
 
-  @param ranks array of Constraint s
-  @param len length of the constraints array
-  @return textual representation of the constraint struct in a static buffer
+  @param line the line as sent by the repo server, the separators in it are overwritten
+  @param r the record parsed, its strings point into line
+  @return 0 on success, -1 if the line is not a record
 */
-const char *constraints2str(Constraint *constraints, int len);
+int parse_measurementrecord(char *line, MeasurementRecord *r);
 
-/** print a Ranking array according to the HTTP encoding used in the reposerver communication 
+/** Free the cached and pending GetPeers/CountPeers queries of a server,
+    answering the callers still waiting with an error
 
-  @param ranks array of Ranking s
-  @param len length of the ranks array
-  @return textual representation of the rankings struct in a static buffer
+  @param server the reposerver being closed
 */
-const char *rankings2str(Ranking *ranks, int len);
+void free_peer_queries(struct reposerver *server);
 
 /** print a MeasurementRecord 
 
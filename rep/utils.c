@@ -25,7 +25,7 @@ const char *measurementrecord2str(const MeasurementRecord r) {
     Such ops are ListMeasurementNames and GetPeers
 */
 void _stringlist_callback(struct evhttp_request *req,void *arg) {
-	if (req == NULL || arg == NULL) return;
+	if (arg == NULL) return;
 	request_data *cbdata = (request_data *)arg;
 
 	void (*user_cb)(HANDLE rep, HANDLE id, void *cbarg, char **result, int nResults) = cbdata->cb;	
@@ -35,6 +35,13 @@ void _stringlist_callback(struct evhttp_request *req,void *arg) {
 	int max = cbdata->data;
 	if (max <= 0) max = 10000;
 
+	if (req == NULL) {
+		warn("Failed repository operation (id %p): no response", id);
+		if (user_cb) user_cb((HANDLE)server, id, cbdata->cbarg, NULL, 0);
+		free(cbdata);
+		return;
+	}
+
 	if (req->response_code != HTTP_OK) {
 		warn("Failed repository operation (id %p, error is %d %s): %s", 
 			id, req->response_code, req->response_code_line, req->uri);
@@ -56,8 +63,12 @@ void _stringlist_callback(struct evhttp_request *req,void *arg) {
 
 	while (1) {
 		char *line = evbuffer_readln(req->input_buffer, NULL, EVBUFFER_EOL_ANY);
-		if (!line || i == max) break;
-		result[i++] = strdup(line);
+		if (!line) break;
+		if (i == max) {
+			free(line);
+			break;
+		}
+		result[i++] = line;
 		if (i % 10000 == 0) {
 			max += 10000;
 			result = realloc(result, max * sizeof(char *));
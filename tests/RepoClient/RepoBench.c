@@ -0,0 +1,193 @@
+/*
+ * Publish throughput of the repository client against a stand-in
+ * repository server running in the same event loop.
+ *
+ * The stand-in answers every request with 200 OK, optionally after a delay
+ * to play a lagging server, and counts the TCP connections it was asked on.
+ * With -g it answers GetMeasurements with that many records, which are then
+ * fetched at once and in batches, and checked.
+ *
+ * Usage: RepoBench [-n publishes] [-d server delay in ms] [-g records]
+ */
+#include	<stdio.h>
+#include	<stdlib.h>
+#include	<string.h>
+#include	<unistd.h>
+#include	<math.h>
+#include	<sys/time.h>
+#include	<sys/socket.h>
+#include	<netinet/in.h>
+
+#include	<event2/event.h>
+#include	<event2/buffer.h>
+#include	<event2/http.h>
+#include	<event2/listener.h>
+
+#include	<napa.h>
+#include	<napa_log.h>
+#include	<repoclient.h>
+
+#define MAX_PORTS 1024
+
+static int delay_ms = 0;
+static int requests = 0;
+static int connections = 0;
+static unsigned short peer_ports[MAX_PORTS];
+
+static int publishes = 5000;
+static int published = 0;
+static int failed = 0;
+
+static int records = 0;
+static int received = 0;
+static int batches = 0;
+
+static void send_reply(evutil_socket_t fd, short what, void *arg) {
+	struct evhttp_request *req = (struct evhttp_request *)arg;
+	struct evbuffer *buf = evbuffer_new();
+	int i;
+
+	if (!strncmp(evhttp_request_get_uri(req), "/GetMeasurements", 16)) {
+		for (i = 0; i != records; i++) {
+			evbuffer_add_printf(buf, "originator=10.0.0.1:6000&targetA=10.0.%d.%d:6000&published_name=RoundTripDelay&value=%d.25&channel=bench\n",
+				i / 250 % 250, i % 250, i);
+		}
+	}
+	else evbuffer_add_printf(buf, "OK\n");
+	evhttp_send_reply(req, HTTP_OK, "OK", buf);
+	evbuffer_free(buf);
+}
+
+/** Stand-in server: count the request and the connection, answer (later) */
+static void server_cb(struct evhttp_request *req, void *arg) {
+	char *peer;
+	ev_uint16_t port;
+	int i;
+
+	requests++;
+	evhttp_connection_get_peer(evhttp_request_get_connection(req), &peer, &port);
+	for (i = 0; i != connections && peer_ports[i] != port; i++);
+	if (i == connections && connections < MAX_PORTS) peer_ports[connections++] = port;
+
+	if (delay_ms) {
+		struct timeval t = { delay_ms / 1000, (delay_ms % 1000) * 1000 };
+		event_base_once(eventbase, -1, EV_TIMEOUT, send_reply, req, &t);
+	}
+	else send_reply(-1, EV_TIMEOUT, req);
+}
+
+static void publish_cb(HANDLE rep, HANDLE id, void *cbarg, int result) {
+	if (result) failed++;
+	if (++published == publishes) event_base_loopbreak(eventbase);
+}
+
+static int check_record(const MeasurementRecord *r, int i) {
+	char target[32];
+	sprintf(target, "10.0.%d.%d:6000", i / 250 % 250, i % 250);
+	return r->value != i + 0.25 || strcmp(r->targetA, target) || strcmp(r->channel, "bench");
+}
+
+static void measurements_cb(HANDLE rep, HANDLE id, void *cbarg, MeasurementRecord *result, int n) {
+	int i;
+	for (i = 0; i != n; i++) failed += check_record(&result[i], i);
+	received = n;
+	free(result);
+	event_base_loopbreak(eventbase);
+}
+
+static void batch_cb(HANDLE rep, HANDLE id, void *cbarg, const MeasurementRecord *batch, int n, int done) {
+	int i;
+	for (i = 0; i != n; i++) failed += check_record(&batch[i], received + i);
+	received += n;
+	batches++;
+	if (done) {
+		if (done < 0) failed++;
+		event_base_loopbreak(eventbase);
+	}
+}
+
+static double ms_since(const struct timeval *t0) {
+	struct timeval t1;
+	gettimeofday(&t1, NULL);
+	return (t1.tv_sec - t0->tv_sec) * 1000.0 + (t1.tv_usec - t0->tv_usec) / 1000.0;
+}
+
+static void bench_measurements(HANDLE rep) {
+	struct timeval t0;
+
+	gettimeofday(&t0, NULL);
+	repGetMeasurements(rep, measurements_cb, NULL, 0, NULL, NULL, NULL, "RoundTripDelay", NULL);
+	event_base_dispatch(eventbase);
+	printf("GetMeasurements: %d of %d records in %.1f ms, %d wrong\n", received, records, ms_since(&t0), failed);
+
+	received = 0;
+	gettimeofday(&t0, NULL);
+	repGetMeasurementsBatched(rep, batch_cb, NULL, 0, NULL, NULL, NULL, "RoundTripDelay", NULL);
+	event_base_dispatch(eventbase);
+	printf("GetMeasurementsBatched: %d of %d records in %d batches, %.1f ms, %d wrong\n", received, records, batches, ms_since(&t0), failed);
+	if (received != records) failed++;
+}
+
+int main(int argc, char *argv[]) {
+	struct evhttp *http;
+	struct evhttp_bound_socket *handle;
+	struct sockaddr_in addr;
+	socklen_t addr_len = sizeof(addr);
+	struct timeval t0, t1;
+	char server[64];
+	int i, o;
+
+	while ((o = getopt(argc, argv, "n:d:g:")) != -1) {
+		if (o == 'n') publishes = atoi(optarg);
+		else if (o == 'd') delay_ms = atoi(optarg);
+		else if (o == 'g') records = atoi(optarg);
+		else {
+			fprintf(stderr, "Usage: %s [-n publishes] [-d server delay in ms] [-g records]\n", argv[0]);
+			exit(1);
+		}
+	}
+
+	napaInit(event_base_new());
+	napaInitLog(LOG_WARN, NULL, NULL);
+	repInit("");
+
+	/* the stand-in server on an ephemeral port */
+	http = evhttp_new(eventbase);
+	handle = evhttp_bind_socket_with_handle(http, "127.0.0.1", 0);
+	if (!handle) fatal("Unable to start the stand-in repository server");
+	evhttp_set_gencb(http, server_cb, NULL);
+	getsockname(evhttp_bound_socket_get_fd(handle), (struct sockaddr *)&addr, &addr_len);
+	sprintf(server, "127.0.0.1:%d", ntohs(addr.sin_port));
+
+	HANDLE rep = repOpen(server, 0);
+
+	if (records) {
+		bench_measurements(rep);
+		repClose(rep);
+		evhttp_free(http);
+		return failed != 0;
+	}
+
+	gettimeofday(&t0, NULL);
+	for (i = 0; i != publishes; i++) {
+		MeasurementRecord r;
+		char target[32];
+		memset(&r, 0, sizeof(r));
+		sprintf(target, "10.0.%d.%d:6000", i / 250, i % 250);
+		r.originator = "10.0.0.1:6000";
+		r.targetA = target;
+		r.published_name = "RoundTripDelay";
+		r.value = i;
+		if (!repPublish(rep, publish_cb, NULL, &r)) failed++, published++;
+	}
+	if (published < publishes) event_base_dispatch(eventbase);
+	gettimeofday(&t1, NULL);
+
+	double ms = (t1.tv_sec - t0.tv_sec) * 1000.0 + (t1.tv_usec - t0.tv_usec) / 1000.0;
+	printf("%d publishes in %.1f ms (%.0f req/s), %d requests on %d connections, %d failed\n",
+		publishes, ms, publishes * 1000.0 / ms, requests, connections, failed);
+
+	repClose(rep);
+	evhttp_free(http);
+	return failed != 0;
+}
@@ -5,6 +5,8 @@
  * 	- napa_log(SEVERITY, format, args...)
  *	- or use one of the convenience macros like debug(format, args...) or info(format, args...) as shown below.
  *
+ * The same calls can also be traced in binary form, cheaply, into a file read with napa_tracedump.
+ *
  */
 
 #include	<napa_log.h>		/* You must include napa_log.h in order to use napa logging */
@@ -25,6 +27,13 @@ int main(int argc, char *argv) {
 
 	error("And this is an error message");	
 
+	/* Trace everything into logtest.trace, keep the text log to warnings and errors */
+	napaCloseLog();
+	napaInitLog(LOG_WARN, NULL, NULL);
+	napaTraceOpen("logtest.trace", 1024 * 1024, LOG_DEBUG);
+	debug("Only in the trace, see napa_tracedump logtest.trace: %d %s %f", 3, "args", M_PI);
+	warn("In both the log and the trace");
+
 	napaCloseLog();
 
 	info("Invisible again, as logging is closed");
@@ -33,7 +33,8 @@
 #include <epan/packet.h>
 #include <epan/prefs.h>
 
-#define GRAPES_ML_HDR_SIZE 23
+#define GRAPES_ML_HDR_SIZE 25
+#define GRAPES_ML_MAGIC 0xA5
 #define GRAPES_MONL_PKT_HDR_SIZE 21
 #define GRAPES_MONL_DATA_HDR_SIZE 20
 
@@ -45,6 +46,8 @@ void proto_reg_handoff_grapes(void);
 static int proto_grapes = -1;
 
 /* ML header */
+static int hf_grapes_ml_magic = -1;
+static int hf_grapes_ml_version = -1;
 static int hf_grapes_ml_msg_type = -1;
 static int hf_grapes_ml_len_mon_data_hdr = -1;
 static int hf_grapes_ml_len_mon_packet_hdr = -1;
@@ -162,13 +165,14 @@ dissect_grapes(tvbuff_t *tvb, packet_info *pinfo, proto_tree *tree)
 		return 0;
 
 	/* Get some values from the packet header, probably using tvb_get_*() */
-	//TODO add further checks if possible
+	if (tvb_get_guint8(tvb, 0) != GRAPES_ML_MAGIC)
+		return 0;
 
 	/* Make entries in Protocol column and Info column on summary display */
 	col_set_str(pinfo->cinfo, COL_PROTOCOL, "GRAPES");
 
 	col_clear(pinfo->cinfo, COL_INFO);
-	col_add_fstr(pinfo->cinfo, COL_INFO, "MsgType: %d Seq: %d Offset: %d", tvb_get_guint8(tvb, 20), tvb_get_ntohl(tvb, 16), tvb_get_ntohl(tvb, 0));
+	col_add_fstr(pinfo->cinfo, COL_INFO, "MsgType: %d Seq: %d Offset: %d", tvb_get_guint8(tvb, 22), tvb_get_ntohl(tvb, 18), tvb_get_ntohl(tvb, 2));
 
 	if (!tree)
 		return tvb_length(tvb);
@@ -177,23 +181,25 @@ dissect_grapes(tvbuff_t *tvb, packet_info *pinfo, proto_tree *tree)
 	ti = proto_tree_add_item(tree, proto_grapes, tvb, 0, GRAPES_ML_HDR_SIZE, FALSE);
 	grapes_tree = proto_item_add_subtree(ti, ett_grapes);
 
-	proto_tree_add_item(grapes_tree, hf_grapes_ml_offset, tvb, 0, 4, FALSE);
-	proto_tree_add_item(grapes_tree, hf_grapes_ml_msg_length, tvb, 4, 4, FALSE);
-	proto_tree_add_item(grapes_tree, hf_grapes_ml_local_con_id, tvb, 8, 4, FALSE);
-	proto_tree_add_item(grapes_tree, hf_grapes_ml_remote_con_id, tvb, 12, 4, FALSE);
-	proto_tree_add_item(grapes_tree, hf_grapes_ml_msg_seq_num, tvb, 16, 4, FALSE);
-	proto_tree_add_item(grapes_tree, hf_grapes_ml_msg_type, tvb, 20, 1, FALSE);
-	proto_tree_add_item(grapes_tree, hf_grapes_ml_len_mon_data_hdr, tvb, 21, 1, FALSE);
-	proto_tree_add_item(grapes_tree, hf_grapes_ml_len_mon_packet_hdr, tvb, 22, 1, FALSE);
+	proto_tree_add_item(grapes_tree, hf_grapes_ml_magic, tvb, 0, 1, FALSE);
+	proto_tree_add_item(grapes_tree, hf_grapes_ml_version, tvb, 1, 1, FALSE);
+	proto_tree_add_item(grapes_tree, hf_grapes_ml_offset, tvb, 2, 4, FALSE);
+	proto_tree_add_item(grapes_tree, hf_grapes_ml_msg_length, tvb, 6, 4, FALSE);
+	proto_tree_add_item(grapes_tree, hf_grapes_ml_local_con_id, tvb, 10, 4, FALSE);
+	proto_tree_add_item(grapes_tree, hf_grapes_ml_remote_con_id, tvb, 14, 4, FALSE);
+	proto_tree_add_item(grapes_tree, hf_grapes_ml_msg_seq_num, tvb, 18, 4, FALSE);
+	proto_tree_add_item(grapes_tree, hf_grapes_ml_msg_type, tvb, 22, 1, FALSE);
+	proto_tree_add_item(grapes_tree, hf_grapes_ml_len_mon_data_hdr, tvb, 23, 1, FALSE);
+	proto_tree_add_item(grapes_tree, hf_grapes_ml_len_mon_packet_hdr, tvb, 24, 1, FALSE);
 
 	offset = GRAPES_ML_HDR_SIZE;
 
-	monl_p_hdr_size = tvb_get_guint8(tvb, 22);
+	monl_p_hdr_size = tvb_get_guint8(tvb, 24);
 	if(monl_p_hdr_size != 0)
 		offset += dissect_grapes_monl_packet(tvb, offset, monl_p_hdr_size, grapes_tree);
 
-	monl_d_hdr_size = tvb_get_guint8(tvb, 21);
-	if(monl_d_hdr_size != 0 && tvb_get_ntohl(tvb, 0) == 0)
+	monl_d_hdr_size = tvb_get_guint8(tvb, 23);
+	if(monl_d_hdr_size != 0 && tvb_get_ntohl(tvb, 2) == 0)
 		offset += dissect_grapes_monl_data(tvb, offset, monl_d_hdr_size, grapes_tree);
 
 	// dissect payload as data
@@ -214,6 +220,14 @@ proto_register_grapes(void)
 /* Setup list of header fields  See Section 1.6.1 for details*/
 	static hf_register_info hf[] = {
 	/* ML header */
+		{ &hf_grapes_ml_magic,
+			{ "Magic", "grapes.magic",
+			FT_UINT8, BASE_HEX, NULL, 0x0,
+			"Marks ML packets, 0xA5", HFILL }},
+		{ &hf_grapes_ml_version,
+			{ "Version", "grapes.version",
+			FT_UINT8, BASE_DEC, NULL, 0x0,
+			"The version of the ML header", HFILL }},
 		{ &hf_grapes_ml_offset,
 			{ "Offset", "grapes.offset",
 			FT_UINT32, BASE_DEC, NULL, 0x0,